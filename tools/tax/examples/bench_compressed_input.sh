@@ -0,0 +1,45 @@
+#!/bin/bash
+# Compares reading compressed reads directly by aligns_to with piping them through zcat / zstd -dc into stdin
+# usage: bench_compressed_input.sh <aligns_to binary> <-db|-dbs|-dbss|-dbsm> <database> <reads.fasta or .fastq> [-num_threads <n>]
+# bgzip and zstd are used if they are installed, all runs must produce identical output
+set -e
+
+aligns_to=$1
+db_option=$2
+db=$3
+reads=$4
+shift 4
+extra_args="$@"
+
+tmp=$(mktemp -d)
+trap "rm -rf $tmp" EXIT
+
+ext=${reads##*.}
+name=$tmp/reads.$ext
+
+seconds() { date +%s.%N; }
+
+run() # <label> <command>
+{
+    local start=$(seconds)
+    eval "$2" > $tmp/out 2>$tmp/log
+    local end=$(seconds)
+    printf "%-32s %8.2fs  %s\n" "$1" $(echo "$end - $start" | awk '{print $1 - $3}') $(sort $tmp/out | md5sum | cut -c1-8)
+}
+
+gzip -c "$reads" > $name.gz
+run "plain file" "$aligns_to $db_option $db $extra_args $reads"
+run "zcat | aligns_to stdin" "zcat $name.gz | $aligns_to $db_option $db $extra_args stdin"
+run "aligns_to .gz" "$aligns_to $db_option $db $extra_args $name.gz"
+
+if which bgzip >/dev/null 2>&1; then
+    bgzip -c -@ 4 "$reads" > $name.bgz.gz
+    run "zcat | aligns_to stdin (bgzf)" "zcat $name.bgz.gz | $aligns_to $db_option $db $extra_args stdin"
+    run "aligns_to .gz (bgzf)" "$aligns_to $db_option $db $extra_args $name.bgz.gz"
+fi
+
+if which zstd >/dev/null 2>&1; then
+    split -b 16M --filter='zstd -q -c' "$reads" > $name.zst # one frame per 16MB, like pzstd
+    run "zstd -dc | aligns_to stdin" "zstd -dc $name.zst | $aligns_to $db_option $db $extra_args stdin"
+    run "aligns_to .zst" "$aligns_to $db_option $db $extra_args $name.zst"
+fi
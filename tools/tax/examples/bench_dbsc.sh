@@ -0,0 +1,46 @@
+#!/bin/bash
+# Compares the compressed .dbsc database with .dbs it is converted from: file size, loading time, peak RSS and kmers per second
+# usage: bench_dbsc.sh <directory with aligns_to and dbs_to_dbsc> <database.dbs> <reads.fasta> [aligns_to options, e.g. -num_threads <n>]
+# lookups per second of the index alone are measured by "tests/kmer_index bench_kmer_index", all runs must produce identical output
+set -e
+
+bin=$1
+dbs=$2
+reads=$3
+shift 3
+extra_args="$@"
+
+tmp=$(mktemp -d)
+trap "rm -rf $tmp" EXIT
+
+$bin/dbs_to_dbsc $dbs $tmp/db.dbsc 2>/dev/null
+printf "%-8s %12d bytes\n" ".dbs" $(stat -c %s $dbs)
+printf "%-8s %12d bytes\n" ".dbsc" $(stat -c %s $tmp/db.dbsc)
+
+# kmers of all reads, every one of them is looked up
+kmer_len=32
+kmers=$(awk -v k=$kmer_len '/^>/ { if (len >= k) n += len - k + 1; len = 0; next } { len += length($0) } END { if (len >= k) n += len - k + 1; print n }' $reads)
+
+seconds() { date +%s.%N; }
+
+run() # <label> <aligns_to arguments>
+{
+    local start=$(seconds)
+    $bin/aligns_to $2 $extra_args $reads > $tmp/out 2>$tmp/log &
+    local pid=$! peak=0
+    while kill -0 $pid 2>/dev/null; do
+        local hwm=$(awk '/VmHWM/ { print $2 }' /proc/$pid/status 2>/dev/null)
+        [ -n "$hwm" ] && peak=$hwm
+        sleep 0.1
+    done
+    wait $pid
+    local end=$(seconds)
+    local total=$(echo "$end $start" | awk '{print $1 - $2}')
+    local loading=$(awk -F'\t' '/loading time/ { split($2, a, " "); print a[4] }' $tmp/log)
+    printf "%-20s %8.2fs  load %3ss  peak rss %7d MB  %6.2fM kmers/s  %s\n" "$1" $total $loading $((peak / 1024)) $(echo "$kmers $total" | awk '{print $1 / $2 / 1000000}') $(sort $tmp/out | md5sum | cut -c1-8)
+}
+
+run "dbs" "-dbs $dbs"
+run "dbs -mmap" "-dbs $dbs -mmap"
+run "dbsc" "-dbsc $tmp/db.dbsc"
+run "dbsc -mmap" "-dbsc $tmp/db.dbsc -mmap"
@@ -42,6 +42,8 @@ typedef uint64_t hash_t;
 #include "aligns_to_dbs_job.h"
 #include "aligns_to_dbsm_job.h"
 #include "aligns_to_dbss_job.h"
+#include "aligns_to_dbsc_job.h"
+#include "aligns_to_server.h"
 //#include "aligns_to_many_jobs.h"
 #include "missing_cpp_features.h"
 #include <spdlog/spdlog.h>
@@ -67,6 +69,9 @@ int main(int argc, char const *argv[])
     
     LOG("aligns_to version " << VERSION);
     Config config(argc, argv);
+    if (!config.client.empty())
+        return AlignsToClient(config).run();
+
     {
         int num_threads = config.num_threads > 0 ? config.num_threads : omp_get_max_threads();
         LOG("hardware threads: "  << std::thread::hardware_concurrency() << ", omp threads: " << num_threads);
@@ -78,39 +83,34 @@ int main(int argc, char const *argv[])
 
     unique_ptr<Job> job;
 
+    const auto mmap_prefetch = IO::MappedFile::prefetch_from_string(config.mmap_prefetch);
+    const auto dbs_index = KmerIndexType::from_string(config.dbs_index);
     if (!config.db.empty())
-        job = unique_ptr<DBJob>(new DBJob(config.db));
+        job = unique_ptr<DBJob>(new DBJob(config.db, config.mmap, mmap_prefetch));
     else if (!config.dbs.empty())
-        job = unique_ptr<DBSBasicJob>(new DBSBasicJob(config.dbs));
+        job = unique_ptr<DBSBasicJob>(new DBSBasicJob(config.dbs, config.mmap, mmap_prefetch, dbs_index));
     else if (!config.dbsm.empty())
-        job = unique_ptr<DBSMJob>(new DBSMJob(config.dbsm));
+        job = unique_ptr<DBSMJob>(new DBSMJob(config.dbsm, config.mmap, mmap_prefetch));
     else if (!config.dbss.empty())
-        job = unique_ptr<DBSSJob>(new DBSSJob(config.dbss, config.dbss_tax_list, config.num_threads));
+        job = unique_ptr<DBSSJob>(new DBSSJob(config.dbss, config.dbss_tax_list, config.num_threads, dbs_index));
+    else if (!config.dbsc.empty())
+        job = unique_ptr<DBSCJob>(new DBSCJob(config.dbsc, config.mmap, mmap_prefetch));
 //    else if (!config.many.empty())
 //        job = make_unique<ManyJobs>(config.many);
     else
         Config::fail();
 
+    if (config.prefilter)
+        job->create_prefilter();
+
     LOG("loading time (sec) " << std::chrono::duration_cast<std::chrono::seconds>( high_resolution_clock::now() - before ).count());
     if (job->db_kmers() > 0)
         LOG("kmers " << job->db_kmers() << " (" << (job->db_kmers() / 1000 / 1000) << "m)");
 
-    for (auto &contig_file : config.contig_files)
-    {
-        LOG(contig_file);
-
-        IO::Writer writer(config.contig_files.size() == 1 ? config.out : contig_file + config.out);
-		try 
-		{
-	        job->run(contig_file, writer, config);
-		}
-		catch (std::exception &e)
-		{
-			LOG(e.what());
-			if (config.contig_files.size() == 1)
-				throw e;
-		}
-    }
+    if (!config.server.empty())
+        return AlignsToServer(*job, config).serve();
+
+    job->run_files(config);
 
 /*
 #ifdef __linux__
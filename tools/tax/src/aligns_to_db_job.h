@@ -30,6 +30,9 @@
 #include "aligns_to_job.h"
 #include "hash.h"
 #include "seq_transform.h"
+#include "seq_encoder.h"
+#include "kmer_index.h"
+#include "dbs.h"
 #include <map>
 #include "omp_adapter.h"
 #include <list>
@@ -59,12 +62,27 @@ struct KmerBasicMatchId
 struct BasicPrinter
 {
     IO::Writer &writer;
-    BasicPrinter(IO::Writer &writer) : writer(writer){}
+    HitStreamWriter *hit_stream; // -out_format binary, spots without hits
+    std::string text; // lines of a chunk written at once
+    BasicPrinter(IO::Writer &writer, HitStreamWriter *hit_stream = nullptr) : writer(writer), hit_stream(hit_stream){}
 
 	void operator() (const std::vector<Reader::Fragment> &processing_sequences, const std::vector<BasicMatchId> &ids)
 	{
-		for (auto seq_id : ids)
-			writer.f() << processing_sequences[seq_id.seq_id].spotid << std::endl;
+		if (hit_stream)
+		{
+			for (auto seq_id : ids)
+				hit_stream->add(processing_sequences[seq_id.seq_id].spotid);
+		}
+		else
+		{
+			text.clear();
+			for (auto seq_id : ids)
+			{
+				text.append(processing_sequences[seq_id.seq_id].spotid);
+				text.push_back('\n');
+			}
+			writer.f().write(text.data(), text.size());
+		}
 
         writer.check();
 	}
@@ -74,13 +92,19 @@ struct KmerBasicPrinter
 {
     IO::Writer &writer;
     int kmer_len = 0;
+    std::string text; // lines of a chunk written at once
     KmerBasicPrinter(IO::Writer &writer, int kmer_len) : writer(writer), kmer_len(kmer_len){}
 
 	void operator() (const std::vector<Reader::Fragment> &processing_sequences, const std::vector<KmerBasicMatchId> &ids)
 	{
-		for (auto seq : ids)
+		text.clear();
+		for (auto &seq : ids)
 		for (auto kmer : seq.matches)
-		    writer.f() << Hash<hash_t>::str_from_hash(kmer, kmer_len) << std::endl;
+		{
+		    text.append(Hash<hash_t>::str_from_hash(kmer, kmer_len));
+		    text.push_back('\n');
+		}
+		writer.f().write(text.data(), text.size());
 
         writer.check();
 	}
@@ -89,27 +113,158 @@ struct KmerBasicPrinter
 struct DBJob : public Job
 {
 	typedef std::vector<hash_t> HashSortedArray;
+	typedef ArrayView<hash_t> HashSortedArrayView;
 
-	HashSortedArray hash_array;
+	HashSortedArray hash_array; // storage when db is loaded into memory
+	IO::MappedFile hash_array_mapping; // storage when db is memory mapped
+	HashSortedArrayView hash_array_view; // searched by matchers
 	size_t kmer_len;
 
-	DBJob(const std::string &db)
+	DBJob(const std::string &db, bool mmap = false, IO::MappedFile::Prefetch prefetch = IO::MappedFile::PREFETCH_NONE)
+	{
+		if (mmap)
+			kmer_len = DBSIO::map_dbs(db, hash_array_mapping, hash_array_view, prefetch);
+		else
+		{
+			kmer_len = DBSIO::load_dbs(db, hash_array);
+			hash_array_view = hash_array;
+		}
+	}
+
+	virtual size_t db_kmers() const override { return hash_array_view.size(); }
+
+	virtual void create_prefilter() override
+	{
+		prefilter = std::make_unique<KmerBloomFilter>();
+		prefilter->build(hash_array_view, [](hash_t kmer) { return kmer; });
+	}
+
+	// kmers of a read searched with batched_lower_bound BATCH_SIZE at a time, buffers are reused between reads
+	struct BatchedLookups
+	{
+		static const size_t BATCH_SIZE = 32; // enough independent probes in flight to overlap their cache misses
+
+		std::vector<uint8_t> codes;
+		std::vector<hash_t> kmers, keys, batch_keys;
+		std::vector<size_t> positions;
+
+		// collects the kmers of the read, nothing is searched yet
+		void prepare(size_t kmer_len, const std::string &seq)
+		{
+			kmers.clear();
+			keys.clear();
+			SeqEncoder::encode(seq, codes);
+			KmerStream<hash_t>::for_all_kmers_do(codes.data(), (int)codes.size(), (int)kmer_len, false, [&](int, hash_t forward, hash_t rev_complement)
+				{
+					kmers.push_back(forward);
+					keys.push_back(std::min(forward, rev_complement));
+					return true;
+				});
+
+			positions.resize(keys.size());
+		}
+
+		// kmers rejected by prefilter are not searched, every kmer passed to it is counted as a lookup
+		static void filter(std::vector<hash_t> &keys, std::vector<hash_t> *kmers, const KmerBloomFilter *prefilter, KmerBloomFilter::Counts &counts)
+		{
+			if (prefilter)
+				prefilter->remove_absent(keys, kmers, counts);
+			else
+				counts.lookups += keys.size();
+		}
+
+		size_t batches() const { return (keys.size() + BATCH_SIZE - 1) / BATCH_SIZE; }
+		size_t batch_begin(size_t batch) const { return batch * BATCH_SIZE; }
+		size_t batch_end(size_t batch) const { return std::min(keys.size(), (batch + 1) * BATCH_SIZE); }
+
+		void search(const HashSortedArrayView &hash_array, size_t batch)
+		{
+			const size_t from = batch_begin(batch);
+			batched_lower_bound(hash_array, keys.data() + from, batch_end(batch) - from, positions.data() + from);
+		}
+
+		// searches all kmers of the read which pass prefilter, found kmers are counted by the caller
+		void find(const HashSortedArrayView &hash_array, size_t kmer_len, const std::string &seq, const KmerBloomFilter *prefilter, KmerBloomFilter::Counts &counts)
+		{
+			prepare(kmer_len, seq);
+			filter(keys, &kmers, prefilter, counts);
+			for (size_t batch = 0; batch < batches(); batch++)
+				search(hash_array, batch);
+		}
+
+		bool in_db(const HashSortedArrayView &hash_array, size_t i) const
+		{
+			return positions[i] < hash_array.size() && hash_array[positions[i]] == keys[i];
+		}
+
+		// true if any kmer of the read is in db, stops after the first batch with a hit
+		// only kmers of the batches searched go through prefilter and are counted, found ones included
+		bool any_in_db(const HashSortedArrayView &hash_array, size_t kmer_len, const std::string &seq, const KmerBloomFilter *prefilter, KmerBloomFilter::Counts &counts)
+		{
+			prepare(kmer_len, seq);
+			bool found = false;
+			for (size_t batch = 0; batch < batches() && !found; batch++)
+			{
+				batch_keys.assign(keys.begin() + batch_begin(batch), keys.begin() + batch_end(batch));
+				filter(batch_keys, nullptr, prefilter, counts);
+				batched_lower_bound(hash_array, batch_keys.data(), batch_keys.size(), positions.data());
+				for (size_t i = 0; i < batch_keys.size(); i++)
+					if (positions[i] < hash_array.size() && hash_array[positions[i]] == batch_keys[i])
+					{
+						counts.found++;
+						found = true;
+					}
+			}
+
+			return found;
+		}
+	};
+
+	// kmer is searched only if prefilter, when set, does not reject it
+	static bool in_db(const HashSortedArrayView &hash_array, size_t kmer_len, const KmerBloomFilter *prefilter, hash_t hash, KmerBloomFilter::Counts &counts)
 	{
-		kmer_len = DBSIO::load_dbs(db, hash_array);
+		hash = seq_transform<hash_t>::min_hash_variant(hash, (int)kmer_len);
+		counts.lookups++;
+		if (prefilter && !prefilter->may_contain(hash))
+		{
+			counts.rejected++;
+			return false;
+		}
+
+		const bool found = std::binary_search(hash_array.begin(), hash_array.end(), hash);
+		counts.found += found;
+		return found;
 	}
 
 	struct Matcher
 	{
-		const HashSortedArray &hash_array;
+		const HashSortedArrayView hash_array;
 		size_t kmer_len;
-		Matcher(const HashSortedArray &hash_array, size_t kmer_len) : hash_array(hash_array), kmer_len(kmer_len){}
+		bool batched_lookups;
+		const KmerBloomFilter *prefilter;
+		Matcher(const HashSortedArrayView &hash_array, size_t kmer_len, bool batched_lookups = false, const KmerBloomFilter *prefilter = nullptr) : hash_array(hash_array), kmer_len(kmer_len), batched_lookups(batched_lookups), prefilter(prefilter){}
 
 		int operator() (const std::string &seq) const 
 		{
+			KmerBloomFilter::Counts counts;
+			const int found = find(seq, counts);
+			RunMetrics::local().add_lookups(counts, seq.size(), kmer_len);
+
+			return found;
+		}
+
+		int find(const std::string &seq, KmerBloomFilter::Counts &counts) const
+		{
+			if (batched_lookups)
+			{
+				thread_local BatchedLookups batch;
+				return batch.any_in_db(hash_array, kmer_len, seq, prefilter, counts);
+			}
+
 			int found = 0;
 			Hash<hash_t>::for_all_hashes_do(seq, (int)kmer_len, [&](hash_t hash)
 				{
-					if (in_db(hash))
+					if (in_db(hash_array, kmer_len, prefilter, hash, counts))
 						found++;
 
 					return !found;
@@ -117,64 +272,69 @@ struct DBJob : public Job
 
 			return found;
 		}
-
-		bool in_db(hash_t hash) const
-		{
-			hash = seq_transform<hash_t>::min_hash_variant(hash, (int)kmer_len);
-			return std::binary_search(hash_array.begin(), hash_array.end(), hash);
-		}
 	};
 
 	struct KmerMatcher
 	{
-		const HashSortedArray &hash_array;
+		const HashSortedArrayView hash_array;
 		size_t kmer_len;
-		KmerMatcher(const HashSortedArray &hash_array, size_t kmer_len) : hash_array(hash_array), kmer_len(kmer_len){}
+		bool batched_lookups;
+		const KmerBloomFilter *prefilter;
+		KmerMatcher(const HashSortedArrayView &hash_array, size_t kmer_len, bool batched_lookups = false, const KmerBloomFilter *prefilter = nullptr) : hash_array(hash_array), kmer_len(kmer_len), batched_lookups(batched_lookups), prefilter(prefilter){}
 
 		KmerBasicMatchId::Matches operator() (const std::string &seq) const 
 		{
             KmerBasicMatchId::Matches matches; // todo: optimize. though not really urgent
-			Hash<hash_t>::for_all_hashes_do(seq, (int)kmer_len, [&](hash_t hash)
-				{
-					if (in_db(hash))
-						matches.push_back(hash);
+			KmerBloomFilter::Counts counts;
+			if (batched_lookups)
+			{
+				thread_local BatchedLookups batch;
+				batch.find(hash_array, kmer_len, seq, prefilter, counts);
+				for (size_t i = 0; i < batch.keys.size(); i++)
+					if (batch.in_db(hash_array, i))
+						matches.push_back(batch.kmers[i]);
 
-					return true;
-				});
+				counts.found += matches.size();
+			}
+			else
+				Hash<hash_t>::for_all_hashes_do(seq, (int)kmer_len, [&](hash_t hash)
+					{
+						if (in_db(hash_array, kmer_len, prefilter, hash, counts))
+							matches.push_back(hash);
 
-			return matches;
-		}
+						return true;
+					});
 
-		bool in_db(hash_t hash) const
-		{
-			hash = seq_transform<hash_t>::min_hash_variant(hash, (int)kmer_len);
-			return std::binary_search(hash_array.begin(), hash_array.end(), hash);
+			RunMetrics::local().add_lookups(counts, seq.size(), kmer_len);
+
+			return matches;
 		}
 	};
 
-    bool print_kmers_only = false;
-
 	virtual void run(const std::string &filename, IO::Writer &writer, const Config &config) override
 	{
-        print_kmers_only = config.print_kmers_only;
-		Job::run_for_matcher(filename, config.spot_filter_file, config.unaligned_only, config.optimization_ultrafast_skip_reader, config.chunk_size, [&](const std::vector<Reader::Fragment> &chunk){ match_and_print_chunk(chunk, writer); } );
-	}
-
-    virtual void match_and_print_chunk(const std::vector<Reader::Fragment> &chunk, IO::Writer &writer)
-    {
-        if (print_kmers_only)
+        const bool batched_lookups = config.optimization_batched_lookups;
+        if (config.print_kmers_only)
         {
-		    KmerMatcher matcher(hash_array, kmer_len);
+		    KmerMatcher matcher(hash_array_view, kmer_len, batched_lookups, prefilter.get());
     		KmerBasicPrinter print(writer, kmer_len);
-            Job::match_and_print<KmerMatcher, KmerBasicPrinter, KmerBasicMatchId>(chunk, print, matcher);
+            Job::run_for_matcher<std::vector<KmerBasicMatchId>>(filename, config.spot_filter_file, config.unaligned_only, config.optimization_ultrafast_skip_reader, config.chunk_size, config.metrics_interval,
+                [&](const std::vector<Reader::Fragment> &chunk, std::vector<KmerBasicMatchId> &matched) { Job::match(chunk, matcher, matched); },
+                [&](const std::vector<Reader::Fragment> &chunk, std::vector<KmerBasicMatchId> &matched) { print(chunk, matched); } );
         }
         else
         {
-    		Matcher matcher(hash_array, kmer_len);
-    		BasicPrinter print(writer);
-            Job::match_and_print<Matcher, BasicPrinter, BasicMatchId>(chunk, print, matcher);
+    		Matcher matcher(hash_array_view, kmer_len, batched_lookups, prefilter.get());
+    		auto hit_stream = Job::create_hit_stream(writer, config);
+    		BasicPrinter print(writer, hit_stream.get());
+            Job::run_for_matcher<std::vector<BasicMatchId>>(filename, config.spot_filter_file, config.unaligned_only, config.optimization_ultrafast_skip_reader, config.chunk_size, config.metrics_interval,
+                [&](const std::vector<Reader::Fragment> &chunk, std::vector<BasicMatchId> &matched) { Job::match(chunk, matcher, matched); },
+                [&](const std::vector<Reader::Fragment> &chunk, std::vector<BasicMatchId> &matched) { print(chunk, matched); } );
+            if (hit_stream)
+                hit_stream->close();
         }
-    }
+        log_prefilter_stats();
+	}
 };
 
 #endif
@@ -32,13 +32,14 @@
 #include <map>
 #include "hash.h"
 #include "seq_transform.h"
+#include "seq_encoder.h"
 #include "p_string.h"
 #include "dbs.h"
+#include "kmer_index.h"
 #include <mutex>
+#include <unistd.h>
 #include "tax_collator.hpp"
-
-// incompatible with multiple intput files option todo: fix by moving table creation to constructor and enable
-#define LOOKUP_TABLE 1
+#include "spot_runs.hpp"
 
 struct DBSJob : public Job
 {
@@ -54,26 +55,19 @@ struct DBSJob : public Job
 
     typedef std::set<hash_t> hash_set;
     typedef std::vector<KmerTax> HashSortedArray;
+    typedef ArrayView<KmerTax> HashSortedArrayView;
 
-    HashSortedArray hash_array;
+    HashSortedArray hash_array; // storage when db is loaded into memory
+    IO::MappedFile hash_array_mapping; // storage when db is memory mapped
+    HashSortedArrayView hash_array_view; // searched by matchers, points to one of the above
     typedef unsigned int tax_t; // todo: remove duplicate definition of tax_t and tax_id_t
     size_t kmer_len = 0;
 
     public:
 
-    struct Hits : public std::map<tax_t, hash_set>
+    // kmers of every tax id hit by any read, collected with -unique
+    struct UniqueHits : public std::map<tax_t, hash_set>
     {
-        operator bool() const { return size() != 0; }
-
-        void operator += (const Hits &x)
-        {
-            for (auto &other : x)
-                // (*this)[other.first] += other.second;
-                for (auto other_khit : other.second){
-                    (*this)[other.first].emplace(other_khit);
-                    //(*this)[other.first].insert(other.second.begin(),other.second.end());
-                }
-        }
         void print_uniq_hits(IO::Writer &uniq_file)
         {
             if (uniq_file.stream_f){
@@ -82,83 +76,300 @@ struct DBSJob : public Job
                 }
             }
             else {
-                std::cout << "Unique" << unique_hits.size() << std::endl;
-                for (auto tax_hit : unique_hits){
+                std::cout << "Unique" << size() << std::endl;
+                for (auto tax_hit : *this){
                     std::cout <<  tax_hit.first << '\t' << tax_hit.second.size() << std::endl;
                 }
             }
         }
 
     };
-    static Hits unique_hits;
 
-    virtual size_t db_kmers() const override { return hash_array.size();}
+    struct TaxHit
+    {
+        tax_t tax_id;
+        unsigned int count;
+    };
 
-    struct Matcher
+    struct HitArena;
+
+    // hits of one read sorted by tax id, a view into the arena of the thread which matched the read
+    struct Hits
     {
-#if LOOKUP_TABLE
-        typedef std::vector<size_t> HashLookupTable;
-        HashLookupTable hash_lookup_table;
-        int hash_lookup_shift;
-#endif
+        const HitArena *arena = nullptr;
+        size_t first = 0, count = 0; // in arena->hits
+        size_t first_kmer = 0, kmer_count = 0; // in arena->kmers, filled in unique mode only
+
+        operator bool() const { return count != 0; }
+        const TaxHit *begin() const { return arena->hits.data() + first; }
+        const TaxHit *end() const { return begin() + count; }
+        const std::pair<tax_t, hash_t> *kmers_begin() const { return arena->kmers.data() + first_kmer; }
+        const std::pair<tax_t, hash_t> *kmers_end() const { return kmers_begin() + kmer_count; }
+    };
 
-        const HashSortedArray &hash_array;
-        int kmer_len;
-        int max_lookups_per_seq = 0;
-        bool unique = false;
+    // flat storage of the hits of all reads of a chunk, kept with the chunk until it is printed
+    // matchers append reads to the arena selected for their thread, so after warming up no memory is allocated per read
+    // hits are appended unsorted while a read is matched and turned into per tax counts or kmer sets by end_read
+    struct HitArena
+    {
+        std::vector<TaxHit> hits;
+        std::vector<std::pair<tax_t, hash_t>> kmers; // (tax id, kmer) sets of the reads in unique mode
+        size_t read_first = 0, read_first_kmer = 0;
 
-        Matcher(const HashSortedArray &hash_array, int kmer_len, int max_lookups_per_seq, bool unique) : hash_array(hash_array), kmer_len(kmer_len), max_lookups_per_seq(max_lookups_per_seq), unique(unique)
+        static HitArena *&current()
         {
-            if (max_lookups_per_seq != 0)
-                LOG("max lookups per seq fragment " << max_lookups_per_seq);
-        
-#if LOOKUP_TABLE
-            // determining size of lookup key
-            int lookup_key_bits = 1;
-            while ((hash_array.size() >> lookup_key_bits) > 5)
+            thread_local HitArena own;
+            thread_local HitArena *arena = &own;
+            return arena;
+        }
+
+        static HitArena &local() { return *current(); }
+
+        // matchers of this thread use the arena while the scope lives
+        struct Scope
+        {
+            HitArena *previous;
+            Scope(HitArena &arena) : previous(current()) { current() = &arena; }
+            ~Scope() { current() = previous; }
+        };
+
+        void begin_read()
+        {
+            read_first = hits.size();
+            read_first_kmer = kmers.size();
+        }
+
+        // with count_repeats a kmer seen again for the same tax id in the read is one more element of its set,
+        // as the set based hits of -dbs -unique did, otherwise repeats are dropped
+        Hits end_read(bool count_repeats = false)
+        {
+            if (kmers.size() != read_first_kmer)
+                make_sets(count_repeats);
+            else
+                count_hits();
+
+            Hits read_hits;
+            read_hits.arena = this;
+            read_hits.first = read_first;
+            read_hits.count = hits.size() - read_first;
+            read_hits.first_kmer = read_first_kmer;
+            read_hits.kmer_count = kmers.size() - read_first_kmer;
+            return read_hits;
+        }
+
+        void clear()
+        {
+            hits.clear();
+            kmers.clear();
+            read_first = read_first_kmer = 0;
+        }
+
+        // one more hit of tax_id in the current read
+        void add(tax_t tax_id) { hits.push_back(TaxHit{tax_id, 1}); }
+
+        // adds value to the kmer set of tax_id in the current read
+        void add_to_set(tax_t tax_id, hash_t value) { kmers.emplace_back(tax_id, value); }
+
+    private:
+        struct KmerHit
+        {
+            tax_t tax_id;
+            hash_t value;
+            size_t order; // of the hit among the hits of the read, then among the hits of its tax id
+        };
+
+        std::vector<KmerHit> scratch; // reused by reads with repeats counted
+
+        // hits of the read sorted by tax id with one entry per tax id
+        void count_hits()
+        {
+            auto first = hits.begin() + read_first;
+            std::sort(first, hits.end(), [](const TaxHit &a, const TaxHit &b) { return a.tax_id < b.tax_id; });
+            auto out = first;
+            for (auto it = first; it != hits.end(); ++it)
+                if (out != first && (out - 1)->tax_id == it->tax_id)
+                    (out - 1)->count += it->count;
+                else
+                    *out++ = *it;
+
+            hits.erase(out, hits.end());
+        }
+
+        // kmers of the read become sets grouped by tax id, hits are the set sizes
+        void make_sets(bool count_repeats)
+        {
+            auto first = kmers.begin() + read_first_kmer;
+            if (count_repeats)
+                count_repeated_kmers();
+            else
+            {
+                std::sort(first, kmers.end());
+                kmers.erase(std::unique(first, kmers.end()), kmers.end());
+            }
+
+            for (auto it = kmers.begin() + read_first_kmer; it != kmers.end(); )
             {
-                lookup_key_bits += 1;
+                const tax_t tax_id = it->first;
+                unsigned int count = 0;
+                for (; it != kmers.end() && it->first == tax_id; ++it)
+                    count++;
+
+                hits.push_back(TaxHit{tax_id, count});
             }
-            hash_lookup_shift = kmer_len * 2 - lookup_key_bits;
+        }
 
-            const size_t bucket_count = size_t(1) << lookup_key_bits;
-            LOG("creating lookup table with " << bucket_count << " buckets, on average " << (float(hash_array.size()) / bucket_count) << " hashes per bucket");
-            hash_lookup_table.resize(bucket_count + 1);
+        // the k-th (from 0) hit of a tax id finds a set of k elements, so a repeated kmer adds k + 1.
+        // that holds while no kmer of the tax id is in [1, hit count]; such a tax id replays the hits one by one
+        void count_repeated_kmers()
+        {
+            scratch.clear();
+            for (size_t i = read_first_kmer; i < kmers.size(); i++)
+                scratch.push_back(KmerHit{kmers[i].first, kmers[i].second, i});
 
-            // figuring out bucket ranges
-            size_t hash_idx = 0;
-            hash_t last_hash = 0;
-            for (size_t bucket_idx = 0; bucket_idx < bucket_count; ++bucket_idx)
+            std::sort(scratch.begin(), scratch.end(), [](const KmerHit &a, const KmerHit &b) { return a.tax_id != b.tax_id ? a.tax_id < b.tax_id : a.order < b.order; });
+            kmers.resize(read_first_kmer);
+            for (size_t group = 0; group < scratch.size(); )
             {
-                hash_lookup_table[bucket_idx] = hash_idx;
-                while (true)
+                size_t end = group;
+                while (end < scratch.size() && scratch[end].tax_id == scratch[group].tax_id)
+                    end++;
+
+                bool small_values = false;
+                for (size_t i = group; i < end; i++)
                 {
-                    if (hash_idx >= hash_array.size())
-                        break;
-                    hash_t hash = hash_array[hash_idx].kmer;
-                    assert(hash >= last_hash);
-                    const size_t hash_bucket = hash >> hash_lookup_shift;
-                    if (hash_bucket != bucket_idx)
-                        break;
-                    
-                    ++hash_idx;
-                    last_hash = hash;
+                    scratch[i].order = i - group;
+                    small_values = small_values || (scratch[i].value >= 1 && scratch[i].value <= hash_t(end - group));
                 }
+
+                if (small_values)
+                    replay_hits(group, end);
+                else
+                {
+                    std::sort(scratch.begin() + group, scratch.begin() + end, [](const KmerHit &a, const KmerHit &b) { return a.value != b.value ? a.value < b.value : a.order < b.order; });
+                    for (size_t i = group; i < end; i++)
+                        kmers.emplace_back(scratch[i].tax_id, (i > group && scratch[i].value == scratch[i - 1].value) ? hash_t(scratch[i].order + 1) : scratch[i].value);
+                }
+
+                group = end;
             }
-            hash_lookup_table[bucket_count] = hash_array.size();
- #endif
+        }
+
+        // hits of one tax id in the order they were found
+        void replay_hits(size_t group, size_t end)
+        {
+            const size_t set_first = kmers.size();
+            auto in_set = [&](hash_t value)
+            {
+                for (size_t i = set_first; i < kmers.size(); i++)
+                    if (kmers[i].second == value)
+                        return true;
+
+                return false;
+            };
+
+            for (size_t i = group; i < end; i++)
+            {
+                hash_t value = scratch[i].value;
+                if (in_set(value))
+                    value = hash_t(kmers.size() - set_first + 1);
+                if (!in_set(value))
+                    kmers.emplace_back(scratch[i].tax_id, value);
+            }
+        }
+    };
+
+    virtual size_t db_kmers() const override { return hash_array_view.size();}
+
+    std::unique_ptr<KmerStaticIndex> static_index; // built once after loading, matchers use lookup_table when not set
+    IO::MappedFile lookup_index_mapping; // lookup index sidecar, when it was found
+    KmerBucketIndex lookup_table; // built or mapped once per database, shared by all runs
+    std::string lookup_index_file;
+    DBSIO::LookupIndexSource lookup_index_source;
+
+    // the bucket table is mapped from the lookup index sidecar of the database if it has a valid one,
+    // otherwise it is built and saved there for the next runs
+    void create_index(KmerIndexType::Type index_type, const std::string &index_file = "", const DBSIO::LookupIndexSource &source = DBSIO::LookupIndexSource())
+    {
+        if (index_type != KmerIndexType::BUCKET_TABLE)
+        {
+            static_index = make_unique<KmerStaticIndex>(index_type, hash_array_view, (int)kmer_len);
+            return;
+        }
+
+        lookup_index_file = index_file;
+        lookup_index_source = source;
+        if (!index_file.empty() && DBSIO::map_lookup_index(index_file, lookup_index_mapping, source, hash_array_view, lookup_table))
+        {
+            LOG("lookup table mapped from " << index_file << ", " << lookup_table.bucket_count() << " buckets");
+            return;
+        }
+
+        lookup_table.build(hash_array_view, (int)kmer_len);
+        save_lookup_index();
+    }
+
+    void save_lookup_index() const
+    {
+        if (lookup_index_file.empty())
+            return;
+
+        try
+        {
+            DBSIO::save_lookup_index(lookup_index_file, lookup_index_source, lookup_table, prefilter.get());
+            LOG("lookup index saved to " << lookup_index_file);
+        }
+        catch (std::exception &e)
+        {
+            LOG(e.what()); // read-only location, runs still work without the sidecar
+        }
+    }
+
+    virtual void create_prefilter() override
+    {
+        prefilter = make_unique<KmerBloomFilter>();
+        auto saved = lookup_index_mapping.is_open() ? DBSIO::lookup_index_filter(lookup_index_mapping) : ArrayView<KmerBloomFilter::Block>();
+        if (!saved.empty())
+        {
+            prefilter->attach(saved.data(), saved.size());
+            LOG("prefilter mapped from " << lookup_index_file);
+            return;
+        }
+
+        prefilter->build(hash_array_view, [](const KmerTax &kmer_tax) { return kmer_tax.kmer; });
+        save_lookup_index();
+    }
+
+    struct Matcher
+    {
+        const HashSortedArrayView hash_array;
+        const KmerStaticIndex *static_index;
+        const KmerBucketIndex *lookup_table; // used when there is no static index
+        const KmerBloomFilter *prefilter;
+        int kmer_len;
+        int max_lookups_per_seq = 0;
+        bool unique = false;
+        bool batched_lookups = false;
+
+        Matcher(const HashSortedArrayView &hash_array, const KmerStaticIndex *static_index, const KmerBucketIndex *lookup_table, int kmer_len, int max_lookups_per_seq, bool unique, bool batched_lookups = false, const KmerBloomFilter *prefilter = nullptr) : hash_array(hash_array), static_index(static_index), lookup_table(lookup_table), prefilter(prefilter), kmer_len(kmer_len), max_lookups_per_seq(max_lookups_per_seq), unique(unique), batched_lookups(batched_lookups)
+        {
+            if (max_lookups_per_seq != 0)
+                LOG("max lookups per seq fragment " << max_lookups_per_seq);
         }
 
         std::pair<tax_t, hash_t>  find_hash(hash_t hash, int  default_value ) const
         {
-#if LOOKUP_TABLE
-            hash_t bucket_idx = hash >> hash_lookup_shift;
-            auto first = hash_array.begin() + hash_lookup_table[bucket_idx];
-            auto last = hash_array.begin() + hash_lookup_table[bucket_idx + 1];            
-#else
-            auto first = hash_array.begin();
-            auto last = hash_array.end();
-#endif
+            if (static_index)
+            {
+                const tax_t tax_id = static_index->find(hash);
+                if (!tax_id)
+                    return {default_value, default_value};
+
+                return {tax_id, (unique ? hash : default_value)};
+            }
+
+            const size_t bucket_idx = lookup_table->bucket_of(hash);
+            auto first = hash_array.begin() + lookup_table->bucket_begin(bucket_idx);
+            auto last = hash_array.begin() + lookup_table->bucket_end(bucket_idx);
             first = std::lower_bound(first, last, KmerTax(hash, 0));
             if ((first == last) || (hash < first->kmer)){
                 return {default_value,default_value};
@@ -169,6 +380,21 @@ struct DBSJob : public Job
             // return { ((first == last) || (hash < first->kmer) ) ? {default_value, default_value}; :  {first->tax_id, first->kmer}; }
         }
 
+        // kmers rejected by prefilter are not searched
+        std::pair<tax_t, hash_t> find_hash(hash_t hash, KmerBloomFilter::Counts &counts) const
+        {
+            counts.lookups++;
+            if (!prefilter->may_contain(hash))
+            {
+                counts.rejected++;
+                return {0, 0};
+            }
+
+            auto hit = find_hash(hash, 0);
+            counts.found += hit.first != 0;
+            return hit;
+        }
+
         int calculate_lookup_window(int seq_kmers) const
         {
             if ((max_lookups_per_seq == 0) || seq_kmers <= max_lookups_per_seq)
@@ -177,9 +403,10 @@ struct DBSJob : public Job
             return (seq_kmers + max_lookups_per_seq - 1) / max_lookups_per_seq;
         }
 
-        Hits operator() (const std::string &seq) const 
+        // calls f for every kmer of seq which has to be looked up in the database
+        template <class F>
+        void for_each_lookup(const std::string &seq, F &&f) const
         {
-            Hits hits;
             int index = 0;
             hash_t min_hash = 0;
             uint64_t min_fnv_hash = 0;
@@ -187,9 +414,10 @@ struct DBSJob : public Job
             int seq_kmers = seq.length() - kmer_len + 1;
             const int lookup_window = calculate_lookup_window(seq_kmers);
 
-            Hash<hash_t>::for_all_hashes_do(seq, kmer_len, [&](hash_t hash)
+            thread_local std::vector<uint8_t> codes;
+            SeqEncoder::encode(seq, codes);
+            KmerStream<hash_t>::for_all_canonical_kmers_do(codes.data(), (int)codes.size(), kmer_len, false, [&](int, hash_t hash)
                 {
-                    hash = seq_transform<hash_t>::min_hash_variant(hash, kmer_len);
                     auto fnv_hash = lookup_window == 1 ? 0 : KmerHash::hash_of(hash); 
 
                     if (index == 0 || fnv_hash < min_fnv_hash)
@@ -202,20 +430,96 @@ struct DBSJob : public Job
 
                     if ((index % lookup_window) == 0 || index == seq_kmers) 
                     {
-                        auto hit = find_hash(min_hash,0);
-                        if (unique && hit.first && hits[hit.first].find(hit.second) == hits[hit.first].end())   {
-                            hits[hit.first].emplace(hit.second);
-                        }
-                        else if (hit.first){
-                            hash_t h(hits[hit.first].size() + 1);
-                            hits[hit.first].emplace(h);
-                        }
+                        f(min_hash);
                         index = 0;
                     }
                     return true;
                 });
+        }
+
+        void add_hit(HitArena &arena, const std::pair<tax_t, hash_t> &hit) const
+        {
+            if (!hit.first)
+                return;
 
-            return hits;
+            if (unique)
+                arena.add_to_set(hit.first, hit.second);
+            else
+                arena.add(hit.first);
+        }
+
+        void prefetch_bucket(hash_t hash) const
+        {
+            if (static_index)
+                static_index->prefetch_bucket(hash);
+            else
+                lookup_table->prefetch_bucket(hash);
+        }
+
+        void prefetch_records(hash_t hash) const
+        {
+            if (static_index)
+                static_index->prefetch_records(hash);
+            else
+                lookup_table->prefetch_records(hash_array, hash);
+        }
+
+        // software pipelined lookups: the table slot of lookup i + 2 * PREFETCH_DISTANCE and the bucket records
+        // of lookup i + PREFETCH_DISTANCE are prefetched while lookup i is resolved, so the misses of different kmers overlap
+        static const size_t PREFETCH_DISTANCE = 8;
+
+        void find_hashes(const std::vector<hash_t> &lookups, std::vector<std::pair<tax_t, hash_t>> &found) const
+        {
+            const size_t count = lookups.size();
+            found.resize(count);
+            for (size_t i = 0; i < count + 2 * PREFETCH_DISTANCE; ++i)
+            {
+                if (i < count)
+                    prefetch_bucket(lookups[i]);
+                if (i >= PREFETCH_DISTANCE && i - PREFETCH_DISTANCE < count)
+                    prefetch_records(lookups[i - PREFETCH_DISTANCE]);
+                if (i >= 2 * PREFETCH_DISTANCE)
+                    found[i - 2 * PREFETCH_DISTANCE] = find_hash(lookups[i - 2 * PREFETCH_DISTANCE], 0);
+            }
+        }
+
+        Hits operator() (const std::string &seq) const 
+        {
+            auto &arena = HitArena::local();
+            arena.begin_read();
+            KmerBloomFilter::Counts counts;
+            if (batched_lookups)
+            {
+                // buffers are reused by all reads processed by the thread
+                thread_local std::vector<hash_t> lookups;
+                thread_local std::vector<std::pair<tax_t, hash_t>> found;
+                lookups.clear();
+                for_each_lookup(seq, [&](hash_t hash) { lookups.push_back(hash); });
+                if (prefilter)
+                    prefilter->remove_absent(lookups, counts); // rejected kmers would not add hits anyway
+                else
+                    counts.lookups += lookups.size();
+                find_hashes(lookups, found);
+                for (auto &hit : found)
+                {
+                    counts.found += hit.first != 0;
+                    add_hit(arena, hit);
+                }
+            }
+            else if (prefilter)
+                for_each_lookup(seq, [&](hash_t hash) { add_hit(arena, find_hash(hash, counts)); });
+            else
+                for_each_lookup(seq, [&](hash_t hash)
+                    {
+                        auto hit = find_hash(hash, 0);
+                        counts.lookups++;
+                        counts.found += hit.first != 0;
+                        add_hit(arena, hit);
+                    });
+
+            RunMetrics::local().add_lookups(counts, seq.size(), kmer_len);
+
+            return arena.end_read(unique); // in unique mode a repeated kmer is counted as one more element of the set
         }
 
     };
@@ -229,20 +533,34 @@ struct DBSJob : public Job
         bool operator < (const TaxMatchId &b) const { return seq_id < b.seq_id; }
     };
 
+    struct MatchedChunk
+    {
+        std::vector<TaxMatchId> ids;
+        HitArena arena;
+    };
+
+    template <class Matcher>
+    static void match_chunk(const std::vector<Reader::Fragment> &chunk, const Matcher &matcher, MatchedChunk &matched)
+    {
+        matched.arena.clear();
+        HitArena::Scope scope(matched.arena);
+        Job::match(chunk, matcher, matched.ids);
+    }
+
 
-template<class TaxHitsO>
+template<class TaxHitsO, class TaxHits = tc::Tax_hits<TaxHitsO>>
     struct TaxHitsPrinter
     {
-        tc::Tax_hits<TaxHitsO> &tax_hits;
+        TaxHits &tax_hits; // tc::Tax_hits or tc::Spot_runs
         const bool print_counts, compact;
         tc::Spot<TaxHitsO> spot;
         tc::Spot<TaxHitsO> last_spot;
 
-        TaxHitsPrinter(bool print_counts, bool compact, tc::Tax_hits<TaxHitsO> &tax_hits_) : print_counts(print_counts), compact(compact), tax_hits(tax_hits_) {}
+        TaxHitsPrinter(bool print_counts, bool compact, TaxHits &tax_hits_) : print_counts(print_counts), compact(compact), tax_hits(tax_hits_) {}
 
         void operator() (const std::vector<Reader::Fragment> &processing_sequences, const std::vector<TaxMatchId> &ids)
         {
-            for (auto seq_id : ids) {
+            for (auto &seq_id : ids) {
                 spot.name = processing_sequences[seq_id.seq_id].spotid;
                 spot.tax_id.clear();
                 if constexpr (TaxHitsO::has_counts()) {
@@ -250,9 +568,9 @@ template<class TaxHitsO>
                 }
                 for_each(spot.name.begin(), spot.name.end(), [](char& c) { if (c == '\n' || c == '\t') c = ' ';});
                 for (auto &hit : seq_id.hits) {
-                    spot.tax_id.push_back(hit.first);
+                    spot.tax_id.push_back(hit.tax_id);
                     if constexpr (TaxHitsO::has_counts()) {
-                        spot.counts.push_back(hit.second.size());
+                        spot.counts.push_back(hit.count);
                     }
                 }
                 if (spot.name == last_spot.name) {
@@ -262,7 +580,13 @@ template<class TaxHitsO>
                     swap(last_spot, spot);
                 }
             }
+        }
+
+        // the last spot is kept until the next chunk to merge its fragments, added after the last chunk
+        void flush()
+        {
             tax_hits.add_row(last_spot);
+            last_spot.name.clear();
         }
     };
 
@@ -270,29 +594,41 @@ template<class TaxHitsO>
     struct TaxPrinter
     {
         IO::Writer &writer;
-        const bool print_counts, compact, unique;
-        TaxPrinter(bool print_counts, bool compact, IO::Writer &writer, bool unique) : print_counts(print_counts), compact(compact), writer(writer), unique(unique) {}
+        const bool print_counts, compact;
+        UniqueHits *unique_hits; // collected with -unique only
+        HitStreamWriter *hit_stream; // -out_format binary, text lines otherwise
+        std::string text; // lines of a chunk written at once
+        TaxPrinter(bool print_counts, bool compact, IO::Writer &writer, UniqueHits *unique_hits, HitStreamWriter *hit_stream = nullptr) : print_counts(print_counts), compact(compact), writer(writer), unique_hits(unique_hits), hit_stream(hit_stream) {}
 
         void load_uniq_chunk(const std::vector<TaxMatchId> &tm_ids)
         {
-            for (auto tm_id : tm_ids){
-                for (auto &hit : tm_id.hits){
-                    for (auto khit : hit.second){
-                        unique_hits[hit.first].emplace(khit);
-                    }
+            for (auto &tm_id : tm_ids){
+                for (auto khit = tm_id.hits.kmers_begin(); khit != tm_id.hits.kmers_end(); ++khit){
+                    (*unique_hits)[khit->first].emplace(khit->second);
                 }
             }
         }
 
         void operator() (const std::vector<Reader::Fragment> &processing_sequences, const std::vector<TaxMatchId> &ids)
         {
-            if (unique){
+            if (unique_hits){
                 load_uniq_chunk(ids);
             }
-            if (compact)
-                print_compact(processing_sequences, ids);
+            if (hit_stream)
+            {
+                for (auto &seq_id : ids)
+                    hit_stream->add(processing_sequences[seq_id.seq_id].spotid, seq_id.hits);
+            }
             else
-                print(processing_sequences, ids);
+            {
+                text.clear();
+                if (compact)
+                    print_compact(processing_sequences, ids);
+                else
+                    print(processing_sequences, ids);
+
+                writer.f().write(text.data(), text.size());
+            }
 
             writer.check();
         }
@@ -301,32 +637,13 @@ template<class TaxHitsO>
 
         void print(const std::vector<Reader::Fragment> &processing_sequences, const std::vector<TaxMatchId> &ids)
         {
-            for (auto seq_id : ids)
+            for (auto &seq_id : ids)
                 print_id_info(processing_sequences, seq_id);
         }
 
-        void print_spotid(const Reader::Fragment &fragment)
-        {
-            for (auto c : fragment.spotid) 
-            {
-                if (c == '\t' || c == '\n')
-                    c = ' ';
-                writer.f() << c;
-            }
-        }
-
         void print_id_info(const std::vector<Reader::Fragment> &processing_sequences, const TaxMatchId &seq_id)
         {
-            print_spotid(processing_sequences[seq_id.seq_id]);
-
-            for (auto &hit : seq_id.hits) 
-            {
-                writer.f() << '\t' << hit.first;
-                if (print_counts && hit.second.size() > 1)
-                    writer.f() << 'x' << hit.second.size();
-            }
-
-            writer.f() << std::endl;
+            HitStream::append_text(text, processing_sequences[seq_id.seq_id].spotid, seq_id.hits, print_counts);
         }
 
         void print_compact(const std::vector<Reader::Fragment> &processing_sequences, const std::vector<TaxMatchId> &ids)
@@ -342,11 +659,14 @@ template<class TaxHitsO>
 
             for (auto &x: reverse_index)
             {
-                writer.f() << x.second;
+                HitStream::append_number(text, x.second);
                 for (auto &tax : x.first)
-                    writer.f() << '\t' << tax;
+                {
+                    text.push_back('\t');
+                    HitStream::append_number(text, tax);
+                }
 
-                writer.f() << std::endl;
+                text.push_back('\n');
             }
         }
 
@@ -354,24 +674,18 @@ template<class TaxHitsO>
         {
             for (int i = 0; i < from; i++)
             {
-                writer.f() << '\t';
+                text.push_back('\t');
                 print_id_info(processing_sequences, ids[i]);
             }
 
             for (int i = to + 1; i < ids.size(); i++)
             {
-                writer.f() << '\t';
+                text.push_back('\t');
                 print_id_info(processing_sequences, ids[i]);
             }
         }
 
-#define INTEGER_SPOTID 0
-
-#if INTEGER_SPOTID
-        typedef long long spot_id_t;
-#else
         typedef p_string spot_id_t;
-#endif
         typedef int tax_id_t;
         typedef std::map<spot_id_t, std::set<tax_id_t> > SpotTaxIds; // todo: unordered map ?
 
@@ -380,15 +694,11 @@ template<class TaxHitsO>
             SpotTaxIds spots;
             for (int i = from; i <= to; i++)
             {
-#if INTEGER_SPOTID
-                auto spotid = std::stoll(processing_sequences[ids[i].seq_id].spotid);
-#else
                 auto spotid = p_string(processing_sequences[ids[i].seq_id].spotid);
-#endif
                 auto &spot = spots[spotid];
 
                 for (auto &hit : ids[i].hits)
-                    spot.insert(hit.first);
+                    spot.insert(hit.tax_id);
             }
 
             return spots;
@@ -407,29 +717,87 @@ template<class TaxHitsO>
 
     };
 
-    bool hide_counts = false;
-    bool compact = false;
+    template<class TaxHitsO, class TaxHits>
+    void collect_tax_hits(const std::string &filename, const Config &config, TaxHits &tax_hits)
+    {
+        {
+            Matcher matcher(hash_array_view, static_index.get(), &lookup_table, (int)kmer_len, config.optimization_dbs_max_lookups_per_seq_fragment, config.unique, config.optimization_batched_lookups, prefilter.get());
+            TaxHitsPrinter<TaxHitsO, TaxHits> tc_print(!config.hide_counts, config.compact, tax_hits);
+
+            Job::run_for_matcher<MatchedChunk>(filename, config.spot_filter_file, config.unaligned_only, config.optimization_ultrafast_skip_reader, config.chunk_size, config.metrics_interval,
+                [&matcher](const std::vector<Reader::Fragment> &chunk, MatchedChunk &matched) { match_chunk(chunk, matcher, matched); },
+                [&tc_print](const std::vector<Reader::Fragment> &chunk, MatchedChunk &matched) { tc_print(chunk, matched.ids); } );
+            tc_print.flush();
+        }
+        log_prefilter_stats();
+        if (!resident && config.contig_files.size() <= 1) // the next input of the same run needs the DB
+        {
+            // We don't need DB anymore
+            hash_array_view = HashSortedArrayView();
+            static_index.reset();
+            lookup_table = KmerBucketIndex();
+            prefilter.reset();
+            lookup_index_mapping.close();
+            hash_array.resize(0); 
+            hash_array.shrink_to_fit();
+            hash_array_mapping.close();
+        }
+    }
+
+    // spots above -collate_memory are written to sorted runs next to the output and merged from disk
+    template<class Options>
+    void run_spot_runs_collator(const std::string &filename, IO::Writer &writer, const Config &config)
+    {
+        tc::Spot_runs<Options> runs(spot_runs_prefix(writer), config.collate_memory << 20);
 
+        // runs are removed also when collecting or merging throws, -vectorize keeps them for tax_collator
+        struct Cleanup
+        {
+            tc::Spot_runs<Options> &runs;
+            bool keep;
+            ~Cleanup() { if (!keep) runs.remove_runs(); }
+        } cleanup = { runs, false };
+
+        collect_tax_hits<Options>(filename, config, runs);
+        runs.flush();
+        if (config.vectorize) {
+            runs.save(filename + ".runs");
+            cleanup.keep = true;
+        } else {
+            int num_threads = config.num_threads ? config.num_threads : std::thread::hardware_concurrency();
+            if (config.compact)
+                runs.group(num_threads, writer.f());
+            else
+                runs.print(num_threads, writer.f());
+        }
+    }
+
+    // the output file, or TMPDIR for stdout, the input may be read only or an accession
+    // runs of inputs collated at once by this process get their own numbers
+    static std::string spot_runs_prefix(const IO::Writer &writer)
+    {
+        static std::atomic<int> next_runs(0);
+        std::string prefix = writer.filename;
+        if (prefix.empty())
+        {
+            const char *tmp_dir = getenv("TMPDIR");
+            prefix = std::string(tmp_dir && *tmp_dir ? tmp_dir : "/tmp") + "/aligns_to";
+        }
+
+        return prefix + "." + std::to_string(getpid()) + "." + std::to_string(next_runs++);
+    }
 
     template<class Options>
     void run_collator(const std::string &filename, IO::Writer &writer, const Config &config)
     {
         //spdlog::stopwatch sw; 
 
-        auto tax_hits = make_unique<tc::Tax_hits<Options>>(true);
-        {
-            Matcher matcher(hash_array, (int)kmer_len, config.optimization_dbs_max_lookups_per_seq_fragment, config.unique); // todo: move to constructor
-            TaxHitsPrinter tc_print(!hide_counts, compact, *tax_hits);
-
-            Job::run_for_matcher(filename, config.spot_filter_file, config.unaligned_only, config.optimization_ultrafast_skip_reader, config.chunk_size,
-                [&matcher, &tc_print](const std::vector<Reader::Fragment> &chunk) { 
-                    Job::match_and_print<Matcher, TaxHitsPrinter<Options>, TaxMatchId>(chunk, tc_print, matcher);
-                    //match_and_print_chunk(chunk, tax_hits, matcher); 
-                } );
+        if (config.collate_memory) {
+            run_spot_runs_collator<Options>(filename, writer, config);
+            return;
         }
-        // We don't need DB anymore
-        hash_array.resize(0); 
-        hash_array.shrink_to_fit();
+        auto tax_hits = make_unique<tc::Tax_hits<Options>>(true);
+        collect_tax_hits<Options>(filename, config, *tax_hits);
         tax_hits->finalize(); 
         if (config.vectorize) {
             tax_hits->save(filename);
@@ -452,11 +820,8 @@ template<class TaxHitsO>
 
     virtual void run(const std::string &filename, IO::Writer &writer, const Config &config) override
     {
-        hide_counts = config.hide_counts;
-        compact = config.compact;
-
         if (config.collate || config.vectorize) {
-            if (hide_counts)
+            if (config.hide_counts)
                 run_collator<tc::tax_hits_options<false, false>>(filename, writer, config);
             else if (config.compact)
                 run_collator<tc::tax_hits_options<false, false>>(filename, writer, config);
@@ -464,13 +829,17 @@ template<class TaxHitsO>
                 run_collator<tc::tax_hits_options<false, true>>(filename, writer, config);
 
         } else {
-            Matcher matcher(hash_array, (int)kmer_len, config.optimization_dbs_max_lookups_per_seq_fragment,
-                            config.unique); // todo: move to constructor
-            TaxPrinter print(!hide_counts, compact, writer, config.unique);
-            Job::run_for_matcher(filename, config.spot_filter_file, config.unaligned_only,  config.optimization_ultrafast_skip_reader, config.chunk_size,
-            [&](const std::vector<Reader::Fragment> &chunk) { 
-                Job::match_and_print<Matcher, TaxPrinter, TaxMatchId>(chunk, print, matcher);
-            } );
+            Matcher matcher(hash_array_view, static_index.get(), &lookup_table, (int)kmer_len, config.optimization_dbs_max_lookups_per_seq_fragment,
+                            config.unique, config.optimization_batched_lookups, prefilter.get());
+            UniqueHits unique_hits;
+            auto hit_stream = Job::create_hit_stream(writer, config);
+            TaxPrinter print(!config.hide_counts, config.compact, writer, config.unique ? &unique_hits : nullptr, hit_stream.get());
+            Job::run_for_matcher<MatchedChunk>(filename, config.spot_filter_file, config.unaligned_only,  config.optimization_ultrafast_skip_reader, config.chunk_size, config.metrics_interval,
+                [&](const std::vector<Reader::Fragment> &chunk, MatchedChunk &matched) { match_chunk(chunk, matcher, matched); },
+                [&](const std::vector<Reader::Fragment> &chunk, MatchedChunk &matched) { print(chunk, matched.ids); } );
+            if (hit_stream)
+                hit_stream->close();
+            log_prefilter_stats();
             if (config.unique){
                 IO::Writer writer_u((!writer.filename.empty()) ? writer.filename + ".uniq" : "");
                 unique_hits.print_uniq_hits(writer_u);
@@ -480,14 +849,19 @@ template<class TaxHitsO>
 };
 
 
-DBSJob::Hits DBSJob::unique_hits;
-
 
 struct DBSBasicJob : public DBSJob
 {
-    DBSBasicJob(const std::string &dbs)
+    DBSBasicJob(const std::string &dbs, bool mmap = false, IO::MappedFile::Prefetch prefetch = IO::MappedFile::PREFETCH_NONE, KmerIndexType::Type index_type = KmerIndexType::BUCKET_TABLE)
     {
-        kmer_len = DBSIO::load_dbs(dbs, hash_array);
+        if (mmap)
+            kmer_len = DBSIO::map_dbs(dbs, hash_array_mapping, hash_array_view, prefetch);
+        else
+        {
+            kmer_len = DBSIO::load_dbs(dbs, hash_array);
+            hash_array_view = hash_array;
+        }
+        create_index(index_type, dbs + ".index", DBSIO::lookup_index_source(dbs, kmer_len, hash_array_view));
     }
 };
 
@@ -0,0 +1,55 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#pragma once
+
+#include "aligns_to_dbs_job.h"
+
+// kmers and tax ids are searched directly in the compressed .dbsc database, loaded into memory or memory mapped
+struct DBSCJob : public DBSJob
+{
+    DBSCJob(const std::string &dbsc, bool mmap = false, IO::MappedFile::Prefetch prefetch = IO::MappedFile::PREFETCH_NONE)
+    {
+        KmerCompressedIndex compressed;
+        if (mmap)
+            kmer_len = DBSIO::map_dbsc(dbsc, hash_array_mapping, compressed, prefetch);
+        else
+            kmer_len = DBSIO::load_dbsc(dbsc, compressed);
+
+        LOG("compressed db " << (compressed.memory_bytes() / 1024 / 1024) << "MB");
+        static_index = make_unique<KmerStaticIndex>(std::move(compressed));
+    }
+
+    virtual size_t db_kmers() const override { return static_index ? static_index->size() : 0; }
+
+    virtual void create_prefilter() override
+    {
+        prefilter = make_unique<KmerBloomFilter>();
+        prefilter->init(static_index->size());
+        static_index->compressed.for_each_kmer([this](hash_t kmer) { prefilter->add(kmer); });
+        prefilter->log_size();
+    }
+};
@@ -28,99 +28,98 @@
 
 #include "aligns_to_dbs_job.h"
 
+// kmers with several tax ids each, kept in compressed sparse row form and loaded at once or memory mapped
 struct DBSMJob : public Job
 {
-    struct KmerTax : public DBS::KmerTaxMulti
-    {
-        KmerTax() = default;
-        KmerTax(hash_t kmer, const std::vector<int> &tax_ids) : DBS::KmerTaxMulti(kmer, tax_ids) { } // todo: remove constructor from KmerTax for faster loading ?
-
-        bool operator < (const KmerTax &x) const // for binary search by hash
-        {
-            return kmer < x.kmer;
-        }
-    };
-
-    typedef std::vector<KmerTax> HashSortedArray;
-
-    HashSortedArray hash_array;
+    KmerMultiTaxIndex index;
+    IO::MappedFile mapping; // holds the tax ids of the index when the database is memory mapped
     size_t kmer_len = 0;
 
     public:
 
-    DBSMJob(const std::string &dbsm)
+    DBSMJob(const std::string &dbsm, bool mmap = false, IO::MappedFile::Prefetch prefetch = IO::MappedFile::PREFETCH_NONE)
     {
-        kmer_len = DBSIO::load_dbsm(dbsm, hash_array);
+        if (mmap)
+            kmer_len = DBSIO::map_dbsm(dbsm, mapping, index, prefetch);
+        else
+            kmer_len = DBSIO::load_dbsm(dbsm, index);
+
+        LOG("multi tax db " << (index.memory_bytes() / 1024 / 1024) << "MB");
     }
 
-    struct Hits : public DBSJob::Hits {};
+    typedef DBSJob::Hits Hits;
+
+    virtual size_t db_kmers() const override { return index.size(); }
 
-    virtual size_t db_kmers() const override { return hash_array.size();}
+    virtual void create_prefilter() override
+    {
+        prefilter = make_unique<KmerBloomFilter>();
+        prefilter->build(index.kmers, [](hash_t kmer) { return kmer; });
+    }
 
     struct Matcher
     {
-        const HashSortedArray &hash_array;
+        const KmerMultiTaxIndex &index;
         int kmer_len;
         bool unique = false;
-        const std::vector<int> EMPTY_TAXES;
+        const KmerBloomFilter *prefilter;
 
-        Matcher(const HashSortedArray &hash_array, int kmer_len, bool unique) : hash_array(hash_array), kmer_len(kmer_len), unique(unique) { }
-
-        const std::vector<int> &find_hash(hash_t hash, const std::vector<int> &default_value) const
-        {
-            auto first = hash_array.begin();
-            auto last = hash_array.end();
-            first = std::lower_bound(first, last, KmerTax(hash, default_value));
-            return ((first == last) || (hash < first->kmer) ) ? default_value : first->tax_ids;
-        }
+        Matcher(const KmerMultiTaxIndex &index, int kmer_len, bool unique, const KmerBloomFilter *prefilter = nullptr) : index(index), kmer_len(kmer_len), unique(unique), prefilter(prefilter) { }
 
         Hits operator() (const std::string &seq) const
         {
-            Hits hits;
+            auto &arena = DBSJob::HitArena::local();
+            arena.begin_read();
+            KmerBloomFilter::Counts counts;
             Hash<hash_t>::for_all_hashes_do(seq, kmer_len, [&](hash_t hash)
             {
-                auto  &tax_ids = get_db_tax(hash);
-                for (auto tax_id : tax_ids)
-                    if (unique && (hits[tax_id].find(hash) == hits[tax_id].end()))  {
-                        hits[tax_id].emplace(hash);
-                    }
-                    else if (!unique){
-                        hash_t h(hits[tax_id].size() + 1);
-                        hits[tax_id].emplace(h);
-                    }
+                for (auto tax_id : get_db_tax(hash, counts))
+                    if (unique)
+                        arena.add_to_set(tax_id, hash);
+                    else
+                        arena.add(tax_id);
                 return true;
             });
 
-            return hits;
+            RunMetrics::local().add_lookups(counts, seq.size(), kmer_len);
+
+            return arena.end_read();
         }
 
-        const std::vector<int> &get_db_tax(hash_t hash) const
+        KmerMultiTaxIndex::TaxIds get_db_tax(hash_t hash, KmerBloomFilter::Counts &counts) const
         {
             hash = seq_transform<hash_t>::min_hash_variant(hash, kmer_len);
-            return find_hash(hash, EMPTY_TAXES);
+            counts.lookups++;
+            if (prefilter && !prefilter->may_contain(hash))
+            {
+                counts.rejected++;
+                return KmerMultiTaxIndex::TaxIds();
+            }
+
+            auto tax_ids = index.find(hash);
+            counts.found += !tax_ids.empty();
+            return tax_ids;
         }
     };
 
     typedef DBSJob::TaxMatchId TaxMatchId;
     typedef DBSJob::TaxPrinter TaxPrinter;
 
-    bool hide_counts = false;
-
     virtual void run(const std::string &filename, IO::Writer &writer, const Config &config) override
     {
-        hide_counts = config.hide_counts;
-        Job::run_for_matcher(filename, config.spot_filter_file, config.unaligned_only, config.optimization_ultrafast_skip_reader, config.chunk_size, [&](const std::vector<Reader::Fragment> &chunk) { match_and_print_chunk(chunk, writer, config); } );
+        Matcher matcher(index, (int)kmer_len, config.unique, prefilter.get());
+        DBSJob::UniqueHits unique_hits;
+        auto hit_stream = Job::create_hit_stream(writer, config);
+        TaxPrinter print(!config.hide_counts, false, writer, config.unique ? &unique_hits : nullptr, hit_stream.get());
+        Job::run_for_matcher<DBSJob::MatchedChunk>(filename, config.spot_filter_file, config.unaligned_only, config.optimization_ultrafast_skip_reader, config.chunk_size, config.metrics_interval,
+            [&](const std::vector<Reader::Fragment> &chunk, DBSJob::MatchedChunk &matched) { DBSJob::match_chunk(chunk, matcher, matched); },
+            [&](const std::vector<Reader::Fragment> &chunk, DBSJob::MatchedChunk &matched) { print(chunk, matched.ids); } );
+        if (hit_stream)
+            hit_stream->close();
+        log_prefilter_stats();
         if (config.unique){
-            DBSJob * jptr;
             IO::Writer writer_u((!writer.filename.empty()) ? writer.filename + ".uniq" : "");
-            jptr->unique_hits.print_uniq_hits(writer_u);
+            unique_hits.print_uniq_hits(writer_u);
         }
     }
-
-    virtual void match_and_print_chunk(const std::vector<Reader::Fragment> &chunk, IO::Writer &writer, const Config &config)
-    {
-        Matcher m(hash_array, (int)kmer_len, config.unique);
-        TaxPrinter print(!hide_counts, false, writer, config.unique);
-        Job::match_and_print<Matcher, TaxPrinter, TaxMatchId>(chunk, print, m);
-    }
 };
@@ -28,10 +28,11 @@
 
 #include "aligns_to_dbs_job.h"
 #include "dbss.h"
+#include <sstream>
 
 struct DBSSJob : public DBSJob
 {
-    DBSSJob(const std::string &dbss, const std::string &dbss_tax_list, int num_threads)
+    DBSSJob(const std::string &dbss, const std::string &dbss_tax_list, int num_threads, KmerIndexType::Type index_type = KmerIndexType::BUCKET_TABLE)
     {
         auto dbss_reader = DBSS::make_reader(dbss);
         kmer_len = dbss_reader->header.kmer_len;
@@ -42,5 +43,25 @@ struct DBSSJob : public DBSJob
 
         auto tax_list = DBSS::load_tax_list(dbss_tax_list);
         DBSS::load_dbss(hash_array, dbss_reader, tax_list, annotation, num_threads);
+        hash_array_view = hash_array;
+
+        // the kmer array depends on the tax list, so every tax list has its own sidecar <dbss>.<fingerprint>.index,
+        // it is checked against the files the kmers were read from, which for a .dbss folder are the files inside it
+        const uint64_t tax_list_fingerprint = fingerprint(tax_list);
+        std::ostringstream index_file;
+        index_file << dbss << '.' << std::hex << tax_list_fingerprint << ".index";
+        auto data_files = dbss_reader->data_files(tax_list, annotation);
+        data_files.push_back(DBSS::DBSAnnot::annotation_filename(dbss));
+        create_index(index_type, index_file.str(), DBSIO::lookup_index_source(data_files, kmer_len, hash_array_view, tax_list_fingerprint));
+    }
+
+private:
+    static uint64_t fingerprint(const DBSS::TaxList &tax_list)
+    {
+        uint64_t h = 0xcbf29ce484222325;
+        for (auto tax_id : tax_list)
+            h = (h ^ uint64_t(tax_id)) * 0x100000001b3;
+
+        return h | 1; // 0 stands for no tax list
     }
 };
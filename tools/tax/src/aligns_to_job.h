@@ -30,64 +30,175 @@
 #include "config_align_to.h"
 #include <time.h>
 #include <thread>
+#include <memory>
 #include "log.h"
 #include "reader.h"
-#include "fasta_reader.h"
+#include "fastx_reader.h"
 #include "io.h"
+#include "ordered_pipeline.h"
+#include "kmer_filter.h"
+#include "omp_adapter.h"
+#include "hit_stream.h"
+#include "run_metrics.h"
+#include <chrono>
+#include <fstream>
+#include <atomic>
 
 struct Job
 {
 	virtual void run(const std::string &contig_filename, IO::Writer &writer, const Config &config) = 0;
-//    virtual void match_and_print_chunk(const std::vector<Reader::Fragment> &chunk, IO::Writer &writer);
 
-	template <class Matcher, class Printer, class MatchId>
-    static void match_and_print(const std::vector<Reader::Fragment> &chunk, Printer &print, Matcher &matcher)
+    // runs all input files of the config, output of a single file goes to out_stream if given and there is no -out
+    void run_files(const Config &config, std::ostream *out_stream = nullptr)
     {
-        std::vector<MatchId> matched_ids;
+        std::vector<RunMetrics> metrics; // of the files run successfully, written to -metrics file
+        if (config.parallel_inputs > 1 && config.contig_files.size() > 1)
+            run_files_interleaved(config, metrics);
+        else
+            for (auto &contig_file : config.contig_files)
+            {
+                RunMetrics file_metrics;
+                if (run_file(contig_file, config, out_stream, file_metrics))
+                    metrics.push_back(file_metrics);
+            }
+
+        if (!config.metrics.empty())
+        {
+            std::ofstream f(config.metrics);
+            RunMetrics::write_json(f, metrics);
+            if (!f)
+                throw std::runtime_error("failed to write metrics " + config.metrics);
+        }
+    }
+    // up to -parallel_inputs files are run at once, each by its own thread with its own reader and writer,
+    // and their chunks are matched by one worker pool in the order they are read, so no worker idles at the tail of a file
+    void run_files_interleaved(const Config &config, std::vector<RunMetrics> &metrics)
+    {
+        const std::vector<std::string> files(config.contig_files.begin(), config.contig_files.end());
+        std::vector<RunMetrics> file_metrics(files.size());
+        std::vector<char> succeeded(files.size(), false);
+        const int runners = std::min(config.parallel_inputs, (int)files.size());
+        LOG("running " << runners << " inputs at once");
+
+        WorkerPool pool(omp_get_max_threads());
+        std::atomic<size_t> next_file(0);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < runners; i++)
+            threads.emplace_back([&]
+            {
+                shared_pool() = &pool;
+                for (size_t f = next_file++; f < files.size(); f = next_file++)
+                    succeeded[f] = run_file(files[f], config, nullptr, file_metrics[f]);
+            });
+
+        for (auto &t : threads)
+            t.join();
+
+        for (size_t f = 0; f < files.size(); f++)
+            if (succeeded[f])
+                metrics.push_back(file_metrics[f]);
+    }
+
+    // false if the run failed, the failure of a single input is thrown
+    bool run_file(const std::string &contig_file, const Config &config, std::ostream *out_stream, RunMetrics &metrics)
+    {
+        LOG(contig_file);
+
+        const bool single = config.contig_files.size() == 1;
+        try
+        {
+            // an output which cannot be created fails this input only, it must not escape the threads of run_files_interleaved
+            std::unique_ptr<IO::Writer> writer;
+            if (single && config.out.empty() && out_stream)
+                writer = std::unique_ptr<IO::Writer>(new IO::Writer(*out_stream));
+            else
+                writer = std::unique_ptr<IO::Writer>(new IO::Writer(single ? config.out : contig_file + config.out));
+
+            auto before = std::chrono::steady_clock::now();
+            last_run_metrics() = RunMetrics();
+            run(contig_file, *writer, config);
+            metrics = last_run_metrics();
+            metrics.input = contig_file;
+            metrics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - before).count(); // with collation after the pipeline
+            return true;
+        }
+        catch (std::exception &e)
+        {
+            LOG(contig_file << " failed: " << e.what());
+            if (single)
+                throw;
+        }
+
+        return false;
+    }
+
+	template <class Matcher, class MatchId>
+    static void match(const std::vector<Reader::Fragment> &chunk, Matcher &matcher, std::vector<MatchId> &matched_ids)
+    {
+        matched_ids.clear();
         matched_ids.reserve(chunk.size()); // todo: tune
 
+        auto &counters = RunMetrics::local();
         for (size_t seq_id = 0; seq_id < chunk.size(); ++seq_id) 
         {
             // auto const &spotid = chunk[seq_id].spotid;
             auto const &bases = chunk[seq_id].bases;
+            counters.bases += bases.size();
             if (auto const m = matcher(bases)) {
                 matched_ids.emplace_back((int)seq_id, m);
             }
         }
 
-        #pragma omp critical (output)
-        {
-            print(chunk, matched_ids);
-        }
-    }     
+        counters.fragments += chunk.size();
+        counters.matched_fragments += matched_ids.size();
+    }
 
-    template <class MatchAndPrint>
-	static void run_for_matcher(const std::string &contig_filename, const std::string &spot_filter_file, bool unaligned_only, int ultrafast_skip_reader, size_t chunk_size, MatchAndPrint &&match_and_print)
+    // chunks are read by one thread, matched by omp_get_max_threads() workers and printed by one thread in input order
+    // match(chunk, matched) fills MatchedChunk, print(chunk, matched) consumes it, slots with both are recycled
+    // counters of the matching threads travel with their chunks and are summed by the printing thread
+    template <class MatchedChunk, class Match, class Print>
+	static void run_for_matcher(const std::string &contig_filename, const std::string &spot_filter_file, bool unaligned_only, int ultrafast_skip_reader, size_t chunk_size, int metrics_interval, Match &&match, Print &&print)
 	{
 		Progress progress;
+        RunMetrics metrics;
+        ThroughputLog throughput(metrics_interval);
         Reader::Params params;
         params.filter_file = spot_filter_file;
         params.ultrafast_skip_reader = ultrafast_skip_reader;
         params.unaligned_only = unaligned_only;
+        params.chunk_size = chunk_size; // read ahead chunks are handed over as is
         auto reader = Reader::create(contig_filename, params);
 
-        #pragma omp parallel
+        struct Slot
         {
             std::vector<Reader::Fragment> chunk;
-            bool done = false;
-            while (!done) {
-                #pragma omp critical (read)
-                {
-                    done = !reader->read_many(chunk, chunk_size);
-                    progress.report(reader->progress());
-                }
+            MatchedChunk matched;
+            RunMetrics::Counters counters;
+        };
 
-                match_and_print(chunk);
-            }
-
-        }
+        OrderedPipeline<Slot> pipeline(omp_get_max_threads(), 2, shared_pool());
+        pipeline.run(
+            [&](Slot &slot)
+            {
+                bool more = reader->read_many(slot.chunk, chunk_size);
+                progress.report(reader->progress());
+                return more;
+            },
+            [&](Slot &slot)
+            {
+                match(slot.chunk, slot.matched);
+                slot.counters = RunMetrics::take_local();
+            },
+            [&](Slot &slot)
+            {
+                print(slot.chunk, slot.matched);
+                metrics.counters.add(slot.counters);
+                throughput.report(metrics.counters);
+            });
 
         progress.report(1, true); // always report 100%, needed by pipeline for proper progress report
+        LOG("pipeline " << pipeline.stats.to_string());
+        metrics.set_stages(pipeline.stats);
 
         Reader::SourceStats total_stats;
         if (unaligned_only) {
@@ -97,7 +208,7 @@ struct Job
         
             Reader::Params total_params;
             total_params.thread_count = 0;
-            if (FastaReader::is_fasta(contig_filename)) {
+            if (FastxReader::is_fastx(contig_filename)) {
                 total_stats = unaligned_stats;
             } else {
                 total_stats = Reader::create(contig_filename, total_params)->stats();
@@ -108,11 +219,63 @@ struct Job
         
         LOG("total spot count: " << total_stats.spot_count);
         LOG("total read count: " << total_stats.read_count);
+        last_run_stats() = total_stats;
+        last_run_metrics() = metrics;
 	}
 
+    // stats of the last run_for_matcher called by this thread, read by the server after a run
+    static Reader::SourceStats &last_run_stats()
+    {
+        thread_local Reader::SourceStats stats;
+        return stats;
+    }
+
+    // pool matching the chunks of this thread's runs together with the chunks of other runs, set by run_files_interleaved
+    static WorkerPool *&shared_pool()
+    {
+        thread_local WorkerPool *pool = nullptr;
+        return pool;
+    }
+
+    // metrics of the last run_for_matcher called by this thread, written by run_files with -metrics
+    static RunMetrics &last_run_metrics()
+    {
+        thread_local RunMetrics metrics;
+        return metrics;
+    }
+
+    // binary hits written instead of text lines with -out_format binary|binary_zstd, null for text
+    static std::unique_ptr<HitStreamWriter> create_hit_stream(IO::Writer &writer, const Config &config)
+    {
+        if (!config.binary_out())
+            return nullptr;
+
+        return std::make_unique<HitStreamWriter>(writer.f(), !config.hide_counts, config.out_format == "binary_zstd");
+    }
+
 	virtual size_t db_kmers() const { return 0; }
     virtual ~Job() {}
 
+    std::unique_ptr<KmerBloomFilter> prefilter; // optional, matchers skip the search of kmers it rejects
+    bool resident = false; // db serves many runs, possibly at once, so runs do not release or change it
+
+    // builds prefilter from the database kmers, jobs without one run without prefilter
+    virtual void create_prefilter() { LOG("prefilter is not supported for this database type"); }
+
+    // stats of the last run_for_matcher called by this thread, so runs of a server or -parallel_inputs report their own
+    void log_prefilter_stats() const
+    {
+        if (!prefilter)
+            return;
+
+        auto &counters = last_run_metrics().counters;
+        KmerBloomFilter::Counts counts;
+        counts.lookups = counters.lookups;
+        counts.rejected = counters.prefilter_rejects;
+        counts.found = counters.kmer_hits;
+        KmerBloomFilter::log_stats(counts);
+    }
+
 private:
 	struct Progress
 	{
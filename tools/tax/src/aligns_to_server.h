@@ -0,0 +1,443 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <sstream>
+#include "aligns_to_job.h"
+
+// resident mode: aligns_to -server loads the database once and classifies runs sent by aligns_to -client over a unix socket
+// a client sends one byte, carrying its stdout descriptor when it has no -out, then its run options ended by "end"
+// the server answers with the stats of the run and "ok" or "error<tab><reason>" once the run is over
+// trust model: the server reads the inputs and writes the -out files of a run with its own permissions,
+// so only clients of the user running the server are served. the socket is created with mode 0600
+// and every connection is checked with the peer credentials of the socket
+namespace AlignsToSocket
+{
+    inline void write_all(int fd, const std::string &s)
+    {
+        for (size_t done = 0; done < s.size(); )
+        {
+            const ssize_t written = ::write(fd, s.data() + done, s.size() - done);
+            if (written < 0 && errno == EINTR)
+                continue;
+
+            if (written <= 0)
+                throw std::runtime_error("cannot write to socket");
+
+            done += written;
+        }
+    }
+
+    // line reader over a socket, lines are ended by '\n'
+    struct LineReader
+    {
+        int fd;
+        std::string buffer;
+
+        LineReader(int fd) : fd(fd) {}
+
+        bool read_line(std::string &line)
+        {
+            for (;;)
+            {
+                const auto end = buffer.find('\n');
+                if (end != std::string::npos)
+                {
+                    line = buffer.substr(0, end);
+                    buffer.erase(0, end + 1);
+                    return true;
+                }
+
+                char chunk[4096];
+                const ssize_t count = ::read(fd, chunk, sizeof(chunk));
+                if (count < 0 && errno == EINTR)
+                    continue;
+
+                if (count <= 0)
+                    return false;
+
+                buffer.append(chunk, count);
+            }
+        }
+    };
+
+    inline sockaddr_un address(const std::string &path)
+    {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error("socket path is too long: " + path);
+
+        memcpy(addr.sun_path, path.c_str(), path.size());
+        return addr;
+    }
+
+    // user of the process at the other end of a connected socket
+    inline uid_t peer_uid(int socket_fd)
+    {
+#ifdef __APPLE__
+        uid_t uid;
+        gid_t gid;
+        if (getpeereid(socket_fd, &uid, &gid) != 0)
+            throw std::runtime_error("cannot get socket peer credentials");
+
+        return uid;
+#else
+        ucred cred;
+        socklen_t size = sizeof(cred);
+        if (getsockopt(socket_fd, SOL_SOCKET, SO_PEERCRED, &cred, &size) != 0)
+            throw std::runtime_error("cannot get socket peer credentials");
+
+        return cred.uid;
+#endif
+    }
+
+    // the descriptor travels as SCM_RIGHTS ancillary data of the first byte, fd < 0 sends no descriptor
+    inline void send_first_byte(int socket_fd, int fd)
+    {
+        char byte = fd >= 0 ? 'F' : 'N';
+        iovec iov{&byte, 1};
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        if (fd >= 0)
+        {
+            memset(control, 0, sizeof(control));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        }
+
+        if (sendmsg(socket_fd, &msg, 0) != 1)
+            throw std::runtime_error("cannot write to socket");
+    }
+
+    // returns the received descriptor or -1
+    inline int receive_first_byte(int socket_fd)
+    {
+        char byte = 0;
+        iovec iov{&byte, 1};
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(socket_fd, &msg, 0) != 1)
+            throw std::runtime_error("cannot read from socket");
+
+        int fd = -1;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+                memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+        if ((byte == 'F') != (fd >= 0))
+        {
+            if (fd >= 0)
+                ::close(fd);
+            throw std::runtime_error("invalid request");
+        }
+
+        return fd;
+    }
+}
+
+struct AlignsToServer
+{
+    Job &job;
+    const Config &config;
+    int threads_per_run = 1;
+    std::atomic<size_t> run_count{0};
+
+    // at most server_jobs runs classify at once, the others wait in the order of arrival
+    std::mutex gate_mutex;
+    std::condition_variable gate;
+    size_t next_ticket = 0, serving_ticket = 0;
+    int running = 0;
+
+    AlignsToServer(Job &job, const Config &config) : job(job), config(config)
+    {
+        const int num_threads = config.num_threads > 0 ? config.num_threads : omp_get_max_threads();
+        threads_per_run = std::max(1, num_threads / config.server_jobs);
+        job.resident = true;
+    }
+
+    int serve()
+    {
+        signal(SIGPIPE, SIG_IGN); // clients going away must not stop the server
+
+        const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0)
+            throw std::runtime_error("cannot create socket");
+
+        struct stat socket_stat;
+        if (stat(config.server.c_str(), &socket_stat) == 0 && S_ISSOCK(socket_stat.st_mode))
+            unlink(config.server.c_str()); // left by a server which did not exit cleanly
+
+        auto addr = AlignsToSocket::address(config.server);
+        if (bind(listen_fd, (const sockaddr*)&addr, sizeof(addr)) != 0 || chmod(config.server.c_str(), S_IRUSR | S_IWUSR) != 0 || listen(listen_fd, 64) != 0)
+            throw std::runtime_error("cannot listen on socket " + config.server);
+
+        LOG("serving " << config.server << ", " << config.server_jobs << " runs at once with " << threads_per_run << " threads each");
+        for (;;)
+        {
+            const int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+
+                throw std::runtime_error("cannot accept connection on " + config.server);
+            }
+
+            std::thread([this, fd]() { serve_client(fd); }).detach();
+        }
+    }
+
+private:
+    void serve_client(int fd)
+    {
+        const size_t run_id = ++run_count;
+        int out_fd = -1;
+        std::string reply;
+        try
+        {
+            Config run_config = config;
+            run_config.contig_files.clear();
+            run_config.num_threads = threads_per_run;
+
+            if (AlignsToSocket::peer_uid(fd) != geteuid())
+                throw std::runtime_error("client is not run by the server user");
+
+            out_fd = AlignsToSocket::receive_first_byte(fd);
+            AlignsToSocket::LineReader reader(fd);
+            std::string line;
+            bool complete = false;
+            while (!complete && reader.read_line(line))
+            {
+                if (line == "end")
+                {
+                    complete = true;
+                    break;
+                }
+
+                const auto tab = line.find('\t');
+                if (tab == std::string::npos)
+                    throw std::runtime_error("invalid request line " + line);
+
+                run_config.read_run_option(line.substr(0, tab), line.substr(tab + 1));
+            }
+
+            if (!complete)
+                throw std::runtime_error("incomplete request");
+
+            if (run_config.contig_files.empty())
+                throw std::runtime_error("no input files");
+
+            reply = run(run_id, run_config, out_fd);
+            reply += "ok\n";
+        }
+        catch (std::exception &e)
+        {
+            LOG("run " << run_id << " failed: " << e.what());
+            reply = std::string("error\t") + e.what() + "\n";
+        }
+
+        if (out_fd >= 0)
+            ::close(out_fd);
+
+        try
+        {
+            AlignsToSocket::write_all(fd, reply);
+        }
+        catch (std::exception &e)
+        {
+            LOG("run " << run_id << ": " << e.what());
+        }
+
+        ::close(fd);
+    }
+
+    // returns the stats lines of the reply
+    std::string run(size_t run_id, const Config &run_config, int out_fd)
+    {
+        std::unique_lock<std::mutex> lock(gate_mutex);
+        const size_t ticket = next_ticket++;
+        gate.wait(lock, [&]() { return ticket == serving_ticket && running < run_config.server_jobs; });
+        serving_ticket++;
+        running++;
+        lock.unlock();
+        gate.notify_all();
+
+        LOG("run " << run_id << " started: " << run_config.contig_files.front() << (run_config.contig_files.size() > 1 ? " ..." : ""));
+        const auto before = std::chrono::steady_clock::now();
+        Reader::SourceStats total;
+        std::string error;
+        try
+        {
+            omp_set_num_threads(threads_per_run); // per thread setting, every run has its own share of the threads
+            IO::FdOutBuf out_buf(out_fd);
+            std::ostream out(&out_buf);
+            Job::last_run_stats() = Reader::SourceStats();
+            job.run_files(run_config, out_fd >= 0 ? &out : nullptr);
+            out.flush();
+            total = Job::last_run_stats();
+        }
+        catch (std::exception &e)
+        {
+            error = e.what();
+        }
+
+        lock.lock();
+        running--;
+        lock.unlock();
+        gate.notify_all();
+
+        if (!error.empty())
+            throw std::runtime_error(error);
+
+        const auto seconds = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - before).count();
+        LOG("run " << run_id << " done in " << seconds << " sec, spots " << total.spot_count << ", reads " << total.read_count);
+
+        std::ostringstream stats;
+        stats << "spots\t" << total.spot_count << "\n" << "reads\t" << total.read_count << "\n" << "seconds\t" << seconds << "\n";
+        return stats.str();
+    }
+};
+
+struct AlignsToClient
+{
+    Config config;
+
+    AlignsToClient(const Config &config) : config(config)
+    {
+        // the server resolves paths in its own working directory and reads its own stdin, only stdout of the client is passed
+        for (auto &contig_file : this->config.contig_files)
+        {
+            if (contig_file == "stdin")
+                throw std::runtime_error("stdin input is not supported with -client, please pass a file");
+
+            contig_file = absolute_if_exists(contig_file);
+        }
+
+        this->config.spot_filter_file = absolute_if_exists(config.spot_filter_file);
+        if (config.contig_files.size() == 1 && !config.out.empty() && config.out[0] != '/') // for many files out is a postfix
+            this->config.out = current_dir() + "/" + config.out;
+    }
+
+    int run()
+    {
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            throw std::runtime_error("cannot create socket");
+
+        auto addr = AlignsToSocket::address(config.client);
+        if (connect(fd, (const sockaddr*)&addr, sizeof(addr)) != 0)
+            throw std::runtime_error("cannot connect to aligns_to server at " + config.client);
+
+        std::cout.flush();
+        std::ostringstream request;
+        config.write_run_options(request);
+        request << "end\n";
+        AlignsToSocket::send_first_byte(fd, config.out.empty() ? STDOUT_FILENO : -1);
+        AlignsToSocket::write_all(fd, request.str());
+
+        AlignsToSocket::LineReader reader(fd);
+        std::string line;
+        int result = 1;
+        while (reader.read_line(line))
+        {
+            const auto tab = line.find('\t');
+            const std::string key = line.substr(0, tab), value = tab == std::string::npos ? "" : line.substr(tab + 1);
+            if (key == "ok")
+                result = 0;
+            else if (key == "error")
+            {
+                LOG("server error: " << value);
+            }
+            else if (key == "spots")
+            {
+                LOG("total spot count: " << value);
+            }
+            else if (key == "reads")
+            {
+                LOG("total read count: " << value);
+            }
+            else if (key == "seconds")
+            {
+                LOG("server run time (sec) " << value);
+            }
+        }
+
+        ::close(fd);
+        if (result != 0)
+            LOG("run failed");
+
+        return result;
+    }
+
+private:
+    static std::string current_dir()
+    {
+        char buffer[PATH_MAX];
+        if (!getcwd(buffer, sizeof(buffer)))
+            throw std::runtime_error("cannot get current directory");
+
+        return buffer;
+    }
+
+    // accessions stay as they are
+    static std::string absolute_if_exists(const std::string &path)
+    {
+        char buffer[PATH_MAX];
+        if (path.empty() || !realpath(path.c_str(), buffer))
+            return path;
+
+        return buffer;
+    }
+};
@@ -24,39 +24,14 @@
 *
 */
 #include <string>
-#include <fstream>
 #include <iostream>
-#include <algorithm>
-#include <vector>
-#include "dbs.h"
-#include "hash.h"
+#include "dbs_set_ops.h"
 #include "config_db_binary_op.h"
 
-bool in_db(hash_t hash, const std::vector<hash_t> &db)
-{
-	return std::binary_search(db.begin(), db.end(), hash);
-}
-
 int main(int argc, char const *argv[])
 {
 	Config config(argc, argv);
 
-	std::vector<hash_t> db_a, db_b;
-	int kmer_len_a = DBSIO::load_dbs(config.db_a, db_a);
-	int kmer_len_b = DBSIO::load_dbs(config.db_b, db_b);
-
-    if (kmer_len_a != kmer_len_b)
-    {
-        std::cerr << "kmer_len_a != kmer_len_b" << std::endl;
-        return 1;
-    }
-
-	std::vector<hash_t> db_c;
-    db_c.reserve(std::min(db_a.size(), db_b.size()));
-
-	for (auto kmer : db_a)
-        if (in_db(kmer, db_b))
-    		db_c.push_back(kmer);
-
-	DBSIO::save_dbs(config.db_c, db_c, kmer_len_a);
+	auto inputs = DBSSetOps::open({config.db_a, config.db_b});
+	DBSSetOps::save(DBSSetOps::INTERSECTION, inputs, config.db_c, config.threads);
 }
@@ -0,0 +1,52 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+
+// read-only non-owning view of a contiguous array, e.g. std::vector or memory mapped file
+template <class C>
+struct ArrayView
+{
+    typedef C value_type;
+    typedef const C *const_iterator;
+
+    const C *first = nullptr;
+    size_t count = 0;
+
+    ArrayView() = default;
+    ArrayView(const C *first, size_t count) : first(first), count(count) {}
+    ArrayView(const std::vector<C> &v) : first(v.data()), count(v.size()) {}
+
+    const C *begin() const { return first; }
+    const C *end() const { return first + count; }
+    const C *data() const { return first; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const C &operator [] (size_t i) const { return first[i]; }
+};
@@ -31,6 +31,7 @@
 #include <iostream>
 #include <unordered_set>
 #include "checksum.h"
+#include "seq_encoder.h"
 #include "log.h"
 
 
@@ -130,6 +131,21 @@ private:
     ReaderType reader;
     Fragment last;
     size_t offset;
+    std::vector<Fragment> batch; // source fragments are taken with read_many, so parallel readers keep their speed
+    size_t batch_idx = 0;
+
+    static const size_t SOURCE_BATCH_SIZE = 4096; // todo: tune
+
+    bool read_source(Fragment& output) {
+        if (batch_idx >= batch.size()) {
+            batch_idx = 0;
+            if (!reader.read_many(batch, SOURCE_BATCH_SIZE)) {
+                return false;
+            }
+        }
+        std::swap(output, batch[batch_idx++]);
+        return true;
+    }
 
 #if AUX_READER_LOG_CHECKSUM
     CheckSum checksum;
@@ -145,7 +161,7 @@ public:
     virtual bool read(Fragment* output) override {
         while (true) {
             if (offset >= last.bases.size()) {
-                if (!reader.read(&last)) {
+                if (!read_source(last)) {
 #if AUX_READER_LOG_CHECKSUM
                     checksum.log();
 #endif
@@ -158,7 +174,8 @@ public:
                 offset = 0;
             }
             auto from = std::find_if(last.bases.begin() + offset, last.bases.end(), is_actg);
-            auto to = std::find_if(from, last.bases.end(), non_actg);
+            const size_t from_pos = from - last.bases.begin();
+            auto to = from + SeqEncoder::find_invalid(last.bases.data() + from_pos, last.bases.size() - from_pos);
             if (from == last.bases.begin() && to == last.bases.end()) {
                 if (output) {
 #if AUX_READER_NO_BASES
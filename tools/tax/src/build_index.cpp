@@ -37,6 +37,9 @@
 #include "config_build_index.h"
 #include "file_list_loader.h"
 #include "build_index.h"
+#include "ordered_pipeline.h"
+#include "kmer_tax_table.h"
+#include "dbss.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -80,26 +83,90 @@ int main(int argc, char const *argv[])
 	TaxIdTree tax_id_tree;
 	TaxIdTreeLoader::load_tax_id_tree(tax_id_tree, config.tax_parents_file);
 
-	Kmers kmers(tax_id_tree);
+	const int threads = config.threads > 0 ? config.threads : omp_get_max_threads();
+	KmerTaxBuilder kmers(tax_id_tree, config.kmer_len, config.spill_folder);
 	size_t total_size = 0;
-	for (auto &file_list_element : file_list.files)
+
+	// files are processed and their kmers are added concurrently, progress is reported in the file list order
+	struct Slot
+	{
+		size_t file_index = 0;
+		int window_size = 0, tax_id = 0;
+		size_t file_size = 0;
+	};
+
+	size_t next_file = 0;
+	if (!file_list.files.empty())
+	{
+		OrderedPipeline<Slot> pipeline(threads, 1);
+		pipeline.run(
+			[&](Slot &slot)
+			{
+				auto &file_list_element = file_list.files[next_file];
+				slot.file_index = next_file++;
+				slot.window_size = calculate_window_size(file_list_element.filesize, FilenameMeta::is_eukaryota(file_list_element.filename), FilenameMeta::is_virus(file_list_element.filename), config.window_divider, config.min_window_size);
+				slot.tax_id = FilenameMeta::tax_id_from(file_list_element.filename);
+				return next_file < file_list.files.size();
+			},
+			[&](Slot &slot)
+			{
+				auto &file_list_element = file_list.files[slot.file_index];
+				std::vector<std::string> summary;
+				slot.file_size = BuildIndex::add_kmers(file_list_element.filename, BuildIndex::VariableWindowSize(slot.window_size, config.min_window_size, config.min_kmers_per_seq), config.kmer_len, summary, [&](hash_t kmer){ kmers.add_kmer(kmer, slot.tax_id); });
+			},
+			[&](Slot &slot)
+			{
+				auto &file_list_element = file_list.files[slot.file_index];
+				LOG(file_list_element.filesize << "\t" << slot.window_size << "\t" << slot.tax_id << "\t" << file_list_element.filename);
+				total_size += slot.file_size;
+
+				auto seconds_past = std::chrono::duration_cast<std::chrono::seconds>( high_resolution_clock::now() - before ).count();
+				if (seconds_past < 1)
+					seconds_past = 1;
+
+				size_t megs = total_size/1000000;
+				auto kmer_count = kmers.size();
+				LOG("processed size " << megs << "M = " << (total_size/1000)/seconds_past << "K/sec, kmers: " << kmer_count/1000 << "K, compression rate " << total_size/std::max(size_t(1), weight(kmer_count)));
+			});
+	}
+
+	if (config.dbs.empty() && config.dbss.empty())
+		kmers.write_shards(threads, [&](const std::vector<DBS::KmerTax> &shard)
+		{
+			for (auto &k : shard)
+				std::cout << KmerIO::str_kmer(k.kmer, config.kmer_len) << '\t' << k.tax_id << std::endl;
+		});
+	else
 	{
-		auto window_size = calculate_window_size(file_list_element.filesize, FilenameMeta::is_eukaryota(file_list_element.filename), FilenameMeta::is_virus(file_list_element.filename), config.window_divider, config.min_window_size);
-		auto tax_id = FilenameMeta::tax_id_from(file_list_element.filename);
-		LOG(file_list_element.filesize << "\t" << window_size << "\t" << tax_id << "\t" << file_list_element.filename);
-		std::vector<std::string> summary;
-		total_size += BuildIndex::add_kmers(file_list_element.filename, BuildIndex::VariableWindowSize(window_size, config.min_window_size, config.min_kmers_per_seq), config.kmer_len, summary, [&](hash_t kmer){ kmers.add_kmer(kmer, tax_id); });
+		// the .dbss is scattered from the .dbs, which is then temporary if only the .dbss is asked for
+		const string dbs = config.dbs.empty() ? config.dbss + ".tmp.dbs" : config.dbs;
+		size_t kmer_count = 0;
 		{
-			auto seconds_past = std::chrono::duration_cast<std::chrono::seconds>( high_resolution_clock::now() - before ).count();
-			if (seconds_past < 1)
-				seconds_past = 1;
+			DBSIO::DBSWriter<DBS::KmerTax> writer(dbs, config.kmer_len);
+			kmers.write_shards(threads, [&](const std::vector<DBS::KmerTax> &shard) { writer.append(shard); });
+			writer.close();
+			kmer_count = writer.count;
+		}
+		LOG(kmer_count << " kmers saved to " << dbs);
 
-			size_t megs = total_size/1000000;
-			LOG("processed size " << megs << "M = " << (total_size/1000)/seconds_past << "K/sec, kmers: " << kmers.storage.size()/1000 << "K, compression rate " << total_size/std::max(size_t(1), weight(kmers.storage.size())));
+		if (!config.dbs.empty())
+		{
+			IO::MappedFile mapping;
+			ArrayView<DBS::KmerTax> saved;
+			DBSIO::map_dbs(dbs, mapping, saved, IO::MappedFile::PREFETCH_NONE);
+			KmerBucketIndex lookup_table;
+			lookup_table.build(saved, config.kmer_len);
+			DBSIO::save_lookup_index(dbs + ".index", DBSIO::lookup_index_source(dbs, config.kmer_len, saved), lookup_table, nullptr);
 		}
-	}
 
-	KmerIO::print_kmers(kmers, config.kmer_len);
+		if (!config.dbss.empty())
+		{
+			DBSS::save_dbss_from_dbs(dbs, config.dbss);
+			LOG("dbss saved to " << config.dbss);
+			if (config.dbs.empty())
+				std::remove(dbs.c_str());
+		}
+	}
 
 	LOG("total time (min) " << std::chrono::duration_cast<std::chrono::minutes>( high_resolution_clock::now() - before ).count());
 }
@@ -27,6 +27,9 @@
 #pragma once
 
 #include <array>
+#include <limits>
+#include <stdexcept>
+#include <thread>
 #include <iostream>
 #include "omp_adapter.h"
 //#include "kmers.h"
@@ -53,83 +56,94 @@ struct BuildIndex
         }
     };
 
-    template <class Lambda>
-    static void process_window(const char *s, int len, int kmer_len, Lambda &&add_kmer)
+    // minimum hash kmer of each window, windows of a clean string follow each other
+    // so the kmer is rolled from the previous window instead of being rebuilt at every position
+    class WindowMinimizer
     {
-        if (len < kmer_len)
-            return;
-
-#if SINGLETHREADED_BUILD_INDEX
-        const int THREADS = 1;
-#else
-        const int THREADS = 32;
-#endif
-
-        struct ThreadFinding
+        const char *s;
+        const int kmer_len;
+        const hash_t mask;
+        const int complement_shift;
+        hash_t forward = 0, reverse = 0;
+        int end = -1; // the rolled kmer ends before s[end]
+
+        void push(char ch)
         {
-            KmerHash::hash_of_hash_t min_hash;
-            int has_kmer_pos, min_hash_pos;
-            ThreadFinding() : min_hash(std::numeric_limits<size_t>::max()), has_kmer_pos(-1), min_hash_pos(-1){}
-        };
+            const hash_t code = (ch >> 1) & 3; // same coding as Hash::update_hash
+            forward = ((forward << 2) | code) & mask;
+            reverse = (reverse >> 2) | ((code ^ 2) << complement_shift);
+        }
 
-        std::array<ThreadFinding, THREADS> thread_findings;
-        bool has_kmer_found = false;
+        void restart(int from)
+        {
+            forward = reverse = 0;
+            for (end = from; end < from + kmer_len - 1; end++)
+                push(s[end]);
+        }
 
+    public:
 #if SINGLETHREADED_BUILD_INDEX
-        for (int i = 0; !has_kmer_found && i <= len - kmer_len; i++)
-        {
-            auto thread_id = 0;
+        static const int TIE_STRIDE = 1;
 #else
-        #pragma omp parallel num_threads(THREADS)
-        for (int i = omp_get_thread_num(); !has_kmer_found && i <= len - kmer_len; i += omp_get_num_threads())
-        {
-            auto thread_id = omp_get_thread_num();
+        static const int TIE_STRIDE = 32; // equal hashes are resolved like the former scan of a window by 32 threads did
 #endif
-            hash_t kmer = KmerIO::kmer_from(s, i, kmer_len);
-            kmer = seq_transform<hash_t>::min_hash_variant(kmer, kmer_len);
 
-            auto h = KmerHash::hash_of(kmer); // todo: can be optimized
+        WindowMinimizer(const char *s, int kmer_len) : s(s), kmer_len(kmer_len),
+            mask(kmer_len >= 32 ? ~hash_t(0) : (hash_t(1) << (2 * kmer_len)) - 1),
+            complement_shift(2 * (kmer_len - 1)) {}
 
-            if (h < thread_findings[thread_id].min_hash)
-            {
-                thread_findings[thread_id].min_hash = h;
-                thread_findings[thread_id].min_hash_pos = i;
-            }
-        }
+        // calls add_kmer(kmer, position) for the kmer starting in [from, to - kmer_len] with the lowest hash
+        template <class Lambda>
+        void process_window(int from, int to, Lambda &&add_kmer)
+        {
+            if (to - from < kmer_len)
+                return;
 
-        int chosen_kmer_pos = -1;
+            if (end != from + kmer_len - 1)
+                restart(from);
 
-        {
-            auto min_hash = thread_findings[0].min_hash;
-            int min_hash_pos = thread_findings[0].min_hash_pos;
+            auto min_hash = std::numeric_limits<KmerHash::hash_of_hash_t>::max();
+            int min_hash_pos = -1, min_hash_tie = TIE_STRIDE;
+            hash_t min_kmer = 0;
 
-            for (int i = 1; i < THREADS; i++)
-                if (thread_findings[i].min_hash < min_hash)
+            for (int i = from; i <= to - kmer_len; i++)
+            {
+                push(s[end++]);
+                const hash_t kmer = std::min(forward, reverse);
+                const auto h = KmerHash::hash_of(kmer);
+                const int tie = (i - from) % TIE_STRIDE;
+                if (h < min_hash || (h == min_hash && tie < min_hash_tie))
                 {
-                    min_hash = thread_findings[i].min_hash;
-                    min_hash_pos = thread_findings[i].min_hash_pos;
+                    min_hash = h;
+                    min_hash_pos = i;
+                    min_hash_tie = tie;
+                    min_kmer = kmer;
                 }
+            }
 
-            chosen_kmer_pos = min_hash_pos;
-
-            if (chosen_kmer_pos < 0)
+            if (min_hash_pos < 0)
                 throw std::runtime_error("cannot find min hash");
+
+            add_kmer(min_kmer, min_hash_pos);
         }
+    };
 
-        hash_t kmer = KmerIO::kmer_from(s, chosen_kmer_pos, kmer_len);
-        kmer = seq_transform<hash_t>::min_hash_variant(kmer, kmer_len);
-        add_kmer(kmer, chosen_kmer_pos);
+    template <class Lambda>
+    static void process_window(const char *s, int len, int kmer_len, Lambda &&add_kmer)
+    {
+        WindowMinimizer(s, kmer_len).process_window(0, len, add_kmer);
     }
 
     template <class Lambda>
     static size_t process_clean_string(p_string p_str, int window_size, int kmer_len, Lambda &&add_kmer)
     {
+        WindowMinimizer minimizer(p_str.s, kmer_len);
         size_t win_proc = 0;
         for (int start = 0; start <= p_str.len - window_size; start += window_size) // todo: check for integer overflows on very long sequences
         {
             int from = std::max(0, start - (kmer_len - 1));
             int to = std::min(start + window_size, p_str.len);
-            process_window(p_str.s + from, to - from, kmer_len, [&](hash_t kmer, int offset) { add_kmer(kmer, offset + from); } );
+            minimizer.process_window(from, to, add_kmer);
             win_proc++;
         }
         return win_proc;
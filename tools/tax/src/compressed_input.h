@@ -0,0 +1,591 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <stdexcept>
+#include <exception>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "omp_adapter.h"
+
+// byte stream of an input file, decompressed on the fly if needed
+// compression is recognized by magic bytes, so compressed stdin works as well
+class InputStream
+{
+public:
+    virtual ~InputStream() {}
+
+    // reads up to size bytes, returns 0 at eof
+    virtual size_t read(char *buffer, size_t size) = 0;
+
+    // [0-1] position in the source file, i.e. the compressed offset for compressed input
+    virtual float progress() const = 0;
+
+    // opens filename or "stdin", thread_count threads are used to decompress bgzf blocks and zstd frames
+    static std::unique_ptr<InputStream> open(const std::string &filename, int thread_count);
+
+    static std::string strip_compression_extension(const std::string &filename)
+    {
+        for (auto ext : {".gz", ".bgz", ".zst"})
+            if (ends_with(filename, ext))
+                return filename.substr(0, filename.size() - strlen(ext));
+
+        return filename;
+    }
+
+private:
+    static bool ends_with(const std::string &s, const std::string &end)
+    {
+        if (end.size() > s.size()) 
+            return false;
+
+        return std::equal(end.rbegin(), end.rend(), s.rbegin());
+    }
+};
+
+typedef std::unique_ptr<InputStream> InputStreamPtr;
+
+// plain file or stdin, first bytes can be peeked before reading
+class FileInput final: public InputStream
+{
+    int fd = -1;
+    size_t filesize = 0, offset = 0;
+    std::vector<char> peeked;
+    size_t peeked_pos = 0;
+
+    size_t read_fd(char *buffer, size_t size)
+    {
+        while (true)
+        {
+            auto bytes = ::read(fd, buffer, size);
+            if (bytes >= 0)
+                return size_t(bytes);
+
+            if (errno != EINTR)
+                throw std::runtime_error(std::string("failed to read input: ") + strerror(errno));
+        }
+    }
+
+public:
+    FileInput(const std::string &filename)
+    {
+        if (filename == "stdin")
+        {
+            fd = STDIN_FILENO;
+            return;
+        }
+
+        fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error(std::string("cannot open the file: ") + filename);
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode))
+            filesize = file_stat.st_size;
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+
+    ~FileInput()
+    {
+        if (fd != STDIN_FILENO)
+            ::close(fd);
+    }
+
+    FileInput(const FileInput &) = delete;
+    FileInput &operator = (const FileInput &) = delete;
+
+    // first size bytes of the file (less if the file is shorter), must be called before read
+    const std::vector<char> &peek(size_t size)
+    {
+        while (peeked.size() < size)
+        {
+            size_t have = peeked.size();
+            peeked.resize(size);
+            auto bytes = read_fd(peeked.data() + have, size - have);
+            peeked.resize(have + bytes);
+            if (bytes == 0)
+                break;
+        }
+
+        return peeked;
+    }
+
+    size_t read(char *buffer, size_t size) override
+    {
+        size_t bytes = 0;
+        if (peeked_pos < peeked.size())
+        {
+            bytes = std::min(size, peeked.size() - peeked_pos);
+            memcpy(buffer, peeked.data() + peeked_pos, bytes);
+            peeked_pos += bytes;
+        }
+        else
+            bytes = read_fd(buffer, size);
+
+        offset += bytes;
+        return bytes;
+    }
+
+    float progress() const override
+    {
+        return filesize ? std::min(1.0f, float(offset) / filesize) : 0;
+    }
+};
+
+// gzip or zlib stream (possibly of several members), decompressed sequentially
+class GzipInput final: public InputStream
+{
+    std::unique_ptr<FileInput> source;
+    std::vector<char> in;
+    z_stream stream;
+    bool stream_ended = false, source_eof = false;
+
+public:
+    static const size_t IN_SIZE = 1024 * 1024;
+
+    GzipInput(std::unique_ptr<FileInput> &&source) : source(std::move(source)), in(IN_SIZE)
+    {
+        memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, 15 + 32) != Z_OK) // 32: gzip or zlib header is detected
+            throw std::runtime_error("inflateInit2 failed");
+    }
+
+    ~GzipInput()
+    {
+        inflateEnd(&stream);
+    }
+
+    size_t read(char *buffer, size_t size) override
+    {
+        stream.next_out = (Bytef*)buffer;
+        stream.avail_out = (uInt)std::min(size, size_t(UINT32_MAX));
+        const size_t avail_out = stream.avail_out;
+
+        while (stream.avail_out == avail_out) // until anything is produced
+        {
+            if (stream.avail_in == 0)
+            {
+                if (source_eof)
+                    break;
+
+                stream.next_in = (Bytef*)in.data();
+                stream.avail_in = (uInt)source->read(in.data(), in.size());
+                if (stream.avail_in == 0)
+                {
+                    source_eof = true;
+                    if (!stream_ended)
+                        throw std::runtime_error("gzip input is truncated");
+                    break;
+                }
+            }
+
+            if (stream_ended) // next member of concatenated gzip
+            {
+                inflateReset(&stream);
+                stream_ended = false;
+            }
+
+            auto ret = inflate(&stream, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END)
+                stream_ended = true;
+            else if (ret != Z_OK && ret != Z_BUF_ERROR)
+                throw std::runtime_error(std::string("gzip input is corrupted: ") + (stream.msg ? stream.msg : std::to_string(ret)));
+        }
+
+        return avail_out - stream.avail_out;
+    }
+
+    float progress() const override { return source->progress(); }
+};
+
+// input made of independent compressed blocks, batches of blocks are decompressed by thread_count omp threads
+class BlockInput: public InputStream
+{
+protected:
+    struct Block
+    {
+        size_t offset = 0, size = 0; // compressed data in raw
+        std::vector<char> out;
+    };
+
+    // size of the complete block at data, 0 if more data is needed
+    virtual size_t block_size(const char *data, size_t size) const = 0;
+
+    // decompresses block into block.out, called concurrently
+    virtual void decode(const char *data, Block &block) const = 0;
+
+    // called instead of decode_batch while the block at raw_begin does not fit into max_raw_size, decodes its next part into block.out
+    virtual void decode_oversized(Block &)
+    {
+        throw std::runtime_error("compressed block is too large");
+    }
+
+    bool oversized = false; // set by decode_batch, cleared by decode_oversized at the end of the block
+
+    std::unique_ptr<FileInput> source;
+    std::vector<char> raw;
+    size_t raw_begin = 0, raw_end = 0;
+    bool source_eof = false;
+
+    // reads more compressed data into raw, returns false if nothing was read
+    bool fill_raw()
+    {
+        if (source_eof)
+            return false;
+
+        if (raw_begin > 0)
+        {
+            memmove(raw.data(), raw.data() + raw_begin, raw_end - raw_begin);
+            raw_end -= raw_begin;
+            raw_begin = 0;
+        }
+
+        if (raw_end == raw.size())
+        {
+            if (raw.size() >= max_raw_size)
+                return false;
+
+            raw.resize(std::min(raw.size() * 2, max_raw_size));
+        }
+
+        size_t bytes = source->read(raw.data() + raw_end, raw.size() - raw_end);
+        raw_end += bytes;
+        source_eof = bytes == 0;
+        return bytes > 0;
+    }
+
+public:
+    static const size_t RAW_SIZE = 8 * 1024 * 1024; // compressed bytes decoded in one batch
+    static const size_t MAX_RAW_SIZE = 64 * 1024 * 1024; // largest block decoded as a whole
+
+    BlockInput(std::unique_ptr<FileInput> &&source, int thread_count, size_t max_raw_size = MAX_RAW_SIZE)
+        : source(std::move(source))
+        , raw(max_raw_size < RAW_SIZE ? max_raw_size : RAW_SIZE)
+        , max_raw_size(max_raw_size)
+        , thread_count(std::max(1, thread_count))
+    {}
+
+    size_t read(char *buffer, size_t size) override
+    {
+        while (current >= block_count || current_pos >= blocks[current].out.size())
+        {
+            if (current < block_count)
+            {
+                current++;
+                current_pos = 0;
+                continue;
+            }
+
+            if (!decode_batch())
+                return 0;
+        }
+
+        auto &out = blocks[current].out;
+        size_t bytes = std::min(size, out.size() - current_pos);
+        memcpy(buffer, out.data() + current_pos, bytes);
+        current_pos += bytes;
+        return bytes;
+    }
+
+    float progress() const override { return source->progress(); }
+
+private:
+    const size_t max_raw_size;
+    const int thread_count;
+    std::vector<Block> blocks;
+    size_t block_count = 0, current = 0, current_pos = 0;
+
+    // returns false at eof
+    bool decode_batch()
+    {
+        block_count = current = current_pos = 0;
+        if (oversized)
+        {
+            blocks.resize(std::max(blocks.size(), size_t(1)));
+            decode_oversized(blocks[0]);
+            block_count = 1;
+            return true;
+        }
+
+        while (true)
+        {
+            size_t size = raw_begin < raw_end ? block_size(raw.data() + raw_begin, raw_end - raw_begin) : 0;
+            if (size > 0)
+            {
+                if (block_count == blocks.size())
+                    blocks.resize(blocks.size() + 1);
+
+                blocks[block_count].offset = raw_begin;
+                blocks[block_count].size = size;
+                block_count++;
+                raw_begin += size;
+                continue;
+            }
+
+            if (block_count > 0) // collected blocks point into raw
+                break;
+
+            if (!fill_raw())
+            {
+                if (raw_begin == raw_end && source_eof)
+                    return false;
+
+                if (source_eof)
+                    throw std::runtime_error("compressed input is truncated");
+
+                oversized = true;
+                return decode_batch();
+            }
+        }
+
+        std::exception_ptr error;
+        const int count = (int)block_count;
+        #pragma omp parallel for num_threads(thread_count) schedule(dynamic) if(thread_count > 1 && count > 1)
+        for (int i = 0; i < count; i++)
+        {
+            try
+            {
+                decode(raw.data() + blocks[i].offset, blocks[i]);
+            }
+            catch (...)
+            {
+                #pragma omp critical (block_input_error)
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+
+        if (error)
+            std::rethrow_exception(error);
+
+        return true;
+    }
+};
+
+// BGZF (blocked gzip, as produced by bgzip): every block is a gzip member of up to 64KB with its size in the header
+class BgzfInput final: public BlockInput
+{
+    static const size_t HEADER_SIZE = 18, FOOTER_SIZE = 8;
+
+    static unsigned read16(const char *p) { return (unsigned char)p[0] | ((unsigned char)p[1] << 8); }
+    static uint32_t read32(const char *p) { return read16(p) | (uint32_t(read16(p + 2)) << 16); }
+
+public:
+    BgzfInput(std::unique_ptr<FileInput> &&source, int thread_count) : BlockInput(std::move(source), thread_count) {}
+
+    // checks gzip header for the BC extra subfield
+    static bool is_bgzf(const char *header, size_t size)
+    {
+        return size >= HEADER_SIZE && (unsigned char)header[0] == 0x1f && (unsigned char)header[1] == 0x8b && header[2] == 8 && (header[3] & 4) && 
+            read16(header + 10) == 6 && header[12] == 'B' && header[13] == 'C' && read16(header + 14) == 2;
+    }
+
+protected:
+    size_t block_size(const char *data, size_t size) const override
+    {
+        if (size < HEADER_SIZE)
+            return 0;
+
+        if (!is_bgzf(data, size))
+            throw std::runtime_error("invalid bgzf block header");
+
+        size_t block_size = read16(data + 16) + 1;
+        return block_size <= size ? block_size : 0;
+    }
+
+    void decode(const char *data, Block &block) const override
+    {
+        if (block.size < HEADER_SIZE + FOOTER_SIZE)
+            throw std::runtime_error("invalid bgzf block size");
+
+        const char *footer = data + block.size - FOOTER_SIZE;
+        const uint32_t crc = read32(footer), out_size = read32(footer + 4);
+        block.out.resize(out_size);
+
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, -15) != Z_OK) // raw deflate data between header and footer
+            throw std::runtime_error("inflateInit2 failed");
+
+        Bytef empty; // inflate rejects a null output buffer, which an empty block (bgzip eof marker) has
+        stream.next_in = (Bytef*)(data + HEADER_SIZE);
+        stream.avail_in = uInt(block.size - HEADER_SIZE - FOOTER_SIZE);
+        stream.next_out = out_size ? (Bytef*)block.out.data() : &empty;
+        stream.avail_out = out_size;
+        auto ret = inflate(&stream, Z_FINISH);
+        inflateEnd(&stream);
+
+        if (ret != Z_STREAM_END || stream.avail_out != 0)
+            throw std::runtime_error("bgzf block is corrupted");
+
+        if (crc32(crc32(0, Z_NULL, 0), (const Bytef*)block.out.data(), out_size) != crc)
+            throw std::runtime_error("bgzf block crc mismatch");
+    }
+};
+
+#if HAVE_ZSTD
+// zstd stream of one or more frames, frames are decompressed in parallel
+// a frame larger than max_raw_size (e.g. single frame files written by zstd cli) is decompressed sequentially
+class ZstdInput final: public BlockInput
+{
+    struct DStreamDeleter
+    {
+        void operator() (ZSTD_DStream *stream) const { ZSTD_freeDStream(stream); }
+    };
+    typedef std::unique_ptr<ZSTD_DStream, DStreamDeleter> DStreamPtr;
+
+    DStreamPtr oversized_stream;
+    static const size_t OVERSIZED_OUT_SIZE = 16 * 1024 * 1024;
+
+    static ZSTD_DStream *thread_stream()
+    {
+        thread_local DStreamPtr stream(ZSTD_createDStream());
+        if (!stream)
+            throw std::runtime_error("ZSTD_createDStream failed");
+
+        ZSTD_initDStream(stream.get());
+        return stream.get();
+    }
+
+    // appends decompressed input to out until the input is consumed, out reaches max_out or the frame ends
+    // returns zstd result, i.e. 0 at the end of frame
+    static size_t decompress(ZSTD_DStream *stream, ZSTD_inBuffer &input, std::vector<char> &out, size_t max_out)
+    {
+        size_t ret = 0;
+        bool out_full = false; // decoder may hold more output even if the input is consumed
+        do
+        {
+            size_t have = out.size();
+            out.resize(std::min(max_out, std::max(have * 2, have + ZSTD_DStreamOutSize())));
+            ZSTD_outBuffer output = { out.data(), out.size(), have };
+            ret = ZSTD_decompressStream(stream, &output, &input);
+            out_full = output.pos == output.size;
+            out.resize(output.pos);
+            if (ZSTD_isError(ret))
+                throw std::runtime_error(std::string("zstd input is corrupted: ") + ZSTD_getErrorName(ret));
+        }
+        while (ret != 0 && out.size() < max_out && (input.pos < input.size || out_full));
+
+        return ret;
+    }
+
+public:
+    ZstdInput(std::unique_ptr<FileInput> &&source, int thread_count, size_t max_raw_size = MAX_RAW_SIZE) : BlockInput(std::move(source), thread_count, max_raw_size) {}
+
+    static bool is_zstd(const char *header, size_t size)
+    {
+        return size >= 4 && (unsigned char)header[0] == 0x28 && (unsigned char)header[1] == 0xb5 && (unsigned char)header[2] == 0x2f && (unsigned char)header[3] == 0xfd;
+    }
+
+protected:
+    size_t block_size(const char *data, size_t size) const override
+    {
+        auto frame_size = ZSTD_findFrameCompressedSize(data, size);
+        return ZSTD_isError(frame_size) ? 0 : frame_size;
+    }
+
+    void decode(const char *data, Block &block) const override
+    {
+        auto content_size = ZSTD_getFrameContentSize(data, block.size);
+        block.out.clear();
+        if (content_size != ZSTD_CONTENTSIZE_UNKNOWN && content_size != ZSTD_CONTENTSIZE_ERROR)
+            block.out.reserve(content_size);
+
+        ZSTD_inBuffer input = { data, block.size, 0 };
+        if (decompress(thread_stream(), input, block.out, SIZE_MAX) != 0)
+            throw std::runtime_error("zstd frame is truncated");
+    }
+
+    void decode_oversized(Block &block) override
+    {
+        if (!oversized_stream)
+        {
+            oversized_stream.reset(ZSTD_createDStream());
+            if (!oversized_stream)
+                throw std::runtime_error("ZSTD_createDStream failed");
+            ZSTD_initDStream(oversized_stream.get());
+        }
+
+        block.out.clear();
+        while (block.out.size() < OVERSIZED_OUT_SIZE)
+        {
+            if (raw_begin == raw_end)
+                fill_raw();
+
+            const size_t decoded = block.out.size();
+            ZSTD_inBuffer input = { raw.data() + raw_begin, raw_end - raw_begin, 0 };
+            auto ret = decompress(oversized_stream.get(), input, block.out, OVERSIZED_OUT_SIZE);
+            raw_begin += input.pos;
+            if (ret == 0) // rest of the input is split to frames again
+            {
+                oversized = false;
+                ZSTD_initDStream(oversized_stream.get());
+                break;
+            }
+
+            if (input.pos == 0 && block.out.size() == decoded && source_eof)
+                throw std::runtime_error("zstd input is truncated");
+        }
+    }
+};
+#endif
+
+inline std::unique_ptr<InputStream> InputStream::open(const std::string &filename, int thread_count)
+{
+    std::unique_ptr<FileInput> file(new FileInput(filename));
+    auto &header = file->peek(18);
+
+    if (BgzfInput::is_bgzf(header.data(), header.size()))
+        return std::unique_ptr<InputStream>(new BgzfInput(std::move(file), thread_count));
+
+    if (header.size() >= 2 && (unsigned char)header[0] == 0x1f && (unsigned char)header[1] == 0x8b)
+        return std::unique_ptr<InputStream>(new GzipInput(std::move(file)));
+
+#if HAVE_ZSTD
+    if (ZstdInput::is_zstd(header.data(), header.size()))
+        return std::unique_ptr<InputStream>(new ZstdInput(std::move(file), thread_count));
+#else
+    if (header.size() >= 4 && (unsigned char)header[0] == 0x28 && (unsigned char)header[1] == 0xb5 && (unsigned char)header[2] == 0x2f && (unsigned char)header[3] == 0xfd)
+        throw std::runtime_error(std::string("zstd input is not supported by this build: ") + filename);
+#endif
+
+    return file;
+}
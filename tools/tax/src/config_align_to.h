@@ -37,7 +37,13 @@
 
 struct Config
 {
-    std::string reference, db, dbs, dbsm, dbss, many, dbss_tax_list, spot_filter_file, out;
+    std::string reference, db, dbs, dbsm, dbss, dbsc, many, dbss_tax_list, spot_filter_file, out, mmap_prefetch, dbs_index;
+    std::string out_format = "text"; // text, binary or binary_zstd hit stream (see hit_stream.h)
+    std::string metrics; // json file with per stage counters of every input (see run_metrics.h)
+    int metrics_interval = 0; // seconds between throughput lines, 0 - none
+    std::string server, client; // unix socket paths
+    int server_jobs = 1;
+    int parallel_inputs = 1; // input files run at once on one worker pool
     std::list <std::string> contig_files;
 
     bool unaligned_only = false, unique = false;
@@ -45,10 +51,14 @@ struct Config
 
     int optimization_ultrafast_skip_reader = 0;
     int optimization_dbs_max_lookups_per_seq_fragment = 0;
+    bool optimization_batched_lookups = false;
     int num_threads = 0;
     size_t chunk_size = 0;
     bool collate = false, print_kmers_only = false;
     bool vectorize = false;
+    size_t collate_memory = 0; // MB of spots kept in memory by -collate/-vectorize before sorted runs are written to disk, 0 - no limit
+    bool mmap = false;
+    bool prefilter = false;
 
     Config(int argc, char const *argv[])
     {
@@ -68,6 +78,8 @@ struct Config
                 dbsm = pop_arg(args);
             else if (arg == "-dbss")
                 dbss = pop_arg(args);
+            else if (arg == "-dbsc")
+                dbsc = pop_arg(args);
             else if (arg == "-many")
                 many = pop_arg(args);
             else if (arg == "-tax_list")
@@ -78,6 +90,8 @@ struct Config
                 collate = true;
             else if (arg == "-vectorize")
                 vectorize = true;
+            else if (arg == "-collate_memory")
+                collate_memory = size_t(std::stoull(pop_arg(args)));
             else if (arg == "-compact")
                 compact = true;
             else if (arg == "-unaligned_only")
@@ -90,14 +104,51 @@ struct Config
                 optimization_ultrafast_skip_reader = std::stoi(pop_arg(args));
             else if (arg == "-optimization_dbs_max_lookups_per_seq_fragment")
                 optimization_dbs_max_lookups_per_seq_fragment = std::stoi(pop_arg(args));
+            else if (arg == "-optimization_batched_lookups")
+                optimization_batched_lookups = true;
             else if (arg == "-num_threads")
                 num_threads = std::stoi(pop_arg(args));
             else if (arg == "-unique")
                 unique = true;
             else if (arg == "-print_kmers_only")
                 print_kmers_only = true;
+            else if (arg == "-mmap")
+                mmap = true;
+            else if (arg == "-prefilter")
+                prefilter = true;
+            else if (arg == "-mmap_prefetch")
+            {
+                mmap = true;
+                mmap_prefetch = pop_arg(args);
+                if (mmap_prefetch != "none" && mmap_prefetch != "willneed" && mmap_prefetch != "populate")
+                    fail("-mmap_prefetch should be one of none, willneed, populate");
+            }
+            else if (arg == "-dbs_index")
+            {
+                dbs_index = pop_arg(args);
+                if (dbs_index != "lookup_table" && dbs_index != "soa" && dbs_index != "compressed")
+                    fail("-dbs_index should be one of lookup_table, soa, compressed");
+            }
             else if (arg == "-chunk_size")
                 chunk_size = size_t(std::stoi(pop_arg(args)));
+            else if (arg == "-metrics")
+                metrics = pop_arg(args);
+            else if (arg == "-metrics_interval")
+                metrics_interval = std::stoi(pop_arg(args));
+            else if (arg == "-out_format")
+            {
+                out_format = pop_arg(args);
+                if (!valid_out_format(out_format))
+                    fail("-out_format should be one of text, binary, binary_zstd");
+            }
+            else if (arg == "-server")
+                server = pop_arg(args);
+            else if (arg == "-server_jobs")
+                server_jobs = std::stoi(pop_arg(args));
+            else if (arg == "-parallel_inputs")
+                parallel_inputs = std::stoi(pop_arg(args));
+            else if (arg == "-client")
+                client = pop_arg(args);
             else if (arg.empty() || arg[0] == '-' || !contig_file.empty()) 
             {
                 std::string reason = "unexpected argument: " + arg;
@@ -107,12 +158,35 @@ struct Config
                 contig_file = arg;
         }
 
+        if (!server.empty() && !client.empty())
+            fail("-server and -client cannot be used together");
+
+        if (!server.empty() && !contig_file.empty())
+            fail("-server takes no input files, they are sent by clients");
+
+        if (server_jobs < 1)
+            fail("-server_jobs should be at least 1");
+
+        if (parallel_inputs < 1)
+            fail("-parallel_inputs should be at least 1");
+
+        if (parallel_inputs > 1 && (!server.empty() || !client.empty()))
+            fail("-parallel_inputs cannot be used with -server or -client, use -server_jobs");
+
         // exactly one should exist
-        if (contig_file.empty()) // == contig_files.empty())
+        if (contig_file.empty() && server.empty()) // == contig_files.empty())
             fail("please provide either contig file or list");
 
-        int db_count = int(!db.empty()) + int(!dbs.empty()) + int(!dbss.empty()) + int(!dbsm.empty()) + int(!many.empty());
-        if (db_count != 1)
+        int db_count = int(!db.empty()) + int(!dbs.empty()) + int(!dbss.empty()) + int(!dbsm.empty()) + int(!dbsc.empty()) + int(!many.empty());
+        if (!client.empty())
+        {
+            if (db_count != 0 || !dbss_tax_list.empty() || mmap || prefilter || !dbs_index.empty() || num_threads != 0)
+                fail("database and thread options are set by the server");
+
+            if (unique && out.empty())
+                fail("-unique requires -out with -client");
+        }
+        else if (db_count != 1)
             fail("please provide exactly one db argument");
 
         // tax list makes sense if and only if dbss specified
@@ -121,14 +195,105 @@ struct Config
 
         if (ends_with(contig_file, ".list"))
             contig_files = load_list(contig_file);
-        else
+        else if (!contig_file.empty())
             contig_files.push_back(contig_file);
 
-        if (contig_files.empty())
+        if (contig_files.empty() && server.empty())
             fail("loaded empty list of files to process");
 
+        if (mmap && db.empty() && dbs.empty() && dbsm.empty() && dbsc.empty())
+            fail("-mmap can be used only with -db, -dbs, -dbsm or -dbsc");
+
+        if (!dbs_index.empty() && dbs.empty() && dbss.empty())
+            fail("-dbs_index can be used only with -dbs or -dbss");
+
         if (contig_files.size() > 1 && out.empty())
             fail("-out postfix required for multiple input files");
+
+        if (collate_memory && !collate && !vectorize)
+            fail("-collate_memory can be used only with -collate or -vectorize");
+
+        if (!metrics.empty() && (!server.empty() || !client.empty()))
+            fail("-metrics cannot be used with -server or -client");
+
+        if (binary_out() && (compact || collate || vectorize || print_kmers_only))
+            fail("-out_format binary cannot be used with -compact, -collate, -vectorize or -print_kmers_only");
+    }
+
+    bool binary_out() const { return out_format != "text"; }
+
+    static bool valid_out_format(const std::string &format)
+    {
+        return format == "text" || format == "binary" || format == "binary_zstd";
+    }
+
+    // run options sent by -client to -server as lines of "key<tab>value", database and thread options are the server ones
+    void write_run_options(std::ostream &f) const
+    {
+        for (auto &contig_file : contig_files)
+            f << "input\t" << contig_file << '\n';
+
+        f << "out\t" << out << '\n'
+            << "spot_filter\t" << spot_filter_file << '\n'
+            << "unaligned_only\t" << unaligned_only << '\n'
+            << "unique\t" << unique << '\n'
+            << "hide_counts\t" << hide_counts << '\n'
+            << "compact\t" << compact << '\n'
+            << "collate\t" << collate << '\n'
+            << "vectorize\t" << vectorize << '\n'
+            << "collate_memory\t" << collate_memory << '\n'
+            << "print_kmers_only\t" << print_kmers_only << '\n'
+            << "out_format\t" << out_format << '\n'
+            << "metrics_interval\t" << metrics_interval << '\n'
+            << "chunk_size\t" << chunk_size << '\n'
+            << "optimization_ultrafast_skip_reader\t" << optimization_ultrafast_skip_reader << '\n'
+            << "optimization_dbs_max_lookups_per_seq_fragment\t" << optimization_dbs_max_lookups_per_seq_fragment << '\n'
+            << "optimization_batched_lookups\t" << optimization_batched_lookups << '\n';
+    }
+
+    // throws instead of exiting on invalid options, the server keeps running
+    void read_run_option(const std::string &key, const std::string &value)
+    {
+        if (key == "input")
+            contig_files.push_back(value);
+        else if (key == "out")
+            out = value;
+        else if (key == "spot_filter")
+            spot_filter_file = value;
+        else if (key == "unaligned_only")
+            unaligned_only = std::stoi(value) != 0;
+        else if (key == "unique")
+            unique = std::stoi(value) != 0;
+        else if (key == "hide_counts")
+            hide_counts = std::stoi(value) != 0;
+        else if (key == "compact")
+            compact = std::stoi(value) != 0;
+        else if (key == "collate")
+            collate = std::stoi(value) != 0;
+        else if (key == "vectorize")
+            vectorize = std::stoi(value) != 0;
+        else if (key == "collate_memory")
+            collate_memory = size_t(std::stoull(value));
+        else if (key == "print_kmers_only")
+            print_kmers_only = std::stoi(value) != 0;
+        else if (key == "metrics_interval")
+            metrics_interval = std::stoi(value);
+        else if (key == "out_format")
+        {
+            if (!valid_out_format(value))
+                throw std::runtime_error("invalid out_format " + value);
+            out_format = value;
+        }
+        else if (key == "chunk_size")
+            chunk_size = size_t(std::stoull(value));
+        else if (key == "optimization_ultrafast_skip_reader")
+            optimization_ultrafast_skip_reader = std::stoi(value);
+        else if (key == "optimization_dbs_max_lookups_per_seq_fragment")
+            optimization_dbs_max_lookups_per_seq_fragment = std::stoi(value);
+        else if (key == "optimization_batched_lookups")
+            optimization_batched_lookups = std::stoi(value) != 0;
+        else
+            throw std::runtime_error("unknown run option " + key);
     }
 
     static std::list<std::string> load_list(const std::string &filename)
@@ -161,12 +326,14 @@ struct Config
 
     static void print_usage()
     {
-        std::cerr << "need <database> [-spot_filter <spot or read file>] [-out <filename>] [-hide_counts] [-compact] [-unaligned_only] [-num_threads <number>] [-unique] [-chunk_size <size>] [-print_kmers_only] <contig fasta, accession or .list file of fasta/accessions>" << std::endl
+        std::cerr << "need <database> [-server <socket> [-server_jobs <number>]] [-spot_filter <spot or read file>] [-out <filename>] [-out_format <text|binary|binary_zstd>] [-metrics <json file>] [-metrics_interval <seconds>] [-hide_counts] [-compact] [-collate [-collate_memory <MB>]] [-unaligned_only] [-num_threads <number>] [-parallel_inputs <number>] [-unique] [-chunk_size <size>] [-print_kmers_only] [-prefilter] [-mmap] [-mmap_prefetch <none|willneed|populate>] [-dbs_index <lookup_table|soa|compressed>] <contig fasta, accession or .list file of fasta/accessions>" << std::endl
             << "where <database> is one of:" << std::endl
             << "-db <database>" << std::endl
             << "-dbs <database +tax>" << std::endl
             << "-dbsm <database +taxes>" << std::endl
-            << "-dbss <sorted database +tax> -tax_list <tax_list file>" << std::endl;
+            << "-dbss <sorted database +tax> -tax_list <tax_list file>" << std::endl
+            << "-dbsc <compressed database +tax>" << std::endl
+            << "or -client <socket> with the run options and input of a database loaded by aligns_to -server" << std::endl;
 //            << "-many <comma-separated list of databases>" << std::endl;
     }
 
@@ -34,10 +34,12 @@ struct ConfigBuildIndex
 {
     std::string file_list, tax_parents_file;
     unsigned int window_divider, kmer_len, min_window_size = 0, min_kmers_per_seq = 0;
+    std::string dbs, dbss, spill_folder;
+    int threads = 0;
 
     ConfigBuildIndex(int argc, char const *argv[])
     {
-        if (argc != 5)
+        if (argc < 5)
         {
             print_usage();
             exit(1);
@@ -49,11 +51,37 @@ struct ConfigBuildIndex
         kmer_len = std::stoi(std::string(argv[4]));
 //        min_window_size = std::stoi(std::string(argv[5]));
 //        min_kmers_per_seq = std::stoi(std::string(argv[6]));
+
+        for (int i = 5; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if (i + 1 >= argc)
+            {
+                print_usage();
+                exit(1);
+            }
+
+            std::string value = argv[++i];
+            if (arg == "-dbs")
+                dbs = value;
+            else if (arg == "-dbss")
+                dbss = value;
+            else if (arg == "-spill")
+                spill_folder = value;
+            else if (arg == "-threads")
+                threads = std::stoi(value);
+            else
+            {
+                print_usage();
+                exit(1);
+            }
+        }
     }
 
     static void print_usage()
     {
-        LOG("need <files.list> <tax.parents> <window divider> <kmer len>");
+        LOG("need <files.list> <tax.parents> <window divider> <kmer len> [-dbs <out.dbs>] [-dbss <out.dbss>] [-spill <folder>] [-threads <count>]\n"
+            "kmers are printed as text unless -dbs or -dbss is given, -spill keeps kmers in files of the folder until they are written");
     }
 };
 
@@ -30,7 +30,8 @@
 
 struct Config
 {
-	std::string db_a, db_b, db_c;
+	std::string db_a, db_b, db_c, tax_parents_file;
+	int threads = 0;
 	int argc;
 	char const **argv;
 
@@ -47,6 +48,17 @@ struct Config
 		db_a = arg(1);
 		db_b = arg(2);
 		db_c = arg(3);
+
+		for (int i = 4; i < argc; i += 2)
+		{
+			std::string option = arg(i), value = arg(i + 1);
+			if (option == "-threads")
+				threads = std::stoi(value);
+			else if (option == "-tax_parents")
+				tax_parents_file = value;
+			else
+				fail();
+		}
 	}
 
 	void fail() const
@@ -57,7 +69,8 @@ struct Config
 
 	static void print_usage()
 	{
-		std::cerr << "need <a.db> <b.db> <c.db>" << std::endl;
+		std::cerr << "need <a.db> <b.db> <c.db> [-threads <n>] [-tax_parents <tax.parents>]" << std::endl;
+		std::cerr << "inputs are .db or .dbs files sorted by kmer, tax ids of a union of .dbs files are merged by consensus with -tax_parents" << std::endl;
 	}
 };
 
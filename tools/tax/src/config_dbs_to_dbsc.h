@@ -0,0 +1,80 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+#pragma once
+#pragma once
+
+#include <string>
+#include <iostream>
+
+struct Config
+{
+	std::string in_dbs, tax_list, out_dbsc;
+	int num_threads = 0;
+	int argc;
+	char const **argv;
+
+	std::string arg(int index) const
+	{
+		if (index >= argc)
+			fail();
+
+		return std::string(argv[index]);
+	}
+
+	Config(int argc, char const *argv[]) : argc(argc), argv(argv)
+	{
+		if (argc == 3)
+		{
+			in_dbs = arg(1);
+			out_dbsc = arg(2);
+		}
+		else if (argc == 4 || argc == 5)
+		{
+			in_dbs = arg(1);
+			tax_list = arg(2);
+			out_dbsc = arg(3);
+			if (argc == 5)
+				num_threads = std::stoi(arg(4));
+		}
+		else
+			fail();
+	}
+
+	bool is_dbss() const { return !tax_list.empty(); }
+
+	void fail() const
+	{
+		print_usage();
+        exit(1);
+	}
+
+	static void print_usage()
+	{
+		std::cerr << "need <in dbs> <out dbsc>" << std::endl
+			<< "or <in dbss> <tax_list file> <out dbsc> [num_threads]" << std::endl;
+	}
+
+};
@@ -5,11 +5,14 @@
 #include <iostream>
 #include <fstream>
 #include <list>
+#include "profile_index.h"
 
 struct Config
 {
-	std::string file_list, profile_file;
+	std::string file_list, profile_file, index_file;
 	int top_count;
+	int rows = ProfileIndex::DEFAULT_ROWS, threads = 0;
+	bool batch = false;
 	int argc;
 	char const **argv;
 
@@ -26,6 +29,21 @@ struct Config
 		file_list = arg(1);
 		profile_file = arg(2);
 		top_count = std::stoi(arg(3));
+
+		for (int i = 4; i < argc; i++)
+		{
+			std::string option = arg(i);
+			if (option == "-batch")
+				batch = true;
+			else if (option == "-index")
+				index_file = arg(++i);
+			else if (option == "-rows")
+				rows = std::stoi(arg(++i));
+			else if (option == "-threads")
+				threads = std::stoi(arg(++i));
+			else
+				fail();
+		}
 	}
 
 	void fail() const
@@ -36,7 +54,10 @@ struct Config
 
 	static void print_usage()
 	{
-		std::cerr << "need <files.list> <profile file> <top count>" << std::endl;
+		std::cerr << "need <files.list> <profile file> <top count> [-batch] [-index <profile index>] [-rows <n>] [-threads <n>]" << std::endl;
+		std::cerr << "-batch: <profile file> is a list of query profiles in the files.list format" << std::endl;
+		std::cerr << "-index: LSH index of the profiles of files.list, built when it is missing or the list changed" << std::endl;
+		std::cerr << "-rows: rows per LSH band of a new index (default " << ProfileIndex::DEFAULT_ROWS << "), wider bands give fewer candidates, but only very close profiles are found without comparing all of them" << std::endl;
 	}
 
 };
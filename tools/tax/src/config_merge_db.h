@@ -32,8 +32,8 @@
 
 struct Config
 {
-	std::string file_list, in_ext, out_file;
-    size_t expected_size;
+	std::string file_list, in_ext, out_file, tax_parents_file;
+	int threads = 0;
 	int argc;
 	char const **argv;
 
@@ -53,7 +53,21 @@ struct Config
 			in_ext = "";
 
 		out_file = arg(3);
-		expected_size = std::stoll(arg(4));
+
+		int i = 4;
+		if (i < argc && arg(i)[0] != '-')
+			i++; // <expected kmers> is not needed anymore, accepted for older scripts
+
+		for (; i < argc; i += 2)
+		{
+			std::string option = arg(i), value = arg(i + 1);
+			if (option == "-threads")
+				threads = std::stoi(value);
+			else if (option == "-tax_parents")
+				tax_parents_file = value;
+			else
+				fail();
+		}
 	}
 
 	void fail() const
@@ -64,7 +78,8 @@ struct Config
 
 	static void print_usage()
 	{
-		std::cerr << "need <files.list> <in ext or -> <out file> <expected kmers>" << std::endl;
+		std::cerr << "need <files.list> <in ext or -> <out file> [-threads <n>] [-tax_parents <tax.parents>]" << std::endl;
+		std::cerr << "inputs are .db or .dbs files sorted by kmer, tax ids of .dbs files are merged by consensus with -tax_parents" << std::endl;
 	}
 
 };
@@ -0,0 +1,71 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef CONFIG_H_INCLUDED
+#define CONFIG_H_INCLUDED
+
+#include <string>
+#include <iostream>
+#include <cstdlib>
+
+struct Config
+{
+	std::string in_hits, out;
+	bool hide_counts = false;
+
+	Config(int argc, char const *argv[])
+	{
+		if (argc < 2)
+			fail();
+
+		in_hits = argv[1];
+		for (int i = 2; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			if (arg == "-hide_counts")
+				hide_counts = true;
+			else if (arg == "-out" && i + 1 < argc)
+				out = argv[++i];
+			else
+				fail();
+		}
+	}
+
+	static void fail()
+	{
+		print_usage();
+		exit(1);
+	}
+
+	static void print_usage()
+	{
+		std::cerr << "need <hits file> [-hide_counts] [-out <filename>]" << std::endl;
+		std::cerr << "prints binary hits of aligns_to -out_format binary|binary_zstd as aligns_to text output" << std::endl;
+	}
+
+};
+
+#endif
@@ -30,7 +30,8 @@
 
 struct Config
 {
-	std::string db_a, db_b;
+	std::string db_a, db_b, db_c;
+	int threads = 0;
 	int argc;
 	char const **argv;
 
@@ -46,6 +47,19 @@ struct Config
 	{
 		db_a = arg(1);
 		db_b = arg(2);
+
+		int i = 3;
+		if (i < argc && arg(i)[0] != '-')
+			db_c = arg(i++);
+
+		for (; i < argc; i += 2)
+		{
+			std::string option = arg(i), value = arg(i + 1);
+			if (option == "-threads")
+				threads = std::stoi(value);
+			else
+				fail();
+		}
 	}
 
 	void fail() const
@@ -56,7 +70,8 @@ struct Config
 
 	static void print_usage()
 	{
-		std::cerr << "need <a.dbs> <b.db>" << std::endl;
+		std::cerr << "need <a.dbs> <b.db> [<c.dbs>] [-threads <n>]" << std::endl;
+		std::cerr << "kmers of a.dbs not found in b.db are saved to c.dbs, or printed as text without it" << std::endl;
 	}
 };
 
@@ -114,6 +114,11 @@ void process_with_taxonomy(const string &fasta_db, const string &out_file)
 
 	sort(kmers.begin(), kmers.end(), kmer_less);
 	DBSIO::save_dbs(out_file, kmers, kmer_len);
+
+	// aligns_to maps the bucket table instead of building it on every run
+	KmerBucketIndex lookup_table;
+	lookup_table.build(kmers, kmer_len);
+	DBSIO::save_lookup_index(out_file + ".index", DBSIO::lookup_index_source(out_file, kmer_len, kmers), lookup_table, nullptr);
 }
 
 bool has_taxonomy_info(const string &filename)
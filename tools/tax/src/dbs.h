@@ -29,7 +29,13 @@
 
 #include "kmer_hash.h"
 #include "io.h"
+#include "array_view.h"
+#include "kmer_index.h"
+#include "kmer_filter.h"
+#include <sys/stat.h>
+#include <unistd.h>
 #include <string>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <vector>
@@ -70,6 +76,15 @@ struct DBSIO
     {
         size_t version, kmer_len;
         DBSHeader(size_t kmer_len = 0) : version(VERSION), kmer_len(kmer_len){}
+
+        // header at the start of a mapped or loaded file, fields are copied one by one as the data may be unaligned
+        static DBSHeader from(const void *data)
+        {
+            DBSHeader header;
+            memcpy(&header.version, (const char*)data, sizeof(header.version));
+            memcpy(&header.kmer_len, (const char*)data + sizeof(header.version), sizeof(header.kmer_len));
+            return header;
+        }
     };
 
     static DBSIO::DBSHeader load_header(const std::string &filename)
@@ -92,6 +107,48 @@ struct DBSIO
         IO::save_vector(f, kmers, offset);
     }
 
+    // writes a .dbs piece by piece, the kmer count is patched into the header on close
+    template <class C>
+    struct DBSWriter
+    {
+        const std::string out_file;
+        std::ofstream f;
+        size_t count = 0;
+
+        DBSWriter(const std::string &out_file, size_t kmer_len) : out_file(out_file), f(out_file, std::ios::binary | std::ios::out | std::ios::trunc)
+        {
+            if (f.fail())
+                throw std::runtime_error(std::string("cannot create file ") + out_file);
+
+            IO::write(f, DBSHeader(kmer_len));
+            IO::write(f, count);
+        }
+
+        void append(const std::vector<C> &kmers)
+        {
+            if (kmers.empty())
+                return;
+
+            IO::save_vector_data(f, kmers);
+            if (!f)
+                throw std::runtime_error("DBSWriter:: failed to write kmers to " + out_file);
+
+            count += kmers.size();
+        }
+
+        void close()
+        {
+            f.seekp(sizeof(DBSHeader)); // flushes the kmers written so far
+            if (!f)
+                throw std::runtime_error("DBSWriter:: failed to write kmers to " + out_file);
+
+            IO::write(f, count);
+            f.close();
+            if (!f)
+                throw std::runtime_error("DBSWriter:: failed to close " + out_file);
+        }
+    };
+
     template <class C>
     static void save_centroid(const std::string &out_file, const C &centroid, size_t kmer_len)
     {
@@ -152,6 +209,32 @@ struct DBSIO
         return header.kmer_len;
     }
 
+    // zero-copy alternative of load_dbs: kmers point directly into the mapped file
+    template <class C>
+    static size_t map_dbs(const std::string &filename, IO::MappedFile &mapping, ArrayView<C> &kmers, IO::MappedFile::Prefetch prefetch)
+    {
+        mapping.open(filename, prefetch);
+
+        const size_t data_offset = sizeof(DBSHeader) + sizeof(size_t);
+        if (mapping.size < data_offset)
+            throw std::runtime_error(std::string("cannot load dbs ") + filename);
+
+        auto header = DBSHeader::from(mapping.data);
+        if (header.version != VERSION)
+            throw std::runtime_error("unsupported dbs file version");
+
+        if (header.kmer_len < 1 || header.kmer_len > 64)
+            throw std::runtime_error("map_dbs:: invalid kmer_len");
+
+        size_t count = 0;
+        memcpy(&count, mapping.data + sizeof(header), sizeof(count));
+        if (count > (mapping.size - data_offset) / sizeof(C)) // count is not trusted, count * sizeof(C) may overflow
+            throw std::runtime_error("map_dbs:: file is truncated");
+
+        kmers = ArrayView<C>((const C*)(mapping.data + data_offset), count);
+        return header.kmer_len;
+    }
+
     static void save_dbsm(const std::string &out_file, const std::vector<DBS::KmerTaxMulti> &kmers, size_t kmer_len)
     {
         std::ofstream f(out_file);
@@ -200,6 +283,332 @@ struct DBSIO
         return header.kmer_len;
     }
 
+    // bulk alternative of load_dbsm: the file is read at once and its tax ids become the flat tax array of the index
+    static size_t load_dbsm(const std::string &filename, KmerMultiTaxIndex &index)
+    {
+        std::ifstream f(filename, std::ios::binary | std::ios::in | std::ios::ate);
+        if (f.fail())
+            throw std::runtime_error(std::string("cannot load dbsm ") + filename);
+
+        const size_t size = f.tellg();
+        if (size % sizeof(int) != 0)
+            throw std::runtime_error("load_dbsm:: invalid file size");
+
+        f.seekg(0);
+        index.tax_storage.resize(size / sizeof(int));
+        f.read((char*)index.tax_storage.data(), size);
+        if (!f)
+            throw std::runtime_error(std::string("cannot load dbsm ") + filename);
+
+        const size_t kmer_len = attach_dbsm(index.tax_storage.data(), index.tax_storage.size(), index);
+        index.compact();
+        index.build(int(kmer_len));
+        return kmer_len;
+    }
+
+    // zero-copy alternative of load_dbsm: tax ids of the index point directly into the mapped file
+    static size_t map_dbsm(const std::string &filename, IO::MappedFile &mapping, KmerMultiTaxIndex &index, IO::MappedFile::Prefetch prefetch)
+    {
+        mapping.open(filename, prefetch);
+        if (mapping.size % sizeof(int) != 0)
+            throw std::runtime_error("map_dbsm:: invalid file size");
+
+        index.tax_storage.clear();
+        const size_t kmer_len = attach_dbsm((const int*)mapping.data, mapping.size / sizeof(int), index);
+        index.build(int(kmer_len));
+        return kmer_len;
+    }
+
+    // identifies the kmer array a lookup index sidecar was built for
+    struct LookupIndexSource
+    {
+        uint64_t kmer_len = 0, kmer_count = 0, db_size = 0;
+        uint64_t tax_list = 0; // fingerprint of the tax list a .dbss was loaded with, 0 for .dbs
+        uint64_t db_mtime = 0; // in nanoseconds, a database rewritten with the same size gets another one, db_size and db_mtime cover all files of the database
+        uint64_t content_checksum = 0; // of a sample of the kmers, see lookup_index_content_checksum
+
+        bool same_database(const LookupIndexSource &x) const
+        {
+            return kmer_len == x.kmer_len && kmer_count == x.kmer_count && db_size == x.db_size && tax_list == x.tax_list;
+        }
+    };
+
+    template <class SortedArray>
+    static LookupIndexSource lookup_index_source(const std::string &db_file, size_t kmer_len, const SortedArray &array, uint64_t tax_list = 0)
+    {
+        return lookup_index_source(std::vector<std::string>{db_file}, kmer_len, array, tax_list);
+    }
+
+    // a database of several files (a .dbss folder) is identified by their total size and a checksum of all their mtimes
+    template <class SortedArray>
+    static LookupIndexSource lookup_index_source(const std::vector<std::string> &db_files, size_t kmer_len, const SortedArray &array, uint64_t tax_list = 0)
+    {
+        LookupIndexSource source;
+        source.kmer_len = kmer_len;
+        source.kmer_count = array.size();
+        source.tax_list = tax_list;
+        uint64_t mtimes = CHECKSUM_SEED;
+        for (auto &db_file : db_files)
+        {
+            struct stat file_stat;
+            if (stat(db_file.c_str(), &file_stat) != 0)
+                throw std::runtime_error(std::string("cannot stat file ") + db_file);
+
+            source.db_size += file_stat.st_size;
+#ifdef __APPLE__
+            source.db_mtime = uint64_t(file_stat.st_mtimespec.tv_sec) * 1000000000 + file_stat.st_mtimespec.tv_nsec;
+#else
+            source.db_mtime = uint64_t(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+#endif
+            mtimes = checksum_word(mtimes, source.db_mtime);
+        }
+
+        if (db_files.size() != 1)
+            source.db_mtime = mtimes;
+
+        source.content_checksum = lookup_index_content_checksum(array);
+        return source;
+    }
+
+    // .index sidecar of a database: header, bucket table and optionally the prefilter blocks at a 64 byte boundary
+    // it is mapped by the next runs instead of building the table again, a sidecar which does not match is ignored
+    static const uint64_t LOOKUP_INDEX_MAGIC = 0x58444e4942445331; // "1SDBINDX"
+    static const uint64_t LOOKUP_INDEX_VERSION = 2;
+    static const size_t LOOKUP_INDEX_CONTENT_SAMPLES = 4096;
+
+    struct LookupIndexHeader
+    {
+        uint64_t magic = LOOKUP_INDEX_MAGIC, version = LOOKUP_INDEX_VERSION;
+        LookupIndexSource source;
+        uint64_t shift = 0, bucket_count = 0, filter_offset = 0, filter_blocks = 0; // filter offset in bytes, 0 without filter
+        uint64_t checksum = 0; // of the table and filter words
+    };
+
+    // kmers at evenly spaced positions and the last one. hashing all of them would cost as much as building the table again,
+    // which the sidecar is there to avoid, the database size and mtime catch the other changes
+    template <class SortedArray>
+    static uint64_t lookup_index_content_checksum(const SortedArray &array)
+    {
+        uint64_t h = CHECKSUM_SEED;
+        const size_t count = array.size();
+        const size_t samples = std::min(count, size_t(LOOKUP_INDEX_CONTENT_SAMPLES));
+        for (size_t i = 0; i < samples; i++)
+            h = checksum_word(h, kmer_of(array[i * count / samples]));
+
+        if (count > 0)
+            h = checksum_word(h, kmer_of(array[count - 1]));
+
+        return h;
+    }
+
+    static void save_lookup_index(const std::string &filename, const LookupIndexSource &source, const KmerBucketIndex &table, const KmerBloomFilter *filter)
+    {
+        LookupIndexHeader header;
+        header.source = source;
+        header.shift = table.shift;
+        header.bucket_count = table.bucket_count();
+        const size_t table_end = sizeof(header) + table.table.size() * sizeof(size_t);
+        if (filter)
+        {
+            header.filter_offset = (table_end + sizeof(KmerBloomFilter::Block) - 1) / sizeof(KmerBloomFilter::Block) * sizeof(KmerBloomFilter::Block);
+            header.filter_blocks = filter->blocks.size();
+        }
+        header.checksum = lookup_index_checksum(table.table, filter ? filter->blocks : ArrayView<KmerBloomFilter::Block>());
+
+        // written under a temporary name of this process and renamed, so running jobs never map a partial file
+        // and processes saving the same sidecar at once do not write into each other's file
+        const std::string tmp = filename + "." + std::to_string(getpid()) + ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::binary | std::ios::out);
+            f.write((const char*)&header, sizeof(header));
+            f.write((const char*)table.table.data(), table.table.size() * sizeof(size_t));
+            if (filter)
+            {
+                const std::vector<char> padding(header.filter_offset - table_end, 0);
+                f.write(padding.data(), padding.size());
+                f.write((const char*)filter->blocks.data(), filter->blocks.size() * sizeof(KmerBloomFilter::Block));
+            }
+
+            if (!f)
+            {
+                std::remove(tmp.c_str());
+                throw std::runtime_error(std::string("cannot save lookup index ") + filename);
+            }
+        }
+
+        if (std::rename(tmp.c_str(), filename.c_str()) != 0)
+        {
+            std::remove(tmp.c_str());
+            throw std::runtime_error(std::string("cannot save lookup index ") + filename);
+        }
+    }
+
+    // maps the sidecar and attaches the table to it, returns false when there is no sidecar or it does not match the array
+    template <class SortedArray>
+    static bool map_lookup_index(const std::string &filename, IO::MappedFile &mapping, const LookupIndexSource &source, const SortedArray &array, KmerBucketIndex &table)
+    {
+        struct stat file_stat;
+        if (stat(filename.c_str(), &file_stat) != 0)
+            return false;
+
+        mapping.open(filename);
+        LookupIndexHeader header;
+        if (mapping.size < sizeof(header))
+            return reject_lookup_index(mapping, filename, "truncated");
+
+        memcpy(&header, mapping.data, sizeof(header));
+        if (header.magic != LOOKUP_INDEX_MAGIC || header.version != LOOKUP_INDEX_VERSION)
+            return reject_lookup_index(mapping, filename, "unsupported version");
+
+        if (!header.source.same_database(source))
+            return reject_lookup_index(mapping, filename, "built for another database");
+
+        if (header.source.db_mtime != source.db_mtime)
+            return reject_lookup_index(mapping, filename, "database was modified");
+
+        if (header.source.content_checksum != source.content_checksum)
+            return reject_lookup_index(mapping, filename, "database content differs");
+
+        const size_t table_end = sizeof(header) + (header.bucket_count + 1) * sizeof(size_t);
+        const size_t filter_end = header.filter_offset + header.filter_blocks * sizeof(KmerBloomFilter::Block);
+        if (header.bucket_count == 0 || table_end > mapping.size || (header.filter_offset && (header.filter_offset < table_end || header.filter_offset % sizeof(KmerBloomFilter::Block) != 0 || filter_end > mapping.size)))
+            return reject_lookup_index(mapping, filename, "truncated");
+
+        ArrayView<size_t> table_words((const size_t*)(mapping.data + sizeof(header)), header.bucket_count + 1);
+        if (lookup_index_checksum(table_words, lookup_index_filter(mapping)) != header.checksum)
+            return reject_lookup_index(mapping, filename, "checksum mismatch");
+
+        KmerBucketIndex mapped;
+        mapped.attach(table_words.data(), header.bucket_count, int(header.shift));
+        if (!mapped.matches(array))
+            return reject_lookup_index(mapping, filename, "does not match the database");
+
+        table = std::move(mapped);
+        return true;
+    }
+
+    // prefilter blocks of a mapped sidecar, empty when it was saved without prefilter
+    static ArrayView<KmerBloomFilter::Block> lookup_index_filter(const IO::MappedFile &mapping)
+    {
+        LookupIndexHeader header;
+        memcpy(&header, mapping.data, sizeof(header));
+        if (!header.filter_offset)
+            return ArrayView<KmerBloomFilter::Block>();
+
+        return ArrayView<KmerBloomFilter::Block>((const KmerBloomFilter::Block*)(mapping.data + header.filter_offset), header.filter_blocks);
+    }
+
+    // .dbsc file is the image of a built KmerCompressedIndex as is
+    static void save_dbsc(const std::string &out_file, const KmerCompressedIndex &index)
+    {
+        assert(!index.image.empty());
+        std::ofstream f(out_file, std::ios::binary | std::ios::out);
+        f.write((const char*)index.image.data(), index.image.size() * sizeof(uint64_t));
+        if (!f)
+            throw std::runtime_error(std::string("cannot save dbsc ") + out_file);
+    }
+
+    static size_t load_dbsc(const std::string &filename, KmerCompressedIndex &index)
+    {
+        std::ifstream f(filename, std::ios::binary | std::ios::in | std::ios::ate);
+        if (f.fail())
+            throw std::runtime_error(std::string("cannot load dbsc ") + filename);
+
+        const size_t size = f.tellg();
+        if (size % sizeof(uint64_t) != 0)
+            throw std::runtime_error("load_dbsc:: invalid file size");
+
+        f.seekg(0);
+        index.image.resize(size / sizeof(uint64_t));
+        f.read((char*)index.image.data(), size);
+        if (!f)
+            throw std::runtime_error(std::string("cannot load dbsc ") + filename);
+
+        index.attach(index.image.data(), index.image.size());
+        return index.kmer_len();
+    }
+
+    // zero-copy alternative of load_dbsc: the index is searched directly in the mapped file
+    static size_t map_dbsc(const std::string &filename, IO::MappedFile &mapping, KmerCompressedIndex &index, IO::MappedFile::Prefetch prefetch)
+    {
+        mapping.open(filename, prefetch);
+        if (mapping.size % sizeof(uint64_t) != 0)
+            throw std::runtime_error("map_dbsc:: invalid file size");
+
+        index.image.clear();
+        index.attach((const uint64_t*)mapping.data, mapping.size / sizeof(uint64_t));
+        return index.kmer_len();
+    }
+
+private:
+    // FNV-1a over 64 bit words
+    static const uint64_t CHECKSUM_SEED = 0xcbf29ce484222325;
+    static uint64_t checksum_word(uint64_t h, uint64_t word) { return (h ^ word) * 0x100000001b3; }
+
+    static uint64_t lookup_index_checksum(const ArrayView<size_t> &table, const ArrayView<KmerBloomFilter::Block> &filter)
+    {
+        uint64_t h = CHECKSUM_SEED;
+        for (auto word : table)
+            h = checksum_word(h, word);
+
+        for (auto &block : filter)
+            for (auto word : block.words)
+                h = checksum_word(h, word);
+
+        return h;
+    }
+
+    static bool reject_lookup_index(IO::MappedFile &mapping, const std::string &filename, const char *reason)
+    {
+        mapping.close();
+        LOG("lookup index " << filename << " is ignored: " << reason);
+        return false;
+    }
+
+    // .dbsm file is the header, kmer count and records of kmer, tax id count and tax ids, all 4 byte aligned
+    // kmers are copied out, offsets point to the tax ids of the records in ints
+    static size_t attach_dbsm(const int *ints, size_t int_count, KmerMultiTaxIndex &index)
+    {
+        const size_t header_ints = (sizeof(DBSHeader) + sizeof(size_t)) / sizeof(int);
+        const size_t record_ints = (sizeof(hash_t) + sizeof(int)) / sizeof(int);
+        if (int_count < header_ints)
+            throw std::runtime_error("load_dbsm:: file is truncated");
+
+        auto header = DBSHeader::from(ints);
+        if (header.version != VERSION)
+            throw std::runtime_error("unsupported dbsm file version");
+
+        if (header.kmer_len < 1 || header.kmer_len > 64)
+            throw std::runtime_error("load_dbsm:: invalid kmer_len");
+
+        size_t count = 0;
+        memcpy(&count, ints + sizeof(DBSHeader) / sizeof(int), sizeof(count));
+        if (count > (int_count - header_ints) / record_ints)
+            throw std::runtime_error("load_dbsm:: file is truncated");
+
+        index.kmers.resize(count);
+        index.offsets.resize(count + 1);
+        size_t pos = header_ints;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (int_count - pos < record_ints)
+                throw std::runtime_error("load_dbsm:: file is truncated");
+
+            memcpy(&index.kmers[i], ints + pos, sizeof(hash_t));
+            const int tax_count = ints[pos + record_ints - 1];
+            pos += record_ints;
+            if (tax_count < 0 || size_t(tax_count) > int_count - pos)
+                throw std::runtime_error("load_dbsm:: file is truncated");
+
+            index.offsets[i] = pos;
+            pos += tax_count;
+        }
+
+        index.offsets[count] = pos + record_ints;
+        index.gap = record_ints;
+        index.tax_ids = ArrayView<int>(ints, int_count);
+        return header.kmer_len;
+    }
 };
 
 #endif
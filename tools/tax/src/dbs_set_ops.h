@@ -0,0 +1,401 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef DBS_SET_OPS_H_INCLUDED
+#define DBS_SET_OPS_H_INCLUDED
+
+#include <string>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <thread>
+#include <stdexcept>
+#include <type_traits>
+
+#include "dbs.h"
+#include "io.h"
+#include "tax_id_tree.h"
+#include "ordered_pipeline.h"
+
+// set algebra over sorted .db (kmers) and .dbs (kmers with tax ids) files without loading them:
+// inputs are mapped, the kmer space is split into partitions of about the same number of input kmers,
+// workers k-way merge the partitions concurrently and the results are written in partition order,
+// so memory is bounded by the partitions in flight
+struct DBSSetOps
+{
+    enum Op
+    {
+        UNION,          // kmers of any input, tax ids of equal kmers are merged by consensus
+        INTERSECTION,   // kmers of the first input found in all the others
+        DIFFERENCE      // kmers of the first input found in none of the others
+    };
+
+    static const size_t PARTITION_KMERS = 4 * 1024 * 1024; // input kmers per partition
+    static const size_t SAMPLE_STEP = 64 * 1024; // input kmers per splitter sample
+    static const size_t LINEAR_MERGE_RUNS = 4;
+
+    // mapped input as an array of records, the kmer is the first field of a record
+    struct Input
+    {
+        std::string filename;
+        IO::MappedFile mapping;
+        const char *records = nullptr;
+        size_t count = 0, record_size = 0, kmer_len = 0; // record size is 0 for an empty input
+
+        Input(const std::string &filename) : filename(filename)
+        {
+            mapping.open(filename);
+            const size_t data_offset = sizeof(DBSIO::DBSHeader) + sizeof(size_t);
+            if (mapping.size < data_offset)
+                throw std::runtime_error(std::string("cannot load dbs ") + filename);
+
+            DBSIO::DBSHeader header;
+            memcpy(&header, mapping.data, sizeof(header));
+            if (header.version != DBSIO::VERSION)
+                throw std::runtime_error("unsupported dbs file version");
+
+            if (header.kmer_len < 1 || header.kmer_len > 64)
+                throw std::runtime_error(std::string("invalid kmer_len in ") + filename);
+
+            kmer_len = header.kmer_len;
+            memcpy(&count, mapping.data + sizeof(header), sizeof(count));
+            records = mapping.data + data_offset;
+            const size_t data_size = mapping.size - data_offset;
+            if (count == 0)
+                return;
+
+            if (data_size == count * sizeof(hash_t))
+                record_size = sizeof(hash_t);
+            else if (data_size == count * sizeof(DBS::KmerTax))
+                record_size = sizeof(DBS::KmerTax);
+            else
+                throw std::runtime_error(filename + " is neither .db nor .dbs or it is truncated");
+        }
+
+        hash_t kmer(size_t i) const
+        {
+            hash_t x;
+            memcpy(&x, records + i * record_size, sizeof(x));
+            return x;
+        }
+
+        bool has_tax_ids() const { return record_size == sizeof(DBS::KmerTax); }
+
+        size_t lower_bound(hash_t x) const
+        {
+            size_t from = 0, to = count;
+            while (from < to)
+            {
+                const size_t mid = from + (to - from) / 2;
+                if (kmer(mid) < x)
+                    from = mid + 1;
+                else
+                    to = mid;
+            }
+            return from;
+        }
+    };
+
+    typedef std::vector<std::unique_ptr<Input>> Inputs;
+
+    static Inputs open(const std::vector<std::string> &filenames)
+    {
+        Inputs inputs;
+        for (auto &filename : filenames)
+            inputs.push_back(std::make_unique<Input>(filename));
+
+        return inputs;
+    }
+
+    static size_t kmer_len_of(const Inputs &inputs)
+    {
+        if (inputs.empty())
+            throw std::runtime_error("no input dbs");
+
+        for (auto &input : inputs)
+            if (input->kmer_len != inputs.front()->kmer_len)
+                throw std::runtime_error(std::string("kmer_len of ") + input->filename + " is " + std::to_string(input->kmer_len) + ", expected " + std::to_string(inputs.front()->kmer_len));
+
+        return inputs.front()->kmer_len;
+    }
+
+    // result records carry tax ids when the first input does (all inputs of a union have to agree)
+    static bool result_has_tax_ids(Op op, const Inputs &inputs)
+    {
+        if (op != UNION)
+            return inputs.front()->has_tax_ids();
+
+        bool known = false, has_tax_ids = false;
+        for (auto &input : inputs)
+        {
+            if (!input->record_size)
+                continue;
+
+            if (known && input->has_tax_ids() != has_tax_ids)
+                throw std::runtime_error(std::string("cannot merge .db and .dbs: ") + input->filename);
+
+            has_tax_ids = input->has_tax_ids();
+            known = true;
+        }
+        return has_tax_ids;
+    }
+
+    // streams the sorted result to write(const std::vector<C>&) chunk by chunk, returns the number of kmers
+    // C is hash_t or DBS::KmerTax, a union of kmers with tax ids needs the tax tree
+    template <class C, class Write>
+    static size_t run(Op op, const Inputs &inputs, int threads, const TaxIdTree *tax_tree, Write &&write, size_t partition_kmers = PARTITION_KMERS)
+    {
+        kmer_len_of(inputs);
+        if (std::is_same<C, DBS::KmerTax>::value)
+        {
+            for (size_t i = 0; i < inputs.size(); i++)
+                if (inputs[i]->record_size && !inputs[i]->has_tax_ids() && (op == UNION || i == 0))
+                    throw std::runtime_error(inputs[i]->filename + " has no tax ids");
+
+            if (op == UNION && !tax_tree)
+                throw std::runtime_error("union of .dbs needs a tax tree to merge tax ids");
+        }
+
+        const auto splitters = partition_splitters(inputs, std::max<size_t>(1, partition_kmers));
+
+        struct Slot
+        {
+            size_t partition = 0;
+            std::vector<C> kmers;
+        };
+
+        size_t next_partition = 0, total = 0;
+        OrderedPipeline<Slot> pipeline(threads > 0 ? threads : std::max(1, int(std::thread::hardware_concurrency())));
+        pipeline.run(
+            [&](Slot &slot)
+            {
+                slot.partition = next_partition++;
+                return next_partition <= splitters.size();
+            },
+            [&](Slot &slot)
+            {
+                slot.kmers.clear();
+                merge_partition(op, inputs, splitters, slot.partition, tax_tree, slot.kmers);
+            },
+            [&](Slot &slot)
+            {
+                total += slot.kmers.size();
+                write(slot.kmers);
+            });
+
+        return total;
+    }
+
+    // the result as .db or .dbs, depending on the first input
+    static size_t save(Op op, const Inputs &inputs, const std::string &out_file, int threads, const TaxIdTree *tax_tree = nullptr)
+    {
+        if (result_has_tax_ids(op, inputs))
+            return save<DBS::KmerTax>(op, inputs, out_file, threads, tax_tree);
+
+        return save<hash_t>(op, inputs, out_file, threads, tax_tree);
+    }
+
+private:
+    template <class C>
+    static size_t save(Op op, const Inputs &inputs, const std::string &out_file, int threads, const TaxIdTree *tax_tree)
+    {
+        DBSIO::DBSWriter<C> writer(out_file, kmer_len_of(inputs));
+        const size_t total = run<C>(op, inputs, threads, tax_tree, [&](const std::vector<C> &kmers) { writer.append(kmers); });
+        writer.close();
+        return total;
+    }
+
+    struct Cursor
+    {
+        hash_t kmer;
+        size_t input, pos, end;
+
+        bool operator > (const Cursor &x) const
+        {
+            return kmer > x.kmer || (kmer == x.kmer && input > x.input);
+        }
+    };
+
+    static void read_record(const Input &input, size_t pos, hash_t &x)
+    {
+        x = input.kmer(pos);
+    }
+
+    static void read_record(const Input &input, size_t pos, DBS::KmerTax &x)
+    {
+        memcpy(&x, input.records + pos * input.record_size, sizeof(x));
+    }
+
+    static void merge_records(hash_t &, const hash_t &, const TaxIdTree *) {}
+
+    static void merge_records(DBS::KmerTax &a, const DBS::KmerTax &b, const TaxIdTree *tax_tree)
+    {
+        a.tax_id = tax_tree->consensus_of(a.tax_id, b.tax_id);
+    }
+
+    // partition p covers kmers in [splitters[p - 1], splitters[p]), the first and the last are open
+    // splitters are sampled from all the inputs, so each partition gets about partition_kmers input kmers however they are spread
+    static std::vector<hash_t> partition_splitters(const Inputs &inputs, size_t partition_kmers)
+    {
+        std::vector<std::pair<hash_t, size_t>> samples; // kmer, input kmers from it to the next sample of its input
+        for (auto &input : inputs)
+            for (size_t pos = 0; pos < input->count; pos += SAMPLE_STEP)
+                samples.emplace_back(input->kmer(pos), std::min(size_t(SAMPLE_STEP), input->count - pos));
+
+        std::sort(samples.begin(), samples.end());
+
+        std::vector<hash_t> splitters;
+        size_t in_partition = 0;
+        for (auto &sample : samples)
+        {
+            if (in_partition >= partition_kmers && (splitters.empty() || sample.first > splitters.back()))
+            {
+                splitters.push_back(sample.first);
+                in_partition = 0;
+            }
+            in_partition += sample.second;
+        }
+        return splitters;
+    }
+
+    template <class C>
+    static void merge_partition(Op op, const Inputs &inputs, const std::vector<hash_t> &splitters, size_t partition, const TaxIdTree *tax_tree, std::vector<C> &out)
+    {
+        std::vector<Cursor> cursors; // in input order
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            auto &input = *inputs[i];
+            Cursor cursor;
+            cursor.input = i;
+            cursor.pos = partition > 0 ? input.lower_bound(splitters[partition - 1]) : 0;
+            cursor.end = partition < splitters.size() ? input.lower_bound(splitters[partition]) : input.count;
+            if (cursor.pos >= cursor.end)
+            {
+                if (op == INTERSECTION || (op == DIFFERENCE && i == 0))
+                    return;
+                continue;
+            }
+
+            cursor.kmer = input.kmer(cursor.pos);
+            cursors.push_back(cursor);
+        }
+
+        // equal kmers are taken in input order, duplicates within an input are merged as well
+        size_t present = 0;
+        bool in_first = false, has_record = false, first_done = false;
+        C record = C();
+
+        // takes all the records of the current kmer from the cursor, returns false when its run is over
+        auto consume = [&](Cursor &cursor, hash_t kmer)
+        {
+            auto &input = *inputs[cursor.input];
+            present++;
+            in_first = in_first || cursor.input == 0;
+
+            hash_t next = kmer;
+            do
+            {
+                if (op == UNION || cursor.input == 0)
+                {
+                    C x;
+                    read_record(input, cursor.pos, x);
+                    if (!has_record)
+                        record = x;
+                    else if (op == UNION)
+                        merge_records(record, x, tax_tree);
+                    has_record = true;
+                }
+
+                cursor.pos++;
+            } while (cursor.pos < cursor.end && (next = input.kmer(cursor.pos)) == kmer);
+
+            if (cursor.pos < cursor.end)
+            {
+                if (next < kmer)
+                    throw std::runtime_error(input.filename + " is not sorted");
+
+                cursor.kmer = next;
+                return true;
+            }
+
+            first_done = first_done || cursor.input == 0;
+            return false;
+        };
+
+        // returns false when nothing can be added anymore
+        auto finish_kmer = [&]
+        {
+            if (op == UNION || (op == INTERSECTION && present == inputs.size()) || (op == DIFFERENCE && in_first && present == 1))
+                out.push_back(record);
+
+            present = 0;
+            in_first = has_record = false;
+            return op == UNION || !first_done; // nothing to add without kmers of the first input
+        };
+
+        // a few runs are scanned for the minimum, more go through a heap
+        if (cursors.size() <= LINEAR_MERGE_RUNS)
+        {
+            while (!cursors.empty())
+            {
+                hash_t kmer = cursors.front().kmer;
+                for (auto &cursor : cursors)
+                    kmer = std::min(kmer, cursor.kmer);
+
+                for (size_t i = 0; i < cursors.size(); )
+                    if (cursors[i].kmer == kmer && !consume(cursors[i], kmer))
+                        cursors.erase(cursors.begin() + i);
+                    else
+                        i++;
+
+                if (!finish_kmer())
+                    break;
+            }
+            return;
+        }
+
+        auto greater = [](const Cursor &a, const Cursor &b) { return a > b; };
+        std::make_heap(cursors.begin(), cursors.end(), greater);
+        while (!cursors.empty())
+        {
+            const hash_t kmer = cursors.front().kmer;
+            while (!cursors.empty() && cursors.front().kmer == kmer)
+            {
+                std::pop_heap(cursors.begin(), cursors.end(), greater);
+                if (consume(cursors.back(), kmer))
+                    std::push_heap(cursors.begin(), cursors.end(), greater);
+                else
+                    cursors.pop_back();
+            }
+
+            if (!finish_kmer())
+                break;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,67 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+#include <string>
+#include <string>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+#include "dbs.h"
+#include "dbss.h"
+#include "config_dbs_to_dbsc.h"
+
+// converts .dbs or the tax ids of tax list from .dbss into compressed .dbsc searched by aligns_to -dbsc
+int main(int argc, char const *argv[])
+{
+	Config config(argc, argv);
+
+	std::vector<DBS::KmerTax> kmers;
+	size_t kmer_len = 0;
+	if (config.is_dbss())
+	{
+		auto dbss_reader = DBSS::make_reader(config.in_dbs);
+		kmer_len = dbss_reader->header.kmer_len;
+
+		DBSS::DBSAnnotation annotation;
+		auto sum_offset = DBSS::load_dbs_annotation(DBSS::DBSAnnot::annotation_filename(config.in_dbs), annotation);
+		dbss_reader->check_consistency(sum_offset);
+
+		auto tax_list = DBSS::load_tax_list(config.tax_list);
+		DBSS::load_dbss(kmers, dbss_reader, tax_list, annotation, config.num_threads);
+	}
+	else
+		kmer_len = DBSIO::load_dbs(config.in_dbs, kmers);
+
+	for (size_t i = 1; i < kmers.size(); i++)
+		if (kmers[i].kmer < kmers[i - 1].kmer)
+			throw std::runtime_error("dbs is not sorted, use sort_dbs first");
+
+	KmerCompressedIndex index;
+	index.build(kmers, (int)kmer_len);
+	DBSIO::save_dbsc(config.out_dbsc, index);
+	LOG("kmers: " << kmers.size() << " -> " << index.size() << " distinct");
+}
@@ -28,12 +28,14 @@
 
 #include <set>
 #include <map>
+#include <unordered_map>
 #include "dbs.h"
 #include "log.h"
 #include "missing_cpp_features.h"
 #include <algorithm>
-#include "taskflow/taskflow.hpp"
-#include <taskflow/algorithm/sort.hpp>
+#include <exception>
+#include "io.h"
+#include "omp_adapter.h"
 
 
 struct DBSS
@@ -64,19 +66,31 @@ struct DBSS
         const std::string dbss;
 
         DBSSReader(const std::string &dbss) : dbss(dbss){}
+        virtual ~DBSSReader() {}
         virtual void check_consistency(size_t sum_offset) = 0;
-        virtual void load_kmers(std::vector<hash_t> &hashes, tax_id_t tax_id, const DBSAnnot &annot) = 0;
+
+        // kmers of the tax partition, either loaded into storage or pointing into the mapped dbss
+        // can be called from several threads at once
+        virtual const hash_t *map_kmers(std::vector<hash_t> &storage, tax_id_t tax_id, const DBSAnnot &annot) = 0;
+
+        // mapping kmers point into if they are not loaded into storage
+        virtual const IO::MappedFile *kmers_mapping() const { return nullptr; }
+
+        // files the kmers of tax_list are read from
+        virtual std::vector<std::string> data_files(const TaxList &tax_list, const DBSAnnotation &annotation) const = 0;
     };
 
     struct DBSSFileReader : public DBSSReader
     {
         std::ifstream f;
+        IO::MappedFile mapping; // partitions are read by the page cache on first access
         DBSSFileReader(const std::string &dbss) : DBSSReader(dbss), f(dbss, std::ios::binary | std::ios::in)
         {
             if (f.fail() || f.eof())
                 throw std::runtime_error(std::string("cannot open dbss ") + dbss);
 
             IO::read(f, header);
+            mapping.open(dbss);
         }
 
         virtual void check_consistency(size_t sum_offset) override
@@ -85,11 +99,17 @@ struct DBSS
                 throw std::runtime_error("inconsistent dbss annotation file");
         }
 
-        virtual void load_kmers(std::vector<hash_t> &hashes, tax_id_t tax_id, const DBSAnnot &annot) override
+        virtual const hash_t *map_kmers(std::vector<hash_t> &storage, tax_id_t tax_id, const DBSAnnot &annot) override
         {
-            hashes.clear();
-            IO::load_vector_no_size(f, hashes, annot.offset, annot.count);
+            if (annot.offset + annot.count * sizeof(hash_t) > mapping.size)
+                throw std::runtime_error("dbss annotation points beyond the end of dbss");
+
+            return (const hash_t*)(mapping.data + annot.offset);
         }
+
+        virtual const IO::MappedFile *kmers_mapping() const override { return &mapping; }
+
+        virtual std::vector<std::string> data_files(const TaxList &, const DBSAnnotation &) const override { return { dbss }; }
     };
 
     struct DBSSFolderReader : public DBSSReader
@@ -105,7 +125,7 @@ struct DBSS
 
         virtual void check_consistency(size_t sum_offset) override {}; // doing nothing at the moment
 
-        virtual void load_kmers(std::vector<hash_t> &hashes, tax_id_t tax_id, const DBSAnnot &annot) override 
+        virtual const hash_t *map_kmers(std::vector<hash_t> &hashes, tax_id_t tax_id, const DBSAnnot &annot) override 
         {
             auto filename = tax_id_to_filename(dbss, tax_id);
 		    auto kmer_len = DBSIO::load_dbs(filename, hashes);
@@ -114,8 +134,19 @@ struct DBSS
 
             if (annot.count != hashes.size())
                 throw std::runtime_error(filename + std::string("kmer number of ") + std::to_string(hashes.size()) + " is inconsistent with the annotation kmer number of " + std::to_string(annot.count));
+
+            return hashes.data();
         };
 
+        virtual std::vector<std::string> data_files(const TaxList &tax_list, const DBSAnnotation &annotation) const override
+        {
+            std::vector<std::string> files = { dbss + "/" + "header" };
+            for (auto annot : select_partitions(tax_list, annotation))
+                files.push_back(tax_id_to_filename(dbss, annot->tax_id));
+
+            return files;
+        }
+
         static std::string tax_id_to_filename(const std::string &dbss, int tax_id)
         {
             return dbss + "/" + std::to_string(tax_id) + ".db";
@@ -125,10 +156,10 @@ struct DBSS
     static std::unique_ptr<DBSSReader> make_reader(const std::string &dbss)
     {
         if (IO::file_exists(dbss))
-            return make_unique<DBSSFileReader>(dbss);
+            return std::make_unique<DBSSFileReader>(dbss);
 
         if (IO::is_folder(dbss + ".split"))
-            return make_unique<DBSSFolderReader>(dbss + ".split");
+            return std::make_unique<DBSSFolderReader>(dbss + ".split");
 
         throw std::runtime_error(std::string("cannot open dbss ") + dbss);
     }
@@ -189,47 +220,300 @@ struct DBSS
         return taxes;
     }
 
+    // sorted kmers of one tax
+    struct Partition
+    {
+        const hash_t *kmers;
+        size_t count;
+        tax_id_t tax_id;
+        const IO::MappedFile *mapping; // merged pages are dropped from memory if kmers are mapped
+    };
+
+    static const size_t MERGE_RANGE_SIZE = 16 * 1024; // kmers merged at once, fits in cache
+    static const size_t SAMPLES_PER_RANGE = 16;
+    static const int SPANS_PER_THREAD = 4; // spans are uneven, so more spans than threads
+    static const size_t RELEASE_EVERY_RANGES = 64;
+
+    // merges partitions sorted by kmer into hash_array, equal kmers keep the order of partitions
+    // kmer space is cut into small ranges by splitters sampled from all partitions
+    // consecutive ranges form spans merged by separate threads, every range is gathered from all partitions and sorted in cache
+    // (a heap or loser tree over thousands of partitions is bound by memory latency and loses to that)
     template <class C>
-    static void load_dbss(std::vector<C> &hash_array, std::unique_ptr<DBSSReader> &dbss_reader, const TaxList &tax_list, const DBSAnnotation &annotation, int num_threads)
+    static void merge_partitions(const std::vector<Partition> &partitions, std::vector<C> &hash_array, int thread_count)
     {
+        size_t total = 0;
+        for (auto &p : partitions)
+            total += p.count;
+
         hash_array.clear();
+        hash_array.resize(total);
+        if (!total)
+            return;
+
+        // every range takes a few kmers of every partition on average, so walking all partitions per range stays cheap
+        const size_t range_size = std::max(size_t(MERGE_RANGE_SIZE), partitions.size() * 4);
+        const size_t range_count = std::max(size_t(1), total / range_size);
+        auto splitters = sample_splitters(partitions, total, range_count);
+
+        const size_t span_count = std::min(range_count, size_t(std::max(1, thread_count)) * SPANS_PER_THREAD);
+        std::vector<size_t> first_range(span_count + 1);
+        for (size_t s = 0; s <= span_count; s++)
+            first_range[s] = s * range_count / span_count;
+
+        // cuts[s][p] is the first kmer of partition p in span s, equal kmers always fall into one range
+        std::vector<std::vector<size_t>> cuts(span_count + 1, std::vector<size_t>(partitions.size(), 0));
+        for (size_t p = 0; p < partitions.size(); p++)
+            cuts[span_count][p] = partitions[p].count;
+
+        #pragma omp parallel for num_threads(thread_count) schedule(dynamic)
+        for (int p = 0; p < int(partitions.size()); p++)
+        {
+            auto &partition = partitions[p];
+            for (size_t s = 1; s < span_count; s++)
+                cuts[s][p] = std::lower_bound(partition.kmers, partition.kmers + partition.count, splitters[first_range[s] - 1]) - partition.kmers;
 
-        size_t total_hashes_count = 0;
-        for (auto tax_id : tax_list)
-            for (auto& annot : annotation)
-                if (annot.tax_id == tax_id)
-                    total_hashes_count += annot.count;
+            if (partition.mapping) // binary searches touch pages all over the partition as well
+                partition.mapping->release(partition.kmers, partition.count * sizeof(hash_t));
+        }
+
+        std::vector<size_t> offsets(span_count + 1, 0);
+        for (size_t s = 0; s < span_count; s++)
+        {
+            offsets[s + 1] = offsets[s];
+            for (size_t p = 0; p < partitions.size(); p++)
+                offsets[s + 1] += cuts[s + 1][p] - cuts[s][p];
+        }
+
+        #pragma omp parallel for num_threads(thread_count) schedule(dynamic)
+        for (int s = 0; s < int(span_count); s++)
+            merge_span(partitions, splitters, first_range[s], first_range[s + 1], cuts[s], cuts[s + 1], hash_array.data() + offsets[s]);
+    }
 
-        hash_array.reserve(total_hashes_count);
+    // range_count - 1 sorted kmers evenly sampled from all partitions, range r ends before splitters[r]
+    static std::vector<hash_t> sample_splitters(const std::vector<Partition> &partitions, size_t total, size_t range_count)
+    {
+        const size_t step = std::max(size_t(1), total / (range_count * SAMPLES_PER_RANGE));
+        std::vector<hash_t> samples;
+        size_t next = step / 2, first = 0;
+        for (auto &p : partitions)
+        {
+            for (; next < first + p.count; next += step)
+                samples.push_back(p.kmers[next - first]);
+
+            if (p.mapping) // samples touch pages all over the partition
+                p.mapping->release(p.kmers, p.count * sizeof(hash_t));
+
+            first += p.count;
+        }
 
-        {        
-            std::vector<hash_t> hashes;
-            for (auto tax_id : tax_list)
-                for (auto& annot : annotation) 
-                    if (annot.tax_id == tax_id && annot.count > 0) 
+        std::sort(samples.begin(), samples.end());
+        std::vector<hash_t> splitters(range_count - 1);
+        for (size_t r = 0; r + 1 < range_count; r++)
+            splitters[r] = samples[(r + 1) * samples.size() / range_count];
+
+        return splitters;
+    }
+
+    // merges ranges [first_range, end_range) made of [from[p], to[p]) of every partition into out
+    template <class C>
+    static void merge_span(const std::vector<Partition> &partitions, const std::vector<hash_t> &splitters, size_t first_range, size_t end_range, const std::vector<size_t> &from, const std::vector<size_t> &to, C *out)
+    {
+        std::vector<size_t> pos(from), released(from);
+        std::vector<C> buffer;
+        std::vector<size_t> counts;
+
+        for (size_t r = first_range; r < end_range; r++)
+        {
+            C *range_begin = out;
+            for (size_t p = 0; p < partitions.size(); p++)
+            {
+                auto &partition = partitions[p];
+                auto &i = pos[p];
+                if (r + 1 == end_range)
+                    for (; i < to[p]; i++)
+                        *out++ = C(partition.kmers[i], partition.tax_id);
+                else
+                    for (; i < to[p] && partition.kmers[i] < splitters[r]; i++)
+                        *out++ = C(partition.kmers[i], partition.tax_id);
+            }
+
+            sort_range(range_begin, out, buffer, counts);
+
+            if ((r - first_range + 1) % RELEASE_EVERY_RANGES == 0 || r + 1 == end_range)
+                for (size_t p = 0; p < partitions.size(); p++)
+                    if (partitions[p].mapping)
                     {
-                        dbss_reader->load_kmers(hashes, tax_id, annot);
-                        for (auto hash : hashes)
-                            hash_array.emplace_back(hash, annot.tax_id);
+                        partitions[p].mapping->release(partitions[p].kmers + released[p], (pos[p] - released[p]) * sizeof(hash_t));
+                        released[p] = pos[p];
                     }
         }
+    }
 
-        if (hash_array.size() != total_hashes_count)
+    // stable sort by kmer of a range gathered from sorted partitions
+    // kmers are distributed into about one bucket per kmer by their high bits, buckets are sorted by insertion
+    template <class C>
+    static void sort_range(C *begin, C *end, std::vector<C> &buffer, std::vector<size_t> &counts)
+    {
+        auto kmer_less = [](const C &a, const C &b) { return a.kmer < b.kmer; };
+        const size_t n = end - begin;
+        if (n < 64)
         {
-            std::cerr << hash_array.size() << " of " << total_hashes_count << " loaded " << std::endl;
-            throw std::runtime_error("unable to load all kmers");
+            std::stable_sort(begin, end, kmer_less);
+            return;
         }
-        
-        LOG("dbss parts loaded (" << (total_hashes_count / 1000 / 1000) << "m kmers)");
-        if (num_threads > 0) {
-            tf::Executor executor(num_threads);
-            tf::Taskflow taskflow;
-            taskflow.sort(hash_array.begin(), hash_array.end());
-            executor.run(taskflow).wait();
-        } else {    
-            std::sort(hash_array.begin(), hash_array.end()); // todo: parallel sort in new C++
+
+        hash_t lo = begin->kmer, hi = begin->kmer;
+        for (auto x = begin; x != end; x++)
+        {
+            lo = std::min(lo, x->kmer);
+            hi = std::max(hi, x->kmer);
         }
+
+        int shift = 0;
+        while (((hi - lo) >> shift) >= n)
+            shift++;
+
+        const size_t bucket_count = size_t((hi - lo) >> shift) + 1;
+        counts.assign(bucket_count + 1, 0);
+        for (auto x = begin; x != end; x++)
+            counts[((x->kmer - lo) >> shift) + 1]++;
+
+        for (size_t b = 1; b <= bucket_count; b++)
+            counts[b] += counts[b - 1];
+
+        buffer.resize(n);
+        for (auto x = begin; x != end; x++)
+            buffer[counts[(x->kmer - lo) >> shift]++] = *x; // counts[b] becomes the end of bucket b
+
+        for (size_t b = 0, bucket_begin = 0; b < bucket_count; bucket_begin = counts[b++])
+        {
+            const size_t bucket_end = counts[b];
+            if (bucket_end - bucket_begin > 16) // many equal or close kmers
+            {
+                std::stable_sort(buffer.begin() + bucket_begin, buffer.begin() + bucket_end, kmer_less);
+                continue;
+            }
+
+            for (size_t i = bucket_begin + 1; i < bucket_end; i++)
+            {
+                C x = buffer[i];
+                size_t j = i;
+                for (; j > bucket_begin && x.kmer < buffer[j - 1].kmer; j--)
+                    buffer[j] = buffer[j - 1];
+
+                buffer[j] = x;
+            }
+        }
+
+        std::copy(buffer.begin(), buffer.end(), begin);
+    }
+
+    // non-empty partitions of the tax_list taxes
+    static std::vector<const DBSAnnot*> select_partitions(const TaxList &tax_list, const DBSAnnotation &annotation)
+    {
+        std::vector<const DBSAnnot*> selected;
+        for (auto tax_id : tax_list)
+        {
+            auto annot = std::lower_bound(annotation.begin(), annotation.end(), DBSAnnot(tax_id, 0, 0)); // annotation is sorted by tax
+            if (annot != annotation.end() && annot->tax_id == tax_id && annot->count > 0)
+                selected.push_back(&*annot);
+        }
+
+        return selected;
+    }
+
+    // partitions of tax_list are mapped or loaded in parallel and merged into hash_array sorted by kmer
+    template <class C>
+    static void load_dbss(std::vector<C> &hash_array, std::unique_ptr<DBSSReader> &dbss_reader, const TaxList &tax_list, const DBSAnnotation &annotation, int num_threads)
+    {
+        auto selected = select_partitions(tax_list, annotation);
+        const int thread_count = num_threads > 0 ? num_threads : omp_get_max_threads();
+        std::vector<std::vector<hash_t>> storage(selected.size());
+        std::vector<Partition> partitions(selected.size());
+        size_t total_hashes_count = 0;
+        std::exception_ptr error;
+
+        #pragma omp parallel for num_threads(thread_count) schedule(dynamic) reduction(+:total_hashes_count)
+        for (int i = 0; i < int(selected.size()); i++)
+        {
+            try
+            {
+                auto &annot = *selected[i];
+                auto kmers = dbss_reader->map_kmers(storage[i], annot.tax_id, annot);
+                auto mapping = kmers == storage[i].data() ? nullptr : dbss_reader->kmers_mapping();
+                if (!std::is_sorted(kmers, kmers + annot.count))
+                {
+                    if (mapping)
+                        storage[i].assign(kmers, kmers + annot.count);
+
+                    std::sort(storage[i].begin(), storage[i].end());
+                    kmers = storage[i].data();
+                }
+
+                if (mapping) // pages are read again by the merge, no need to keep all of them until then
+                    mapping->release(kmers, annot.count * sizeof(hash_t));
+
+                partitions[i] = Partition{kmers, annot.count, annot.tax_id, mapping};
+                total_hashes_count += annot.count;
+            }
+            catch (...)
+            {
+                #pragma omp critical (dbss_load_error)
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+
+        if (error)
+            std::rethrow_exception(error);
+
+        LOG("dbss parts loaded (" << (total_hashes_count / 1000 / 1000) << "m kmers)");
+        merge_partitions(partitions, hash_array, thread_count);
         LOG("dbss parts merged");
     }
+
+    // writes the .dbss and its annotation of a .dbs sorted by kmer without loading it:
+    // one pass counts kmers of every tax, the second one scatters kmers into their tax ranges of the mapped output
+    static void save_dbss_from_dbs(const std::string &dbs_file, const std::string &dbss_file)
+    {
+        IO::MappedFile mapping;
+        ArrayView<DBS::KmerTax> kmers;
+        const size_t kmer_len = DBSIO::map_dbs(dbs_file, mapping, kmers, IO::MappedFile::PREFETCH_NONE);
+
+        std::unordered_map<tax_id_t, size_t> counts;
+        for (auto &k : kmers)
+            counts[k.tax_id]++;
+
+        std::unordered_map<tax_id_t, size_t> cursors;
+        size_t offset = 0;
+        {
+            std::ofstream f(DBSAnnot::annotation_filename(dbss_file));
+            for (auto &c : std::map<tax_id_t, size_t>(counts.begin(), counts.end()))
+            {
+                if (c.first <= 0)
+                    throw std::runtime_error("invalid taxonomy");
+
+                cursors[c.first] = offset;
+                offset += c.second;
+                f << c.first << '\t' << c.second << std::endl;
+            }
+        }
+
+        IO::MappedOutFile out;
+        out.create(dbss_file, sizeof(DBSIO::DBSHeader) + sizeof(size_t) + kmers.size() * sizeof(hash_t));
+        DBSIO::DBSHeader header(kmer_len);
+        const size_t count = kmers.size();
+        memcpy(out.data, &header, sizeof(header));
+        memcpy(out.data + sizeof(header), &count, sizeof(count));
+        hash_t *hashes = (hash_t*)(out.data + sizeof(header) + sizeof(count));
+
+        const size_t RELEASE_EVERY = 1024 * 1024;
+        for (size_t i = 0; i < kmers.size(); i++)
+        {
+            hashes[cursors[kmers[i].tax_id]++] = kmers[i].kmer;
+            if ((i + 1) % RELEASE_EVERY == 0)
+                mapping.release(&kmers[i + 1 - RELEASE_EVERY], RELEASE_EVERY * sizeof(DBS::KmerTax));
+        }
+    }
 };
 
@@ -0,0 +1,417 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+#include <exception>
+#include <algorithm>
+#include <assert.h>
+
+#include "reader.h"
+#include "fasta_reader.h"
+#include "compressed_input.h"
+#include "omp_adapter.h"
+
+// FASTA and FASTQ reader working on large blocks instead of lines
+// records are located in the block with memchr and parsed into fragments by thread_count omp threads
+// produces the same fragments as FastaReader for fasta input
+// gzip, bgzf and zstd input is decompressed on the fly, bgzf blocks and zstd frames by thread_count threads
+// fastq records are expected to be 4 lines each (no multi-line sequence or quality)
+class FastxReader final: public Reader
+{
+public:
+    enum Format
+    {
+        FORMAT_FASTA,
+        FORMAT_FASTQ
+    };
+
+    static const size_t BLOCK_SIZE = 16 * 1024 * 1024; // todo: tune
+    static const size_t BATCH_SIZE = 4096; // fragments parsed at once when served by read()
+    static const int SAM_QUALITY_BASE = 33;
+    static const int MIN_GOOD_QUALITY = SAM_QUALITY_BASE + 3; // same as vdb reader
+
+    static bool is_fastq(const std::string &filename) 
+    {
+        auto name = InputStream::strip_compression_extension(filename);
+        return ends_with(name, ".fastq") || ends_with(name, ".fq");
+    }
+
+    static bool is_fastx(const std::string &filename) 
+    {
+        return FastaReader::is_fasta(InputStream::strip_compression_extension(filename)) || is_fastq(filename);
+    }
+
+    FastxReader(const std::string &filename, bool read_qualities = false, int thread_count = 1, size_t block_size = BLOCK_SIZE)
+        : read_qualities(read_qualities)
+        , thread_count(std::max(1, thread_count))
+        , input(InputStream::open(filename, thread_count))
+        , buffer(std::max(size_t(1), block_size))
+    {
+        // format is recognized by the first record, so fastq can come from stdin as well
+        while (begin < end || fill())
+        {
+            if (buffer[begin] != '\n' && buffer[begin] != '\r')
+            {
+                format = buffer[begin] == '@' ? FORMAT_FASTQ : FORMAT_FASTA;
+                break;
+            }
+            begin++; // leading empty lines
+        }
+    }
+
+    FastxReader(const FastxReader &) = delete;
+    FastxReader &operator = (const FastxReader &) = delete;
+
+    Format file_format() const { return format; }
+
+    virtual SourceStats stats() const override 
+    {
+        assert(at_eof());
+        return SourceStats(spot_count, read_count);
+    }
+
+    virtual float progress() const override 
+    {
+        return at_eof() ? 1.0f : input->progress();
+    }
+
+    bool read(Fragment* output) override 
+    {
+        if (parsed_idx >= parsed.size())
+        {
+            parsed.resize(BATCH_SIZE);
+            parsed.resize(parse_into(parsed, 0));
+            parsed_idx = 0;
+            if (parsed.empty())
+                return false;
+        }
+
+        if (output)
+            std::swap(*output, parsed[parsed_idx]);
+
+        parsed_idx++;
+        return true;
+    }
+
+    // fragments are parsed directly into output, strings of output are reused
+    bool read_many(std::vector<Fragment>& output, size_t chunk_size) override 
+    {
+        if (chunk_size == 0)
+            chunk_size = DEFAULT_CHUNK_SIZE;
+
+        output.resize(std::max(output.capacity(), chunk_size));
+        size_t count = 0;
+
+        while (count < output.size() && parsed_idx < parsed.size()) // leftovers of read()
+            std::swap(output[count++], parsed[parsed_idx++]);
+
+        output.resize(parse_into(output, count));
+        return !output.empty();
+    }
+
+private:
+    struct Record
+    {
+        size_t desc, desc_end; // description line without '>' or '@'
+        size_t seq, seq_end; // fasta: all lines of sequence including line ends
+        size_t qual, qual_end; // fastq only
+    };
+
+    const bool read_qualities;
+    const int thread_count;
+    InputStreamPtr input;
+    Format format = FORMAT_FASTA;
+
+    std::vector<char> buffer;
+    size_t begin = 0, end = 0; // unparsed data of buffer
+    bool input_eof = false;
+
+    std::vector<Record> records;
+    std::vector<Fragment> parsed; // used by read()
+    size_t parsed_idx = 0;
+
+    size_t spot_count = 0, read_count = 0;
+    std::string last_spot_id;
+
+    bool at_eof() const { return input_eof && begin == end && parsed_idx >= parsed.size(); }
+
+    static bool ends_with(const std::string &s, const std::string &end)
+    {
+        if (end.size() > s.size()) 
+            return false;
+
+        return std::equal(end.rbegin(), end.rend(), s.rbegin());
+    }
+
+    // moves unparsed data to the beginning of the buffer and reads next block
+    // returns false if nothing was read
+    bool fill()
+    {
+        if (input_eof)
+            return false;
+
+        if (begin > 0)
+        {
+            memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+
+        if (end == buffer.size()) // record longer than the buffer
+            buffer.resize(buffer.size() * 2);
+
+        auto bytes = input->read(buffer.data() + end, buffer.size() - end);
+        end += bytes;
+        input_eof = bytes == 0;
+        return bytes > 0;
+    }
+
+    const char *find_char(size_t from, char c) const
+    {
+        return (const char*)memchr(buffer.data() + from, c, end - from);
+    }
+
+    // end of line starting at from, or npos if the line is not complete yet
+    size_t line_end(size_t from) const
+    {
+        auto p = find_char(from, '\n');
+        if (p)
+            return p - buffer.data();
+
+        return input_eof ? end : std::string::npos;
+    }
+
+    // [from, to) of the next line, returns false if it is not complete yet
+    bool next_line(size_t &from, size_t &to) const
+    {
+        to = line_end(from);
+        return to != std::string::npos;
+    }
+
+    static size_t after_line(size_t line_end, size_t end) { return std::min(line_end + 1, end); }
+
+    bool find_fasta_record(size_t at, Record &record, size_t &next) const
+    {
+        size_t line = 0;
+        if (!next_line(at, line))
+            return false;
+
+        record.desc = at + 1;
+        record.desc_end = std::max(record.desc, line);
+        record.seq = after_line(line, end);
+
+        // record ends where the next line starts with '>'
+        size_t pos = record.seq;
+        while (pos < end && buffer[pos] != '>')
+        {
+            auto p = find_char(pos, '\n');
+            pos = p ? p - buffer.data() + 1 : end;
+        }
+
+        if (pos == end && !input_eof)
+            return false; // cannot tell yet if the record continues in the next block
+
+        record.seq_end = pos;
+        record.qual = record.qual_end = 0;
+        next = pos;
+        return true;
+    }
+
+    bool find_fastq_record(size_t at, Record &record, size_t &next) const
+    {
+        size_t desc_end = 0, seq_end = 0, plus_end = 0, qual_end = 0;
+        if (!next_line(at, desc_end))
+            return false;
+
+        size_t seq = after_line(desc_end, end);
+        if (!next_line(seq, seq_end))
+            return false;
+
+        size_t plus = after_line(seq_end, end);
+        if (!next_line(plus, plus_end))
+            return false;
+
+        size_t qual = after_line(plus_end, end);
+        if (!next_line(qual, qual_end))
+            return false;
+
+        if (buffer[at] != '@' || plus >= end || buffer[plus] != '+')
+            throw std::runtime_error(std::string("invalid fastq record: ") + std::string(buffer.data() + at, desc_end - at));
+
+        record.desc = at + 1;
+        record.desc_end = desc_end;
+        record.seq = seq;
+        record.seq_end = seq_end;
+        record.qual = qual;
+        record.qual_end = qual_end;
+        next = after_line(qual_end, end);
+        return true;
+    }
+
+    // collects up to max_count complete records of the buffer, reads next block if there are none
+    size_t find_records(size_t max_count)
+    {
+        records.clear();
+        while (records.size() < max_count)
+        {
+            if (format == FORMAT_FASTQ)
+                while (begin < end && (buffer[begin] == '\n' || buffer[begin] == '\r'))
+                    begin++; // empty lines between records
+
+            if (begin == end)
+            {
+                if (!records.empty() || !fill()) // found records point into the buffer, parse them first
+                    break;
+
+                continue;
+            }
+
+            Record record;
+            size_t next = 0;
+            bool found = format == FORMAT_FASTQ ? find_fastq_record(begin, record, next) : find_fasta_record(begin, record, next);
+            if (!found)
+            {
+                if (!records.empty())
+                    break;
+
+                fill();
+                continue;
+            }
+
+            records.push_back(record);
+            begin = next;
+        }
+
+        return records.size();
+    }
+
+    static size_t trim_cr(const char *line, size_t from, size_t to)
+    {
+        return (to > from && line[to - 1] == '\r') ? to - 1 : to;
+    }
+
+    void parse_record(const Record &record, Fragment &output) const
+    {
+        const char *data = buffer.data();
+        size_t desc_end = trim_cr(data, record.desc, record.desc_end);
+
+        auto id_end = record.desc;
+        while (id_end < desc_end && data[id_end] != ' ' && data[id_end] != '/')
+            id_end++;
+
+        output.spotid.assign(data + record.desc, id_end - record.desc);
+        output.bases.clear();
+
+        if (format == FORMAT_FASTQ)
+        {
+            size_t seq_end = trim_cr(data, record.seq, record.seq_end);
+            output.bases.assign(data + record.seq, seq_end - record.seq);
+
+            if (read_qualities)
+            {
+                size_t qual_end = trim_cr(data, record.qual, record.qual_end);
+                if (qual_end - record.qual != output.bases.size())
+                    throw std::runtime_error(std::string("quality length does not match read length: ") + std::string(data + record.desc, desc_end - record.desc));
+
+                for (size_t i = 0; i < output.bases.size(); i++)
+                    if ((unsigned char)data[record.qual + i] < MIN_GOOD_QUALITY)
+                        output.bases[i] = 'N';
+            }
+        }
+        else
+        {
+            size_t pos = record.seq;
+            while (pos < record.seq_end)
+            {
+                auto p = (const char*)memchr(data + pos, '\n', record.seq_end - pos);
+                size_t line_end = p ? p - data : record.seq_end;
+                output.bases.append(data + pos, trim_cr(data, pos, line_end) - pos);
+                pos = line_end + 1;
+            }
+        }
+
+        if (output.bases.empty())
+            throw std::runtime_error(std::string("Read is empty: ") + std::string(data + record.desc, desc_end - record.desc));
+    }
+
+    // fills output from offset to its end, returns count of fragments in output
+    size_t parse_into(std::vector<Fragment> &output, size_t offset)
+    {
+        while (offset < output.size())
+        {
+            size_t found = find_records(output.size() - offset);
+            if (found == 0)
+                break;
+
+            parse_records(output, offset);
+            offset += found;
+        }
+
+        return offset;
+    }
+
+    // parses records into output starting at offset, updates stats
+    void parse_records(std::vector<Fragment> &output, size_t offset)
+    {
+        const int count = (int)records.size();
+        std::exception_ptr error;
+
+        #pragma omp parallel for num_threads(thread_count) schedule(static) if(thread_count > 1 && count >= 256)
+        for (int i = 0; i < count; i++)
+        {
+            try
+            {
+                parse_record(records[i], output[offset + i]);
+            }
+            catch (...)
+            {
+                #pragma omp critical (fastx_reader_error)
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+
+        if (error)
+            std::rethrow_exception(error);
+
+        for (int i = 0; i < count; i++)
+        {
+            auto &spotid = output[offset + i].spotid;
+            if (spotid != last_spot_id)
+            {
+                spot_count++;
+                last_spot_id = spotid;
+            }
+        }
+
+        read_count += count;
+    }
+};
@@ -4,7 +4,8 @@
 #include <map>
 #include "config_find_closest_profile_linear.h"
 #include "file_list_loader.h"
-#include "io.h"
+#include "profile_index.h"
+#include "omp_adapter.h"
 #include <algorithm>
 
 typedef uint64_t hash_t;
@@ -22,31 +23,34 @@ typedef std::vector<Profile> Profiles;
 
 void load_profile(const string &filename, Profile &profile)
 {
-    std::ifstream f(filename, std::ios::in | std::ios::binary);
-    if (!f.good())
-        throw std::runtime_error(string("cannot load profile ") + filename);
-
     profile.filename = filename;
-    IO::load_vector(f, profile.kmers);
+    profile.kmers = ProfileIndex::load_profile(filename);
 }
 
-void load_profiles(const string &file_list_name, Profiles &profiles)
+vector<string> profile_files(const string &file_list_name)
 {
 	FileListLoader file_list(file_list_name);
-    profiles.resize(file_list.files.size());
-    cout << "loading " << file_list.files.size() << " profiles" << endl;
-    for (int file_number = 0; file_number < int(file_list.files.size()); file_number ++)
-    {
-        auto &file = file_list.files[file_number];
-        load_profile(file.filename, profiles[file_number]);
-//        load_profile(file.filename + ".profile", profiles[file_number]);
-    }
+    vector<string> filenames;
+    for (auto &file : file_list.files)
+        filenames.push_back(file.filename);
+//        filenames.push_back(file.filename + ".profile");
+
+    return filenames;
+}
+
+void load_profiles(const string &file_list_name, Profiles &profiles)
+{
+    auto filenames = profile_files(file_list_name);
+    profiles.resize(filenames.size());
+    cout << "loading " << filenames.size() << " profiles" << endl;
+    for (int file_number = 0; file_number < int(filenames.size()); file_number ++)
+        load_profile(filenames[file_number], profiles[file_number]);
     cout << "loaded" << endl;
 }
 
 struct ProfileSimilarity
 {
-    double operator() ( const Profile &a, const Profile &b) const
+    size_t operator() ( const Profile &a, const Profile &b) const
     {
         if (a.kmers.size() != b.kmers.size())
             throw std::runtime_error("ProfileSimilarity:: a.kmers.size() != b.kmers.size()");
@@ -54,56 +58,103 @@ struct ProfileSimilarity
         if (a.kmers.empty())
             throw std::runtime_error("ProfileSimilarity:: a.kmers.empty()");
 
-        double sum = 0;
-        for (int i=0; i < a.kmers.size(); i++)
-            if (a.kmers[i] == b.kmers[i])
-                sum++;
-
-        return sum / a.kmers.size();
+        return ProfileIndex::equal_count(a.kmers.data(), b.kmers.data(), a.kmers.size());
     }
 };
 
-int main(int argc, char const *argv[])
-{
-	Config config(argc, argv);
-
-	auto before = high_resolution_clock::now();
+typedef std::vector<ProfileIndex::Match> Matches;
 
+// all the profiles are compared with every query
+vector<Matches> closest_linear(const Config &config, const Profiles &queries, int threads, vector<string> &filenames)
+{
     Profiles profiles;
     load_profiles(config.file_list, profiles);
-
-    Profile profile;
-    load_profile(config.profile_file, profile);
+    for (auto &profile : profiles)
+        filenames.push_back(profile.filename);
 
     ProfileSimilarity sim;
+    vector<Matches> results(queries.size());
+    for (size_t q = 0; q < queries.size(); q++)
+    {
+        auto &res = results[q];
+        res.resize(profiles.size());
+
+       	#pragma omp parallel for num_threads(threads)
+        for (int i = 0; i < int(res.size()); i++)
+            res[i] = ProfileIndex::Match(i, sim(queries[q], profiles[i]));
+
+        ProfileIndex::top(res, config.top_count);
+    }
 
-    struct ComparisonResult
+    return results;
+}
+
+// candidates from the LSH bands of the index are compared first
+vector<Matches> closest_indexed(const Config &config, const Profiles &queries, int threads, vector<string> &filenames)
+{
+    ProfileIndex index;
+    const auto files = profile_files(config.file_list);
+    auto source = ProfileIndex::source_of(config.file_list, files);
+    if (!index.open(config.index_file, source))
+    {
+        cout << "building profile index " << config.index_file << endl;
+        ProfileIndex::build(config.index_file, files, source, config.rows);
+        if (!index.open(config.index_file, source))
+            throw std::runtime_error(string("cannot open profile index ") + config.index_file);
+    }
+
+    filenames = index.names;
+    cout << "profile index of " << index.size() << " profiles, " << index.header.bands << " bands of " << index.header.rows << " rows" << endl;
+
+    vector<Matches> results(queries.size());
+    vector<ProfileIndex::QueryStats> stats(queries.size());
+   	#pragma omp parallel for num_threads(threads) schedule(dynamic)
+    for (int q = 0; q < int(queries.size()); q++)
+        results[q] = index.closest(queries[q].kmers, config.top_count, &stats[q]);
+
+    size_t candidates = 0, scanned = 0;
+    for (auto &s : stats)
     {
-        double sim = 0;
-        string filename;
+        candidates += s.candidates;
+        scanned += s.scanned;
+    }
 
-        ComparisonResult() = default;
-        ComparisonResult(double sim, const string &filename) : sim(sim), filename(filename){}
+    cerr << "candidates per query " << (queries.empty() ? 0 : candidates / queries.size()) << ", queries compared with all profiles " << scanned << " of " << queries.size() << endl;
+    return results;
+}
 
-        bool operator < (const ComparisonResult &x) const
-        {
-            return sim > x.sim;
-        }
-    };
+int main(int argc, char const *argv[])
+{
+	Config config(argc, argv);
 
-    typedef std::vector<ComparisonResult> ComparisonResults;
+	auto before = high_resolution_clock::now();
 
-    ComparisonResults res(profiles.size());
+    Profiles queries;
+    if (config.batch)
+    {
+        auto filenames = profile_files(config.profile_file);
+        queries.resize(filenames.size());
+        for (size_t i = 0; i < filenames.size(); i++)
+            load_profile(filenames[i], queries[i]);
+    }
+    else
+    {
+        queries.resize(1);
+        load_profile(config.profile_file, queries[0]);
+    }
 
-    const int THREADS = 32;
-   	#pragma omp parallel for num_threads(THREADS)
-    for (int i = 0; i < res.size(); i++)
-        res[i] = ComparisonResult(sim(profile, profiles[i]), profiles[i].filename);
+    const int threads = config.threads > 0 ? config.threads : omp_get_max_threads();
+    vector<string> filenames;
+    auto results = config.index_file.empty() ? closest_linear(config, queries, threads, filenames) : closest_indexed(config, queries, threads, filenames);
 
-    std::sort(res.begin(), res.end());
+    for (size_t q = 0; q < queries.size(); q++)
+    {
+        if (config.batch)
+            cout << "query " << queries[q].filename << endl;
 
-    for (int i = 0; i < config.top_count && i < res.size(); i++)
-        cout << res[i].sim << " " << res[i].filename << endl;
+        for (auto &match : results[q])
+            cout << double(match.equal) / queries[q].kmers.size() << " " << filenames[match.profile] << endl;
+    }
 
 	cerr << "total time (sec) " << std::chrono::duration_cast<std::chrono::seconds>( high_resolution_clock::now() - before ).count() << endl;
 }
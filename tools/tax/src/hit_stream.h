@@ -0,0 +1,330 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <cstring>
+#include <charconv>
+#include <type_traits>
+#include <stdint.h>
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// binary hits of aligns_to -out_format binary|binary_zstd, the same data as the text lines
+// "spot<tab>tax_id[xcount]..." without number formatting, written and read a chunk at a time
+//
+// header: "TAXHITS1", flags byte
+// chunk: uint32 records, uint32 raw size, uint32 stored size, stored bytes (a zstd frame with ZSTD flag)
+// end: a chunk header of 0 records and sizes, a stream without it is truncated
+// record: varint spot id size, spot id, varint hit count, varint tax ids, varint counts (with HAS_COUNTS flag)
+struct HitStream
+{
+    static const int HAS_COUNTS = 1;
+    static const int ZSTD = 2;
+    static const size_t MAGIC_SIZE = 8;
+    static const size_t CHUNK_SIZE = 4 * 1024 * 1024; // raw bytes per chunk
+    static const int ZSTD_LEVEL = 3;
+
+    static const char *magic() { return "TAXHITS1"; }
+
+    struct Hit
+    {
+        int32_t tax_id; // stored as uint32, as tax_id_t it can be negative
+        uint32_t count;
+    };
+
+    struct ChunkHeader
+    {
+        uint32_t records, raw_size, stored_size;
+    };
+
+    // signed numbers keep their sign, tax ids are signed
+    template <class Number>
+    static void append_number(std::string &out, Number x)
+    {
+        static_assert(std::is_integral<Number>::value, "append_number of an integer");
+        char buf[24];
+        auto res = std::to_chars(buf, buf + sizeof(buf), x);
+        out.append(buf, res.ptr);
+    }
+
+    // aligns_to text line "spot<tab>tax_id[xcount]...", tabs and line ends of spot id are replaced with spaces
+    template <class Hits>
+    static void append_text(std::string &out, const std::string &spotid, const Hits &hits, bool print_counts)
+    {
+        auto from = out.size();
+        out.append(spotid);
+        for (auto i = from; i < out.size(); i++)
+            if (out[i] == '\t' || out[i] == '\n')
+                out[i] = ' ';
+
+        for (auto &hit : hits)
+        {
+            out.push_back('\t');
+            append_number(out, hit.tax_id);
+            if (print_counts && hit.count > 1)
+            {
+                out.push_back('x');
+                append_number(out, hit.count);
+            }
+        }
+
+        out.push_back('\n');
+    }
+
+    static bool is_hit_stream(const std::string &filename)
+    {
+        std::ifstream f(filename, std::ios::binary);
+        char header[MAGIC_SIZE];
+        return f.read(header, MAGIC_SIZE) && memcmp(header, magic(), MAGIC_SIZE) == 0;
+    }
+};
+
+class HitStreamWriter
+{
+    std::ostream &f;
+    const int flags;
+    std::string raw, stored;
+    uint32_t records = 0;
+    bool closed = false;
+
+    void put_varint(uint64_t x)
+    {
+        while (x >= 0x80)
+        {
+            raw.push_back(char(x | 0x80));
+            x >>= 7;
+        }
+        raw.push_back(char(x));
+    }
+
+    void write_chunk()
+    {
+        if (!records)
+            return;
+
+        const std::string *out = &raw;
+#if HAVE_ZSTD
+        if (flags & HitStream::ZSTD)
+        {
+            stored.resize(ZSTD_compressBound(raw.size()));
+            auto size = ZSTD_compress(&stored[0], stored.size(), raw.data(), raw.size(), HitStream::ZSTD_LEVEL);
+            if (ZSTD_isError(size))
+                throw std::runtime_error(std::string("cannot compress hits: ") + ZSTD_getErrorName(size));
+            stored.resize(size);
+            out = &stored;
+        }
+#endif
+        HitStream::ChunkHeader header = { records, uint32_t(raw.size()), uint32_t(out->size()) };
+        f.write((const char*)&header, sizeof(header));
+        f.write(out->data(), out->size());
+        if (!f)
+            throw std::runtime_error("failed to write hits (no space left on drive?)");
+
+        raw.clear();
+        records = 0;
+    }
+
+public:
+    HitStreamWriter(std::ostream &f, bool has_counts, bool compress) : f(f), flags((has_counts ? HitStream::HAS_COUNTS : 0) | (compress ? HitStream::ZSTD : 0))
+    {
+#if !HAVE_ZSTD
+        if (compress)
+            throw std::runtime_error("zstd output is not supported by this build");
+#endif
+        raw.reserve(HitStream::CHUNK_SIZE + 4096);
+        f.write(HitStream::magic(), HitStream::MAGIC_SIZE);
+        f.put(char(flags));
+    }
+
+    bool has_counts() const { return flags & HitStream::HAS_COUNTS; }
+
+    // hits are iterated twice, every hit has tax_id and count
+    template <class Hits>
+    void add(const std::string &spotid, const Hits &hits)
+    {
+        put_varint(spotid.size());
+        raw.append(spotid);
+        put_varint(std::distance(hits.begin(), hits.end()));
+        for (auto &hit : hits)
+            put_varint(uint32_t(hit.tax_id));
+        if (has_counts())
+            for (auto &hit : hits)
+                put_varint(hit.count);
+
+        records++;
+        if (raw.size() >= HitStream::CHUNK_SIZE)
+            write_chunk();
+    }
+
+    void add(const std::string &spotid)
+    {
+        add(spotid, std::vector<HitStream::Hit>());
+    }
+
+    // writes the last chunk and the end marker, the stream is incomplete without them
+    void close()
+    {
+        if (closed)
+            return;
+
+        write_chunk();
+        HitStream::ChunkHeader end = { 0, 0, 0 };
+        f.write((const char*)&end, sizeof(end));
+        f.flush();
+        if (!f)
+            throw std::runtime_error("failed to write hits (no space left on drive?)");
+
+        closed = true;
+    }
+};
+
+class HitStreamReader
+{
+    std::ifstream f;
+    int flags = 0;
+    std::string raw, stored;
+    size_t pos = 0, file_size = 0;
+    uint32_t records_left = 0;
+    bool ended = false;
+
+    // false after the end marker
+    bool read_chunk()
+    {
+        if (ended)
+            return false;
+
+        HitStream::ChunkHeader header;
+        if (!f.read((char*)&header, sizeof(header)))
+            throw std::runtime_error(f.gcount() ? "truncated hits chunk header" : "truncated hits, no end marker");
+
+        if (!header.records)
+        {
+            if (header.raw_size || header.stored_size)
+                throw std::runtime_error("corrupted hits chunk");
+
+            ended = true;
+            return false;
+        }
+
+        if (header.stored_size > file_size - size_t(f.tellg()))
+            throw std::runtime_error("truncated hits chunk");
+
+        auto &in = (flags & HitStream::ZSTD) ? stored : raw;
+        in.resize(header.stored_size);
+        if (!f.read(&in[0], in.size()))
+            throw std::runtime_error("truncated hits chunk");
+
+#if HAVE_ZSTD
+        if (flags & HitStream::ZSTD)
+        {
+            if (ZSTD_getFrameContentSize(stored.data(), stored.size()) != header.raw_size)
+                throw std::runtime_error("corrupted hits chunk");
+
+            raw.resize(header.raw_size);
+            auto size = ZSTD_decompress(&raw[0], raw.size(), stored.data(), stored.size());
+            if (ZSTD_isError(size) || size != header.raw_size)
+                throw std::runtime_error("corrupted hits chunk");
+        }
+#endif
+        if (raw.size() != header.raw_size)
+            throw std::runtime_error("corrupted hits chunk");
+
+        pos = 0;
+        records_left = header.records;
+        return true;
+    }
+
+    uint64_t get_varint()
+    {
+        uint64_t x = 0;
+        for (int shift = 0; pos < raw.size() && shift < 64; shift += 7)
+        {
+            auto c = (unsigned char)raw[pos++];
+            x |= uint64_t(c & 0x7f) << shift;
+            if (c < 0x80)
+                return x;
+        }
+
+        throw std::runtime_error("corrupted hits record");
+    }
+
+public:
+    HitStreamReader(const std::string &filename) : f(filename, std::ios::binary)
+    {
+        if (!f)
+            throw std::runtime_error("cannot open hits " + filename);
+
+        f.seekg(0, std::ios::end);
+        file_size = size_t(f.tellg());
+        f.seekg(0);
+        char header[HitStream::MAGIC_SIZE + 1];
+        if (!f.read(header, sizeof(header)) || memcmp(header, HitStream::magic(), HitStream::MAGIC_SIZE) != 0)
+            throw std::runtime_error("not a hits file " + filename);
+
+        flags = header[HitStream::MAGIC_SIZE];
+#if !HAVE_ZSTD
+        if (flags & HitStream::ZSTD)
+            throw std::runtime_error("zstd hits are not supported by this build: " + filename);
+#endif
+    }
+
+    bool has_counts() const { return flags & HitStream::HAS_COUNTS; }
+
+    // counts are 1 when the stream has none
+    bool next(std::string &spotid, std::vector<uint32_t> &tax_ids, std::vector<uint32_t> &counts)
+    {
+        while (!records_left)
+            if (!read_chunk())
+                return false;
+
+        auto size = get_varint();
+        if (size > raw.size() - pos)
+            throw std::runtime_error("corrupted hits record");
+
+        spotid.assign(raw, pos, size);
+        pos += size;
+        const auto hit_count = get_varint();
+        if (hit_count > raw.size() - pos) // every hit takes at least a byte
+            throw std::runtime_error("corrupted hits record");
+
+        tax_ids.resize(hit_count);
+        for (auto &tax_id : tax_ids)
+            tax_id = uint32_t(get_varint());
+        counts.resize(tax_ids.size());
+        for (auto &count : counts)
+            count = has_counts() ? uint32_t(get_varint()) : 1;
+
+        records_left--;
+        return true;
+    }
+};
@@ -34,6 +34,12 @@
 #include <set>
 #include "missing_cpp_features.h"
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <streambuf>
 
 struct IO
 {
@@ -104,6 +110,7 @@ struct IO
         std::ofstream out_f;
         std::ofstream &stream_f;
         int stream_id = -1;
+        std::ostream *other_f = nullptr; // written instead of std::cout when filename is empty
 
         Writer(const std::string &filename) : filename(filename), out_f(filename), stream_f(out_f)
         {
@@ -111,13 +118,20 @@ struct IO
             check();
         }
 
-        Writer(const Writer &writer, int stream_id) : filename(writer.filename), stream_f(writer.stream_f), stream_id(stream_id)
+        Writer(std::ostream &other_f) : stream_f(out_f), other_f(&other_f)
+        {
+        }
+
+        Writer(const Writer &writer, int stream_id) : filename(writer.filename), stream_f(writer.stream_f), stream_id(stream_id), other_f(writer.other_f)
         {
         }
 
         std::ostream &f()
         {
-            return filename.empty() ? std::cout : stream_f;
+            if (!filename.empty())
+                return stream_f;
+
+            return other_f ? *other_f : std::cout;
         }
 
         void check()
@@ -136,6 +150,211 @@ struct IO
     };
 #endif
 
+    // buffered output to a file descriptor, e.g. one received over a unix socket
+    struct FdOutBuf : public std::streambuf
+    {
+        int fd;
+        std::vector<char> buffer;
+
+        FdOutBuf(int fd, size_t buffer_size = 1024 * 1024) : fd(fd), buffer(buffer_size)
+        {
+            setp(buffer.data(), buffer.data() + buffer.size());
+        }
+
+        ~FdOutBuf()
+        {
+            sync();
+        }
+
+    protected:
+        virtual int_type overflow(int_type c) override
+        {
+            if (!flush_buffer())
+                return traits_type::eof();
+
+            if (!traits_type::eq_int_type(c, traits_type::eof()))
+            {
+                *pptr() = traits_type::to_char_type(c);
+                pbump(1);
+            }
+
+            return traits_type::not_eof(c);
+        }
+
+        virtual int sync() override
+        {
+            return flush_buffer() ? 0 : -1;
+        }
+
+    private:
+        bool flush_buffer()
+        {
+            for (const char *p = pbase(); p < pptr(); )
+            {
+                const ssize_t written = ::write(fd, p, pptr() - p);
+                if (written < 0 && errno == EINTR)
+                    continue;
+
+                if (written <= 0)
+                    return false;
+
+                p += written;
+            }
+
+            setp(buffer.data(), buffer.data() + buffer.size());
+            return true;
+        }
+    };
+
+    // read-only memory mapping of the whole file
+    // pages are shared through the page cache, so concurrent processes mapping the same file hold one copy
+    struct MappedFile
+    {
+        enum Prefetch
+        {
+            PREFETCH_NONE,      // pages are faulted in on first access
+            PREFETCH_WILLNEED,  // asynchronous readahead of the whole file
+            PREFETCH_POPULATE   // synchronous load of the whole file before returning
+        };
+
+        const char *data = nullptr;
+        size_t size = 0;
+
+        MappedFile() = default;
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator = (const MappedFile &) = delete;
+
+        void open(const std::string &filename, Prefetch prefetch = PREFETCH_NONE)
+        {
+            close();
+            int fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error(std::string("cannot open file ") + filename);
+
+            struct stat file_stat;
+            if (fstat(fd, &file_stat) != 0)
+            {
+                ::close(fd);
+                throw std::runtime_error(std::string("cannot stat file ") + filename);
+            }
+
+            if (file_stat.st_size > 0)
+            {
+                int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+                if (prefetch == PREFETCH_POPULATE)
+                    flags |= MAP_POPULATE;
+#endif
+                void *p = mmap(nullptr, file_stat.st_size, PROT_READ, flags, fd, 0);
+                if (p == MAP_FAILED)
+                {
+                    ::close(fd);
+                    throw std::runtime_error(std::string("cannot mmap file ") + filename);
+                }
+
+                data = (const char*)p;
+                size = file_stat.st_size;
+                if (prefetch == PREFETCH_WILLNEED)
+                    madvise(p, size, MADV_WILLNEED);
+            }
+
+            ::close(fd); // mapping stays valid
+        }
+
+        void close()
+        {
+            if (data)
+                munmap((void*)data, size);
+
+            data = nullptr;
+            size = 0;
+        }
+
+        bool is_open() const { return data != nullptr; }
+
+        // drops pages ending within [from, from + bytes) from the process memory, so consecutive calls release consecutive data
+        // the mapping stays valid, pages are read from the page cache again on next access
+        void release(const void *from, size_t bytes) const
+        {
+            const size_t page_size = sysconf(_SC_PAGESIZE);
+            const size_t begin = std::max((size_t)data, (size_t)from / page_size * page_size);
+            const size_t end = ((size_t)from + bytes) / page_size * page_size;
+            if (begin < end)
+                madvise((void*)begin, end - begin, MADV_DONTNEED);
+        }
+
+        static Prefetch prefetch_from_string(const std::string &s)
+        {
+            if (s.empty() || s == "none")
+                return PREFETCH_NONE;
+            if (s == "willneed")
+                return PREFETCH_WILLNEED;
+            if (s == "populate")
+                return PREFETCH_POPULATE;
+
+            throw std::runtime_error(std::string("unknown mmap prefetch policy ") + s);
+        }
+
+        ~MappedFile()
+        {
+            close();
+        }
+    };
+
+    // writable shared mapping of a new file of a known size, for outputs written out of order
+    struct MappedOutFile
+    {
+        char *data = nullptr;
+        size_t size = 0;
+
+        MappedOutFile() = default;
+        MappedOutFile(const MappedOutFile &) = delete;
+        MappedOutFile &operator = (const MappedOutFile &) = delete;
+
+        void create(const std::string &filename, size_t file_size)
+        {
+            close();
+            int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                throw std::runtime_error(std::string("cannot create file ") + filename);
+
+            if (ftruncate(fd, file_size) != 0)
+            {
+                ::close(fd);
+                throw std::runtime_error(std::string("cannot resize file ") + filename);
+            }
+
+            if (file_size > 0)
+            {
+                void *p = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (p == MAP_FAILED)
+                {
+                    ::close(fd);
+                    throw std::runtime_error(std::string("cannot mmap file ") + filename);
+                }
+
+                data = (char*)p;
+                size = file_size;
+            }
+
+            ::close(fd);
+        }
+
+        void close()
+        {
+            if (data)
+                munmap(data, size);
+
+            data = nullptr;
+            size = 0;
+        }
+
+        ~MappedOutFile()
+        {
+            close();
+        }
+    };
+
     template <class C>
     static void save_vector_data(std::ofstream &f, const std::vector<C> &v, size_t offset = 0)
     {
@@ -0,0 +1,169 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <stdint.h>
+#include "kmer_hash.h"
+#include "array_view.h"
+#include "log.h"
+#include "omp_adapter.h"
+
+// blocked bloom filter of database kmers answering "definitely not in the database" before the search
+// all bits of a kmer are in one cache line: one bit in each of the 8 words of the block selected by the kmer hash,
+// so a lookup costs at most one cache miss, with 12 bits per kmer about 0.4% of absent kmers pass the filter
+struct KmerBloomFilter
+{
+    static const size_t BITS_PER_KMER = 12;
+    static const size_t PREFETCH_DISTANCE = 8;
+
+    struct alignas(64) Block
+    {
+        uint64_t words[8];
+    };
+
+    // lookups of one read are counted locally and added to the run metrics at once
+    struct Counts
+    {
+        size_t lookups = 0, rejected = 0, found = 0;
+    };
+
+    std::vector<Block> storage; // blocks when built, empty when attached to the lookup index sidecar
+    ArrayView<Block> blocks;
+
+    void init(size_t kmer_count)
+    {
+        const size_t block_bits = sizeof(Block) * 8;
+        storage.assign(std::max(size_t(1), (kmer_count * BITS_PER_KMER + block_bits - 1) / block_bits), Block());
+        blocks = storage;
+    }
+
+    void attach(const Block *data, size_t count)
+    {
+        storage.clear();
+        blocks = ArrayView<Block>(data, count);
+    }
+
+    // can be called by many threads at once, while the filter is built
+    void add(hash_t kmer)
+    {
+        const uint64_t h = mix(kmer);
+        auto &block = storage[block_of(h)];
+        for (int w = 0; w < 8; w++)
+            __atomic_fetch_or(&block.words[w], bit_of(h, w), __ATOMIC_RELAXED);
+    }
+
+    template <class Array, class KmerOf>
+    void build(const Array &array, KmerOf &&kmer_of)
+    {
+        init(array.size());
+        const long long count = (long long)array.size();
+        #pragma omp parallel for schedule(static)
+        for (long long i = 0; i < count; i++)
+            add(kmer_of(array[i]));
+
+        log_size();
+    }
+
+    void log_size() const { LOG("prefilter created, " << (blocks.size() * sizeof(Block) / 1024 / 1024) << "MB"); }
+
+    bool may_contain(hash_t kmer) const
+    {
+        const uint64_t h = mix(kmer);
+        const auto &block = blocks[block_of(h)];
+        bool found = true;
+        for (int w = 0; w < 8; w++)
+            found &= (block.words[w] & bit_of(h, w)) != 0;
+
+        return found;
+    }
+
+    void prefetch(hash_t kmer) const { __builtin_prefetch(&blocks[block_of(mix(kmer))]); }
+
+    // removes kmers which are not in the database from keys and from the parallel array values, if given
+    // blocks of the next kmers are prefetched while the current one is tested
+    template <class Value>
+    void remove_absent(std::vector<hash_t> &keys, std::vector<Value> *values, Counts &counts) const
+    {
+        const size_t count = keys.size();
+        size_t kept = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (i + PREFETCH_DISTANCE < count)
+                prefetch(keys[i + PREFETCH_DISTANCE]);
+
+            if (may_contain(keys[i]))
+            {
+                keys[kept] = keys[i];
+                if (values)
+                    (*values)[kept] = (*values)[i];
+                kept++;
+            }
+        }
+
+        counts.lookups += count;
+        counts.rejected += count - kept;
+        keys.resize(kept);
+        if (values)
+            values->resize(kept);
+    }
+
+    void remove_absent(std::vector<hash_t> &keys, Counts &counts) const { remove_absent<hash_t>(keys, nullptr, counts); }
+
+    // counts of one run, summed by the run metrics of its pipeline, so concurrent runs of a server do not mix
+    static void log_stats(const Counts &counts)
+    {
+        const size_t passed = counts.lookups - counts.rejected;
+        LOG("prefilter: " << counts.lookups << " lookups, " << counts.rejected << " rejected (" << percent(counts.rejected, counts.lookups) << "%), "
+            << (passed - counts.found) << " false positives (" << percent(passed - counts.found, counts.lookups - counts.found) << "% of absent kmers)");
+    }
+
+private:
+    static float percent(size_t part, size_t total) { return total ? 100.0f * part / total : 0.0f; }
+
+    // murmur3 finalizer, kmers themselves are far from uniform in their high bits
+    static uint64_t mix(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    size_t block_of(uint64_t h) const { return size_t(((unsigned __int128)h * blocks.size()) >> 64); }
+
+    // upper half of the hash is used for blocks, the lower one for bits: 6 bits of its product with an odd salt per word
+    static uint64_t bit_of(uint64_t h, int word)
+    {
+        static const uint32_t SALT[8] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU, 0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+        return uint64_t(1) << ((uint32_t(h) * SALT[word]) >> 26);
+    }
+};
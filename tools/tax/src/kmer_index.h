@@ -0,0 +1,706 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include <assert.h>
+#include "kmer_hash.h"
+#include "array_view.h"
+#include "log.h"
+
+// static search structures over a sorted array of kmer records (anything with .kmer and .tax_id members)
+// built once after the database is loaded and shared read-only by all matcher threads
+
+template <class Record>
+inline hash_t kmer_of(const Record &record) { return record.kmer; }
+
+inline hash_t kmer_of(hash_t kmer) { return kmer; } // arrays of bare kmers
+
+// lookup table of record ranges bucketed by the top bits of the kmer
+// built in memory or attached to a table saved in the lookup index sidecar of the database
+struct KmerBucketIndex
+{
+    std::vector<size_t> storage; // table when built, empty when attached
+    ArrayView<size_t> table; // bucket count + 1
+    int shift = 0;
+
+    KmerBucketIndex() = default;
+    KmerBucketIndex(KmerBucketIndex &&) = default; // the table view stays valid
+    KmerBucketIndex &operator = (KmerBucketIndex &&) = default;
+    KmerBucketIndex(const KmerBucketIndex &) = delete;
+
+    static int lookup_key_bits(size_t array_size)
+    {
+        int bits = 1;
+        while ((array_size >> bits) > 5)
+            bits += 1;
+
+        return bits;
+    }
+
+    template <class SortedArray>
+    void build(const SortedArray &array, int kmer_len)
+    {
+        const int key_bits = lookup_key_bits(array.size());
+        shift = kmer_len * 2 - key_bits;
+
+        const size_t bucket_count = size_t(1) << key_bits;
+        LOG("creating lookup table with " << bucket_count << " buckets, on average " << (float(array.size()) / bucket_count) << " hashes per bucket");
+        storage.resize(bucket_count + 1);
+        auto &table = storage;
+
+        // figuring out bucket ranges
+        size_t hash_idx = 0;
+#ifndef NDEBUG
+        hash_t last_hash = 0;
+#endif
+        for (size_t bucket_idx = 0; bucket_idx < bucket_count; ++bucket_idx)
+        {
+            table[bucket_idx] = hash_idx;
+            while (hash_idx < array.size())
+            {
+                hash_t hash = kmer_of(array[hash_idx]);
+                if ((hash >> shift) != bucket_idx)
+                    break;
+
+#ifndef NDEBUG
+                assert(hash >= last_hash);
+                last_hash = hash;
+#endif
+                ++hash_idx;
+            }
+        }
+        table[bucket_count] = array.size();
+        this->table = storage;
+    }
+
+    void attach(const size_t *table_data, size_t bucket_count, int key_shift)
+    {
+        storage.clear();
+        table = ArrayView<size_t>(table_data, bucket_count + 1);
+        shift = key_shift;
+    }
+
+    size_t bucket_count() const { return table.empty() ? 0 : table.size() - 1; }
+
+    // checks the table against the array at a sample of buckets, catches a table of another array of the same size
+    template <class SortedArray>
+    bool matches(const SortedArray &array, size_t samples = 4096) const
+    {
+        const size_t count = bucket_count();
+        if (count == 0 || table[0] != 0 || table[count] != array.size())
+            return false;
+
+        for (size_t i = 0; i <= samples; i++)
+        {
+            const size_t bucket = std::min(count - 1, i * count / samples);
+            const size_t begin = table[bucket], end = table[bucket + 1];
+            if (begin > end || end > array.size())
+                return false;
+
+            if (begin > 0 && (kmer_of(array[begin - 1]) >> shift) >= bucket)
+                return false;
+
+            if (begin < end && ((kmer_of(array[begin]) >> shift) != bucket || (kmer_of(array[end - 1]) >> shift) != bucket))
+                return false;
+        }
+
+        return true;
+    }
+
+    size_t bucket_of(hash_t hash) const { return hash >> shift; }
+    size_t bucket_begin(size_t bucket) const { return table[bucket]; }
+    size_t bucket_end(size_t bucket) const { return table[bucket + 1]; }
+
+    // batched lookups touch the table slot first and the bucket records a few lookups later
+    void prefetch_bucket(hash_t hash) const { __builtin_prefetch(&table[bucket_of(hash)]); }
+
+    template <class SortedArray>
+    void prefetch_records(const SortedArray &array, hash_t hash) const { __builtin_prefetch(array.data() + bucket_begin(bucket_of(hash))); }
+};
+
+// same buckets as KmerBucketIndex over a copy of the kmers split into separate key and tax id arrays
+// a bucket holds ~5 keys, so its keys usually share one cache line and are scanned linearly,
+// the tax id line is touched only on a hit
+struct KmerSoABucketIndex
+{
+    KmerBucketIndex buckets;
+    std::vector<hash_t> keys;
+    std::vector<int> tax_ids;
+
+    template <class SortedArray>
+    void build(const SortedArray &array, int kmer_len)
+    {
+        buckets.build(array, kmer_len);
+        keys.resize(array.size());
+        tax_ids.resize(array.size());
+        for (size_t i = 0; i < array.size(); i++)
+        {
+            keys[i] = array[i].kmer;
+            tax_ids[i] = array[i].tax_id;
+        }
+        LOG("soa index created, " << (keys.size() * (sizeof(hash_t) + sizeof(int)) / 1024 / 1024) << "MB");
+    }
+
+    size_t size() const { return keys.size(); }
+
+    void prefetch_bucket(hash_t hash) const { buckets.prefetch_bucket(hash); }
+    void prefetch_records(hash_t hash) const { buckets.prefetch_records(keys, hash); }
+
+    // returns tax id of the kmer or 0 if not found
+    int find(hash_t hash) const
+    {
+        const auto bucket = buckets.bucket_of(hash);
+        const size_t end = buckets.bucket_end(bucket);
+        for (size_t i = buckets.bucket_begin(bucket); i < end; i++)
+            if (keys[i] >= hash)
+                return keys[i] == hash ? tax_ids[i] : 0;
+
+        return 0;
+    }
+};
+
+// kmers with any number of tax ids in compressed sparse row form: sorted kmers, offsets of their tax id ranges
+// and the tax ids of all kmers in one array, kmer i owns tax_ids[offsets[i], offsets[i + 1] - gap)
+// gap is the count of ints between the ranges, 0 for the compact array or the record header size
+// when tax_ids points into a memory mapped .dbsm file, so the ranges are handed out without copying
+struct KmerMultiTaxIndex
+{
+    typedef ArrayView<int> TaxIds;
+
+    std::vector<hash_t> kmers;
+    std::vector<size_t> offsets; // kmers.size() + 1
+    std::vector<int> tax_storage; // storage of tax_ids when loaded, empty when mapped
+    ArrayView<int> tax_ids;
+    size_t gap = 0;
+    KmerBucketIndex buckets;
+
+    size_t size() const { return kmers.size(); }
+    size_t memory_bytes() const { return kmers.size() * sizeof(hash_t) + offsets.size() * sizeof(size_t) + tax_storage.size() * sizeof(int); }
+
+    void build(int kmer_len)
+    {
+        for (size_t i = 1; i < kmers.size(); i++)
+            if (kmers[i] < kmers[i - 1])
+                throw std::runtime_error("multi tax kmer index:: kmers are not sorted");
+
+        buckets.build(kmers, kmer_len);
+    }
+
+    // moves the ranges of tax_storage to its beginning, dropping the gaps between them
+    void compact()
+    {
+        assert(tax_ids.data() == tax_storage.data());
+        size_t to = 0;
+        for (size_t i = 0; i < kmers.size(); i++)
+        {
+            const size_t from = offsets[i], count = offsets[i + 1] - gap - from;
+            memmove(tax_storage.data() + to, tax_storage.data() + from, count * sizeof(int));
+            offsets[i] = to;
+            to += count;
+        }
+        offsets[kmers.size()] = to;
+        gap = 0;
+        tax_storage.resize(to);
+        tax_storage.shrink_to_fit();
+        tax_ids = tax_storage;
+    }
+
+    void prefetch_bucket(hash_t hash) const { buckets.prefetch_bucket(hash); }
+    void prefetch_records(hash_t hash) const { buckets.prefetch_records(kmers, hash); }
+
+    // returns tax ids of the kmer, empty if not found
+    TaxIds find(hash_t hash) const
+    {
+        const auto bucket = buckets.bucket_of(hash);
+        const size_t end = buckets.bucket_end(bucket);
+        for (size_t i = buckets.bucket_begin(bucket); i < end; i++)
+            if (kmers[i] >= hash)
+                return kmers[i] == hash ? TaxIds(tax_ids.data() + offsets[i], offsets[i + 1] - gap - offsets[i]) : TaxIds();
+
+        return TaxIds();
+    }
+};
+
+// compressed kmers searchable in place, the same image is built in memory, saved as .dbsc file and loaded or memory mapped
+// kmers are split into blocks of BLOCK_SIZE, a block keeps its first kmer in the skip array and Elias-Fano codes
+// the differences of the others to it: the high parts in unary (bit (difference >> l) + i is set for the i-th difference)
+// followed by l low bits of every difference, followed by tax ids of all kmers of the block,
+// so a lookup touches a few neighbouring cache lines of one block
+// tax ids are replaced by their index in a sorted dictionary of distinct tax ids and packed with the minimal width
+// a lookup finds the block with a lookup table over the skip array and decodes the block only up to the kmer
+// duplicate kmers are stored once with the first tax id, as lower_bound over the array would find
+struct KmerCompressedIndex
+{
+    static const size_t BLOCK_SIZE = 128;
+    static const uint64_t MAGIC = 0x3143534244; // "DBSC1"
+    static const uint64_t VERSION = 1;
+
+    // trivial, so it is copied from and to the image with memcpy
+    struct Header
+    {
+        uint64_t magic, version, kmer_len, kmer_count, block_size, block_count;
+        uint64_t tax_count, tax_bits, data_words; // data words without the padding word
+
+        static Header empty() { return Header{MAGIC, VERSION, 0, 0, BLOCK_SIZE, 0, 0, 0, 0}; }
+    };
+
+    struct Block
+    {
+        hash_t kmer; // first kmer of the block
+        uint64_t bits; // bit offset of the block data << 6 | width of low bits
+    };
+
+    // image is the header followed by tax dictionary (padded to words), skip array with one extra block
+    // pointing to the end of the data, and the data of all blocks with one padding word
+    std::vector<uint64_t> image; // storage when the index is built or loaded, empty when attached to a mapped file
+    Header header = Header::empty();
+    ArrayView<int> tax_dictionary;
+    ArrayView<Block> blocks; // block_count + 1
+    const uint64_t *data = nullptr;
+    KmerBucketIndex buckets; // over the first kmers of the blocks
+
+    size_t size() const { return header.kmer_count; }
+    int kmer_len() const { return int(header.kmer_len); }
+    size_t memory_bytes() const { return image_words(header) * sizeof(uint64_t) + buckets.table.size() * sizeof(size_t); }
+
+    template <class SortedArray>
+    void build(const SortedArray &array, int kmer_len)
+    {
+        if (kmer_len < 1 || kmer_len > 32)
+            throw std::runtime_error("compressed kmer index:: invalid kmer_len");
+
+        std::vector<int> dictionary;
+        size_t kmer_count = 0, compact_size = 1024 * 1024;
+        for (size_t i = 0; i < array.size(); i++)
+        {
+            if (i > 0 && array[i].kmer == array[i - 1].kmer)
+                continue;
+
+            kmer_count++;
+            dictionary.push_back(array[i].tax_id);
+            if (dictionary.size() >= compact_size)
+            {
+                sort_unique(dictionary);
+                compact_size = 2 * dictionary.size() + 1024 * 1024;
+            }
+        }
+        sort_unique(dictionary);
+
+        Header h = Header::empty();
+        h.kmer_len = kmer_len;
+        h.kmer_count = kmer_count;
+        h.block_count = (kmer_count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        h.tax_count = dictionary.size();
+        h.tax_bits = dictionary.size() > 1 ? 64 - __builtin_clzll(dictionary.size() - 1) : 0;
+
+        std::vector<Block> skip(h.block_count + 1);
+        std::vector<uint64_t> bits;
+        uint64_t bit_count = 0;
+        hash_t block_kmers[BLOCK_SIZE];
+        uint64_t block_taxes[BLOCK_SIZE];
+        size_t rank = 0;
+
+        for (size_t i = 0; i < array.size(); i++)
+        {
+            if (i > 0 && array[i].kmer == array[i - 1].kmer)
+                continue;
+
+            assert(i == 0 || array[i].kmer > array[i - 1].kmer);
+            block_kmers[rank % BLOCK_SIZE] = array[i].kmer;
+            block_taxes[rank % BLOCK_SIZE] = std::lower_bound(dictionary.begin(), dictionary.end(), int(array[i].tax_id)) - dictionary.begin();
+            rank++;
+            if (rank % BLOCK_SIZE == 0 || rank == kmer_count)
+                encode_block(block_kmers, block_taxes, (rank - 1) % BLOCK_SIZE + 1, int(h.tax_bits), skip[(rank - 1) / BLOCK_SIZE], bits, bit_count);
+        }
+
+        skip[h.block_count] = Block{0, bit_count << 6};
+        h.data_words = (bit_count + 63) / 64;
+        bits.resize(h.data_words + 1, 0);
+
+        image.assign(image_words(h), 0);
+        uint64_t *p = image.data();
+        memcpy(p, &h, sizeof(h));
+        p += header_words();
+        memcpy(p, dictionary.data(), dictionary.size() * sizeof(int));
+        p += dictionary_words(h);
+        memcpy(p, skip.data(), skip.size() * sizeof(Block));
+        p += skip.size() * (sizeof(Block) / sizeof(uint64_t));
+        memcpy(p, bits.data(), bits.size() * sizeof(uint64_t));
+
+        attach(image.data(), image.size());
+        LOG("compressed index created, " << (memory_bytes() / 1024 / 1024) << "MB, " << (kmer_count ? float(memory_bytes()) / kmer_count : 0.0f) << " bytes per kmer");
+    }
+
+    // points the index to an image of words, e.g. the image member or a memory mapped file, and builds the lookup table
+    void attach(const uint64_t *image_data, size_t words)
+    {
+        if (words < header_words())
+            throw std::runtime_error("compressed kmer index is truncated");
+
+        memcpy(&header, image_data, sizeof(header));
+        if (header.magic != MAGIC)
+            throw std::runtime_error("not a compressed kmer index");
+        if (header.version != VERSION || header.block_size != BLOCK_SIZE)
+            throw std::runtime_error("unsupported compressed kmer index version");
+        if (header.kmer_len < 1 || header.kmer_len > 32 || header.tax_bits > 32 || header.block_count != (header.kmer_count + BLOCK_SIZE - 1) / BLOCK_SIZE)
+            throw std::runtime_error("invalid compressed kmer index header");
+        if (words != image_words(header))
+            throw std::runtime_error("compressed kmer index is truncated");
+
+        const uint64_t *p = image_data + header_words();
+        tax_dictionary = ArrayView<int>((const int*)p, header.tax_count);
+        p += dictionary_words(header);
+        blocks = ArrayView<Block>((const Block*)p, header.block_count + 1);
+        p += blocks.size() * (sizeof(Block) / sizeof(uint64_t));
+        data = p;
+
+        buckets.build(ArrayView<Block>(blocks.data(), header.block_count), kmer_len());
+    }
+
+    // calls f(kmer) for all kmers in no particular order, blocks are decoded by omp threads in parallel so f must be thread safe
+    template <class F>
+    void for_each_kmer(F &&f) const
+    {
+        const long long block_count = (long long)header.block_count;
+        #pragma omp parallel for schedule(dynamic, 1024)
+        for (long long b = 0; b < block_count; b++)
+        {
+            BlockData block = {};
+            find_block(blocks[b].kmer, block);
+            assert(block.index == size_t(b));
+            f(blocks[b].kmer);
+            for (size_t pos = block.high_begin, i = 0; i < block.count; pos++)
+                if (read_bits(data, pos, 1))
+                {
+                    const uint64_t high = pos - block.high_begin - i;
+                    f(blocks[b].kmer + ((high << block.low_width) | read_bits(data, block.low_begin + i * block.low_width, block.low_width)));
+                    i++;
+                }
+        }
+    }
+
+    // the lookup table is small enough to stay in cache, so the skip array entries are prefetched first
+    // and the unary, low bits and tax id lines expected for the kmer once its block is known
+    void prefetch_bucket(hash_t hash) const { buckets.prefetch_records(blocks, hash); }
+
+    void prefetch_records(hash_t hash) const
+    {
+        BlockData block = {};
+        if (find_block(hash, block))
+            prefetch_block(block, hash);
+    }
+
+    // returns tax id of the kmer or 0 if not found
+    int find(hash_t hash) const
+    {
+        BlockData block = {};
+        if (!find_block(hash, block))
+            return 0;
+
+        prefetch_block(block, hash); // misses of the low bits and tax id overlap with decoding of the unary part
+
+        const hash_t first = blocks[block.index].kmer;
+        if (hash == first)
+            return tax_of(block, 0);
+
+        const hash_t difference = hash - first;
+        const uint64_t high = difference >> block.low_width;
+        const uint64_t low = difference & low_mask(block.low_width);
+        const uint64_t high_end = block.low_begin;
+
+        // differences with this high part start after high zeros of the unary part
+        uint64_t pos = block.high_begin;
+        for (uint64_t zeros_left = high; zeros_left > 0; )
+        {
+            if (pos >= high_end)
+                return 0;
+
+            const int available = int(std::min(uint64_t(64), high_end - pos));
+            uint64_t zeros = ~read_bits(data, pos, available) & low_mask(available);
+            const uint64_t zero_count = __builtin_popcountll(zeros);
+            if (zero_count < zeros_left)
+            {
+                zeros_left -= zero_count;
+                pos += available;
+                continue;
+            }
+
+            pos += select_in_word(zeros, int(zeros_left) - 1) + 1;
+            break;
+        }
+
+        for (size_t i = pos - block.high_begin - high; pos < high_end && read_bits(data, pos, 1); pos++, i++)
+        {
+            const uint64_t x = read_bits(data, block.low_begin + i * block.low_width, block.low_width);
+            if (x >= low)
+                return x == low ? tax_of(block, i + 1) : 0;
+        }
+
+        return 0;
+    }
+
+    static size_t header_words() { return (sizeof(Header) + sizeof(uint64_t) - 1) / sizeof(uint64_t); }
+    static size_t dictionary_words(const Header &h) { return (h.tax_count * sizeof(int) + sizeof(uint64_t) - 1) / sizeof(uint64_t); }
+
+    static size_t image_words(const Header &h)
+    {
+        return header_words() + dictionary_words(h) + (h.block_count + 1) * (sizeof(Block) / sizeof(uint64_t)) + h.data_words + 1;
+    }
+
+private:
+    struct BlockData
+    {
+        size_t index, count; // count of coded differences
+        int low_width;
+        uint64_t high_begin, low_begin, tax_begin; // bit offsets in data, every part ends where the next one begins
+    };
+
+    // the block is the last one starting at or before the kmer, it can be in one of the previous buckets
+    bool find_block(hash_t hash, BlockData &block) const
+    {
+        const size_t bucket = buckets.bucket_of(hash);
+        size_t index = buckets.bucket_end(bucket);
+        const size_t first_index = buckets.bucket_begin(bucket);
+        while (index > first_index && blocks[index - 1].kmer > hash)
+            index--;
+
+        if (index == 0)
+            return false;
+
+        block.index = --index;
+        block.count = std::min(size_t(BLOCK_SIZE), size_t(header.kmer_count - index * BLOCK_SIZE)) - 1;
+        block.low_width = blocks[index].bits & 63;
+        block.high_begin = blocks[index].bits >> 6;
+        block.tax_begin = (blocks[index + 1].bits >> 6) - (block.count + 1) * header.tax_bits;
+        block.low_begin = block.tax_begin - block.count * block.low_width;
+        return true;
+    }
+
+    // the kmer position in the block is estimated assuming kmers are spread evenly over the block range
+    void prefetch_block(const BlockData &block, hash_t hash) const
+    {
+        const uint64_t high_count = block.low_begin - block.high_begin - block.count; // high part of the last difference
+        const uint64_t high = std::min(high_count, uint64_t((hash - blocks[block.index].kmer) >> block.low_width));
+        const size_t i = high_count ? size_t(high * block.count / high_count) : 0;
+        __builtin_prefetch(data + ((block.high_begin + high + i) >> 6));
+        __builtin_prefetch(data + ((block.low_begin + i * block.low_width) >> 6));
+        __builtin_prefetch(data + ((block.tax_begin + i * header.tax_bits) >> 6));
+    }
+
+    int tax_of(const BlockData &block, size_t i) const
+    {
+        return tax_dictionary[read_bits(data, block.tax_begin + i * header.tax_bits, int(header.tax_bits))];
+    }
+
+    static void sort_unique(std::vector<int> &v)
+    {
+        std::sort(v.begin(), v.end());
+        v.erase(std::unique(v.begin(), v.end()), v.end());
+    }
+
+    // position of the set bit of x with rank (0 based) rank, located byte by byte
+    static int select_in_word(uint64_t x, int rank)
+    {
+        int shift = 0;
+        for (int count = __builtin_popcountll(x & 0xFF); count <= rank; count = __builtin_popcountll((x >> shift) & 0xFF))
+        {
+            rank -= count;
+            shift += 8;
+        }
+
+        x >>= shift;
+        for (; rank > 0; rank--)
+            x &= x - 1;
+
+        return shift + __builtin_ctzll(x);
+    }
+
+    static uint64_t low_mask(int width) { return width >= 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1; }
+
+    // data is read with one word past the bits, so it is padded with one word
+    static uint64_t read_bits(const uint64_t *words, uint64_t pos, int width)
+    {
+        if (width == 0)
+            return 0;
+
+        const int shift = pos & 63;
+        uint64_t x = words[pos >> 6] >> shift;
+        if (shift + width > 64)
+            x |= words[(pos >> 6) + 1] << (64 - shift);
+
+        return x & low_mask(width);
+    }
+
+    static void write_bits(std::vector<uint64_t> &words, uint64_t pos, uint64_t value, int width)
+    {
+        if (width == 0)
+            return;
+
+        const int shift = pos & 63;
+        words[pos >> 6] |= value << shift;
+        if (shift + width > 64)
+            words[(pos >> 6) + 1] |= value >> (64 - shift);
+    }
+
+    static void encode_block(const hash_t *kmers, const uint64_t *taxes, size_t count, int tax_bits, Block &block, std::vector<uint64_t> &words, uint64_t &bit_count)
+    {
+        const size_t differences = count - 1;
+        const hash_t range = kmers[count - 1] - kmers[0];
+        const int low_width = (differences > 0 && range / differences > 0) ? 63 - __builtin_clzll(range / differences) : 0;
+        const uint64_t low_begin = bit_count + differences + (range >> low_width);
+        const uint64_t tax_begin = low_begin + differences * low_width;
+        const uint64_t end = tax_begin + count * tax_bits;
+        words.resize((end + 63) / 64 + 1, 0);
+
+        block = Block{kmers[0], (bit_count << 6) | uint64_t(low_width)};
+        for (size_t i = 0; i < differences; i++)
+        {
+            const hash_t difference = kmers[i + 1] - kmers[0];
+            const uint64_t high_pos = bit_count + (difference >> low_width) + i;
+            words[high_pos >> 6] |= uint64_t(1) << (high_pos & 63);
+            write_bits(words, low_begin + i * low_width, difference & low_mask(low_width), low_width);
+        }
+
+        for (size_t i = 0; i < count; i++)
+            write_bits(words, tax_begin + i * tax_bits, taxes[i], tax_bits);
+
+        bit_count = end;
+    }
+};
+
+struct KmerIndexType
+{
+    enum Type { BUCKET_TABLE, SOA, COMPRESSED };
+
+    static Type from_string(const std::string &s)
+    {
+        if (s.empty() || s == "lookup_table")
+            return BUCKET_TABLE;
+        if (s == "soa")
+            return SOA;
+        if (s == "compressed")
+            return COMPRESSED;
+
+        throw std::runtime_error(std::string("unknown kmer index type ") + s);
+    }
+};
+
+// the index selected by KmerIndexType, built over a sorted array of kmers when it is loaded
+struct KmerStaticIndex
+{
+    const KmerIndexType::Type type;
+    KmerSoABucketIndex soa;
+    KmerCompressedIndex compressed;
+
+    template <class SortedArray>
+    KmerStaticIndex(KmerIndexType::Type type, const SortedArray &array, int kmer_len) : type(type)
+    {
+        if (type == KmerIndexType::SOA)
+            soa.build(array, kmer_len);
+        else if (type == KmerIndexType::COMPRESSED)
+            compressed.build(array, kmer_len);
+        else
+            throw std::runtime_error("KmerStaticIndex:: unsupported index type");
+    }
+
+    // compressed index loaded from .dbsc file, its views stay valid when it is moved
+    KmerStaticIndex(KmerCompressedIndex &&compressed) : type(KmerIndexType::COMPRESSED), compressed(std::move(compressed)) {}
+
+    size_t size() const
+    {
+        switch (type)
+        {
+            case KmerIndexType::SOA: return soa.size();
+            case KmerIndexType::COMPRESSED: return compressed.size();
+            default: return 0;
+        }
+    }
+
+    void prefetch_bucket(hash_t hash) const
+    {
+        if (type == KmerIndexType::SOA)
+            soa.prefetch_bucket(hash);
+        else if (type == KmerIndexType::COMPRESSED)
+            compressed.prefetch_bucket(hash);
+    }
+
+    void prefetch_records(hash_t hash) const
+    {
+        if (type == KmerIndexType::SOA)
+            soa.prefetch_records(hash);
+        else if (type == KmerIndexType::COMPRESSED)
+            compressed.prefetch_records(hash);
+    }
+
+    // returns tax id of the kmer or 0 if not found
+    int find(hash_t hash) const
+    {
+        switch (type)
+        {
+            case KmerIndexType::SOA: return soa.find(hash);
+            case KmerIndexType::COMPRESSED: return compressed.find(hash);
+            default: return 0;
+        }
+    }
+};
+
+// lower_bound of every key over the same sorted array, searched in lock step:
+// the probes of all keys at one level are independent loads, so their cache misses overlap
+// instead of being paid one after another as with a std::lower_bound per key
+template <class SortedArray>
+void batched_lower_bound(const SortedArray &array, const hash_t *keys, size_t count, size_t *positions)
+{
+    for (size_t i = 0; i < count; i++)
+        positions[i] = 0;
+
+    if (array.empty())
+        return;
+
+    size_t n = array.size();
+    while (n > 1)
+    {
+        const size_t half = n / 2;
+        const size_t next_half = (n - half) / 2;
+        for (size_t i = 0; i < count; i++)
+        {
+            const size_t probe = positions[i] + half;
+            positions[i] = (array[probe] < keys[i]) ? probe : positions[i];
+            __builtin_prefetch(array.data() + positions[i] + next_half);
+        }
+
+        n -= half;
+    }
+
+    for (size_t i = 0; i < count; i++)
+        positions[i] += (array[positions[i]] < keys[i]);
+}
@@ -0,0 +1,337 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include "kmer_hash.h"
+#include "tax_id_tree.h"
+#include "dbs.h"
+#include "io.h"
+#include "ordered_pipeline.h"
+
+// concurrent kmer -> tax id table with open addressing
+// a kmer added again gets the consensus of its tax ids, merged by compare and swap, so adding threads do not wait for each other
+// the table grows under an exclusive lock when it gets full
+class KmerTaxTable
+{
+    static const hash_t EMPTY = ~hash_t(0); // never a canonical kmer, for kmer len 32 its reverse complement is smaller
+    static const size_t MIN_CAPACITY = 1024;
+
+    const TaxIdTree &tax_id_tree;
+    std::unique_ptr<std::atomic<hash_t>[]> keys;
+    std::unique_ptr<std::atomic<tax_id_t>[]> tax_ids;
+    size_t capacity = 0;
+    int shift = 0;
+    std::atomic<size_t> count;
+    std::shared_mutex resize_mutex;
+
+    size_t max_count() const { return capacity / 4 * 3; }
+
+    size_t slot_of(hash_t kmer) const { return size_t((kmer * 0x9E3779B97F4A7C15ull) >> shift); }
+
+    void allocate(size_t new_capacity)
+    {
+        capacity = MIN_CAPACITY;
+        shift = 64 - 10;
+        while (capacity < new_capacity)
+        {
+            capacity *= 2;
+            shift--;
+        }
+
+        keys.reset(new std::atomic<hash_t>[capacity]);
+        tax_ids.reset(new std::atomic<tax_id_t>[capacity]);
+        for (size_t i = 0; i < capacity; i++)
+        {
+            keys[i].store(EMPTY, std::memory_order_relaxed);
+            tax_ids[i].store(0, std::memory_order_relaxed);
+        }
+
+        count.store(0);
+    }
+
+    size_t insert(hash_t kmer)
+    {
+        for (size_t i = slot_of(kmer);; i = (i + 1) & (capacity - 1))
+        {
+            hash_t key = keys[i].load(std::memory_order_acquire);
+            if (key == EMPTY)
+            {
+                if (keys[i].compare_exchange_strong(key, kmer, std::memory_order_acq_rel))
+                {
+                    count.fetch_add(1, std::memory_order_relaxed);
+                    return i;
+                }
+                // key is what another thread has put into the slot
+            }
+
+            if (key == kmer)
+                return i;
+        }
+    }
+
+    void merge(std::atomic<tax_id_t> &at, tax_id_t tax_id)
+    {
+        tax_id_t current = at.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            if (current == tax_id)
+                return;
+
+            const tax_id_t merged = current == 0 ? tax_id : tax_id_tree.consensus_of(tax_id, current);
+            if (merged == current || at.compare_exchange_weak(current, merged, std::memory_order_relaxed))
+                return;
+        }
+    }
+
+    void grow()
+    {
+        std::unique_lock<std::shared_mutex> lock(resize_mutex);
+        if (count.load() < max_count())
+            return; // grown by another thread
+
+        auto old_keys = std::move(keys);
+        auto old_tax_ids = std::move(tax_ids);
+        const size_t old_capacity = capacity;
+        allocate(capacity * 2);
+        for (size_t i = 0; i < old_capacity; i++)
+        {
+            const hash_t key = old_keys[i].load(std::memory_order_relaxed);
+            if (key != EMPTY)
+                tax_ids[insert(key)].store(old_tax_ids[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+    }
+
+public:
+    KmerTaxTable(const TaxIdTree &tax_id_tree, size_t expected_count = 0) : tax_id_tree(tax_id_tree), count(0)
+    {
+        allocate(expected_count + expected_count / 3);
+    }
+
+    // thread safe
+    void add_kmer(hash_t kmer, tax_id_t tax_id)
+    {
+        for (;;)
+        {
+            {
+                std::shared_lock<std::shared_mutex> lock(resize_mutex);
+                if (count.load(std::memory_order_relaxed) < max_count()) // a few threads may pass at once, the table keeps a quarter free
+                {
+                    merge(tax_ids[insert(kmer)], tax_id);
+                    return;
+                }
+            }
+
+            grow();
+        }
+    }
+
+    size_t size() const { return count.load(); }
+
+    tax_id_t find(hash_t kmer) const
+    {
+        for (size_t i = slot_of(kmer);; i = (i + 1) & (capacity - 1))
+        {
+            const hash_t key = keys[i].load(std::memory_order_acquire);
+            if (key == kmer)
+                return tax_ids[i].load(std::memory_order_relaxed);
+
+            if (key == EMPTY)
+                return 0;
+        }
+    }
+
+    // not thread safe with add_kmer
+    void sorted_kmers(std::vector<DBS::KmerTax> &kmers) const
+    {
+        kmers.clear();
+        kmers.reserve(size());
+        for (size_t i = 0; i < capacity; i++)
+        {
+            const hash_t key = keys[i].load(std::memory_order_relaxed);
+            if (key != EMPTY)
+                kmers.emplace_back(key, tax_ids[i].load(std::memory_order_relaxed));
+        }
+
+        std::sort(kmers.begin(), kmers.end(), [](const DBS::KmerTax &a, const DBS::KmerTax &b) { return a.kmer < b.kmer; });
+    }
+};
+
+// kmer -> tax id builder split into shards by the leading bits of the kmer, so shards sorted one by one make a sorted database
+// in memory every shard is a KmerTaxTable; with a spill folder kmers are appended to a file of their shard instead
+// and the shard is put into a table only when it is written out, one shard per worker at a time
+class KmerTaxBuilder
+{
+    struct SpillShard
+    {
+        std::mutex mutex;
+        std::vector<DBS::KmerTax> buffer;
+        std::ofstream f;
+        size_t count = 0;
+    };
+
+    const TaxIdTree &tax_id_tree;
+    int shard_shift = 0;
+    std::string spill_folder;
+    std::vector<std::unique_ptr<KmerTaxTable>> tables;
+    std::vector<std::unique_ptr<SpillShard>> spill_shards;
+    std::atomic<size_t> spilled;
+
+    std::string spill_filename(size_t shard) const { return spill_folder + "/kmers." + std::to_string(shard) + ".spill"; }
+
+    static void write_spill(SpillShard &shard)
+    {
+        IO::save_vector_data(shard.f, shard.buffer);
+        if (!shard.f)
+            throw std::runtime_error("cannot write kmers spill file");
+
+        shard.count += shard.buffer.size();
+        shard.buffer.clear();
+    }
+
+    void load_spilled(size_t shard, std::vector<DBS::KmerTax> &kmers)
+    {
+        auto &spill = *spill_shards[shard];
+        spill.f.close();
+        std::vector<DBS::KmerTax> records;
+        if (spill.count > 0)
+        {
+            std::ifstream f(spill_filename(shard), std::ios::binary);
+            IO::load_vector_data(f, records, spill.count);
+        }
+
+        std::remove(spill_filename(shard).c_str());
+
+        KmerTaxTable table(tax_id_tree, records.size());
+        for (auto &r : records)
+            table.add_kmer(r.kmer, r.tax_id);
+
+        records = std::vector<DBS::KmerTax>();
+        table.sorted_kmers(kmers);
+    }
+
+public:
+    static const int DEFAULT_SHARD_BITS = 8;
+    static const size_t SPILL_BUFFER_SIZE = 4096; // kmers buffered per shard before they are appended to its file
+
+    KmerTaxBuilder(const TaxIdTree &tax_id_tree, int kmer_len, const std::string &spill_folder = "", int shard_bits = DEFAULT_SHARD_BITS) :
+        tax_id_tree(tax_id_tree), spill_folder(spill_folder), spilled(0)
+    {
+        shard_shift = std::max(0, 2 * kmer_len - shard_bits);
+        const size_t shard_count = size_t(1) << std::min(shard_bits, 2 * kmer_len);
+        for (size_t i = 0; i < shard_count; i++)
+            if (spill_folder.empty())
+                tables.emplace_back(new KmerTaxTable(tax_id_tree));
+            else
+            {
+                spill_shards.emplace_back(new SpillShard());
+                spill_shards.back()->f.open(spill_filename(i), std::ios::binary | std::ios::out | std::ios::trunc);
+                if (spill_shards.back()->f.fail())
+                    throw std::runtime_error(std::string("cannot create spill file ") + spill_filename(i));
+            }
+    }
+
+    size_t shard_count() const { return spill_folder.empty() ? tables.size() : spill_shards.size(); }
+
+    // thread safe
+    void add_kmer(hash_t kmer, tax_id_t tax_id)
+    {
+        const size_t shard = kmer >> shard_shift;
+        if (spill_folder.empty())
+        {
+            tables[shard]->add_kmer(kmer, tax_id);
+            return;
+        }
+
+        auto &spill = *spill_shards[shard];
+        std::lock_guard<std::mutex> lock(spill.mutex);
+        spill.buffer.emplace_back(kmer, tax_id);
+        if (spill.buffer.size() >= SPILL_BUFFER_SIZE)
+            write_spill(spill);
+
+        spilled++;
+    }
+
+    // distinct kmers in memory, all added kmers when they are spilled
+    size_t size() const
+    {
+        if (!spill_folder.empty())
+            return spilled.load();
+
+        size_t count = 0;
+        for (auto &t : tables)
+            count += t->size();
+        return count;
+    }
+
+    // calls write(kmers) with the sorted kmers of every shard in kmer order, kmers of the root tax are left out as they identify nothing
+    // shards are consolidated by concurrent workers and released afterwards, so the builder is empty when it returns
+    template <class Write>
+    void write_shards(int workers, Write &&write)
+    {
+        for (auto &spill : spill_shards)
+            if (!spill->buffer.empty())
+                write_spill(*spill);
+
+        struct Slot
+        {
+            size_t shard = 0;
+            std::vector<DBS::KmerTax> kmers;
+        };
+
+        size_t next_shard = 0;
+        OrderedPipeline<Slot> pipeline(workers);
+        pipeline.run(
+            [&](Slot &slot)
+            {
+                slot.shard = next_shard++;
+                return next_shard < shard_count();
+            },
+            [&](Slot &slot)
+            {
+                if (spill_folder.empty())
+                {
+                    tables[slot.shard]->sorted_kmers(slot.kmers);
+                    tables[slot.shard].reset();
+                }
+                else
+                    load_spilled(slot.shard, slot.kmers);
+
+                slot.kmers.erase(std::remove_if(slot.kmers.begin(), slot.kmers.end(), [](const DBS::KmerTax &k) { return k.tax_id == TaxIdTree::ROOT; }), slot.kmers.end());
+            },
+            [&](Slot &slot) { write(slot.kmers); });
+    }
+};
@@ -28,48 +28,12 @@
 #include <chrono>
 #include "config_merge_db.h"
 #include "file_list_loader.h"
-#include "dbs.h"
+#include "dbs_set_ops.h"
 
 using namespace std;
 using namespace std::chrono;
 
-const string VERSION = "0.14";
-
-template <class C>
-struct HashTable
-{
-	std::vector<C> storage;
-	size_t inserted = 0;
-	HashTable(size_t storage_size) : storage(storage_size){}
-
-	void insert(C x)
-	{
-		if (x == 0)
-			return;
-
-		for (size_t pos = x % storage.size(); storage[pos] != x ; pos = next(pos))
-			if (storage[pos] == 0)
-			{
-				storage[pos] = x;
-				inserted++;
-				if (inserted > storage.size() * 2 / 3)
-					throw std::runtime_error("HashTable inserted > storage_size * 2 / 3");
-				break;
-			}
-	}
-
-	size_t next(size_t pos) const
-	{
-		pos++;
-		if (pos < storage.size())
-			return pos;
-		if (pos > storage.size())
-			throw std::runtime_error("HashTable pos > storage.size()");
-
-		return 0;		
-	}
-
-};
+const string VERSION = "0.15";
 
 int main(int argc, char const *argv[])
 {
@@ -79,37 +43,25 @@ int main(int argc, char const *argv[])
 	auto before = high_resolution_clock::now();
 
 	FileListLoader file_list(config.file_list);
-	HashTable<hash_t> kmers(config.expected_size * 2);
-
-	size_t kmer_len = 0;
-
-	vector<hash_t> loaded_kmers;
+	vector<string> in_files;
 	for (auto &file_list_element : file_list.files)
-	{
-		string in_file = file_list_element.filename + config.in_ext;
-		cout << in_file << endl;
-		auto loaded_kmer_len = DBSIO::load_dbs(in_file, loaded_kmers);
-		if (kmer_len != 0 && loaded_kmer_len != kmer_len)
-			throw std::runtime_error("loaded_kmer_len != kmer_len");
+		in_files.push_back(file_list_element.filename + config.in_ext);
 
-		if (loaded_kmers.empty())
-		{
-			cout << "skip empty" << endl;
-			continue;
-		}
-
-		auto before_kmers = kmers.inserted;
-		kmer_len = loaded_kmer_len;
-		for (auto kmer : loaded_kmers)
-			kmers.insert(kmer);
-
-		auto inserted = kmers.inserted - before_kmers;
-		cout << "inserted " << inserted << " of " << loaded_kmers.size() << " = " << int(100.0 * inserted / loaded_kmers.size()) << " %, fullness = " << int(kmers.inserted * 100.0 / kmers.storage.size()) << " %" << endl;
+	auto inputs = DBSSetOps::open(in_files);
+	size_t input_kmers = 0;
+	for (auto &input : inputs)
+	{
+		cout << input->filename << " kmers: " << input->count << endl;
+		input_kmers += input->count;
 	}
 
-	std::sort(kmers.storage.begin(), kmers.storage.end());
-	cout << "saving to " << config.out_file << " kmers: " << kmers.inserted << endl;
-	DBSIO::save_dbs(config.out_file, kmers.storage, kmer_len, kmers.storage.size() - kmers.inserted);
+	TaxIdTree tax_tree;
+	if (!config.tax_parents_file.empty())
+		TaxIdTreeLoader::load_tax_id_tree(tax_tree, config.tax_parents_file);
+
+	cout << "saving to " << config.out_file << endl;
+	auto kmers = DBSSetOps::save(DBSSetOps::UNION, inputs, config.out_file, config.threads, config.tax_parents_file.empty() ? nullptr : &tax_tree);
+	cout << "kmers: " << kmers << " of " << input_kmers << " = " << int(input_kmers ? 100.0 * kmers / input_kmers : 0) << " %" << endl;
 
 	cout << "total time (min) " << std::chrono::duration_cast<std::chrono::minutes>( high_resolution_clock::now() - before ).count() << endl;
 }
@@ -24,177 +24,159 @@
 *
 */
 
-#if 0 // not in use anymore due to some issues
-
 #pragma once
 
 #include "reader.h"
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-
-#include "log.h"
-
+#include <exception>
+#include <vector>
+#include <algorithm>
+#include <assert.h>
+
+// read-ahead wrapper: a background thread owns the wrapped reader and fills a ring of queue_size chunks
+// consumer swaps ready chunks out, so reading and parsing overlap with processing of previous chunks
+// there is a single reader instance, so chunks come in the input order and stdin works
 template <typename ReaderType>
 class MTReader final: public Reader {
+public:
+    static const size_t QUEUE_SIZE = 2; // double buffering
+
 private:
     typedef std::vector<Fragment> Chunk;
-    struct Thread {
-        // protected with global reader locked
-        bool done;
-        float progress;
-        size_t next_chunk_idx;
-        bool chunk_ready;
-        Chunk loaded_chunk;
-        std::condition_variable consumed;
-
-        // private to thread
-        size_t chunk_idx;
-        ReaderType reader;
-        std::thread thread_impl;
-
-        template <typename ...Args>
-        Thread(Args... args)
-            : done(false)
-            , progress(0)
-            , chunk_ready(false)
-            , chunk_idx(0)
-            , reader(args...)
-        {}
-        Thread(Thread&& other) = delete;
-        Thread(const Thread& other) = delete;
-
-        void run(size_t chunk_size, size_t start_chunk_idx, std::mutex& mutex, std::condition_variable& ready) {
-            run_impl(chunk_size, start_chunk_idx, mutex, ready);
-        }
-
-        void run_impl(size_t chunk_size, size_t start_chunk_idx, std::mutex& mutex, std::condition_variable& ready) {
-            size_t skip_to_idx = start_chunk_idx;
-            Chunk chunk;
-            std::unique_lock<std::mutex> lock(mutex);
-            while (!done) {
-                float chunk_progress = progress;
-                lock.unlock();
-                { // not locked section
-                    assert(chunk_idx <= skip_to_idx);
-                    size_t fragments_to_skip = (skip_to_idx - chunk_idx) * chunk_size;
-                    for (size_t i = 0; i < fragments_to_skip; ++i) {
-                        if (!reader.read(nullptr)) {
-                            break;
-                        }
-                    }
-
-                    chunk.resize(chunk_size);
-                    for (size_t i = 0; i < chunk_size; ++i) {
-                        if (!reader.read(&chunk[i])) {
-                            chunk.resize(i);
-                            break;
-                        }
-                    }
-                    chunk_idx = skip_to_idx + 1;
-                    
-                    chunk_progress = reader.progress();
-                }
-                lock.lock();
-                const bool reader_at_eof = chunk.size() < chunk_size;
-                if (!chunk.empty()) {
-                    while (chunk_ready) {
-                        consumed.wait(lock);
-                    }
-                    std::swap(loaded_chunk, chunk);
-                    chunk_ready = true;
-                    skip_to_idx = next_chunk_idx;
-                }
-                progress = chunk_progress; 
-                done = reader_at_eof;
-                ready.notify_one();
-            }
-        }
+    struct Slot {
+        Chunk chunk;
+        float progress = 0;
     };
+
+    ReaderType reader; // used by background thread only until it is done
     const size_t chunk_size;
-    bool all_done;
-    size_t next_chunk_idx;
-    std::vector<std::unique_ptr<Thread> > threads;
+
+    // protected with mutex
     mutable std::mutex mutex;
-    std::condition_variable ready;
-    
+    mutable std::condition_variable loaded, consumed;
+    std::vector<Slot> slots;
+    size_t loaded_count;
+    size_t consumed_count;
+    bool done; // background thread does not touch reader anymore
+    bool stop;
+    std::exception_ptr error;
+    float current_progress;
+
+    // consumer side
     Chunk current_chunk;
     size_t current_fragment_idx;
 
-    
-    bool load_chunk() {
-        while (!all_done) {
-            std::unique_lock<std::mutex> lock(mutex);
-            size_t done_count = 0;
-            for (auto& thread: threads) {
-                if (thread->chunk_ready) {
-                    current_fragment_idx = 0;
-                    std::swap(current_chunk, thread->loaded_chunk);
-                    thread->next_chunk_idx = next_chunk_idx;
-                    ++next_chunk_idx;
-                    thread->chunk_ready = false;
-                    thread->consumed.notify_one();
-                    return true;
-                }
-                if (thread->done) {
-                    ++done_count;
-                }
+    std::thread thread_impl;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stop) {
+            if (loaded_count - consumed_count >= slots.size()) {
+                consumed.wait(lock);
+                continue;
             }
-            all_done = (done_count == threads.size());
-            if (!all_done) {
-                ready.wait(lock);
+
+            auto& slot = slots[loaded_count % slots.size()]; // not touched by consumer until loaded_count grows
+            lock.unlock();
+            bool more = false;
+            std::exception_ptr chunk_error;
+            try {
+                more = reader.read_many(slot.chunk, chunk_size);
+                slot.progress = reader.progress();
+            } catch (...) {
+                chunk_error = std::current_exception();
             }
+            lock.lock();
+
+            if (!more || chunk_error) {
+                error = chunk_error;
+                break;
+            }
+
+            ++loaded_count;
+            loaded.notify_one();
         }
-        return false;
+
+        done = true;
+        loaded.notify_all();
     }
-    
-public:
-    template <typename ...Args>
-    MTReader(size_t thread_count, size_t chunk_size, Args... args)
-        : chunk_size(chunk_size)
-        , all_done(false)
-        , current_fragment_idx(0)
-    {
-        assert(thread_count > 0);
-        threads.resize(thread_count);
 
-        #pragma omp parallel for
-        for (auto i = 0; i < thread_count; ++i) {
-            threads[i] = std::unique_ptr<Thread>(new Thread(args...));
+    void wait_done() const {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!done) {
+            loaded.wait(lock);
         }
-        
-        for (size_t i = 0; i < thread_count; ++i) {
-            auto& thread = threads[i];
-            const size_t start_chunk_idx = i;
-            thread->next_chunk_idx = start_chunk_idx + thread_count;
-            thread->thread_impl = std::thread(&MTReader::Thread::run, thread.get(), chunk_size, start_chunk_idx, std::ref(mutex), std::ref(ready));
+        if (error) {
+            std::rethrow_exception(error);
         }
-        next_chunk_idx = thread_count * 2;
     }
-    ~MTReader() {
+
+    bool load_chunk() {
         std::unique_lock<std::mutex> lock(mutex);
-        for (auto& thread: threads) {
-            thread->done = true;
-            thread->chunk_ready = false;
-            thread->consumed.notify_one();
+        while (consumed_count == loaded_count && !done) {
+            loaded.wait(lock);
         }
-        lock.unlock();
-        for (auto& thread: threads) {
-            thread->thread_impl.join();
+
+        if (consumed_count == loaded_count) { // chunks before the failure are served first
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            current_chunk.clear();
+            current_fragment_idx = 0;
+            current_progress = 1;
+            return false;
         }
+
+        auto& slot = slots[consumed_count % slots.size()];
+        std::swap(current_chunk, slot.chunk);
+        current_fragment_idx = 0;
+        current_progress = slot.progress;
+        ++consumed_count;
+        consumed.notify_one();
+        return true;
+    }
+
+public:
+    // chunks of chunk_size are read ahead with reader.read_many, args are passed to ReaderType constructor
+    template <typename ...Args>
+    MTReader(size_t queue_size, size_t chunk_size, Args... args)
+        : reader(args...)
+        , chunk_size(chunk_size > 0 ? chunk_size : size_t(DEFAULT_CHUNK_SIZE))
+        , slots(std::max(queue_size, size_t(1)))
+        , loaded_count(0)
+        , consumed_count(0)
+        , done(false)
+        , stop(false)
+        , current_progress(0)
+        , current_fragment_idx(0)
+    {
+        thread_impl = std::thread(&MTReader::run, this);
     }
 
+    MTReader(const MTReader&) = delete;
+    MTReader& operator=(const MTReader&) = delete;
+
+    ~MTReader() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stop = true;
+            consumed.notify_one();
+        }
+        thread_impl.join();
+    }
+
+    // waits for the background thread to reach eof of the wrapped reader
     SourceStats stats() const override {
-        assert(all_done);
-        return threads[0]->reader.stats();
+        wait_done();
+        return reader.stats();
     }
+
+    // progress of the wrapped reader at the end of the last consumed chunk
     float progress() const override {
         std::unique_lock<std::mutex> lock(mutex);
-        float max_progress = 0;
-        for (auto& thread : threads) {
-            max_progress = std::max(max_progress, thread->progress);
-        }
-        return max_progress;
+        return current_progress;
     }
 
     bool read(Fragment* output) override {
@@ -211,27 +193,20 @@ public:
         return true;
     }
 
+    // whole read ahead chunk is swapped into output when the same chunk_size is requested
     bool read_many(std::vector<Fragment>& output, size_t chunk_size) override {
-        if (current_fragment_idx >= current_chunk.size()) {
-            if (!load_chunk()) {
-                output.clear();
-                return false;
-            }
+        if (chunk_size == 0) {
+            chunk_size = DEFAULT_CHUNK_SIZE;
         }
-        if (current_fragment_idx == 0) {
-            std::swap(current_chunk, output);
-            current_fragment_idx = current_chunk.size();
-        } else {
-            size_t count = current_chunk.size() - current_fragment_idx;
-            output.resize(count);
-            for (size_t i = 0; i < count; ++i) {
-                std::swap(output[i], current_chunk[i + current_fragment_idx]);
-            }
-            current_fragment_idx += count;
+        if (chunk_size != this->chunk_size || current_fragment_idx < current_chunk.size()) {
+            return Reader::read_many(output, chunk_size);
+        }
+        if (!load_chunk()) {
+            output.clear();
+            return false;
         }
-        assert(!output.empty());
+        std::swap(current_chunk, output);
+        current_fragment_idx = current_chunk.size();
         return true;
     }
 };
-
-#endif
\ No newline at end of file
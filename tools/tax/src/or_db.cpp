@@ -24,40 +24,18 @@
 *
 */
 #include <string>
-#include <fstream>
 #include <iostream>
-#include <algorithm>
-#include <vector>
-#include "dbs.h"
-#include "hash.h"
+#include "dbs_set_ops.h"
 #include "config_db_binary_op.h"
 
-bool in_db(hash_t hash, const std::vector<hash_t> &db, size_t lookup_len)
-{
-	return std::binary_search(db.begin(), db.begin() + lookup_len, hash);
-}
-
 int main(int argc, char const *argv[])
 {
 	Config config(argc, argv);
 
-	std::vector<hash_t> db_a, db_b;
-	int kmer_len_a = DBSIO::load_dbs(config.db_a, db_a);
-	int kmer_len_b = DBSIO::load_dbs(config.db_b, db_b);
-
-    if (kmer_len_a != kmer_len_b)
-    {
-        std::cerr << "kmer_len_a != kmer_len_b" << std::endl;
-        return 1;
-    }
-
-    size_t original_a_size = db_a.size();
-    db_a.reserve(db_a.size() + db_b.size());
-
-	for (auto kmer : db_b)
-        if (!in_db(kmer, db_a, original_a_size))
-    		db_a.push_back(kmer);
+	TaxIdTree tax_tree;
+	if (!config.tax_parents_file.empty())
+		TaxIdTreeLoader::load_tax_id_tree(tax_tree, config.tax_parents_file);
 
-	std::sort(db_a.begin(), db_a.end());
-	DBSIO::save_dbs(config.db_c, db_a, kmer_len_a);
+	auto inputs = DBSSetOps::open({config.db_a, config.db_b});
+	DBSSetOps::save(DBSSetOps::UNION, inputs, config.db_c, config.threads, config.tax_parents_file.empty() ? nullptr : &tax_tree);
 }
@@ -0,0 +1,460 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <sstream>
+#include <functional>
+#include <stdint.h>
+
+// bounded multi producer multi consumer queue without locks (Dmitry Vyukov's design)
+// every cell carries a sequence number telling producers and consumers whose turn it is
+template <class T>
+class MPMCQueue
+{
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    static const size_t CACHE_LINE = 64;
+
+    std::vector<Cell> cells;
+    const size_t mask;
+    alignas(CACHE_LINE) std::atomic<size_t> enqueue_pos;
+    alignas(CACHE_LINE) std::atomic<size_t> dequeue_pos;
+
+    static size_t round_up_to_power_of_2(size_t x)
+    {
+        size_t p = 2;
+        while (p < x)
+            p *= 2;
+        return p;
+    }
+
+public:
+    MPMCQueue(size_t min_capacity) : cells(round_up_to_power_of_2(min_capacity)), mask(cells.size() - 1), enqueue_pos(0), dequeue_pos(0)
+    {
+        for (size_t i = 0; i < cells.size(); i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool try_push(const T &data)
+    {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = cells[pos & mask];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+            if (diff == 0)
+            {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.data = data;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false; // full
+            else
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool try_pop(T &data)
+    {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = cells[pos & mask];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    data = cell.data;
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false; // empty
+            else
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    // approximate, for statistics only
+    size_t size() const
+    {
+        const size_t in = enqueue_pos.load(std::memory_order_relaxed), out = dequeue_pos.load(std::memory_order_relaxed);
+        return in > out ? in - out : 0;
+    }
+};
+
+// spins briefly, then yields, then sleeps, so idle threads do not burn a core for long
+inline void pipeline_backoff(int &attempt)
+{
+    attempt++;
+    if (attempt < 64)
+        return;
+    if (attempt < 128)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+// worker threads shared by several OrderedPipelines running at once, tasks are run in the order they are submitted,
+// so the chunks of all the pipelines are interleaved on the same workers
+class WorkerPool
+{
+public:
+    typedef std::function<void(int)> Task; // called with the index of the worker thread running it
+
+    WorkerPool(int workers, size_t capacity = 4096) : tasks(capacity), stopping(false)
+    {
+        for (int w = 0; w < std::max(1, workers); w++)
+            threads.emplace_back([this, w] { work(w); });
+    }
+
+    ~WorkerPool()
+    {
+        stopping = true;
+        for (auto &t : threads)
+            t.join();
+    }
+
+    int size() const { return (int)threads.size(); }
+
+    // approximate, for statistics only
+    size_t queued() const { return tasks.size(); }
+
+    // tasks must not throw
+    void submit(const Task &task)
+    {
+        int attempt = 0;
+        while (!tasks.try_push(task))
+            pipeline_backoff(attempt);
+    }
+
+private:
+    MPMCQueue<Task> tasks;
+    std::atomic<bool> stopping;
+    std::vector<std::thread> threads;
+
+    // the queue is drained before the workers stop
+    void work(int w)
+    {
+        Task task;
+        int attempt = 0;
+        for (;;)
+        {
+            if (tasks.try_pop(task))
+            {
+                task(w);
+                task = nullptr;
+                attempt = 0;
+            }
+            else if (stopping)
+                return;
+            else
+                pipeline_backoff(attempt);
+        }
+    }
+};
+
+// reader -> N workers -> writer pipeline over a fixed set of recycled slots
+// the reader fills slots in input order, workers process them in any order,
+// the writer consumes them strictly in the order the reader produced them
+template <class Slot>
+struct OrderedPipeline
+{
+    struct StageStats
+    {
+        size_t items = 0;
+        double busy_sec = 0, stall_sec = 0; // processing, waiting for input or for room in the output queue
+        size_t depth_sum = 0, depth_max = 0; // slots queued for the stage when it takes one
+
+        void add(const StageStats &x)
+        {
+            items += x.items;
+            busy_sec += x.busy_sec;
+            stall_sec += x.stall_sec;
+            depth_sum += x.depth_sum;
+            depth_max = std::max(depth_max, x.depth_max);
+        }
+
+        void sample_depth(size_t depth)
+        {
+            depth_sum += depth;
+            depth_max = std::max(depth_max, depth);
+        }
+
+        std::string to_string() const
+        {
+            std::ostringstream s;
+            s.precision(3);
+            s << items << " chunks, busy " << busy_sec << "s, stalled " << stall_sec << "s, queue depth avg " << (items ? double(depth_sum) / items : 0.0) << " max " << depth_max;
+            return s.str();
+        }
+    };
+
+    struct Stats
+    {
+        StageStats reader, writer; // writer queue depth is the number of finished slots waiting for an earlier one
+        std::vector<StageStats> workers;
+
+        std::string to_string() const
+        {
+            StageStats all_workers;
+            for (auto &w : workers)
+                all_workers.add(w);
+
+            return "reader: " + reader.to_string() + "; " + std::to_string(workers.size()) + " workers: " + all_workers.to_string() + "; writer: " + writer.to_string();
+        }
+    };
+
+    Stats stats;
+
+    // with a pool the slots are processed by its workers, together with the slots of other pipelines, instead of own threads
+    OrderedPipeline(int workers, int slots_per_worker = 2, WorkerPool *pool = nullptr) : workers(pool ? pool->size() : std::max(1, workers)), slots(this->workers * slots_per_worker + 2), pool(pool) {}
+
+    // read(Slot&) returns false when the slot got the last input (the slot is still processed)
+    // process(Slot&) is called concurrently from the worker threads, write(Slot&) from the writer thread
+    // the first exception thrown by any stage stops the pipeline and is rethrown here
+    template <class Read, class Process, class Write>
+    void run(Read &&read, Process &&process, Write &&write)
+    {
+        const int slot_count = (int)slots.size();
+        MPMCQueue<int> free_slots(slot_count), work(slot_count), done(slot_count);
+        std::vector<size_t> slot_seq(slot_count);
+        std::atomic<size_t> total(SIZE_MAX);
+        stats = Stats();
+        stats.workers.resize(workers);
+        failed = false;
+        error = nullptr;
+        std::atomic<int> in_flight(0); // slots submitted to the pool and not processed yet
+
+        auto process_slot = [&](int w, int slot)
+        {
+            auto &worker_stats = stats.workers[w];
+            worker_stats.sample_depth(pool ? pool->queued() : work.size());
+            auto before = now();
+            process(slots[slot]);
+            worker_stats.busy_sec += seconds(before);
+            worker_stats.items++;
+            push(done, slot, worker_stats);
+        };
+
+        auto dispatch = [&](int slot)
+        {
+            if (!pool)
+            {
+                push(work, slot, stats.reader);
+                return;
+            }
+
+            in_flight++;
+            pool->submit([&, slot](int w)
+            {
+                if (!failed)
+                    guarded([&] { process_slot(w, slot); });
+                in_flight--;
+            });
+        };
+
+        for (int i = 0; i < slot_count; i++)
+            free_slots.try_push(i);
+
+        std::thread reader([&]
+        {
+            guarded([&]
+            {
+                size_t seq = 0;
+                bool more = true;
+                while (more)
+                {
+                    int slot = 0;
+                    if (!pop(free_slots, slot, stats.reader))
+                        return;
+
+                    auto before = now();
+                    more = read(slots[slot]);
+                    slot_seq[slot] = seq++;
+                    stats.reader.busy_sec += seconds(before);
+                    stats.reader.items++;
+                    dispatch(slot);
+                }
+
+                total = seq;
+                if (!pool)
+                    for (int i = 0; i < workers; i++)
+                        push(work, -1, stats.reader);
+            });
+        });
+
+        std::vector<std::thread> worker_threads;
+        for (int w = 0; !pool && w < workers; w++)
+            worker_threads.emplace_back([&, w]
+            {
+                guarded([&]
+                {
+                    int slot = 0;
+                    while (pop(work, slot, stats.workers[w]) && slot >= 0)
+                        process_slot(w, slot);
+                });
+            });
+
+        std::thread writer([&]
+        {
+            guarded([&]
+            {
+                std::vector<int> pending(slot_count, -1); // by sequence number modulo slot count
+                size_t next = 0, waiting = 0;
+                while (next != total.load())
+                {
+                    int slot = 0;
+                    if (pending[next % slot_count] < 0)
+                    {
+                        if (!pop(done, slot, stats.writer, [&] { return next == total.load(); }))
+                            return;
+
+                        pending[slot_seq[slot] % slot_count] = slot;
+                        waiting++;
+                        continue;
+                    }
+
+                    slot = pending[next % slot_count];
+                    pending[next % slot_count] = -1;
+                    waiting--;
+                    stats.writer.sample_depth(waiting);
+
+                    auto before = now();
+                    write(slots[slot]);
+                    stats.writer.busy_sec += seconds(before);
+                    stats.writer.items++;
+                    next++;
+                    push(free_slots, slot, stats.writer);
+                }
+            });
+        });
+
+        reader.join();
+        for (auto &t : worker_threads)
+            t.join();
+        writer.join();
+
+        // pool tasks refer to the slots and queues of this call
+        for (int attempt = 0; in_flight > 0; )
+            pipeline_backoff(attempt);
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    const int workers;
+    std::vector<Slot> slots;
+    WorkerPool *pool;
+    std::atomic<bool> failed;
+    std::exception_ptr error;
+    std::atomic_flag error_lock = ATOMIC_FLAG_INIT;
+
+    typedef std::chrono::steady_clock clock;
+    static clock::time_point now() { return clock::now(); }
+    static double seconds(clock::time_point since) { return std::chrono::duration<double>(now() - since).count(); }
+
+    template <class F>
+    void guarded(F &&f)
+    {
+        try
+        {
+            f();
+        }
+        catch (...)
+        {
+            if (!error_lock.test_and_set())
+                error = std::current_exception();
+            failed = true;
+        }
+    }
+
+    template <class Stop>
+    bool pop(MPMCQueue<int> &queue, int &slot, StageStats &stage, Stop &&stop)
+    {
+        if (queue.try_pop(slot))
+            return true;
+
+        auto before = now();
+        int attempt = 0;
+        while (!queue.try_pop(slot))
+        {
+            if (failed || stop())
+            {
+                stage.stall_sec += seconds(before);
+                return false;
+            }
+            pipeline_backoff(attempt);
+        }
+
+        stage.stall_sec += seconds(before);
+        return true;
+    }
+
+    bool pop(MPMCQueue<int> &queue, int &slot, StageStats &stage)
+    {
+        return pop(queue, slot, stage, [] { return false; });
+    }
+
+    void push(MPMCQueue<int> &queue, int slot, StageStats &stage)
+    {
+        if (queue.try_push(slot))
+            return;
+
+        // queues are as large as the slot count, so this happens only while other stages are catching up
+        auto before = now();
+        int attempt = 0;
+        while (!queue.try_push(slot))
+        {
+            if (failed)
+                throw std::runtime_error("pipeline stopped");
+            pipeline_backoff(attempt);
+        }
+        stage.stall_sec += seconds(before);
+    }
+};
@@ -0,0 +1,62 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "config_print_hits.h"
+#include <iostream>
+#include "hit_stream.h"
+#include "io.h"
+
+int main(int argc, char const *argv[])
+{
+	Config config(argc, argv);
+
+	HitStreamReader reader(config.in_hits);
+	IO::Writer writer(config.out);
+	const bool print_counts = !config.hide_counts && reader.has_counts();
+
+	std::string spotid, text;
+	std::vector<uint32_t> tax_ids, counts;
+	std::vector<HitStream::Hit> hits;
+	while (reader.next(spotid, tax_ids, counts))
+	{
+		hits.resize(tax_ids.size());
+		for (size_t i = 0; i < hits.size(); i++)
+			hits[i] = HitStream::Hit{int32_t(tax_ids[i]), counts[i]};
+
+		HitStream::append_text(text, spotid, hits, print_counts);
+		if (text.size() >= HitStream::CHUNK_SIZE)
+		{
+			writer.f().write(text.data(), text.size());
+			writer.check();
+			text.clear();
+		}
+	}
+
+	writer.f().write(text.data(), text.size());
+	writer.check();
+
+    return 0;
+}
@@ -0,0 +1,417 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef PROFILE_INDEX_H_INCLUDED
+#define PROFILE_INDEX_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE4_1__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "io.h"
+#include "log.h"
+
+// MinHash profiles made by get_profile (sketch length, then the minimal kmers) packed into one matrix,
+// with LSH band tables to find the profiles close to a query without comparing it with every one of them.
+// band b of a sketch is its rows [b * rows, (b + 1) * rows), a profile is a candidate when a band is equal to the query's,
+// so a profile which is not a candidate differs from the query in every band and has at most sketch_len - bands equal positions:
+// when the top count of candidates are closer than that, they are the exact result, otherwise all the profiles are compared.
+// bands of one row (the default) prove nearly every result, wider bands give fewer candidates but prove only very close ones
+struct ProfileIndex
+{
+    typedef uint64_t kmer_t;
+
+    static const uint64_t MAGIC = 0x5844494c464f5250; // "PROFLIDX"
+    static const uint64_t VERSION = 2;
+    static const int DEFAULT_ROWS = 1;
+    static const size_t MAX_CANDIDATES_PART = 4; // more than a quarter of the profiles are compared in order
+
+    struct Header
+    {
+        uint64_t magic = MAGIC, version = VERSION;
+        uint64_t source_size = 0, source_mtime_sec = 0, source_mtime_nsec = 0; // of the files list the index was built from
+        uint64_t profiles_checksum = 0; // of the sizes and mtimes of the listed profiles, a profile made again changes it
+        uint64_t profile_count = 0, sketch_len = 0, rows = 0, bands = 0;
+        uint64_t sketches_offset = 0, tables_offset = 0, names_offset = 0, names_size = 0; // in bytes
+    };
+
+    struct BandEntry
+    {
+        uint32_t key, profile;
+
+        bool operator < (const BandEntry &x) const
+        {
+            return key < x.key || (key == x.key && profile < x.profile);
+        }
+    };
+
+    struct Match
+    {
+        size_t profile = 0, equal = 0; // equal positions of the sketches
+        Match() = default;
+        Match(size_t profile, size_t equal) : profile(profile), equal(equal){}
+
+        // closer first, then in the order of the files list
+        bool operator < (const Match &x) const
+        {
+            return equal > x.equal || (equal == x.equal && profile < x.profile);
+        }
+    };
+
+    Header header;
+    IO::MappedFile mapping;
+    const kmer_t *sketches = nullptr;
+    const BandEntry *tables = nullptr;
+    std::vector<std::string> names;
+
+    size_t size() const { return header.profile_count; }
+    size_t sketch_len() const { return header.sketch_len; }
+    const kmer_t *sketch(size_t profile) const { return sketches + profile * header.sketch_len; }
+
+    static std::vector<kmer_t> load_profile(const std::string &filename)
+    {
+        std::ifstream f(filename, std::ios::in | std::ios::binary);
+        if (!f.good())
+            throw std::runtime_error(std::string("cannot load profile ") + filename);
+
+        std::vector<kmer_t> kmers;
+        IO::load_vector(f, kmers);
+        return kmers;
+    }
+
+    static Header source_of(const std::string &files_list, const std::vector<std::string> &profile_files)
+    {
+        struct stat file_stat;
+        if (stat(files_list.c_str(), &file_stat) != 0)
+            throw std::runtime_error(std::string("cannot stat file ") + files_list);
+
+        Header source;
+        source.source_size = file_stat.st_size;
+        source.source_mtime_sec = file_stat.st_mtim.tv_sec;
+        source.source_mtime_nsec = file_stat.st_mtim.tv_nsec;
+
+        uint64_t h = 0xcbf29ce484222325; // FNV-1a over 64 bit words
+        for (auto &profile_file : profile_files)
+        {
+            if (stat(profile_file.c_str(), &file_stat) != 0)
+                throw std::runtime_error(std::string("cannot stat file ") + profile_file);
+
+            for (uint64_t word : { uint64_t(file_stat.st_size), uint64_t(file_stat.st_mtim.tv_sec), uint64_t(file_stat.st_mtim.tv_nsec) })
+                h = (h ^ word) * 0x100000001b3;
+        }
+
+        source.profiles_checksum = h;
+        return source;
+    }
+
+    // the profiles are read one by one, only the band tables are kept in memory until they are written
+    static void build(const std::string &index_file, const std::vector<std::string> &profile_files, const Header &source, int rows = DEFAULT_ROWS)
+    {
+        if (profile_files.empty())
+            throw std::runtime_error("no profiles to index");
+
+        if (rows < 1)
+            throw std::runtime_error("invalid LSH rows");
+
+        // written under a temporary name of this process and renamed, so a failed build leaves no index behind
+        // and concurrent builds do not write the same file
+        const std::string tmp = index_file + "." + std::to_string(getpid()) + ".tmp";
+        try
+        {
+            write_index(tmp, profile_files, source, rows);
+        }
+        catch (...)
+        {
+            std::remove(tmp.c_str());
+            throw;
+        }
+
+        if (std::rename(tmp.c_str(), index_file.c_str()) != 0)
+        {
+            std::remove(tmp.c_str());
+            throw std::runtime_error(std::string("cannot save profile index ") + index_file);
+        }
+    }
+
+    // returns false when the index does not exist or was built from another version of the files list or of its profiles
+    bool open(const std::string &index_file, const Header &source)
+    {
+        struct stat file_stat;
+        if (stat(index_file.c_str(), &file_stat) != 0)
+            return false;
+
+        mapping.open(index_file, IO::MappedFile::PREFETCH_WILLNEED);
+        if (mapping.size < sizeof(Header))
+            return reject(index_file, "truncated");
+
+        memcpy(&header, mapping.data, sizeof(header));
+        if (header.magic != MAGIC || header.version != VERSION)
+            return reject(index_file, "unsupported version");
+
+        if (header.source_size != source.source_size || header.source_mtime_sec != source.source_mtime_sec || header.source_mtime_nsec != source.source_mtime_nsec)
+            return reject(index_file, "built from another files list");
+
+        if (header.profiles_checksum != source.profiles_checksum)
+            return reject(index_file, "profiles were modified");
+
+        if (header.rows == 0 || header.bands != header.sketch_len / header.rows || header.bands == 0 ||
+            header.sketches_offset + header.profile_count * header.sketch_len * sizeof(kmer_t) > header.tables_offset ||
+            header.tables_offset + header.profile_count * header.bands * sizeof(BandEntry) != header.names_offset ||
+            header.names_offset + header.names_size != mapping.size)
+            return reject(index_file, "truncated");
+
+        sketches = (const kmer_t*)(mapping.data + header.sketches_offset);
+        tables = (const BandEntry*)(mapping.data + header.tables_offset);
+
+        names.clear();
+        const char *name = mapping.data + header.names_offset, *names_end = name + header.names_size;
+        while (name < names_end)
+        {
+            const char *end = (const char*)memchr(name, '\n', names_end - name);
+            if (!end)
+                return reject(index_file, "truncated");
+
+            names.emplace_back(name, end);
+            name = end + 1;
+        }
+
+        if (names.size() != header.profile_count)
+            return reject(index_file, "truncated");
+
+        return true;
+    }
+
+    // number of equal positions
+    static size_t equal_count(const kmer_t *a, const kmer_t *b, size_t len)
+    {
+        size_t i = 0, count = 0;
+#if defined(__AVX2__)
+        __m256i sum = _mm256_setzero_si256();
+        for (; i + 4 <= len; i += 4)
+        {
+            const __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)));
+            sum = _mm256_sub_epi64(sum, eq); // equal lanes are -1
+        }
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i*)lanes, sum);
+        count = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__SSE4_1__)
+        __m128i sum = _mm_setzero_si128();
+        for (; i + 2 <= len; i += 2)
+        {
+            const __m128i eq = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+            sum = _mm_sub_epi64(sum, eq);
+        }
+        uint64_t lanes[2];
+        _mm_storeu_si128((__m128i*)lanes, sum);
+        count = lanes[0] + lanes[1];
+#endif
+        for (; i < len; i++)
+            count += a[i] == b[i];
+
+        return count;
+    }
+
+    struct QueryStats
+    {
+        size_t candidates = 0;
+        bool scanned = false; // the candidates did not prove the result and all the profiles were compared
+    };
+
+    // top_count closest profiles, the same as comparing the query with all of them
+    std::vector<Match> closest(const std::vector<kmer_t> &query, size_t top_count, QueryStats *stats = nullptr) const
+    {
+        if (query.size() != header.sketch_len)
+            throw std::runtime_error("query profile size differs from the indexed profiles");
+
+        std::vector<uint32_t> candidates;
+        std::vector<bool> seen(size());
+        for (size_t band = 0; band < header.bands && candidates.size() <= size() / MAX_CANDIDATES_PART; band++)
+        {
+            const BandEntry *from = tables + band * header.profile_count, *to = from + header.profile_count;
+            const BandEntry key = {band_key(query.data(), band, int(header.rows)), 0};
+            for (auto it = std::lower_bound(from, to, key); it != to && it->key == key.key; ++it)
+                if (!seen[it->profile])
+                {
+                    seen[it->profile] = true;
+                    candidates.push_back(it->profile);
+                }
+        }
+
+        top_count = std::min(top_count, size());
+        std::vector<Match> matches;
+        bool proven = false;
+        if (candidates.size() <= size() / MAX_CANDIDATES_PART) // otherwise most profiles share something with the query and comparing them in order is faster
+        {
+            for (auto profile : candidates)
+                matches.emplace_back(profile, equal_count(query.data(), sketch(profile), header.sketch_len));
+
+            top(matches, top_count);
+            const size_t bound = header.sketch_len - header.bands; // equal positions of a profile which is not a candidate
+            proven = matches.size() == top_count && (top_count == 0 || matches.back().equal > bound);
+            if (!proven && bound == 0)
+            {
+                // with bands of one row the profiles which are not candidates share nothing with the query, so they follow in the files list order
+                while (!matches.empty() && matches.back().equal == 0)
+                    matches.pop_back();
+
+                std::vector<size_t> sharing;
+                for (auto &match : matches)
+                    sharing.push_back(match.profile);
+                std::sort(sharing.begin(), sharing.end());
+
+                for (size_t profile = 0; profile < size() && matches.size() < top_count; profile++)
+                    if (!std::binary_search(sharing.begin(), sharing.end(), profile))
+                        matches.emplace_back(profile, 0);
+
+                proven = true;
+            }
+        }
+
+        if (stats)
+        {
+            stats->candidates = candidates.size();
+            stats->scanned = !proven;
+        }
+
+        return proven ? matches : scan(query, top_count);
+    }
+
+    // compares the query with all the profiles
+    std::vector<Match> scan(const std::vector<kmer_t> &query, size_t top_count) const
+    {
+        std::vector<Match> matches(size());
+        for (size_t profile = 0; profile < size(); profile++)
+            matches[profile] = Match(profile, equal_count(query.data(), sketch(profile), header.sketch_len));
+
+        return top(matches, top_count);
+    }
+
+    // sorts the top count matches to the front and drops the rest
+    static std::vector<Match> &top(std::vector<Match> &matches, size_t top_count)
+    {
+        top_count = std::min(top_count, matches.size());
+        std::partial_sort(matches.begin(), matches.begin() + top_count, matches.end());
+        matches.resize(top_count);
+        return matches;
+    }
+
+private:
+    static void write_index(const std::string &filename, const std::vector<std::string> &profile_files, const Header &source, int rows)
+    {
+        Header header = source;
+        header.magic = MAGIC;
+        header.version = VERSION;
+        header.profile_count = profile_files.size();
+        header.rows = rows;
+        header.sketches_offset = align(sizeof(Header));
+
+        std::ofstream f(filename, std::ios::binary | std::ios::out | std::ios::trunc);
+        if (f.fail())
+            throw std::runtime_error(std::string("cannot create file ") + filename);
+
+        f.seekp(header.sketches_offset);
+        std::vector<BandEntry> tables;
+        for (size_t profile = 0; profile < profile_files.size(); profile++)
+        {
+            auto kmers = load_profile(profile_files[profile]);
+            if (profile == 0)
+            {
+                if (kmers.empty() || kmers.size() < size_t(rows))
+                    throw std::runtime_error(std::string("profile is shorter than LSH rows: ") + profile_files[profile]);
+
+                header.sketch_len = kmers.size();
+                header.bands = kmers.size() / rows;
+                tables.resize(header.bands * profile_files.size());
+            }
+            else if (kmers.size() != header.sketch_len)
+                throw std::runtime_error(std::string("profile sizes differ: ") + profile_files[profile]);
+
+            f.write((const char*)kmers.data(), kmers.size() * sizeof(kmer_t));
+            for (size_t band = 0; band < header.bands; band++)
+            {
+                auto &entry = tables[band * profile_files.size() + profile];
+                entry.key = band_key(kmers.data(), band, rows);
+                entry.profile = uint32_t(profile);
+            }
+        }
+
+        for (size_t band = 0; band < header.bands; band++)
+            std::sort(tables.begin() + band * profile_files.size(), tables.begin() + (band + 1) * profile_files.size());
+
+        std::string names;
+        for (auto &name : profile_files)
+            names += name + '\n';
+
+        header.tables_offset = align(header.sketches_offset + header.profile_count * header.sketch_len * sizeof(kmer_t));
+        header.names_offset = header.tables_offset + tables.size() * sizeof(BandEntry);
+        header.names_size = names.size();
+
+        f.seekp(header.tables_offset);
+        f.write((const char*)tables.data(), tables.size() * sizeof(BandEntry));
+        f.write(names.data(), names.size());
+        f.seekp(0);
+        f.write((const char*)&header, sizeof(header));
+        f.close();
+        if (!f)
+            throw std::runtime_error(std::string("cannot save profile index ") + filename);
+    }
+
+
+    static uint64_t align(uint64_t offset)
+    {
+        return (offset + 63) / 64 * 64;
+    }
+
+    static uint32_t band_key(const kmer_t *sketch, size_t band, int rows)
+    {
+        uint64_t h = 0xcbf29ce484222325 ^ band;
+        for (int i = 0; i < rows; i++)
+            h = (h ^ sketch[band * rows + i]) * 0x100000001b3;
+
+        return uint32_t(h ^ (h >> 32));
+    }
+
+    bool reject(const std::string &index_file, const char *reason)
+    {
+        mapping.close();
+        LOG("profile index " << index_file << " is ignored: " << reason);
+        return false;
+    }
+};
+
+#endif
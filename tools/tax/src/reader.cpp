@@ -26,53 +26,57 @@
 
 #include "reader.h"
 #include "fasta_reader.h"
+#include "fastx_reader.h"
 #include "mt_reader.h"
 #include "aux_reader.h"
 #include "omp_adapter.h"
 #include "log.h"
 
 template <typename ReaderImpl, typename... ReaderArgs>
-static ReaderPtr create_wrapped(int ultrafast_skip_reader_step, ReaderArgs... args) {
+static ReaderPtr create_prefetching(bool prefetch, size_t chunk_size, ReaderArgs... args) {
+    if (prefetch)
+        return ReaderPtr(new MTReader<ReaderImpl>(MTReader<ReaderImpl>::QUEUE_SIZE, chunk_size, args...));
+    else
+        return ReaderPtr(new ReaderImpl(args...));
+}
+
+// read-ahead is the outermost wrapper, so splitting and filtering run in the background thread as well
+template <typename ReaderImpl, typename... ReaderArgs>
+static ReaderPtr create_wrapped(int ultrafast_skip_reader_step, bool prefetch, size_t chunk_size, ReaderArgs... args) {
     if (ultrafast_skip_reader_step == 0)
-        return ReaderPtr(new SplittingReader<ReaderImpl>(args...));
+        return create_prefetching<SplittingReader<ReaderImpl>>(prefetch, chunk_size, args...);
     else
-        return ReaderPtr(new UltraFastSkipReader<ReaderImpl>(ultrafast_skip_reader_step, args...));
+        return create_prefetching<UltraFastSkipReader<ReaderImpl>>(prefetch, chunk_size, ultrafast_skip_reader_step, args...);
 }
 
 template <typename ReaderImpl, typename... ReaderArgs>
-static ReaderPtr create_filtered(const std::string& filter_file, bool exclude_filter, int ultrafast_skip_reader_step, ReaderArgs... args) {
+static ReaderPtr create_filtered(const std::string& filter_file, bool exclude_filter, int ultrafast_skip_reader_step, bool prefetch, size_t chunk_size, ReaderArgs... args) {
     if (!filter_file.empty()) {
         if (exclude_filter) {
-            return create_wrapped<FilteringReader<ReaderImpl, ExcludeFileSpotFilter>>(ultrafast_skip_reader_step, filter_file, args...);
+            return create_wrapped<FilteringReader<ReaderImpl, ExcludeFileSpotFilter>>(ultrafast_skip_reader_step, prefetch, chunk_size, filter_file, args...);
         } else {
-            return create_wrapped<FilteringReader<ReaderImpl, IncludeFileSpotFilter>>(ultrafast_skip_reader_step, filter_file, args...);
+            return create_wrapped<FilteringReader<ReaderImpl, IncludeFileSpotFilter>>(ultrafast_skip_reader_step, prefetch, chunk_size, filter_file, args...);
         }
     } else {
-        return create_wrapped<ReaderImpl>(ultrafast_skip_reader_step, args...);
+        return create_wrapped<ReaderImpl>(ultrafast_skip_reader_step, prefetch, chunk_size, args...);
     }
 }
 
+// thread_count == 0 reads in the calling thread, otherwise chunks are read ahead by one background thread
 template <typename ReaderImpl, typename... ReaderArgs>
 static ReaderPtr create_threaded(const std::string& filter_file, bool exclude_filter, int ultrafast_skip_reader_step, int thread_count, size_t chunk_size, ReaderArgs... args) {
-    if (thread_count < 0) {
-//        thread_count = std::max(omp_get_max_threads() / 2, 1);
-//        thread_count = std::max(std::thread::hardware_concurrency() / 2, 1u);
-        thread_count = 1; //bug SRA-6371 - does not work with stdin std::max(std::thread::hardware_concurrency() / 2, 1u); workaround over ngs high overhead
-    }
     if (chunk_size == 0) {
         chunk_size = Reader::DEFAULT_CHUNK_SIZE;
     }
-//    if (thread_count > 1) {
-//        return create_filtered<MTReader<ReaderImpl>>(filter_file, exclude_filter, ultrafast_skip_reader_step, thread_count, chunk_size, args...);
-//    } else {
-        return create_filtered<ReaderImpl>(filter_file, exclude_filter, ultrafast_skip_reader_step, args...);
-//    }
+    return create_filtered<ReaderImpl>(filter_file, exclude_filter, ultrafast_skip_reader_step, thread_count != 0, chunk_size, args...);
 }
 
 ReaderPtr Reader::create(const std::string& path, const Reader::Params& params) {
-    if (FastaReader::is_fasta(path)) {
-        LOG("FastaReader");
-        return create_threaded<FastaReader>(params.filter_file, params.exclude_filter, params.ultrafast_skip_reader, params.thread_count, params.chunk_size, path);
+    if (FastxReader::is_fastx(path)) {
+        // reading is sequential, only parsing of blocks runs in parallel, so stdin is fine here
+        int parse_threads = params.thread_count > 0 ? params.thread_count : std::max(1, omp_get_max_threads() / 4);
+        LOG("FastxReader");
+        return create_threaded<FastxReader>(params.filter_file, params.exclude_filter, params.ultrafast_skip_reader, params.thread_count, params.chunk_size, path, params.read_qualities, parse_threads);
     } else 
 		throw std::runtime_error("NGS library support has been removed, please use fasta data streaming to stdin instead");
 }
@@ -103,8 +103,8 @@ public:
         bool read_qualities = false; // if true, low quality bases replaced with N
         int ultrafast_skip_reader = 0;
         bool unaligned_only = false; // if true, skips aligned reads
-        int thread_count = -1; // default means auto
-        size_t chunk_size = 0; ; // default means auto
+        int thread_count = -1; // default means auto, 0 reads in the calling thread, otherwise chunks are read ahead in background
+        size_t chunk_size = 0; // default means auto, size of read ahead chunks
         Params() = default;
     };
     // factory method, creates corresponding reader depending on file type
@@ -0,0 +1,197 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <chrono>
+#include <type_traits>
+#include "kmer_filter.h"
+#include "log.h"
+
+// per stage counters of an aligns_to run, reported with -metrics <file> and -metrics_interval <seconds>
+// matchers count into counters of their own thread, which are handed over with every matched chunk
+// and summed by the output stage, so counting needs neither locks nor atomics
+struct RunMetrics
+{
+    struct Counters
+    {
+        size_t fragments = 0, bases = 0, matched_fragments = 0;
+        size_t kmers = 0; // kmers of the fragments
+        size_t lookups = 0, prefilter_rejects = 0, kmer_hits = 0; // lookups include the kmers rejected by prefilter
+
+        void add(const Counters &x)
+        {
+            fragments += x.fragments;
+            bases += x.bases;
+            matched_fragments += x.matched_fragments;
+            kmers += x.kmers;
+            lookups += x.lookups;
+            prefilter_rejects += x.prefilter_rejects;
+            kmer_hits += x.kmer_hits;
+        }
+
+        // one fragment looked up by a matcher
+        void add_lookups(const KmerBloomFilter::Counts &counts, size_t seq_len, size_t kmer_len)
+        {
+            kmers += seq_len >= kmer_len ? seq_len - kmer_len + 1 : 0;
+            lookups += counts.lookups;
+            prefilter_rejects += counts.rejected;
+            kmer_hits += counts.found;
+        }
+    };
+
+    // pipeline stage: chunks, time spent processing them and waiting for input or for room in the queue
+    struct Stage
+    {
+        size_t chunks = 0;
+        double busy_sec = 0, stall_sec = 0;
+
+        template <class StageStats>
+        void set(const StageStats &stats)
+        {
+            chunks = stats.items;
+            busy_sec = stats.busy_sec;
+            stall_sec = stats.stall_sec;
+        }
+    };
+
+    std::string input;
+    double seconds = 0;
+    Counters counters;
+    Stage read, match, output; // match is the sum of all workers
+    int workers = 0;
+
+    // counters of the calling thread since the previous call
+    static Counters &local()
+    {
+        thread_local Counters counters;
+        return counters;
+    }
+
+    static Counters take_local()
+    {
+        auto counters = local();
+        local() = Counters();
+        return counters;
+    }
+
+    template <class PipelineStats>
+    void set_stages(const PipelineStats &stats)
+    {
+        read.set(stats.reader);
+        output.set(stats.writer);
+        typename std::remove_const<decltype(stats.reader)>::type all_workers;
+        for (auto &w : stats.workers)
+            all_workers.add(w);
+        match.set(all_workers);
+        workers = (int)stats.workers.size();
+    }
+
+    static void write_json(std::ostream &f, const std::vector<RunMetrics> &runs)
+    {
+        f << "{\n  \"runs\": [";
+        for (size_t i = 0; i < runs.size(); i++)
+        {
+            f << (i ? ",\n" : "\n");
+            runs[i].write_json(f);
+        }
+        f << "\n  ]\n}\n";
+    }
+
+    void write_json(std::ostream &f) const
+    {
+        f << "    {\n"
+            << "      \"input\": \"" << escaped(input) << "\",\n"
+            << "      \"seconds\": " << seconds << ",\n"
+            << "      \"fragments\": " << counters.fragments << ",\n"
+            << "      \"bases\": " << counters.bases << ",\n"
+            << "      \"matched_fragments\": " << counters.matched_fragments << ",\n"
+            << "      \"kmers\": " << counters.kmers << ",\n"
+            << "      \"lookups\": " << counters.lookups << ",\n"
+            << "      \"prefilter_rejects\": " << counters.prefilter_rejects << ",\n"
+            << "      \"kmer_hits\": " << counters.kmer_hits << ",\n"
+            << "      \"workers\": " << workers << ",\n"
+            << "      \"stages\": {\n";
+        write_stage(f, "read", read, false);
+        write_stage(f, "match", match, false);
+        write_stage(f, "output", output, true);
+        f << "      }\n    }";
+    }
+
+private:
+    static void write_stage(std::ostream &f, const char *name, const Stage &stage, bool last)
+    {
+        f << "        \"" << name << "\": { \"chunks\": " << stage.chunks << ", \"busy_sec\": " << stage.busy_sec << ", \"stall_sec\": " << stage.stall_sec << " }" << (last ? "\n" : ",\n");
+    }
+
+    static std::string escaped(const std::string &s)
+    {
+        std::string out;
+        for (auto c : s)
+        {
+            if (c == '"' || c == '\\')
+                out.push_back('\\');
+            if ((unsigned char)c < 0x20)
+                out.push_back(' ');
+            else
+                out.push_back(c);
+        }
+        return out;
+    }
+};
+
+// throughput since the previous line, logged by the output stage every -metrics_interval seconds
+struct ThroughputLog
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const int interval_sec;
+    Clock::time_point last = Clock::now();
+    RunMetrics::Counters at_last;
+
+    ThroughputLog(int interval_sec) : interval_sec(interval_sec) {}
+
+    void report(const RunMetrics::Counters &counters)
+    {
+        if (interval_sec <= 0)
+            return;
+
+        auto now = Clock::now();
+        const double sec = std::chrono::duration<double>(now - last).count();
+        if (sec < interval_sec)
+            return;
+
+        LOG("throughput: " << size_t((counters.fragments - at_last.fragments) / sec) << " fragments/s, "
+            << (counters.bases - at_last.bases) / sec / 1e6 << " Mbases/s, "
+            << size_t((counters.lookups - at_last.lookups) / sec) << " lookups/s, "
+            << size_t((counters.matched_fragments - at_last.matched_fragments) / sec) << " matched fragments/s");
+        last = now;
+        at_last = counters;
+    }
+};
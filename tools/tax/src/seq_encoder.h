@@ -0,0 +1,224 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#ifndef SEQ_ENCODER_H_INCLUDED
+#define SEQ_ENCODER_H_INCLUDED
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SEQ_ENCODER_X86 1
+#include <immintrin.h>
+#endif
+
+// converts whole reads to 2-bit base codes with the same mapping as Hash::update_hash (A=0, C=1, T=2, G=3)
+// every base takes one byte, anything but A, C, T, G is flagged with INVALID on top of its 2 bits
+// the widest kernel supported by the cpu is selected at runtime
+struct SeqEncoder
+{
+    static const uint8_t CODE_MASK = 3;
+    static const uint8_t INVALID = 4;
+
+    typedef void (*EncodeFunction)(const char *s, size_t len, uint8_t *codes);
+
+    static void encode(const char *s, size_t len, uint8_t *codes)
+    {
+        static const EncodeFunction encode_function = select_encode_function();
+        encode_function(s, len, codes);
+    }
+
+    static void encode(const std::string &s, std::vector<uint8_t> &codes)
+    {
+        codes.resize(s.length());
+        encode(s.data(), s.length(), codes.data());
+    }
+
+    static uint8_t encode_base(char ch)
+    {
+        const uint8_t code = (ch >> 1) & CODE_MASK;
+        return (ch == 'A' || ch == 'C' || ch == 'T' || ch == 'G') ? code : (code | INVALID);
+    }
+
+    // position of the first base other than A, C, T, G or len if there is none
+    static size_t find_invalid(const char *s, size_t len)
+    {
+        size_t i = 0;
+#if SEQ_ENCODER_X86
+        const __m128i a = _mm_set1_epi8('A'), c = _mm_set1_epi8('C'), t = _mm_set1_epi8('T'), g = _mm_set1_epi8('G');
+        for (; i + 16 <= len; i += 16)
+        {
+            const __m128i ch = _mm_loadu_si128((const __m128i*)(s + i));
+            const __m128i valid = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(ch, a), _mm_cmpeq_epi8(ch, c)), _mm_or_si128(_mm_cmpeq_epi8(ch, t), _mm_cmpeq_epi8(ch, g)));
+            const unsigned invalid_mask = ~(unsigned)_mm_movemask_epi8(valid) & 0xFFFF;
+            if (invalid_mask)
+                return i + __builtin_ctz(invalid_mask);
+        }
+#endif
+        for (; i < len; i++)
+            if (encode_base(s[i]) & INVALID)
+                return i;
+
+        return len;
+    }
+
+    static void encode_scalar(const char *s, size_t len, uint8_t *codes)
+    {
+        for (size_t i = 0; i < len; i++)
+            codes[i] = encode_base(s[i]);
+    }
+
+#if SEQ_ENCODER_X86
+    static void encode_sse2(const char *s, size_t len, uint8_t *codes)
+    {
+        const __m128i a = _mm_set1_epi8('A'), c = _mm_set1_epi8('C'), t = _mm_set1_epi8('T'), g = _mm_set1_epi8('G');
+        const __m128i code_mask = _mm_set1_epi8(CODE_MASK), invalid = _mm_set1_epi8(INVALID);
+
+        size_t i = 0;
+        for (; i + 16 <= len; i += 16)
+        {
+            const __m128i ch = _mm_loadu_si128((const __m128i*)(s + i));
+            const __m128i code = _mm_and_si128(_mm_srli_epi16(ch, 1), code_mask); // bits shifted in from the neighbour byte are masked out
+            const __m128i valid = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(ch, a), _mm_cmpeq_epi8(ch, c)), _mm_or_si128(_mm_cmpeq_epi8(ch, t), _mm_cmpeq_epi8(ch, g)));
+            _mm_storeu_si128((__m128i*)(codes + i), _mm_or_si128(code, _mm_andnot_si128(valid, invalid)));
+        }
+
+        encode_scalar(s + i, len - i, codes + i);
+    }
+
+    __attribute__((target("avx2")))
+    static void encode_avx2(const char *s, size_t len, uint8_t *codes)
+    {
+        const __m256i a = _mm256_set1_epi8('A'), c = _mm256_set1_epi8('C'), t = _mm256_set1_epi8('T'), g = _mm256_set1_epi8('G');
+        const __m256i code_mask = _mm256_set1_epi8(CODE_MASK), invalid = _mm256_set1_epi8(INVALID);
+
+        size_t i = 0;
+        for (; i + 32 <= len; i += 32)
+        {
+            const __m256i ch = _mm256_loadu_si256((const __m256i*)(s + i));
+            const __m256i code = _mm256_and_si256(_mm256_srli_epi16(ch, 1), code_mask);
+            const __m256i valid = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(ch, a), _mm256_cmpeq_epi8(ch, c)), _mm256_or_si256(_mm256_cmpeq_epi8(ch, t), _mm256_cmpeq_epi8(ch, g)));
+            _mm256_storeu_si256((__m256i*)(codes + i), _mm256_or_si256(code, _mm256_andnot_si256(valid, invalid)));
+        }
+
+        encode_sse2(s + i, len - i, codes + i);
+    }
+#endif
+
+    static EncodeFunction select_encode_function()
+    {
+#if SEQ_ENCODER_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return encode_avx2;
+
+        return encode_sse2;
+#else
+        return encode_scalar;
+#endif
+    }
+};
+
+// forward, reverse complement and canonical kmers of every position of an encoded read
+// both strands are rolled by one base per step, so no per kmer bit reversal is needed
+template <class hash_t>
+struct KmerStream
+{
+    static hash_t kmer_mask(int kmer_len)
+    {
+        return kmer_len * 2 >= int(sizeof(hash_t) * 8) ? ~hash_t(0) : (hash_t(1) << (kmer_len * 2)) - 1;
+    }
+
+    // calls lambda(pos, forward, rev_complement) for every kmer, returns early if lambda returns false
+    // split_on_invalid skips kmers containing anything but A, C, T, G, as SeqCleaner does,
+    // otherwise every byte contributes its 2 bits, as Hash::for_all_hashes_do does
+    template <class Lambda>
+    static void for_all_kmers_do(const uint8_t *codes, int len, int kmer_len, bool split_on_invalid, Lambda &&lambda)
+    {
+        const hash_t mask = kmer_mask(kmer_len);
+        const int rc_shift = kmer_len * 2 - 2;
+
+        hash_t forward = 0, rev_complement = 0;
+        int valid_len = 0; // number of good bases ending at current position
+        for (int i = 0; i < len; i++)
+        {
+            const uint8_t code = codes[i];
+            if (split_on_invalid && (code & SeqEncoder::INVALID))
+            {
+                valid_len = 0;
+                continue;
+            }
+
+            const hash_t base = code & SeqEncoder::CODE_MASK;
+            forward = ((forward << 2) | base) & mask;
+            rev_complement = (rev_complement >> 2) | ((base ^ 2) << rc_shift);
+
+            if (++valid_len >= kmer_len)
+                if (!lambda(i - kmer_len + 1, forward, rev_complement))
+                    break;
+        }
+    }
+
+    template <class Lambda>
+    static void for_all_canonical_kmers_do(const uint8_t *codes, int len, int kmer_len, bool split_on_invalid, Lambda &&lambda)
+    {
+        for_all_kmers_do(codes, len, kmer_len, split_on_invalid, [&](int pos, hash_t forward, hash_t rev_complement)
+            {
+                return lambda(pos, forward < rev_complement ? forward : rev_complement);
+            });
+    }
+};
+
+// per thread buffers with all kmer streams of one read, reused from read to read
+template <class hash_t>
+struct KmerStreams
+{
+    std::vector<uint8_t> codes;
+    std::vector<int> positions;
+    std::vector<hash_t> forward, rev_complement, canonical;
+
+    void build(const std::string &seq, int kmer_len, bool split_on_invalid)
+    {
+        SeqEncoder::encode(seq, codes);
+        positions.clear();
+        forward.clear();
+        rev_complement.clear();
+        canonical.clear();
+        KmerStream<hash_t>::for_all_kmers_do(codes.data(), (int)codes.size(), kmer_len, split_on_invalid, [&](int pos, hash_t f, hash_t rc)
+            {
+                positions.push_back(pos);
+                forward.push_back(f);
+                rev_complement.push_back(rc);
+                canonical.push_back(f < rc ? f : rc);
+                return true;
+            });
+    }
+
+    size_t size() const { return positions.size(); }
+};
+
+#endif
@@ -0,0 +1,620 @@
+#ifndef __SPOT_RUNS_HPP__
+#define __SPOT_RUNS_HPP__
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include "tax_collator.hpp"
+#include "ordered_pipeline.h"
+
+#include <map>
+#include <cstdio>
+#include <string_view>
+
+BEGIN_TC_NAMESPACE
+
+/**
+ * @brief Out-of-core collation: spots are buffered up to a memory limit, 
+ * then sorted, merged by spot name and written to a run file.
+ * Runs are k-way merged at the end, so only one buffer and the merge heap are in memory.
+ * 
+ * Run file: header (integer_ids, has_counts) followed by records sorted by spot 
+ *   integer ids: varint(id - previous id), names: varint(length) name
+ *   varint(number of tax_id), varint(tax_id)..., [varint(count)...] 
+ * 
+ * Output is the same as Tax_hits collate() + print() or group():
+ * spots seen once keep their tax_id order, repeated spots are merged and normalized,
+ * integer spot ids are ordered numerically, names lexicographically
+ * 
+ * @tparam Options 
+ */
+template<class Options = tax_hits_options<>>
+struct Spot_runs
+{
+    static const size_t IO_BUFFER_SIZE = 1 << 20;   ///< run file read/write buffer
+    static const size_t BATCH_SIZE = 20000;          ///< merged spots per pipeline slot
+
+    string prefix;                 ///< run files are prefix + ".run.N"
+    size_t memory_limit = 0;       ///< spots buffer size in bytes that triggers flush()
+    bool integer_ids = true;       ///< all spot names seen so far are numeric
+    vector<string> run_files;      ///< sorted runs
+    size_t num_spots = 0;          ///< number of added spots (telemetry)
+
+    /**
+     * @brief Construct a new Spot_runs object
+     * 
+     * @param _prefix run files prefix
+     * @param _memory_limit buffer size in bytes 
+     */
+    Spot_runs(const string& _prefix = "", size_t _memory_limit = 0) : prefix(_prefix), memory_limit(_memory_limit) {}
+
+    /**
+     * @brief Buffers new spot stats, writes a run when buffer exceeds memory_limit
+     * 
+     * @param spot 
+     */
+    void add_row(const Spot<Options>& spot);
+
+    /**
+     * @brief Sorts and merges buffered spots and writes them as a new run
+     * 
+     */
+    void flush();
+
+    /**
+     * @brief Saves the list of run files (used by tax_collator to merge them)
+     * 
+     * @param list_file 
+     */
+    void save(const string& list_file) const;
+
+    /**
+     * @brief Loads the list of run files saved by save()
+     * 
+     * @param list_file 
+     * @return false if list_file does not exist
+     */
+    bool init(const string& list_file);
+
+    /**
+     * @brief Deletes run files
+     * 
+     */
+    void remove_runs();
+
+    /**
+     * @brief Merges runs and prints collated spots
+     * 
+     * @tparam PrintOptions 
+     * @param num_threads 
+     * @param os 
+     */
+    template<class PrintOptions = Options>
+    void print(int num_threads, ostream& os);
+
+    /**
+     * @brief Merges runs and prints counts of unique tax_id sets (compact mode)
+     * 
+     * @param num_threads 
+     * @param os 
+     */
+    void group(int num_threads, ostream& os);
+
+    /**
+     * @brief Buffered spots size in bytes
+     * 
+     */
+    size_t memory_used() const { return rows.size() * sizeof(Row) + names.size() + taxa.size() * sizeof(uint32_t); }
+
+private:
+
+    struct Row 
+    {
+        uint64_t id;            ///< spot id in integer mode
+        size_t name_pos;        ///< name offset in names 
+        size_t taxa_pos;        ///< tax_id (and counts) offset in taxa
+        uint32_t name_len;
+        uint32_t taxa_count;
+    };
+
+    vector<Row> rows;           ///< buffered spots
+    vector<char> names;         ///< buffered spot names (names mode only)
+    vector<uint32_t> taxa;      ///< buffered tax_id followed by counts
+    size_t next_run = 0;
+
+    struct Run_writer;
+    struct Run_reader;
+
+    /**
+     * @brief Merged spot ready for output, normalized by the pipeline workers when it was seen more than once
+     * 
+     */
+    template<class SpotOptions>
+    struct Merged_spot
+    {
+        uint64_t id = 0;
+        Spot<SpotOptions> spot;
+        bool repeated = false;
+    };
+
+    template<class SpotOptions>
+    struct Slot
+    {
+        vector<Merged_spot<SpotOptions>> spots;
+        size_t size = 0;
+        string text;
+    };
+
+    /**
+     * @brief Rewrites integer mode runs and buffer in names order 
+     * 
+     */
+    void switch_to_names();
+
+    void buffer_row(const Spot<Options>& spot, uint64_t id, bool has_name);
+
+    /**
+     * @brief K-way merge of the runs, spots with the same name are merged, 
+     * process(slot) is called concurrently, write(slot) in order
+     * 
+     */
+    template<class SpotOptions, class Process, class Write>
+    void merge(int num_threads, Process&& process, Write&& write);
+};
+
+/* -----------------------------------------------------
+ * Run file io
+ * ----------------------------------------------------- */
+
+template<class Options>
+struct Spot_runs<Options>::Run_writer
+{
+    ofstream f;
+    vector<char> buffer;
+    uint64_t prev_id = 0;
+
+    Run_writer(const string& file_name, bool integer_ids) 
+    {
+        f.open(file_name, ios::out | ios::binary | ios::trunc);
+        if (f.fail())
+            throw std::runtime_error(std::string("cannot create run file ") + file_name);
+        buffer.reserve(IO_BUFFER_SIZE + 64);
+        buffer.push_back(char(integer_ids));
+        buffer.push_back(char(Options::has_counts()));
+    }
+
+    void put_varint(uint64_t x)
+    {
+        while (x >= 0x80) {
+            buffer.push_back(char(x | 0x80));
+            x >>= 7;
+        }
+        buffer.push_back(char(x));
+    }
+
+    void write_buffer()
+    {
+        f.write(buffer.data(), buffer.size());
+        if (f.fail())
+            throw std::runtime_error("cannot write run file");
+        buffer.clear();
+    }
+
+    template<class Taxa>
+    void put(uint64_t id, const char* name, size_t name_len, size_t taxa_count, const Taxa& taxa)
+    {
+        if (name) {
+            put_varint(name_len);
+            buffer.insert(buffer.end(), name, name + name_len);
+        } else {
+            put_varint(id - prev_id);
+            prev_id = id;
+        }
+        put_varint(taxa_count);
+        for (size_t i = 0; i < taxa_count; ++i)
+            put_varint(taxa(i, false));
+        if constexpr (Options::has_counts())
+            for (size_t i = 0; i < taxa_count; ++i)
+                put_varint(taxa(i, true));
+        if (buffer.size() >= IO_BUFFER_SIZE)
+            write_buffer();
+    }
+
+    void close()
+    {
+        write_buffer();
+        f.close();
+    }
+};
+
+template<class Options>
+struct Spot_runs<Options>::Run_reader
+{
+    ifstream f;
+    vector<char> buffer;
+    size_t pos = 0;
+    size_t end = 0;
+    bool integer_ids = false;
+    bool has_counts = false;
+    uint64_t id = 0;                    ///< current spot id (integer mode)
+    string name;                        ///< current spot name (names mode)
+    vector<uint32_t> tax_id, counts;    ///< current spot tax_id and counts
+
+    Run_reader(const string& file_name) : buffer(IO_BUFFER_SIZE)
+    {
+        f.open(file_name, ios::in | ios::binary);
+        if (f.fail())
+            throw std::runtime_error(std::string("cannot open run file ") + file_name);
+        int i = get();
+        int c = get();
+        if (i < 0 || c < 0)
+            throw std::runtime_error(std::string("invalid run file ") + file_name);
+        integer_ids = i != 0;
+        has_counts = c != 0;
+    }
+
+    int get()
+    {
+        if (pos == end) {
+            f.read(buffer.data(), buffer.size());
+            end = f.gcount();
+            pos = 0;
+            if (end == 0)
+                return -1;
+        }
+        return (unsigned char)buffer[pos++];
+    }
+
+    uint64_t get_varint()
+    {
+        uint64_t x = 0;
+        for (int shift = 0; ; shift += 7) {
+            int c = get();
+            if (c < 0)
+                throw std::runtime_error("truncated run file");
+            x |= uint64_t(c & 0x7f) << shift;
+            if (c < 0x80)
+                return x;
+        }
+    }
+
+    /**
+     * @brief Reads the next spot 
+     * 
+     * @return false at the end of run
+     */
+    bool next()
+    {
+        if (pos == end) {
+            int c = get();
+            if (c < 0)
+                return false;
+            --pos;
+        }
+        if (integer_ids) {
+            id += get_varint();
+        } else {
+            name.resize(get_varint());
+            for (auto& c : name) {
+                int x = get();
+                if (x < 0)
+                    throw std::runtime_error("truncated run file");
+                c = char(x);
+            }
+        }
+        tax_id.resize(get_varint());
+        for (auto& t : tax_id)
+            t = uint32_t(get_varint());
+        counts.resize(tax_id.size());
+        for (auto& t : counts)
+            t = has_counts ? uint32_t(get_varint()) : 1;
+        return true;
+    }
+
+    bool less(const Run_reader& r) const
+    {
+        return integer_ids ? id < r.id : name < r.name;
+    }
+
+    bool is(uint64_t spot_id, const string& spot_name) const
+    {
+        return integer_ids ? id == spot_id : name == spot_name;
+    }
+
+    template<class SpotOptions>
+    void add_to(Spot<SpotOptions>& spot) const
+    {
+        spot.tax_id.insert(spot.tax_id.end(), tax_id.begin(), tax_id.end());
+        if constexpr (SpotOptions::has_counts())
+            spot.counts.insert(spot.counts.end(), counts.begin(), counts.end());
+    }
+};
+
+/* -----------------------------------------------------
+ * Spot_runs methods implementation 
+ * ----------------------------------------------------- */
+
+template<class Options>
+void Spot_runs<Options>::add_row(const Spot<Options>& spot)
+{
+    if (spot.name.empty())
+        return;
+    uint64_t id = 0;
+    if (integer_ids && !parse_spot_id(spot.name, id))
+        switch_to_names();
+    buffer_row(spot, id, !integer_ids);
+    ++num_spots;
+    if (memory_used() >= memory_limit)
+        flush();
+}
+
+template<class Options>
+void Spot_runs<Options>::buffer_row(const Spot<Options>& spot, uint64_t id, bool has_name)
+{
+    Row row{id, names.size(), taxa.size(), 0, uint32_t(spot.tax_id.size())};
+    if (has_name) {
+        row.name_len = uint32_t(spot.name.size());
+        names.insert(names.end(), spot.name.begin(), spot.name.end());
+    }
+    taxa.insert(taxa.end(), spot.tax_id.begin(), spot.tax_id.end());
+    if constexpr (Options::has_counts())
+        taxa.insert(taxa.end(), spot.counts.begin(), spot.counts.end());
+    rows.push_back(row);
+}
+
+template<class Options>
+void Spot_runs<Options>::switch_to_names()
+{
+    spdlog::info("Non-numeric spot name, rewriting {} runs ordered by spot name", run_files.size());
+    integer_ids = false;
+    // buffered spots get names, every integer mode run is re-sorted as a buffer of its own 
+    for (auto& row : rows) {
+        auto name = to_string(row.id);
+        row.name_pos = names.size();
+        row.name_len = uint32_t(name.size());
+        names.insert(names.end(), name.begin(), name.end());
+    }
+    auto files = move(run_files);
+    run_files.clear();
+    flush();
+    Spot<Options> spot;
+    for (auto& file_name : files) {
+        {
+            Run_reader reader(file_name);
+            while (reader.next()) {
+                spot.name = to_string(reader.id);
+                spot.tax_id = reader.tax_id;
+                if constexpr (Options::has_counts())
+                    spot.counts = reader.counts;
+                buffer_row(spot, 0, true);
+            }
+        }
+        std::remove(file_name.c_str());
+        flush();
+    }
+}
+
+template<class Options>
+void Spot_runs<Options>::flush()
+{
+    if (rows.empty())
+        return;
+    spdlog::stopwatch sw;
+    auto name_of = [&](const Row& row) { return string_view(names.data() + row.name_pos, row.name_len); };
+    if (integer_ids)
+        std::sort(rows.begin(), rows.end(), [](const Row& l, const Row& r) { return l.id < r.id; });
+    else
+        std::sort(rows.begin(), rows.end(), [&](const Row& l, const Row& r) { return name_of(l) < name_of(r); });
+    auto same = [&](const Row& l, const Row& r) { return integer_ids ? l.id == r.id : name_of(l) == name_of(r); };
+
+    run_files.push_back(prefix + ".run." + to_string(next_run++));
+    Run_writer writer(run_files.back(), integer_ids);
+    Spot<Options> spot, next_spot;
+    auto load = [&](const Row& row, Spot<Options>& s) {
+        auto t = taxa.begin() + row.taxa_pos;
+        s.tax_id.assign(t, t + row.taxa_count);
+        if constexpr (Options::has_counts())
+            s.counts.assign(t + row.taxa_count, t + 2 * row.taxa_count);
+    };
+    size_t num_rows = rows.size();
+    size_t num_written = 0;
+    for (size_t i = 0, j = 0; i < num_rows; i = j) {
+        auto& row = rows[i];
+        const char* name = integer_ids ? nullptr : names.data() + row.name_pos;
+        for (j = i + 1; j < num_rows && same(row, rows[j]); ++j);
+        if (j == i + 1) {
+            const uint32_t* t = taxa.data() + row.taxa_pos;
+            writer.put(row.id, name, row.name_len, row.taxa_count, [&](size_t k, bool count) { return t[count ? row.taxa_count + k : k]; });
+        } else {
+            load(row, spot);
+            for (auto k = i + 1; k < j; ++k) {
+                load(rows[k], next_spot);
+                spot.add_taxa(next_spot);
+            }
+            spot.normalize();
+            writer.put(row.id, name, row.name_len, spot.tax_id.size(), [&](size_t k, bool count) { return count ? spot.counts[k] : spot.tax_id[k]; });
+        }
+        ++num_written;
+    }
+    writer.close();
+    spdlog::info("Run '{}': {:L} rows, {:L} spots, took {:.3}", run_files.back(), num_rows, num_written, sw);
+    rows.clear();
+    names.clear();
+    taxa.clear();
+}
+
+template<class Options>
+void Spot_runs<Options>::save(const string& list_file) const
+{
+    ofstream f(list_file);
+    for (auto& file_name : run_files)
+        f << file_name << '\n';
+    if (f.fail())
+        throw std::runtime_error(std::string("cannot write run list ") + list_file);
+}
+
+template<class Options>
+bool Spot_runs<Options>::init(const string& list_file)
+{
+    ifstream f(list_file);
+    if (f.fail())
+        return false;
+    run_files.clear();
+    for (string file_name; getline(f, file_name); )
+        if (!file_name.empty())
+            run_files.push_back(file_name);
+    if (!run_files.empty())
+        integer_ids = Run_reader(run_files.front()).integer_ids;
+    return true;
+}
+
+template<class Options>
+void Spot_runs<Options>::remove_runs()
+{
+    for (auto& file_name : run_files)
+        std::remove(file_name.c_str());
+    run_files.clear();
+}
+
+template<class Options>
+template<class SpotOptions, class Process, class Write>
+void Spot_runs<Options>::merge(int num_threads, Process&& process, Write&& write)
+{
+    spdlog::stopwatch sw;
+    vector<unique_ptr<Run_reader>> readers;
+    vector<Run_reader*> heap; 
+    auto greater = [](const Run_reader* l, const Run_reader* r) { return r->less(*l); };
+    for (auto& file_name : run_files) {
+        readers.push_back(std::make_unique<Run_reader>(file_name));
+        if (readers.back()->integer_ids != readers.front()->integer_ids)
+            throw std::runtime_error("runs are sorted by both spot ids and spot names");
+        if (readers.back()->next()) {
+            heap.push_back(readers.back().get());
+            push_heap(heap.begin(), heap.end(), greater);
+        }
+    }
+    size_t num_merged = 0;
+    OrderedPipeline<Slot<SpotOptions>> pipeline(num_threads);
+    pipeline.run([&](Slot<SpotOptions>& slot) {
+        slot.size = 0;
+        while (slot.size < BATCH_SIZE && !heap.empty()) {
+            if (slot.spots.size() == slot.size)
+                slot.spots.emplace_back();
+            auto& merged = slot.spots[slot.size++];
+            pop_heap(heap.begin(), heap.end(), greater);
+            auto reader = heap.back();
+            merged.id = reader->id;
+            merged.spot.name = reader->name;
+            merged.spot.tax_id.clear();
+            merged.spot.counts.clear();
+            reader->add_to(merged.spot);
+            merged.repeated = false;
+            // the same spot in the other runs 
+            while (true) {
+                if (reader->next()) 
+                    push_heap(heap.begin(), heap.end(), greater);
+                else 
+                    heap.pop_back();
+                if (heap.empty() || !heap.front()->is(merged.id, merged.spot.name))
+                    break;
+                pop_heap(heap.begin(), heap.end(), greater);
+                reader = heap.back();
+                reader->add_to(merged.spot);
+                merged.repeated = true;
+                ++num_merged;
+            }
+        }
+        return !heap.empty();
+    }, [&](Slot<SpotOptions>& slot) {
+        for (size_t i = 0; i < slot.size; ++i)
+            if (slot.spots[i].repeated)
+                slot.spots[i].spot.normalize();
+        process(slot);
+    }, write);
+    spdlog::info("Merged {} runs, {:L} merges, took {:.3}", run_files.size(), num_merged, sw);
+}
+
+template<class Options>
+template<class PrintOptions>
+void Spot_runs<Options>::print(int num_threads, ostream& os)
+{
+    merge<PrintOptions>(num_threads, [this](Slot<PrintOptions>& slot) {
+        auto& text = slot.text;
+        text.clear();
+        for (size_t i = 0; i < slot.size; ++i) {
+            auto& merged = slot.spots[i];
+            auto& spot = merged.spot;
+            text += integer_ids ? to_string(merged.id) : spot.name;
+            for (size_t k = 0; k < spot.tax_id.size(); ++k) {
+                text += '\t';
+                text += to_string(spot.tax_id[k]);
+                if constexpr (PrintOptions::has_counts()) {
+                    if (spot.counts[k] > 1) {
+                        text += 'x';
+                        text += to_string(spot.counts[k]);
+                    }
+                }
+            }
+            text += '\n';
+        }
+    }, [&](Slot<PrintOptions>& slot) {
+        os.write(slot.text.data(), slot.text.size());
+    });
+    os.flush();
+}
+
+template<class Options>
+void Spot_runs<Options>::group(int num_threads, ostream& os)
+{
+    typedef tax_hits_options<COMPACT_OPT, EXCLUDE_COUNTS_OPT> GroupOptions;
+    // same order as Tax_hits::group(): by cardinality, then by tax_id
+    struct Taxa_less
+    {
+        bool operator()(const vector<uint32_t>& l, const vector<uint32_t>& r) const
+        {
+            return l.size() != r.size() ? l.size() < r.size() : l < r;
+        }
+    };
+    map<vector<uint32_t>, size_t, Taxa_less> groups;
+    merge<GroupOptions>(num_threads, [](Slot<GroupOptions>&) {}, [&](Slot<GroupOptions>& slot) {
+        for (size_t i = 0; i < slot.size; ++i) {
+            auto& tax_id = slot.spots[i].spot.tax_id;
+            if (!tax_id.empty())
+                ++groups[tax_id];
+        }
+    });
+    spdlog::info("{:L} groups", groups.size());
+    for (auto& g : groups) {
+        os << g.second;
+        for (auto t : g.first)
+            os << '\t' << t;
+        os << '\n';
+    }
+    os.flush();
+}
+
+END_TC_NAMESPACE
+
+#endif
@@ -24,35 +24,27 @@
 *
 */
 #include <string>
-#include <fstream>
 #include <iostream>
 #include <vector>
-#include "dbs.h"
+#include "dbs_set_ops.h"
 #include "hash.h"
 #include "config_subtract_dbs.h"
 
-bool in_db(hash_t hash, const std::vector<hash_t> &db)
-{
-	return std::binary_search(db.begin(), db.end(), hash);
-}
-
 int main(int argc, char const *argv[])
 {
 	Config config(argc, argv);
 
-	std::vector<DBS::KmerTax> db_a;
-	std::vector<hash_t> db_b;
-	int kmer_len_a = DBSIO::load_dbs(config.db_a, db_a);
-	int kmer_len_b = DBSIO::load_dbs(config.db_b, db_b);
-
-    if (kmer_len_a != kmer_len_b)
-    {
-        std::cerr << "kmer_len_a != kmer_len_b" << std::endl;
-        return 1;
-    }
+	auto inputs = DBSSetOps::open({config.db_a, config.db_b});
+	if (!config.db_c.empty())
+	{
+		DBSSetOps::save(DBSSetOps::DIFFERENCE, inputs, config.db_c, config.threads);
+		return 0;
+	}
 
-    // todo: mt
-	for (auto &x : db_a)
-        if (!in_db(x.kmer, db_b))
-    		std::cout << Hash<hash_t>::str_from_hash(x.kmer, kmer_len_a) << " " << x.tax_id << std::endl;
+	const size_t kmer_len = DBSSetOps::kmer_len_of(inputs);
+	DBSSetOps::run<DBS::KmerTax>(DBSSetOps::DIFFERENCE, inputs, config.threads, nullptr, [&](const std::vector<DBS::KmerTax> &kmers)
+	{
+		for (auto &x : kmers)
+			std::cout << Hash<hash_t>::str_from_hash(x.kmer, kmer_len) << " " << x.tax_id << '\n';
+	});
 }
@@ -26,6 +26,7 @@
 
 #include "config_tax_collator.h"
 #include "tax_collator.hpp"
+#include "spot_runs.hpp"
 
 #include <iostream>
 #include <chrono>
@@ -48,9 +49,27 @@ using namespace std::chrono;
 template<class Options>
 void run_collator(tf::Executor& executor, bool compact, ostream& os, const string& file) 
 {
+    // sorted runs written by aligns_to -vectorize -collate_memory
+    tc::Spot_runs<Options> runs;
+    if (runs.init(file + ".runs")) {
+        if (compact)
+            runs.group(executor.num_workers(), os);
+        else
+            runs.print(executor.num_workers(), os);
+        return;
+    }
+
+    // binary hits of aligns_to -out_format binary, spot names are needed to collate them as aligns_to -collate does
+    const bool hit_stream = HitStream::is_hit_stream(file);
 
     //tax_hits_opt::is_compact()
-    if (compact) {
+    if (compact && hit_stream) {
+        auto tax_hits = std::make_unique<tc::Tax_hits<Options>>(true);
+        tax_hits->load_hit_stream(file);
+        auto collated_tax_hits = tax_hits->template collate<tc::tax_hits_options<true, false>>(executor);   
+        tax_hits.reset(0);
+        collated_tax_hits->group(executor, os);
+    } else if (compact) {
         auto tax_hits = std::make_unique<tc::Tax_hits<tc::tax_hits_options<true, false>>>(true);
         tax_hits->init(file);
         auto collated_tax_hits = tax_hits->template collate<tc::tax_hits_options<true, false>>(executor);   
@@ -68,7 +87,10 @@ void run_collator(tf::Executor& executor, bool compact, ostream& os, const strin
         */
     } else {
         auto tax_hits = std::make_unique<tc::Tax_hits<Options>>(true);
-        tax_hits->init(file);
+        if (hit_stream)
+            tax_hits->load_hit_stream(file);
+        else
+            tax_hits->init(file);
         auto collated_tax_hits = tax_hits->template collate<Options>(executor);   
         tax_hits.reset(0);
         collated_tax_hits->print(executor, os); 
@@ -41,6 +41,7 @@
 #include "spdlog/stopwatch.h"
 #include "taskflow/taskflow.hpp"
 #include <taskflow/algorithm/sort.hpp>
+#include "hit_stream.h"
  
 #include <iostream>
 #include <fstream>
@@ -126,6 +127,30 @@ typedef bm::str_sparse_vector<char, bvector_type, 3> str_sv_type;
 
 typedef bm::sparse_vector<uint32_t, bvector_type> sparse_vector_u32;
 typedef bm::rsc_sparse_vector<uint32_t, sparse_vector_u32>  rsc_sparse_vector_u32;
+typedef bm::sparse_vector<uint64_t, bvector_type> sparse_vector_u64;
+
+/**
+ * @brief Parses canonical decimal spot id (digits only, no leading zeros) 
+ * Only such ids survive the round trip through an integer and back to the same string
+ * 
+ * @param name spot name
+ * @param id parsed id
+ * @return true if name is a canonical decimal number that fits uint64_t
+ */
+static 
+bool parse_spot_id(const string& name, uint64_t& id)
+{
+    auto sz = name.size();
+    if (sz == 0 || sz > 19 || (name[0] == '0' && sz > 1))
+        return false;
+    id = 0;
+    for (auto c : name) {
+        if (c < '0' || c > '9')
+            return false;
+        id = id * 10 + (c - '0');
+    }
+    return true;
+}
 
 /**
  * @brief Matrix of uint32 values where each columns is represented by rsc_sparse_vector
@@ -245,6 +270,8 @@ struct Tax_hits
 {
     unique_ptr<str_sv_type> spot_names;    ///< spot names list 
     unique_ptr<str_sv_type::back_insert_iterator> spot_names_bi; ///< spot names insert iterator 
+    unique_ptr<sparse_vector_u64> spot_ids;    ///< integer spot ids, used instead of spot_names while all spot names are numeric
+    unique_ptr<sparse_vector_u64::back_insert_iterator> spot_ids_bi; ///< spot ids insert iterator 
  
     U32_rsc_matrix tax_ids{"Tax_id"};      ///< tax_id matrix
     U32_rsc_matrix counts{"Counts"};       ///< tax_id's counts matrix
@@ -255,14 +282,16 @@ struct Tax_hits
     mutex m_output_mutex;                  ///< protects output
 
     vector<uint32_t> spot_index;           ///< temporary index used by collate (sort and merge)
+    vector<uint64_t> sorted_ids;           ///< temporary spot ids in spot_index order, used by collate in integer mode
 
     /**
      * @brief Construct a new Tax_hits object
      * 
      * @param _num_threads 
      * @param use_null - flag to indicate if spot_names cane be nullable (and thus pruned more efficiently)
+     * @param integer_ids - start in integer spot id mode, falls back to spot_names on the first non-numeric spot name
      */
-    Tax_hits(bool use_null = false);
+    Tax_hits(bool use_null = false, bool integer_ids = true);
 
     /**
      * @brief Adds new spot stats
@@ -271,6 +300,20 @@ struct Tax_hits
      */
     void add_row(const Spot<Options>& spot);
 
+    /**
+     * @brief Adds new spot stats with already parsed integer spot id (integer mode only)
+     * 
+     * @param spot 
+     * @param spot_id 
+     */
+    void add_row(const Spot<Options>& spot, uint64_t spot_id);
+
+    /**
+     * @brief Number of spots (rows)
+     * 
+     */
+    size_t size() const { return spot_ids ? spot_ids->size() : spot_names->size(); }
+
     /**
      * @brief Finalize insertions by flashing spot name insert iterator and finalizing rsc_matrices 
      * After finalize  insertions operation are not valid 
@@ -311,6 +354,14 @@ struct Tax_hits
      */
     void load(const string& filename);
 
+    /**
+     * @brief Loads binary hits written by aligns_to -out_format binary|binary_zstd (see hit_stream.h)
+     * Same as load of the text output without parsing the lines
+     * 
+     * @param filename 
+     */
+    void load_hit_stream(const string& filename);
+
     /**
      * Clears all data
      * 
@@ -345,6 +396,15 @@ struct Tax_hits
      */
     void sort(tf::Executor& executor);
 
+    /**
+     * @brief Integer mode sort: fills spot_index and sorted_ids  
+     * Keeps the insertion order when ids are already monotonic (single reader), 
+     * otherwise packs (id, row) into uint64 and radix sorts them
+     * 
+     * @param executor 
+     */
+    void sort_ids(tf::Executor& executor);
+
     /**
      * @brief used by collate() method. Merges sorted (via spot_index) spots and saves them in the new Tax_hits structure
      * peridocally prunes itself using set_null method
@@ -408,6 +468,19 @@ struct Tax_hits
      */
     void group(tf::Executor& executor, ostream& os); 
 
+    /**
+     * @brief Converts collected integer spot ids into spot_names and turns off integer mode
+     * 
+     */
+    void switch_to_names();
+
+    /**
+     * @brief Adds tax_id and counts of the spot as a new row
+     * 
+     * @param spot 
+     */
+    void add_taxa_row(const Spot<Options>& spot);
+
     /**
      * @brief Temporary buffer structure to perform asynchronous merge
      * 
@@ -422,7 +495,12 @@ struct Tax_hits
             spot.name = spot_name;
             assert(spot_name.empty() == false);
         }
+        Merge_data(uint64_t spot_id, uint32_t i) 
+            : idx(1, i), id(spot_id)
+        {
+        }
         vector<uint32_t> idx;
+        uint64_t id = 0;          ///< spot id in integer mode
         Spot<SpotOptions> spot;
     };
 
@@ -483,6 +561,8 @@ void Spot<Options>::add_taxa(const Spot<Options>& spot)
 template<class Options>
 void Spot<Options>::normalize() 
 {
+    if (tax_id.empty())
+        return;
     if constexpr (Options::has_counts()) {
         static thread_local vector<uint32_t> new_tax_id;
         static thread_local vector<uint32_t> new_counts;
@@ -663,11 +743,31 @@ void U32_rsc_matrix::get_row(uint32_t row_index, vector<uint32_t>& cols)
  * ----------------------------------------------------- */
 
 template<class Options>
-Tax_hits<Options>::Tax_hits(bool use_null) 
+Tax_hits<Options>::Tax_hits(bool use_null, bool integer_ids) 
 {
     spot_names = std::make_unique<str_sv_type>(use_null ? bm::use_null : bm::no_null);
-    if constexpr (Options::is_compact() == false)
-        spot_names_bi = std::make_unique<str_sv_type::back_insert_iterator>(spot_names.get());        
+    if (integer_ids)
+        spot_ids = std::make_unique<sparse_vector_u64>(use_null ? bm::use_null : bm::no_null);
+    if constexpr (Options::is_compact() == false) {
+        if (spot_ids)
+            spot_ids_bi = std::make_unique<sparse_vector_u64::back_insert_iterator>(spot_ids.get());
+        else
+            spot_names_bi = std::make_unique<str_sv_type::back_insert_iterator>(spot_names.get());        
+    }
+}
+
+template<class Options>
+void Tax_hits<Options>::switch_to_names() 
+{
+    assert(spot_ids && spot_ids_bi);
+    spot_ids_bi->flush();
+    spot_ids_bi.reset(0);
+    spot_names_bi = std::make_unique<str_sv_type::back_insert_iterator>(spot_names.get());        
+    auto sz = spot_ids->size();
+    spdlog::info("Non-numeric spot name, converting {:L} integer spot ids to names", sz);
+    for (auto it = spot_ids->get_const_iterator(0); it.valid(); it.advance()) 
+        *spot_names_bi = to_string(it.value());
+    spot_ids.reset(0);
 }
 
 template<class Options>
@@ -675,7 +775,12 @@ void Tax_hits<Options>::set_null(tf::Executor& executor, const bvector_type& bv)
 {
 
     tf::Taskflow taskflow;
-    taskflow.emplace([&]() { spot_names->set_null(bv);});
+    taskflow.emplace([&]() { 
+        if (spot_ids)
+            spot_ids->set_null(bv);
+        else
+            spot_names->set_null(bv);
+    });
     
     taskflow.for_each(tax_ids.data.begin(), tax_ids.data.end(), [&](unique_ptr<U32_rsc_matrix::vector_type>& data) { 
         try {
@@ -705,6 +810,8 @@ template<class Options>
 void Tax_hits<Options>::clear() 
 {
     spot_names->clear_all(true);
+    if (spot_ids)
+        spot_ids->clear_all(true);
     tax_ids.clear();
     if constexpr (Options::has_counts()) 
         counts.clear();
@@ -721,10 +828,15 @@ template<class Options>
 void Tax_hits<Options>::finalize() 
 {
     if constexpr (Options::is_compact() == false) {
-        spot_names_bi->flush();
-        spot_names_bi.reset(0);
-        spot_names->remap();
-        //spot_names->optimize(TB);
+        if (spot_ids) {
+            spot_ids_bi->flush();
+            spot_ids_bi.reset(0);
+        } else {
+            spot_names_bi->flush();
+            spot_names_bi.reset(0);
+            spot_names->remap();
+            //spot_names->optimize(TB);
+        }
     }
     tax_ids.finalize();
     if constexpr (Options::has_counts())
@@ -737,14 +849,23 @@ template<class Options>
 void Tax_hits<Options>::optimize(bool print_stats) 
 {
     if constexpr (Options::is_compact() == false) {
-        spot_names->optimize(TB);
-        str_sv_type::statistics st;    
-//        spot_names->optimize(TB, bvector_type::opt_compress, &st); // doesn't work, returns incorrect stat
-        spot_names->calc_stat(&st);
-
-        if (print_stats) {
-            spdlog::info("Spot name size: {:L}", spot_names->size());    
-            spdlog::info("Spot name memory: {:L}", st.memory_used);
+        if (spot_ids) {
+            sparse_vector_u64::statistics st;
+            spot_ids->optimize(TB, bvector_type::opt_compress, &st);
+            if (print_stats) {
+                spdlog::info("Spot id size: {:L}", spot_ids->size());    
+                spdlog::info("Spot id memory: {:L}", st.memory_used);
+            }
+        } else {
+            spot_names->optimize(TB);
+            str_sv_type::statistics st;    
+//            spot_names->optimize(TB, bvector_type::opt_compress, &st); // doesn't work, returns incorrect stat
+            spot_names->calc_stat(&st);
+
+            if (print_stats) {
+                spdlog::info("Spot name size: {:L}", spot_names->size());    
+                spdlog::info("Spot name memory: {:L}", st.memory_used);
+            }
         }
     }
     tax_ids.optimize(print_stats);
@@ -756,19 +877,39 @@ void Tax_hits<Options>::optimize(bool print_stats)
 template<class Options>
 bool Tax_hits<Options>::init(const string& file_prefix) 
 {
+    string spot_id_file = file_prefix + ".ids";
     string spot_name_file = file_prefix + ".names";
-    if (!file_exists(spot_name_file))
+    bool has_ids = file_exists(spot_id_file);
+    if (!has_ids && !file_exists(spot_name_file))
         return false;
+    spot_ids_bi.reset(0);
+    if (has_ids) {
+        if (!spot_ids)
+            spot_ids = std::make_unique<sparse_vector_u64>(bm::use_null);
+    } else {
+        spot_ids.reset(0);
+    }
     tf::Executor executor{4};
     tf::Taskflow taskflow;
-    taskflow.emplace([this, spot_name_file]() { 
-        spdlog::info("Loading '{}'", spot_name_file);
-        file_load_svector(*spot_names, spot_name_file);
-        str_sv_type::statistics st;
-        spot_names->calc_stat(&st);
-        spdlog::info("Spot name size: {:L}", spot_names->size());
-        spdlog::info("Spot name memory: {:L}", st.memory_used);
-    });
+    if (has_ids) {
+        taskflow.emplace([this, spot_id_file]() { 
+            spdlog::info("Loading '{}'", spot_id_file);
+            file_load_svector(*spot_ids, spot_id_file);
+            sparse_vector_u64::statistics st;
+            spot_ids->calc_stat(&st);
+            spdlog::info("Spot id size: {:L}", spot_ids->size());
+            spdlog::info("Spot id memory: {:L}", st.memory_used);
+        });
+    } else {
+        taskflow.emplace([this, spot_name_file]() { 
+            spdlog::info("Loading '{}'", spot_name_file);
+            file_load_svector(*spot_names, spot_name_file);
+            str_sv_type::statistics st;
+            spot_names->calc_stat(&st);
+            spdlog::info("Spot name size: {:L}", spot_names->size());
+            spdlog::info("Spot name memory: {:L}", st.memory_used);
+        });
+    }
     string tax_file = file_prefix + ".taxa";
     if (!file_exists(tax_file))
         return false;
@@ -814,8 +955,31 @@ void Tax_hits<Options>::add_row(const Spot<Options>& spot)
     if constexpr (Options::is_compact()  == false) {
         if (spot.name.empty())
             return;
-        *spot_names_bi = spot.name;
+        uint64_t spot_id;
+        if (spot_ids && parse_spot_id(spot.name, spot_id)) {
+            spot_ids_bi->add(spot_id);
+        } else {
+            if (spot_ids)
+                switch_to_names();
+            *spot_names_bi = spot.name;
+        }
     }
+    add_taxa_row(spot);
+}
+
+template<class Options>
+void Tax_hits<Options>::add_row(const Spot<Options>& spot, uint64_t spot_id)
+{
+    if constexpr (Options::is_compact()  == false) {
+        assert(spot_ids);
+        spot_ids_bi->add(spot_id);
+    }
+    add_taxa_row(spot);
+}
+
+template<class Options>
+void Tax_hits<Options>::add_taxa_row(const Spot<Options>& spot)
+{
     int spot_sz = spot.tax_id.size();
 
     if (tax_ids.num_cols < spot_sz) {
@@ -840,11 +1004,11 @@ void Tax_hits<Options>::add_row(const Spot<Options>& spot)
         counts.end_row();
 }
 
-static 
-void serialize_vec(const string& file_name, str_sv_type& vec)
+template<class SV>
+void serialize_vec(const string& file_name, SV& vec)
 {
-    bm::sparse_vector_serializer<str_sv_type> serializer;
-    bm::sparse_vector_serial_layout<str_sv_type> sv_lay;
+    bm::sparse_vector_serializer<SV> serializer;
+    bm::sparse_vector_serial_layout<SV> sv_lay;
     vec.optimize(TB);
     serializer.serialize(vec, sv_lay);
     ofstream ofs(file_name.c_str(), ofstream::out | ofstream::binary);
@@ -857,10 +1021,20 @@ template<class Options>
 void Tax_hits<Options>::save(const string& file_prefix) 
 {
     if constexpr (Options::is_compact() == false) {
-        serialize_vec(file_prefix + ".names", *spot_names);
-        str_sv_type::statistics st;
-        spot_names->calc_stat(&st);
-        spdlog::info("Spot name size: {:L}, spot name memory {:L}", spot_names->size(), st.memory_used);
+        // init prefers .ids, the file of the other mode left by an earlier save must not be loaded with this one
+        if (spot_ids) {
+            std::remove((file_prefix + ".names").c_str());
+            serialize_vec(file_prefix + ".ids", *spot_ids);
+            sparse_vector_u64::statistics st;
+            spot_ids->calc_stat(&st);
+            spdlog::info("Spot id size: {:L}, spot id memory {:L}", spot_ids->size(), st.memory_used);
+        } else {
+            std::remove((file_prefix + ".ids").c_str());
+            serialize_vec(file_prefix + ".names", *spot_names);
+            str_sv_type::statistics st;
+            spot_names->calc_stat(&st);
+            spdlog::info("Spot name size: {:L}, spot name memory {:L}", spot_names->size(), st.memory_used);
+        }
     }
 
     tax_ids.save(file_prefix + ".taxa");
@@ -904,7 +1078,7 @@ void Tax_hits<Options>::print(tf::Executor& executor, ostream& os, size_t count)
 
     tf::Taskflow taskflow;
 
-    auto sz = count == - 1 ? spot_names->size() : count;
+    auto sz = count == - 1 ? size() : count;
     spdlog::info("printing {:L}", sz);
     int page_size = 500000;
     auto num_pages = sz/page_size + 1;
@@ -914,11 +1088,7 @@ void Tax_hits<Options>::print(tf::Executor& executor, ostream& os, size_t count)
     page_index.resize(num_pages, 0);
     generate(page_index.begin(), page_index.end(), [n = 0] () mutable { return n++; });
 //    std::locale::global(std::locale("C")); // disable comma as thousand separator
-    taskflow.for_each(page_index.begin(), page_index.end(), [&](int index) { 
-        
-        size_t start_pos = index * page_size;
-        auto it = spot_names->get_const_iterator(start_pos);
-
+    auto print_page = [&](size_t start_pos, auto it) {
         vector<unique_ptr<U32_rsc_matrix::vector_type::const_iterator>> tax_id_b;
         for (const auto& v : tax_ids.data) {
             //v->sync();
@@ -989,7 +1159,14 @@ void Tax_hits<Options>::print(tf::Executor& executor, ostream& os, size_t count)
             const lock_guard<std::mutex> lock(m_output_mutex);
             copy(buffer.begin(), buffer.end(), ostream_iterator<string>(os, "\n"));
         }
+    };
 
+    taskflow.for_each(page_index.begin(), page_index.end(), [&](int index) { 
+        size_t start_pos = index * page_size;
+        if (spot_ids)
+            print_page(start_pos, spot_ids->get_const_iterator(start_pos));
+        else
+            print_page(start_pos, spot_names->get_const_iterator(start_pos));
     }); 
     executor.run(taskflow).wait();
     os.flush();
@@ -1002,8 +1179,12 @@ template<class Options>
 template<class SpotOptions>
 void Tax_hits<Options>::get_spot(uint32_t index, Spot<SpotOptions>& spot, bool get_name)
 {
-    if (get_name)
-        spot_names->get(index, spot.name);
+    if (get_name) {
+        if (spot_ids)
+            spot.name = to_string(spot_ids->get(index));
+        else
+            spot_names->get(index, spot.name);
+    }
     spot.tax_id.clear();
     if constexpr (SpotOptions::has_counts()) 
         spot.counts.clear();
@@ -1332,9 +1513,15 @@ tf::Future<void> Tax_hits<Options>::run_merge(tf::Executor& executor, vector<Mer
         data.idx.shrink_to_fit();
     });
     auto insert_task = taskflow.emplace([&]() {
-        for_each(merge_data.begin(), merge_data.end(), [&](const Merge_data<CollateOptions>& data) {
-            tax_hits.add_row(data.spot); 
-        });
+        if (tax_hits.spot_ids) {
+            for_each(merge_data.begin(), merge_data.end(), [&](const Merge_data<CollateOptions>& data) {
+                tax_hits.add_row(data.spot, data.id); 
+            });
+        } else {
+            for_each(merge_data.begin(), merge_data.end(), [&](const Merge_data<CollateOptions>& data) {
+                tax_hits.add_row(data.spot); 
+            });
+        }
     });
     merge_task.precede(insert_task);
     
@@ -1344,6 +1531,10 @@ tf::Future<void> Tax_hits<Options>::run_merge(tf::Executor& executor, vector<Mer
 template<class Options>
 void Tax_hits<Options>::sort(tf::Executor& executor) 
 {
+    if (spot_ids) {
+        sort_ids(executor);
+        return;
+    }
     auto num_rows = spot_names->size();
     spot_index.resize(num_rows);
     generate(spot_index.begin(), spot_index.end(), [n = 0] () mutable { return n++; });
@@ -1364,17 +1555,106 @@ void Tax_hits<Options>::sort(tf::Executor& executor)
 
 }
 
+static 
+int s_bit_width(uint64_t value)
+{
+    int bits = 0;
+    for (; value; value >>= 1)
+        ++bits;
+    return bits;
+}
+
+template<class Options>
+void Tax_hits<Options>::sort_ids(tf::Executor& executor) 
+{
+    spdlog::stopwatch sw; 
+    size_t num_rows = spot_ids->size();
+    sorted_ids.resize(num_rows);
+    spot_index.resize(num_rows);
+    if (num_rows == 0)
+        return;
+    spot_ids->decode(sorted_ids.data(), 0, num_rows);
+    if (is_sorted(sorted_ids.begin(), sorted_ids.end())) {
+        generate(spot_index.begin(), spot_index.end(), [n = 0] () mutable { return n++; });
+        spdlog::info("Spot ids are monotonic, sorting skipped");
+        return;
+    }
+    auto min_max = minmax_element(sorted_ids.begin(), sorted_ids.end());
+    uint64_t min_id = *min_max.first;
+    int index_bits = s_bit_width(num_rows - 1);
+    int key_bits = s_bit_width(*min_max.second - min_id) + index_bits;
+    if (key_bits > 64) {
+        // ids are too sparse to pack with a row number
+        generate(spot_index.begin(), spot_index.end(), [n = 0] () mutable { return n++; });
+        tf::Taskflow taskflow;
+        taskflow.sort(spot_index.begin(), spot_index.end(), [&](uint32_t l, uint32_t r) {
+            return sorted_ids[l] < sorted_ids[r];
+        });
+        executor.run(taskflow).wait();
+        vector<uint64_t> ids(num_rows);
+        for (size_t i = 0; i < num_rows; ++i)
+            ids[i] = sorted_ids[spot_index[i]];
+        swap(sorted_ids, ids);
+        spdlog::info("Sorting took {:.3}", sw);       
+        return;
+    }
+
+    // LSD radix sort of (id - min_id) << index_bits | row, row keeps it stable and unique
+    static const int RADIX_BITS = 11;
+    static const size_t RADIX_SIZE = size_t(1) << RADIX_BITS;
+    for (size_t i = 0; i < num_rows; ++i)
+        sorted_ids[i] = ((sorted_ids[i] - min_id) << index_bits) | i;
+    vector<uint64_t> buffer(num_rows);
+    vector<size_t> offsets(RADIX_SIZE);
+    for (int shift = 0; shift < key_bits; shift += RADIX_BITS) {
+        fill(offsets.begin(), offsets.end(), 0);
+        for (auto key : sorted_ids)
+            ++offsets[(key >> shift) & (RADIX_SIZE - 1)];
+        size_t total = 0;
+        for (auto& offset : offsets) {
+            auto count = offset;
+            offset = total;
+            total += count;
+        }
+        for (auto key : sorted_ids)
+            buffer[offsets[(key >> shift) & (RADIX_SIZE - 1)]++] = key;
+        swap(sorted_ids, buffer);
+    }
+    buffer.clear();
+    buffer.shrink_to_fit();
+    const uint64_t index_mask = (uint64_t(1) << index_bits) - 1;
+    for (size_t i = 0; i < num_rows; ++i) {
+        spot_index[i] = uint32_t(sorted_ids[i] & index_mask);
+        sorted_ids[i] = (sorted_ids[i] >> index_bits) + min_id;
+    }
+    spdlog::info("Sorting took {:.3}", sw);       
+}
+
 
 
 template<class Options>
 template<class CollateOptions>
 void Tax_hits<Options>::merge(tf::Executor& executor, Tax_hits<CollateOptions>& tax_hits) 
 { 
-    auto num_rows = spot_names->size();
+    auto num_rows = size();
     if (num_rows == 0)
         return;
     spdlog::stopwatch sw; 
     string prev;
+    uint64_t prev_id = 0;
+    bool by_id = bool(spot_ids);
+    auto set_prev = [&](uint32_t idx) {
+        if (by_id)
+            prev_id = sorted_ids[idx];
+        else
+            spot_names->get(spot_index[idx], prev);
+    };
+    auto same_as_prev = [&](uint32_t idx) {
+        return by_id ? sorted_ids[idx] == prev_id : spot_names->compare_remap(spot_index[idx], prev.c_str()) == 0;
+    };
+    auto make_data = [&](uint32_t pos) {
+        return by_id ? Merge_data<CollateOptions>(prev_id, pos) : Merge_data<CollateOptions>(prev, pos);
+    };
     size_t pos_idx = 0;
     int total_null = 0;
     static const int BATCH_SIZE = 30000;
@@ -1398,15 +1678,14 @@ void Tax_hits<Options>::merge(tf::Executor& executor, Tax_hits<CollateOptions>&
     size_t first_index = idx;
     size_t last_index = idx;
 
-    spot_names->get(spot_index[idx], prev);
+    set_prev(idx);
     for (idx = 1; idx < num_rows; ++idx) {
-        const auto& i = spot_index[idx];
-        if (spot_names->compare_remap(i, prev.c_str()) == 0) {
+        if (same_as_prev(idx)) {
             last_index = idx;
         } else {
 
             pos_idx = spot_index[first_index];
-            Merge_data<CollateOptions> data(prev, pos_idx);
+            Merge_data<CollateOptions> data = make_data(pos_idx);
             null_spots_curr.set_bit_no_check(pos_idx);
             while (++first_index <= last_index) {
                 pos_idx = spot_index[first_index];
@@ -1437,11 +1716,11 @@ void Tax_hits<Options>::merge(tf::Executor& executor, Tax_hits<CollateOptions>&
                 }
             }
             first_index = idx;
-            spot_names->get(i, prev);
+            set_prev(idx);
         }
     }
     pos_idx = spot_index[first_index];
-    Merge_data<CollateOptions> data(prev, pos_idx);
+    Merge_data<CollateOptions> data = make_data(pos_idx);
     while (++first_index <= last_index) {
         pos_idx = spot_index[first_index];
         data.idx.push_back(pos_idx);
@@ -1450,6 +1729,8 @@ void Tax_hits<Options>::merge(tf::Executor& executor, Tax_hits<CollateOptions>&
 
     spot_index.resize(0);
     spot_index.shrink_to_fit();
+    sorted_ids.resize(0);
+    sorted_ids.shrink_to_fit();
 
     if (merge_ft.valid()) {
         merge_ft.wait();
@@ -1470,12 +1751,13 @@ template<class CollateOptions>
 unique_ptr<Tax_hits<CollateOptions>> Tax_hits<Options>::collate(tf::Executor& executor) 
 { 
     sort(executor);
-    auto merged_tax_hits = std::make_unique<Tax_hits<CollateOptions>>(false);
+    auto merged_tax_hits = std::make_unique<Tax_hits<CollateOptions>>(false, bool(spot_ids));
     merge(executor, *merged_tax_hits);
     clear();
     merged_tax_hits->finalize();
     if constexpr (CollateOptions::is_compact()) {
         merged_tax_hits->spot_names.reset(0);
+        merged_tax_hits->spot_ids.reset(0);
         //clear_all(true);
         if constexpr (CollateOptions::has_counts()) {
             merged_tax_hits->counts.clear();
@@ -1517,6 +1799,11 @@ void Tax_hits<Options>::load(const string& filename)
         spdlog::info("Load read took {:.3}", sw);
         return;
     }
+    if (HitStream::is_hit_stream(filename)) {
+        load_hit_stream(filename);
+        spdlog::info("Load read took {:.3}", sw);
+        return;
+    }
     ifstream f(filename);
     if (f.fail())
         throw std::runtime_error(std::string("cannot open list file ") + filename);
@@ -1552,6 +1839,36 @@ void Tax_hits<Options>::load(const string& filename)
     spdlog::info("Load read took {:.3}", sw);
 }
 
+template<class Options>
+void Tax_hits<Options>::load_hit_stream(const string& filename)
+{
+    HitStreamReader reader(filename);
+    Spot<Options> last_spot;
+    Spot<Options> next_spot;
+    vector<uint32_t> counts;
+    size_t num_records = 0;
+    while (reader.next(next_spot.name, next_spot.tax_id, counts)) {
+        if (next_spot.tax_id.empty())
+            continue;
+        for (auto& c : next_spot.name) {
+            if (c == '\t' || c == '\n') 
+                c = ' ';
+        }
+        if constexpr (Options::has_counts()) 
+            swap(next_spot.counts, counts);
+        if (next_spot.name == last_spot.name) {
+            last_spot.merge(next_spot);
+        } else {
+            add_row(last_spot);
+            swap(last_spot, next_spot);
+        }
+        ++num_records;
+    }
+    add_row(last_spot);
+    spdlog::info("{:L} records", num_records);
+    finalize();
+}
+
 
 END_TC_NAMESPACE
 
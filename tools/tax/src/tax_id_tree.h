@@ -27,59 +27,52 @@
 #ifndef TAX_ID_TREE_H_INCLUDED
 #define TAX_ID_TREE_H_INCLUDED
 
-#include <set>
 #include <string>
 #include <fstream>
 #include <iostream>
-#include <map>
-#include <memory>
+#include <vector>
 #include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "log.h"
 
 typedef int tax_id_t;
 
+// immutable tax tree flattened in depth first order: a node index is its preorder number,
+// so the subtree of a node is the index interval [node, subtree_end) and a_sub_b is two comparisons.
+// the lowest common ancestor of nodes u < v outside of each other's subtree is the parent of the shallowest node in (u, v]
+// (an Euler tour which keeps only the first visit of a node), the shallowest node is a range minimum query over depths:
+// a sparse table over blocks of 64 nodes plus a bitmask of the minimum stack at every position within a block,
+// both linear in the node count, answer it in constant time
 struct TaxIdTree
 {
 	static const tax_id_t ROOT = 1;
 
-	struct Node
-	{
-		tax_id_t tax_id, parent_tax_id;
-		std::set<tax_id_t> subids;
-
-		Node(tax_id_t tax_id, tax_id_t parent_tax_id) : tax_id(tax_id), parent_tax_id(parent_tax_id){}
-	};
-
-	typedef std::map<tax_id_t, Node*> Nodes;
-//	typedef std::map<tax_id_t, std::unique_ptr<Node> > Nodes;
-	Nodes nodes;
-
-    ~TaxIdTree()
-    {
-        for (auto &n : nodes)
-            delete n.second;
-    }
+	std::vector<tax_id_t> tax_ids; // by node, node 0 is the root
+	std::vector<int> parents; // node 0 is its own parent
+	bool root_listed = false; // the root has its own line in the tax parents file
 
 	tax_id_t consensus_of(tax_id_t tax_a, tax_id_t tax_b) const
 	{
 		if (tax_a == ROOT || tax_b == ROOT)
 			return ROOT;
 
-        if (tax_a <= 0 && tax_b > 0)
-            return tax_a;
-
-        // negative tax ids have higher priority over positive
-        if (tax_b <= 0 && tax_a > 0)
-            return tax_b;
+		if (tax_a <= 0 && tax_b > 0)
+			return tax_a;
 
-		if (a_sub_b(tax_a, tax_b))
+		// negative tax ids have higher priority over positive
+		if (tax_b <= 0 && tax_a > 0)
 			return tax_b;
 
-		if (a_sub_b(tax_b, tax_a))
-			return tax_a;
+		if (tax_a == tax_b)
+			return tax_b;
 
-		return consensus_of(get_parent_id(tax_a), get_parent_id(tax_b));
+		const int b = node_of(tax_b), a = node_of(tax_a);
+		return tax_ids[lowest_common_ancestor(a, b)];
 	}
 
 	bool a_sub_b(tax_id_t tax_a, tax_id_t tax_b) const
@@ -87,101 +80,355 @@ struct TaxIdTree
 		if (tax_a == tax_b || tax_b == ROOT)
 			return true;
 
-		auto node_ptr = get_node_ptr(tax_b);
-		return node_ptr->subids.find(tax_a) != node_ptr->subids.end();
+		const int b = node_of(tax_b);
+		const int a = find_node(tax_a);
+		return a >= b && a < subtree_ends[b];
 	}
 
+	// number of nodes from the tax up to the root, the root excluded, 0 for unknown tax ids
 	int level(tax_id_t tax_id) const
 	{
-		auto it = nodes.find(tax_id);
-		if (it == nodes.end())
-			return 0;
-
-		return level(it->second->parent_tax_id) + 1;
+		const int node = find_node(tax_id);
+		return node < 0 ? 0 : depths[node];
 	}
 
 	bool known_id(tax_id_t tax_id) const
 	{
-		return nodes.find(tax_id) != nodes.end();
+		return tax_id == ROOT ? root_listed : find_node(tax_id) >= 0;
 	}
 
-	Node *get_node_ptr(tax_id_t tax_id) const
+	tax_id_t get_parent_id(tax_id_t tax_id) const
+	{
+		return tax_ids[parents[node_of(tax_id)]];
+	}
+
+	size_t size() const { return tax_ids.size(); }
+
+	int node_of(tax_id_t tax_id) const
 	{
-		auto it = nodes.find(tax_id);
-		if (it == nodes.end())
+		const int node = find_node(tax_id);
+		if (node < 0)
 		{
 			auto message = std::string("no such tax_id as ") + std::to_string(tax_id);
 			LOG(message);
 			throw std::runtime_error(message);
 		}
 
-		return it->second;
+		return node;
 	}
 
-	tax_id_t get_parent_id(tax_id_t tax_id) const
+	int find_node(tax_id_t tax_id) const
+	{
+		return tax_id >= 0 && size_t(tax_id) < node_of_tax.size() ? node_of_tax[tax_id] : -1;
+	}
+
+	int lowest_common_ancestor(int u, int v) const
+	{
+		if (u > v)
+			std::swap(u, v);
+
+		if (v < subtree_ends[u])
+			return u;
+
+		return parents[shallowest(u + 1, v)];
+	}
+
+	// derives everything else from tax_ids and parents in preorder
+	void index()
 	{
-		return get_node_ptr(tax_id)->parent_tax_id;
+		const int n = int(tax_ids.size());
+		tax_id_t max_tax_id = 0;
+		for (auto t : tax_ids)
+			max_tax_id = std::max(max_tax_id, t);
+
+		node_of_tax.assign(size_t(max_tax_id) + 1, -1);
+		depths.assign(n, 0);
+		subtree_ends.resize(n);
+		for (int i = 0; i < n; i++)
+		{
+			node_of_tax[tax_ids[i]] = i;
+			subtree_ends[i] = i + 1;
+			if (i > 0)
+			{
+				if (parents[i] >= i)
+					throw std::runtime_error("tax tree is not in preorder");
+
+				depths[i] = depths[parents[i]] + 1;
+			}
+		}
+
+		for (int i = n - 1; i > 0; i--)
+			subtree_ends[parents[i]] = std::max(subtree_ends[parents[i]], subtree_ends[i]);
+
+		// minimum stack within a block at every position
+		stack_masks.assign(n, 0);
+		std::vector<int> stack;
+		for (int i = 0; i < n; i++)
+		{
+			if (i % BLOCK == 0)
+				stack.clear();
+
+			uint64_t mask = i % BLOCK ? stack_masks[i - 1] : 0;
+			while (!stack.empty() && depths[stack.back()] >= depths[i])
+			{
+				mask &= ~(uint64_t(1) << (stack.back() % BLOCK));
+				stack.pop_back();
+			}
+
+			stack.push_back(i);
+			stack_masks[i] = mask | (uint64_t(1) << (i % BLOCK));
+		}
+
+		// sparse table of block minimums, level k holds the minimum of 2^k blocks
+		const int blocks = (n + BLOCK - 1) / BLOCK;
+		block_levels.clear();
+		block_levels.emplace_back(blocks);
+		for (int b = 0; b < blocks; b++)
+			block_levels[0][b] = in_block(b * BLOCK, std::min(n, (b + 1) * BLOCK) - 1);
+
+		for (int k = 1; (1 << k) <= blocks; k++)
+		{
+			auto &prev = block_levels[k - 1];
+			std::vector<int> level(blocks - (1 << k) + 1);
+			for (size_t b = 0; b < level.size(); b++)
+				level[b] = shallower(prev[b], prev[b + (1 << (k - 1))]);
+
+			block_levels.push_back(std::move(level));
+		}
+	}
+
+private:
+	static const int BLOCK = 64;
+
+	std::vector<int> node_of_tax; // by tax id, -1 for unknown
+	std::vector<int> depths, subtree_ends;
+	std::vector<uint64_t> stack_masks;
+	std::vector<std::vector<int>> block_levels;
+
+	int shallower(int a, int b) const { return depths[b] < depths[a] ? b : a; }
+
+	// the smallest position of the minimum stack at `to` which is not before `from` is the minimum of [from, to]
+	int in_block(int from, int to) const
+	{
+		const uint64_t mask = stack_masks[to] & (~uint64_t(0) << (from % BLOCK));
+		return to / BLOCK * BLOCK + __builtin_ctzll(mask);
+	}
+
+	int shallowest(int from, int to) const
+	{
+		const int first_block = from / BLOCK, last_block = to / BLOCK;
+		if (first_block == last_block)
+			return in_block(from, to);
+
+		int best = shallower(in_block(from, first_block * BLOCK + BLOCK - 1), in_block(last_block * BLOCK, to));
+		if (last_block - first_block > 1)
+		{
+			const int count = last_block - first_block - 1;
+			const int k = 31 - __builtin_clz(count);
+			auto &level = block_levels[k];
+			best = shallower(best, shallower(level[first_block + 1], level[last_block - (1 << k)]));
+		}
+
+		return best;
 	}
 };
 
 struct TaxIdTreeLoader
 {
+	typedef std::vector<std::pair<tax_id_t, tax_id_t>> TaxParents;
+
+	static std::string cache_filename(const std::string &filename) { return filename + ".cache"; }
+
+	// reads the binary cache next to the tax parents file if it was made from the file as it is now,
+	// otherwise parses the file and writes the cache for the next run
 	static void load_tax_id_tree(TaxIdTree &tax_id_tree, const std::string &filename)
 	{
+		const auto source = cache_source(filename);
+		if (load_cache(tax_id_tree, cache_filename(filename), source))
+			return;
+
 		std::ifstream f(filename);
 		if (f.fail() || f.eof())
 			throw std::runtime_error(std::string("cannot open file ") + filename);
 
-		while (!f.eof())
+		TaxParents tax_parents;
+		tax_id_t x = 0, parent = 0;
+		while (f >> x >> parent)
 		{
-			tax_id_t x, parent;
-			f >> x;
-			f >> parent;
-
-			if (!x || !parent)
+			if (x <= 0 || parent <= 0)
 				throw std::runtime_error(std::string("bad tax id: ") + std::to_string(x));
 
-			tax_id_tree.nodes[x] = new TaxIdTree::Node(x, parent);
+			tax_parents.emplace_back(x, parent);
 		}
 
-		calculate_subids(tax_id_tree);
+		if (!f.eof())
+			throw std::runtime_error(std::string("bad tax parents file format: ") + filename);
+
+		build(tax_id_tree, tax_parents);
+
+		try
+		{
+			save_cache(tax_id_tree, cache_filename(filename), source);
+		}
+		catch (std::exception &e)
+		{
+			LOG("tax tree cache is not saved: " << e.what());
+		}
 	}
 
-	static void calculate_subids(TaxIdTree &tax_id_tree)
+	// nodes are numbered in depth first order, children in tax id order, the last line of a tax listed twice wins
+	static void build(TaxIdTree &tax_id_tree, const TaxParents &listed_tax_parents)
 	{
-		std::set<TaxIdTree::Node*> nodes;
-		for (auto &n : tax_id_tree.nodes)
-			nodes.insert(n.second);
+		tax_id_tree.root_listed = false;
+		tax_id_t max_tax_id = TaxIdTree::ROOT;
+		for (auto &p : listed_tax_parents)
+			max_tax_id = std::max(max_tax_id, p.first);
+
+		std::vector<char> listed(size_t(max_tax_id) + 1, 0);
+		TaxParents tax_parents;
+		tax_parents.reserve(listed_tax_parents.size());
+		for (auto it = listed_tax_parents.rbegin(); it != listed_tax_parents.rend(); ++it)
+		{
+			if (it->first == TaxIdTree::ROOT)
+				tax_id_tree.root_listed = true;
+			else if (!listed[it->first])
+			{
+				listed[it->first] = 1;
+				tax_parents.push_back(*it);
+			}
+		}
+
+		std::sort(tax_parents.begin(), tax_parents.end(), [](const std::pair<tax_id_t, tax_id_t> &a, const std::pair<tax_id_t, tax_id_t> &b)
+		{
+			return a.second == b.second ? a.first < b.first : a.second < b.second;
+		});
+
+		for (auto &p : tax_parents)
+			if (p.second > max_tax_id || (p.second != TaxIdTree::ROOT && !listed[p.second]))
+			{
+				auto message = std::string("no such tax_id as ") + std::to_string(p.second);
+				LOG(message);
+				throw std::runtime_error(message);
+			}
+
+		// children of a tax are a run of the sorted list
+		std::vector<size_t> children_begin(size_t(max_tax_id) + 2, 0);
+		for (auto &p : tax_parents)
+			children_begin[p.second + 1]++;
+		for (size_t i = 1; i < children_begin.size(); i++)
+			children_begin[i] += children_begin[i - 1];
+
+		std::vector<tax_id_t> children;
+		children.reserve(tax_parents.size());
+		for (auto &p : tax_parents)
+			children.push_back(p.first);
+
+		auto &tax_ids = tax_id_tree.tax_ids;
+		auto &parents = tax_id_tree.parents;
+		tax_ids.assign(1, tax_id_t(TaxIdTree::ROOT));
+		parents.assign(1, 0);
+
+		struct Visit { tax_id_t tax_id; int node; };
+		std::vector<Visit> stack(1, Visit{TaxIdTree::ROOT, 0});
+		while (!stack.empty())
+		{
+			auto visit = stack.back();
+			stack.pop_back();
+			if (visit.tax_id != TaxIdTree::ROOT)
+			{
+				tax_ids.push_back(visit.tax_id);
+				parents.push_back(visit.node);
+			}
+
+			const int node = int(tax_ids.size()) - 1;
+			for (size_t i = children_begin[visit.tax_id + 1]; i > children_begin[visit.tax_id]; i--)
+				stack.push_back(Visit{children[i - 1], node});
+		}
 
-		calculate_subids(tax_id_tree, nodes);
+		if (tax_ids.size() != children.size() + 1)
+			throw std::runtime_error("tax tree has nodes which are not connected to the root");
+
+		tax_id_tree.index();
 	}
 
-	static void calculate_subids(TaxIdTree &tax_id_tree, const std::set<TaxIdTree::Node*> &nodes)
+	static const uint64_t CACHE_MAGIC = 0x45455254584154; // "TAXTREE"
+	static const uint64_t CACHE_VERSION = 1;
+
+	struct CacheHeader
 	{
-		std::set<TaxIdTree::Node*> parents;
-		for (auto n : nodes)
-			if (n->parent_tax_id != TaxIdTree::ROOT)
-				parents.insert(tax_id_tree.get_node_ptr(n->parent_tax_id));
+		uint64_t magic = CACHE_MAGIC, version = CACHE_VERSION;
+		uint64_t source_size = 0, source_mtime_sec = 0, source_mtime_nsec = 0;
+		uint64_t node_count = 0, root_listed = 0;
+	};
 
-		for (auto n : nodes)
-			if (parents.find(n) == parents.end())
-				add_subids(tax_id_tree, n->parent_tax_id, n->tax_id, n->subids);
+	static void save_cache(const TaxIdTree &tax_id_tree, const std::string &cache_file, const CacheHeader &source)
+	{
+		CacheHeader header = source;
+		header.node_count = tax_id_tree.size();
+		header.root_listed = tax_id_tree.root_listed;
 
-		if (!parents.empty())
-			calculate_subids(tax_id_tree, parents);
+		// the temporary file of this process, processes saving the cache at once rename only complete files
+		const std::string tmp_file = cache_file + "." + std::to_string(getpid()) + ".tmp";
+		{
+			std::ofstream f(tmp_file, std::ios::binary | std::ios::out | std::ios::trunc);
+			f.write((const char*)&header, sizeof(header));
+			f.write((const char*)tax_id_tree.tax_ids.data(), sizeof(tax_id_t) * tax_id_tree.tax_ids.size());
+			f.write((const char*)tax_id_tree.parents.data(), sizeof(int) * tax_id_tree.parents.size());
+			f.close();
+			if (!f)
+			{
+				std::remove(tmp_file.c_str());
+				throw std::runtime_error(std::string("cannot write ") + tmp_file);
+			}
+		}
+
+		if (std::rename(tmp_file.c_str(), cache_file.c_str()) != 0)
+		{
+			std::remove(tmp_file.c_str());
+			throw std::runtime_error(std::string("cannot rename ") + tmp_file);
+		}
 	}
 
-	static void	add_subids(TaxIdTree &tax_id_tree, tax_id_t to, tax_id_t what_to_add, const std::set<tax_id_t> &what_to_add_more)
+	static bool load_cache(TaxIdTree &tax_id_tree, const std::string &cache_file, const CacheHeader &source)
 	{
-		if (to == TaxIdTree::ROOT)
-			return;
+		std::ifstream f(cache_file, std::ios::binary);
+		if (f.fail())
+			return false;
+
+		CacheHeader header;
+		f.read((char*)&header, sizeof(header));
+		if (!f || header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.source_size != source.source_size ||
+			header.source_mtime_sec != source.source_mtime_sec || header.source_mtime_nsec != source.source_mtime_nsec || header.node_count == 0)
+			return false;
+
+		tax_id_tree.tax_ids.resize(header.node_count);
+		tax_id_tree.parents.resize(header.node_count);
+		f.read((char*)tax_id_tree.tax_ids.data(), sizeof(tax_id_t) * header.node_count);
+		f.read((char*)tax_id_tree.parents.data(), sizeof(int) * header.node_count);
+		if (!f || f.peek() != EOF || tax_id_tree.tax_ids[0] != TaxIdTree::ROOT)
+			return false;
+
+		for (size_t i = 1; i < header.node_count; i++)
+			if (tax_id_tree.tax_ids[i] <= 0 || tax_id_tree.parents[i] < 0 || size_t(tax_id_tree.parents[i]) >= i)
+				return false;
+
+		tax_id_tree.root_listed = header.root_listed != 0;
+		tax_id_tree.index();
+		return true;
+	}
 
-		auto to_ptr = tax_id_tree.get_node_ptr(to);
+	static CacheHeader cache_source(const std::string &filename)
+	{
+		struct stat file_stat;
+		if (stat(filename.c_str(), &file_stat) != 0)
+			throw std::runtime_error(std::string("cannot open file ") + filename);
 
-		to_ptr->subids.insert(what_to_add);
-		to_ptr->subids.insert(what_to_add_more.begin(), what_to_add_more.end());
+		CacheHeader source;
+		source.source_size = file_stat.st_size;
+		source.source_mtime_sec = file_stat.st_mtim.tv_sec;
+		source.source_mtime_nsec = file_stat.st_mtim.tv_nsec;
+		return source;
 	}
-
 };
 
 #endif
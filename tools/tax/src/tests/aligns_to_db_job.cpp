@@ -0,0 +1,140 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+
+#include <random>
+#include <set>
+
+#include "tests.h"
+#include "aligns_to_db_job.h"
+
+static std::string random_read(std::mt19937_64 &rnd, size_t len)
+{
+    std::string seq(len, 'A');
+    for (auto &c : seq)
+        c = "ACGT"[rnd() % 4];
+
+    return seq;
+}
+
+static std::vector<hash_t> read_kmers(const std::string &seq, int kmer_len)
+{
+    std::vector<hash_t> kmers;
+    Hash<hash_t>::for_all_hashes_do(seq, kmer_len, [&](hash_t hash)
+        {
+            kmers.push_back(seq_transform<hash_t>::min_hash_variant(hash, kmer_len));
+            return true;
+        });
+
+    return kmers;
+}
+
+// db of every step-th kmer of the reads, so reads have hits at various positions or none
+static std::vector<hash_t> db_of(const std::vector<std::string> &reads, int kmer_len, size_t step)
+{
+    std::set<hash_t> kmers;
+    size_t i = 0;
+    for (auto &seq : reads)
+        for (auto kmer : read_kmers(seq, kmer_len))
+            if (i++ % step == 0)
+                kmers.insert(kmer);
+
+    return std::vector<hash_t>(kmers.begin(), kmers.end());
+}
+
+TEST(batched_lookups_equivalence) {
+    const int kmer_len = 25;
+    std::mt19937_64 rnd(1);
+    std::vector<std::string> reads;
+    for (size_t len : {0, 10, 25, 26, 56, 57, 58, 100, 300, 1000})
+        for (int i = 0; i < 20; i++)
+            reads.push_back(random_read(rnd, len));
+
+    for (size_t step : {1, 7, 90, 1000000}) {
+        const auto db = db_of(reads, kmer_len, step);
+        const DBJob::HashSortedArrayView view(db);
+        DBJob::BatchedLookups batch;
+        DBJob::Matcher plain(view, kmer_len), batched(view, kmer_len, true);
+        for (auto &seq : reads) {
+            KmerBloomFilter::Counts counts;
+            batch.find(view, kmer_len, seq, nullptr, counts);
+            const auto kmers = read_kmers(seq, kmer_len);
+            ASSERT_EQUALS(batch.keys.size(), kmers.size());
+            bool any = false;
+            for (size_t i = 0; i < kmers.size(); i++) {
+                ASSERT_EQUALS(batch.keys[i], kmers[i]);
+                const bool expected = std::binary_search(db.begin(), db.end(), kmers[i]);
+                ASSERT_EQUALS(batch.in_db(view, i), expected);
+                any = any || expected;
+            }
+
+            ASSERT_EQUALS(batch.any_in_db(view, kmer_len, seq, nullptr, counts), any);
+            ASSERT_EQUALS(batched(seq), plain(seq));
+            ASSERT_EQUALS(plain(seq), int(any));
+        }
+    }
+}
+
+TEST(batched_lookups_hit_in_last_batch) {
+    const int kmer_len = 25;
+    std::mt19937_64 rnd(2);
+    const auto seq = random_read(rnd, DBJob::BatchedLookups::BATCH_SIZE * 3 + kmer_len);
+    const auto kmers = read_kmers(seq, kmer_len);
+    std::vector<hash_t> db = {kmers.back()};
+    const DBJob::HashSortedArrayView view(db);
+    DBJob::BatchedLookups batch;
+    KmerBloomFilter::Counts counts;
+    ASSERT(batch.any_in_db(view, kmer_len, seq, nullptr, counts));
+    do
+        db[0]++;
+    while (std::count(kmers.begin(), kmers.end(), db[0]));
+    ASSERT(!batch.any_in_db(view, kmer_len, seq, nullptr, counts));
+}
+
+TEST(batched_lookups_prefilter_counts) {
+    // kmers of the batches after the one with a hit are neither searched nor counted
+    const int kmer_len = 25;
+    std::mt19937_64 rnd(3);
+    const auto seq = random_read(rnd, DBJob::BatchedLookups::BATCH_SIZE * 3 + kmer_len);
+    const auto kmers = read_kmers(seq, kmer_len);
+    std::vector<hash_t> db = {kmers.front()};
+    const DBJob::HashSortedArrayView view(db);
+    KmerBloomFilter prefilter;
+    prefilter.build(view, [](hash_t kmer) { return kmer; });
+
+    DBJob::BatchedLookups batch;
+    KmerBloomFilter::Counts counts;
+    ASSERT(batch.any_in_db(view, kmer_len, seq, &prefilter, counts));
+    ASSERT_EQUALS(counts.lookups, size_t(DBJob::BatchedLookups::BATCH_SIZE));
+    ASSERT_EQUALS(counts.found, 1);
+    ASSERT(counts.rejected < counts.lookups);
+
+    KmerBloomFilter::Counts plain_counts;
+    DBJob::Matcher(view, kmer_len, false, &prefilter).find(seq, plain_counts);
+    ASSERT_EQUALS(plain_counts.found, counts.found);
+}
+
+TEST_MAIN();
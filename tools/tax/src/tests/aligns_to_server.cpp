@@ -0,0 +1,115 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include <cstdio>
+
+#include "tests.h"
+#include "aligns_to_server.h"
+
+TEST(run_options_roundtrip) {
+    const char *argv[] = {"aligns_to", "-client", "x.sock", "-compact", "-unique", "-out", "o.txt", "-chunk_size", "77", "-optimization_batched_lookups", "in.fasta"};
+    Config config(sizeof(argv) / sizeof(argv[0]), argv);
+    ASSERT_EQUALS(config.client, "x.sock");
+
+    std::stringstream options;
+    config.write_run_options(options);
+
+    const char *server_argv[] = {"aligns_to", "-dbs", "x.dbs", "-server", "x.sock"};
+    Config run_config(sizeof(server_argv) / sizeof(server_argv[0]), server_argv);
+    ASSERT(run_config.contig_files.empty());
+    std::string line;
+    while (std::getline(options, line)) {
+        auto tab = line.find('\t');
+        run_config.read_run_option(line.substr(0, tab), line.substr(tab + 1));
+    }
+
+    ASSERT_EQUALS(run_config.dbs, "x.dbs");
+    ASSERT_EQUALS(run_config.contig_files.size(), 1);
+    ASSERT_EQUALS(run_config.contig_files.front(), "in.fasta");
+    ASSERT_EQUALS(run_config.out, "o.txt");
+    ASSERT(run_config.compact && run_config.unique && run_config.optimization_batched_lookups);
+    ASSERT(!run_config.hide_counts && !run_config.collate);
+    ASSERT_EQUALS(run_config.chunk_size, 77);
+
+    bool failed = false;
+    try { run_config.read_run_option("db", "other.db"); } catch (std::runtime_error &) { failed = true; }
+    ASSERT(failed);
+}
+
+TEST(socket_descriptor_and_lines) {
+    int sockets[2], pipe_fds[2];
+    ASSERT_EQUALS(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    ASSERT_EQUALS(pipe(pipe_fds), 0);
+
+    AlignsToSocket::send_first_byte(sockets[0], pipe_fds[1]);
+    AlignsToSocket::write_all(sockets[0], "a\tb\nc\n");
+    AlignsToSocket::send_first_byte(sockets[0], -1);
+    ::close(sockets[0]);
+
+    const int received = AlignsToSocket::receive_first_byte(sockets[1]);
+    ASSERT(received >= 0);
+    {
+        // output written to the received descriptor arrives at the sender's pipe
+        IO::FdOutBuf buf(received, 4);
+        std::ostream out(&buf);
+        out << "hello world";
+    }
+    ::close(received);
+    ::close(pipe_fds[1]);
+    char data[32] = {0};
+    ASSERT_EQUALS(::read(pipe_fds[0], data, sizeof(data)), 11);
+    ASSERT_EQUALS(std::string(data), "hello world");
+    ::close(pipe_fds[0]);
+
+    AlignsToSocket::LineReader reader(sockets[1]);
+    std::string line;
+    ASSERT(reader.read_line(line));
+    ASSERT_EQUALS(line, "a\tb");
+    ASSERT(reader.read_line(line));
+    ASSERT_EQUALS(line, "c");
+    ASSERT_EQUALS(reader.buffer, "N"); // the second first byte was read as a line byte, there is no descriptor with it
+    ASSERT(!reader.read_line(line));
+    ::close(sockets[1]);
+}
+
+TEST(socket_peer_uid) {
+    int sockets[2];
+    ASSERT_EQUALS(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    ASSERT_EQUALS(AlignsToSocket::peer_uid(sockets[0]), geteuid());
+    ASSERT_EQUALS(AlignsToSocket::peer_uid(sockets[1]), geteuid());
+    ::close(sockets[0]);
+    ::close(sockets[1]);
+}
+
+TEST(client_rejects_stdin) {
+    const char *argv[] = {"aligns_to", "-client", "x.sock", "stdin"};
+    Config config(sizeof(argv) / sizeof(argv[0]), argv);
+    bool failed = false;
+    try { AlignsToClient client(config); } catch (std::runtime_error &) { failed = true; }
+    ASSERT(failed);
+}
+
+TEST_MAIN();
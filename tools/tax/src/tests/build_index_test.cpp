@@ -0,0 +1,182 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include <random>
+#include <chrono>
+#include <cstdlib>
+
+#include "tests.h"
+#include "build_index.h"
+
+using namespace std::chrono;
+
+typedef std::vector<std::pair<hash_t, int>> Chosen;
+
+// the former window scan: every position rebuilds its kmer, positions are split between 32 threads
+// by position modulo 32, the lowest hash wins and equal hashes go to the lowest thread
+static void reference_window(const char *s, int len, int kmer_len, int from, Chosen &chosen)
+{
+    if (len < kmer_len)
+        return;
+
+    const int THREADS = BuildIndex::WindowMinimizer::TIE_STRIDE;
+    std::vector<KmerHash::hash_of_hash_t> min_hash(THREADS, std::numeric_limits<size_t>::max());
+    std::vector<int> min_hash_pos(THREADS, -1);
+    for (int t = 0; t < THREADS; t++)
+        for (int i = t; i <= len - kmer_len; i += THREADS)
+        {
+            hash_t kmer = seq_transform<hash_t>::min_hash_variant(KmerIO::kmer_from(s, i, kmer_len), kmer_len);
+            auto h = KmerHash::hash_of(kmer);
+            if (h < min_hash[t])
+            {
+                min_hash[t] = h;
+                min_hash_pos[t] = i;
+            }
+        }
+
+    int pos = min_hash_pos[0];
+    auto h = min_hash[0];
+    for (int t = 1; t < THREADS; t++)
+        if (min_hash[t] < h)
+        {
+            h = min_hash[t];
+            pos = min_hash_pos[t];
+        }
+
+    chosen.emplace_back(KmerIO::kmer_from(s, pos, kmer_len), from + pos);
+}
+
+static Chosen reference_clean_string(const std::string &seq, int window_size, int kmer_len)
+{
+    Chosen chosen;
+    const int len = int(seq.size());
+    for (int start = 0; start <= len - window_size; start += window_size)
+    {
+        int from = std::max(0, start - (kmer_len - 1));
+        int to = std::min(start + window_size, len);
+        reference_window(seq.c_str() + from, to - from, kmer_len, from, chosen);
+    }
+    return chosen;
+}
+
+static Chosen minimizer_clean_string(const std::string &seq, int window_size, int kmer_len, size_t *windows = nullptr)
+{
+    Chosen chosen;
+    auto count = BuildIndex::process_clean_string(p_string(seq), window_size, kmer_len, [&](hash_t kmer, int offset) { chosen.emplace_back(kmer, offset); });
+    if (windows)
+        *windows = count;
+    return chosen;
+}
+
+static std::string random_seq(size_t len, uint64_t seed)
+{
+    static const char letters[] = "ACGTacgt";
+    std::mt19937_64 rnd(seed);
+    std::string s(len, 'A');
+    for (auto &c : s)
+        c = letters[rnd() % 8];
+    return s;
+}
+
+// short units repeated many times, the same kmer occurs many times in a window
+static std::string repeat_seq(size_t len, uint64_t seed)
+{
+    std::mt19937_64 rnd(seed);
+    std::string s;
+    while (s.size() < len)
+    {
+        auto unit = random_seq(1 + rnd() % 40, rnd());
+        for (int copies = 1 + rnd() % 50; copies > 0 && s.size() < len; copies--)
+            s += unit;
+    }
+    s.resize(len);
+    return s;
+}
+
+TEST(minimizer_matches_window_scan) {
+    for (int kmer_len : {1, 5, 16, 31, 32})
+        for (int window_size : {1, 7, 32, 64, 100, 2000})
+            for (size_t len : {0, 10, 31, 32, 33, 999, 20000})
+                for (int repeats = 0; repeats < 2; repeats++)
+                {
+                    auto seed = len * 1000 + window_size * 10 + kmer_len + repeats;
+                    auto seq = repeats ? repeat_seq(len, seed) : random_seq(len, seed);
+                    size_t windows = 0;
+                    auto chosen = minimizer_clean_string(seq, window_size, kmer_len, &windows);
+                    auto expected = reference_clean_string(seq, window_size, kmer_len);
+                    ASSERT_EQUALS(windows, len >= size_t(window_size) ? len / window_size : 0);
+                    ASSERT_EQUALS(chosen.size(), expected.size());
+                    for (size_t i = 0; i < chosen.size(); i++)
+                    {
+                        ASSERT_EQUALS(chosen[i].first, expected[i].first);
+                        ASSERT_EQUALS(chosen[i].second, expected[i].second);
+                    }
+                }
+}
+
+TEST(minimizer_single_window) {
+    const std::string seq = "ACGTTGCAACGTAGCTAGCTAGGCTAGCATCGACTAGCATCGACTGAC";
+    Chosen chosen;
+    BuildIndex::process_window(seq.c_str(), int(seq.size()), 11, [&](hash_t kmer, int offset) { chosen.emplace_back(kmer, offset); });
+    Chosen expected;
+    reference_window(seq.c_str(), int(seq.size()), 11, 0, expected);
+    ASSERT_EQUALS(chosen.size(), 1);
+    ASSERT_EQUALS(chosen[0].first, expected[0].first);
+    ASSERT_EQUALS(chosen[0].second, expected[0].second);
+
+    chosen.clear();
+    BuildIndex::process_window(seq.c_str(), 10, 11, [&](hash_t kmer, int offset) { chosen.emplace_back(kmer, offset); });
+    ASSERT(chosen.empty());
+}
+
+// run explicitly as "build_index_test bench_minimizer"
+// BUILD_INDEX_BENCH_SIZE sets the number of bases of each set
+DISABLED_TEST(bench_minimizer) {
+    const char *size_env = getenv("BUILD_INDEX_BENCH_SIZE");
+    const size_t len = size_env ? std::stoull(size_env) : 100 * 1000 * 1000;
+    const int kmer_len = 32;
+
+    struct Set { const char *name; int window_size; std::string seq; };
+    Set sets[] = {
+        { "bacterial", 2000, random_seq(len, 1) },
+        { "eukaryotic", 8000, random_seq(len / 2, 2) + repeat_seq(len - len / 2, 3) }, // half of it repeats
+    };
+
+    for (auto &set : sets)
+    {
+        auto measure = [&](const char *name, auto process) {
+            auto before = high_resolution_clock::now();
+            auto chosen = process(set.seq, set.window_size, kmer_len);
+            auto seconds = duration_cast<duration<double>>(high_resolution_clock::now() - before).count();
+            std::cerr << set.name << " " << name << ": " << size_t(set.seq.size() / seconds / 1000000) << " Mbases/sec, " << chosen.size() << " kmers" << std::endl;
+        };
+
+        measure("window scan", [](const std::string &seq, int window_size, int kmer_len) { return reference_clean_string(seq, window_size, kmer_len); });
+        measure("minimizer", [](const std::string &seq, int window_size, int kmer_len) { return minimizer_clean_string(seq, window_size, kmer_len); });
+    }
+}
+
+TEST_MAIN();
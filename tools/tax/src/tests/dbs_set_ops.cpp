@@ -0,0 +1,203 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include <random>
+#include <map>
+#include <cstdio>
+
+#include "tests.h"
+#include "dbs_set_ops.h"
+
+static const size_t KMER_LEN = 32;
+
+// sorted kmers drawn from a shared pool, so inputs overlap, with some duplicates
+static std::vector<hash_t> random_kmers(std::mt19937_64 &rnd, size_t count, const std::vector<hash_t> &pool)
+{
+    std::vector<hash_t> kmers;
+    for (size_t i = 0; i < count; i++)
+        kmers.push_back(rnd() % 3 ? pool[rnd() % pool.size()] : rnd());
+
+    std::sort(kmers.begin(), kmers.end());
+    return kmers;
+}
+
+static std::vector<hash_t> unique_kmers(std::vector<hash_t> kmers)
+{
+    kmers.erase(std::unique(kmers.begin(), kmers.end()), kmers.end());
+    return kmers;
+}
+
+template <class C>
+static std::vector<C> load(const std::string &filename)
+{
+    std::vector<C> kmers;
+    DBSIO::load_dbs(filename, kmers);
+    return kmers;
+}
+
+TEST(set_ops_match_std) {
+    std::mt19937_64 rnd(1);
+    std::vector<hash_t> pool(200000);
+    for (auto &x : pool)
+        x = rnd();
+
+    for (size_t input_count : {1, 2, 5})
+    {
+        std::vector<std::vector<hash_t>> kmers;
+        std::vector<std::string> files;
+        for (size_t i = 0; i < input_count; i++)
+        {
+            kmers.push_back(random_kmers(rnd, i == 1 ? 1000 : 300000, pool)); // a small input, so partitions get few of its kmers
+            files.push_back("./set_ops_" + std::to_string(i) + ".db");
+            DBSIO::save_dbs(files.back(), kmers.back(), KMER_LEN);
+        }
+
+        std::vector<hash_t> expected_union = unique_kmers(kmers[0]), expected_and = expected_union, expected_minus = expected_union;
+        for (size_t i = 1; i < input_count; i++)
+        {
+            auto b = unique_kmers(kmers[i]);
+            std::vector<hash_t> x;
+            std::set_union(expected_union.begin(), expected_union.end(), b.begin(), b.end(), std::back_inserter(x));
+            expected_union.swap(x);
+            x.clear();
+            std::set_intersection(expected_and.begin(), expected_and.end(), b.begin(), b.end(), std::back_inserter(x));
+            expected_and.swap(x);
+            x.clear();
+            std::set_difference(expected_minus.begin(), expected_minus.end(), b.begin(), b.end(), std::back_inserter(x));
+            expected_minus.swap(x);
+        }
+
+        auto inputs = DBSSetOps::open(files);
+        for (size_t partition_kmers : {size_t(50000), DBSSetOps::PARTITION_KMERS})
+            for (int threads : {1, 3})
+            {
+                std::vector<hash_t> result;
+                auto collect = [&](const std::vector<hash_t> &chunk) { result.insert(result.end(), chunk.begin(), chunk.end()); };
+
+                ASSERT_EQUALS(DBSSetOps::run<hash_t>(DBSSetOps::UNION, inputs, threads, nullptr, collect, partition_kmers), expected_union.size());
+                ASSERT(result == expected_union);
+                result.clear();
+                DBSSetOps::run<hash_t>(DBSSetOps::INTERSECTION, inputs, threads, nullptr, collect, partition_kmers);
+                ASSERT(result == expected_and);
+                result.clear();
+                DBSSetOps::run<hash_t>(DBSSetOps::DIFFERENCE, inputs, threads, nullptr, collect, partition_kmers);
+                ASSERT(result == expected_minus);
+            }
+
+        DBSSetOps::save(DBSSetOps::UNION, inputs, "./set_ops_out.db", 2);
+        ASSERT(load<hash_t>("./set_ops_out.db") == expected_union);
+
+        for (auto &file : files)
+            std::remove(file.c_str());
+    }
+    std::remove("./set_ops_out.db");
+}
+
+TEST(set_ops_tax_union) {
+    TaxIdTree tax_tree;
+    TaxIdTreeLoader::TaxParents tax_parents;
+    for (int t = 2; t < 64; t++)
+        tax_parents.emplace_back(t, t / 2);
+    TaxIdTreeLoader::build(tax_tree, tax_parents);
+
+    std::mt19937_64 rnd(2);
+    std::map<hash_t, int> expected;
+    std::vector<std::string> files;
+    for (int i = 0; i < 3; i++)
+    {
+        std::vector<DBS::KmerTax> kmers;
+        for (int k = 0; k < 200000; k++)
+            kmers.emplace_back(rnd() % 500000, 2 + rnd() % 62);
+
+        std::sort(kmers.begin(), kmers.end(), [](const DBS::KmerTax &a, const DBS::KmerTax &b) { return a.kmer < b.kmer; });
+        for (auto &x : kmers)
+            expected[x.kmer] = expected.count(x.kmer) ? tax_tree.consensus_of(expected[x.kmer], x.tax_id) : x.tax_id;
+
+        files.push_back("./set_ops_tax_" + std::to_string(i) + ".dbs");
+        DBSIO::save_dbs(files.back(), kmers, KMER_LEN);
+    }
+
+    auto inputs = DBSSetOps::open(files);
+    std::vector<DBS::KmerTax> result;
+    DBSSetOps::run<DBS::KmerTax>(DBSSetOps::UNION, inputs, 3, &tax_tree, [&](const std::vector<DBS::KmerTax> &chunk) { result.insert(result.end(), chunk.begin(), chunk.end()); }, 30000);
+    ASSERT_EQUALS(result.size(), expected.size());
+    auto it = expected.begin();
+    for (auto &x : result)
+    {
+        ASSERT_EQUALS(x.kmer, it->first);
+        ASSERT_EQUALS(x.tax_id, it->second);
+        ++it;
+    }
+
+    bool failed = false;
+    try { DBSSetOps::save(DBSSetOps::UNION, inputs, "./set_ops_out.dbs", 1); } catch (std::runtime_error &) { failed = true; }
+    ASSERT(failed); // tax ids cannot be merged without the tree
+
+    for (auto &file : files)
+        std::remove(file.c_str());
+    std::remove("./set_ops_out.dbs");
+}
+
+TEST(set_ops_mixed_inputs) {
+    std::vector<DBS::KmerTax> a = {{1, 10}, {3, 11}, {5, 12}, {7, 13}};
+    std::vector<hash_t> b = {3, 4, 7}, unsorted = {5, 4}, empty;
+    DBSIO::save_dbs("./set_ops_a.dbs", a, KMER_LEN);
+    DBSIO::save_dbs("./set_ops_b.db", b, KMER_LEN);
+    DBSIO::save_dbs("./set_ops_unsorted.db", unsorted, KMER_LEN);
+    DBSIO::save_dbs("./set_ops_empty.db", empty, KMER_LEN);
+    DBSIO::save_dbs("./set_ops_short.db", b, KMER_LEN - 1);
+
+    // records of the first input are kept, the others are read as kmers
+    auto inputs = DBSSetOps::open({"./set_ops_a.dbs", "./set_ops_b.db"});
+    ASSERT_EQUALS(DBSSetOps::save(DBSSetOps::DIFFERENCE, inputs, "./set_ops_out.dbs", 2), 2);
+    auto minus = load<DBS::KmerTax>("./set_ops_out.dbs");
+    ASSERT_EQUALS(minus[0].kmer, 1);
+    ASSERT_EQUALS(minus[1].tax_id, 12);
+
+    DBSSetOps::save(DBSSetOps::INTERSECTION, inputs, "./set_ops_out.dbs", 2);
+    auto common = load<DBS::KmerTax>("./set_ops_out.dbs");
+    ASSERT_EQUALS(common.size(), 2);
+    ASSERT_EQUALS(common[1].tax_id, 13);
+
+    auto with_empty = DBSSetOps::open({"./set_ops_empty.db", "./set_ops_b.db"});
+    ASSERT_EQUALS(DBSSetOps::save(DBSSetOps::UNION, with_empty, "./set_ops_out.db", 2), 3);
+    ASSERT_EQUALS(DBSSetOps::save(DBSSetOps::DIFFERENCE, with_empty, "./set_ops_out.db", 2), 0);
+
+    bool failed = false;
+    try { DBSSetOps::save(DBSSetOps::UNION, inputs, "./set_ops_out.db", 2); } catch (std::runtime_error &) { failed = true; }
+    ASSERT(failed); // .db and .dbs
+    failed = false;
+    try { DBSSetOps::save(DBSSetOps::UNION, DBSSetOps::open({"./set_ops_unsorted.db", "./set_ops_b.db"}), "./set_ops_out.db", 2); } catch (std::runtime_error &) { failed = true; }
+    ASSERT(failed);
+    failed = false;
+    try { DBSSetOps::save(DBSSetOps::UNION, DBSSetOps::open({"./set_ops_short.db", "./set_ops_b.db"}), "./set_ops_out.db", 2); } catch (std::runtime_error &) { failed = true; }
+    ASSERT(failed); // kmer lengths differ
+
+    for (auto file : {"./set_ops_a.dbs", "./set_ops_b.db", "./set_ops_unsorted.db", "./set_ops_empty.db", "./set_ops_short.db", "./set_ops_out.db", "./set_ops_out.dbs"})
+        std::remove(file);
+}
+
+TEST_MAIN();
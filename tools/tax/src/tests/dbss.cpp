@@ -0,0 +1,191 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include <random>
+#include <cstdlib>
+#include <cstdio>
+#include <sys/stat.h>
+#include <utime.h>
+
+#include "tests.h"
+#include "dbss.h"
+
+typedef std::vector<DBS::KmerTax> KmerTaxes;
+
+static bool same(const KmerTaxes &a, const KmerTaxes &b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); i++)
+        if (a[i].kmer != b[i].kmer || a[i].tax_id != b[i].tax_id)
+            return false;
+
+    return true;
+}
+
+// partitions of random sizes with kmers repeated inside and across partitions
+static std::vector<std::vector<hash_t>> random_partitions(size_t count, uint64_t seed)
+{
+    std::mt19937_64 rnd(seed);
+    std::vector<std::vector<hash_t>> kmers(count);
+    for (auto &p : kmers)
+    {
+        p.resize(rnd() % 3 == 0 ? rnd() % 3 : rnd() % 5000);
+        for (auto &h : p)
+            h = rnd() % 2 ? rnd() % 1000 : rnd();
+
+        std::sort(p.begin(), p.end());
+    }
+
+    return kmers;
+}
+
+static KmerTaxes stable_sorted(const std::vector<std::vector<hash_t>> &kmers, const std::vector<int> &tax_ids)
+{
+    KmerTaxes expected;
+    for (size_t p = 0; p < kmers.size(); p++)
+        for (auto h : kmers[p])
+            expected.emplace_back(h, tax_ids[p]);
+
+    std::stable_sort(expected.begin(), expected.end(), [](const DBS::KmerTax &a, const DBS::KmerTax &b) { return a.kmer < b.kmer; });
+    return expected;
+}
+
+TEST(merge_partitions)
+{
+    for (size_t partition_count : {0, 1, 2, 7, 100})
+    {
+        auto kmers = random_partitions(partition_count, partition_count);
+        std::vector<int> tax_ids;
+        std::vector<DBSS::Partition> partitions;
+        for (size_t p = 0; p < kmers.size(); p++)
+        {
+            tax_ids.push_back(int(p + 1));
+            partitions.push_back(DBSS::Partition{kmers[p].data(), kmers[p].size(), tax_ids.back(), nullptr});
+        }
+
+        auto expected = stable_sorted(kmers, tax_ids);
+        for (int thread_count : {1, 2, 3, 16})
+        {
+            KmerTaxes merged(5); // replaced
+            DBSS::merge_partitions(partitions, merged, thread_count);
+            ASSERT(same(merged, expected));
+        }
+    }
+}
+
+TEST(load_dbss)
+{
+    const std::string dbss = "./dbss_test.dbss";
+    auto kmers = random_partitions(20, 42);
+    std::vector<hash_t> hashes;
+    std::vector<int> tax_ids;
+    {
+        std::ofstream annotation(DBSS::DBSAnnot::annotation_filename(dbss));
+        for (size_t p = 0; p < kmers.size(); p++)
+        {
+            tax_ids.push_back(int(p * 10 + 1));
+            if (kmers[p].empty())
+                continue;
+
+            if (p == 3)
+                std::reverse(kmers[p].begin(), kmers[p].end()); // unsorted partition is sorted on load
+
+            hashes.insert(hashes.end(), kmers[p].begin(), kmers[p].end());
+            annotation << tax_ids.back() << '\t' << kmers[p].size() << std::endl;
+        }
+    }
+    DBSIO::save_dbs(dbss, hashes, 32);
+
+    auto dbss_reader = DBSS::make_reader(dbss);
+    DBSS::DBSAnnotation annotation;
+    dbss_reader->check_consistency(DBSS::load_dbs_annotation(DBSS::DBSAnnot::annotation_filename(dbss), annotation));
+
+    DBSS::TaxList tax_list = { 1, 31, 41, 91, 191, 1000 }; // 1000 is not in dbss
+    std::vector<std::vector<hash_t>> selected_kmers;
+    std::vector<int> selected_tax_ids;
+    for (size_t p = 0; p < kmers.size(); p++)
+        if (std::find(tax_list.begin(), tax_list.end(), tax_ids[p]) != tax_list.end())
+        {
+            selected_kmers.push_back(kmers[p]);
+            std::sort(selected_kmers.back().begin(), selected_kmers.back().end());
+            selected_tax_ids.push_back(tax_ids[p]);
+        }
+
+    auto expected = stable_sorted(selected_kmers, selected_tax_ids);
+    for (int num_threads : {0, 1, 4})
+    {
+        KmerTaxes loaded;
+        DBSS::load_dbss(loaded, dbss_reader, tax_list, annotation, num_threads);
+        ASSERT(same(loaded, expected));
+    }
+
+    std::remove(dbss.c_str());
+    std::remove(DBSS::DBSAnnot::annotation_filename(dbss).c_str());
+}
+
+TEST(folder_data_files)
+{
+    // a .dbss folder: <dbss>.split/header and <dbss>.split/<tax>.db, the annotation stays next to <dbss>
+    const std::string dbss = "./dbss_folder_test.dbss", folder = dbss + ".split";
+    ASSERT_EQUALS(mkdir(folder.c_str(), 0700), 0);
+    {
+        std::ofstream header(folder + "/header");
+        header << 32;
+        std::ofstream annotation(DBSS::DBSAnnot::annotation_filename(dbss));
+        annotation << 1 << '\t' << 2 << std::endl << 3 << '\t' << 1 << std::endl;
+    }
+    DBSIO::save_dbs(DBSS::DBSSFolderReader::tax_id_to_filename(folder, 1), std::vector<hash_t>{ 5, 7 }, 32);
+    DBSIO::save_dbs(DBSS::DBSSFolderReader::tax_id_to_filename(folder, 3), std::vector<hash_t>{ 6 }, 32);
+
+    auto dbss_reader = DBSS::make_reader(dbss);
+    DBSS::DBSAnnotation annotation;
+    DBSS::load_dbs_annotation(DBSS::DBSAnnot::annotation_filename(dbss), annotation);
+    DBSS::TaxList tax_list = { 1, 2, 3 }; // 2 is not in dbss
+    auto files = dbss_reader->data_files(tax_list, annotation);
+    ASSERT_EQUALS(files.size(), 3);
+    ASSERT_EQUALS(files[0], folder + "/header");
+    ASSERT_EQUALS(files[2], DBSS::DBSSFolderReader::tax_id_to_filename(folder, 3));
+
+    KmerTaxes loaded;
+    DBSS::load_dbss(loaded, dbss_reader, tax_list, annotation, 1);
+    auto source = DBSIO::lookup_index_source(files, 32, loaded, 1);
+
+    // a partition rewritten in place changes neither the size nor the mtime of the folder
+    utimbuf times = { 12345, 12345 };
+    ASSERT_EQUALS(utime(files[2].c_str(), &times), 0);
+    auto changed = DBSIO::lookup_index_source(files, 32, loaded, 1);
+    ASSERT(source.same_database(changed));
+    ASSERT(source.db_mtime != changed.db_mtime);
+
+    for (auto &file : files)
+        std::remove(file.c_str());
+    rmdir(folder.c_str());
+    std::remove(DBSS::DBSAnnot::annotation_filename(dbss).c_str());
+}
+
+TEST_MAIN();
@@ -0,0 +1,126 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+
+#include <random>
+#include <map>
+#include <set>
+
+#include "tests.h"
+#include "aligns_to_dbs_job.h"
+
+typedef DBSJob::tax_t tax_t;
+typedef std::vector<std::pair<tax_t, hash_t>> KmerHits;
+typedef std::map<tax_t, std::set<hash_t>> Sets;
+
+// kmer sets of a read as the set based hits built them, hit by hit
+static Sets reference_sets(const KmerHits &read, bool count_repeats)
+{
+    Sets sets;
+    for (auto &hit : read) {
+        auto &set = sets[hit.first];
+        if (!set.insert(hit.second).second && count_repeats)
+            set.insert(hash_t(set.size() + 1));
+    }
+
+    return sets;
+}
+
+static Sets arena_sets(const DBSJob::Hits &hits)
+{
+    Sets sets;
+    for (auto it = hits.kmers_begin(); it != hits.kmers_end(); ++it)
+        ASSERT(sets[it->first].insert(it->second).second);
+
+    ASSERT_EQUALS(size_t(hits.end() - hits.begin()), sets.size());
+    auto set = sets.begin();
+    for (auto &hit : hits) {
+        ASSERT_EQUALS(hit.tax_id, set->first);
+        ASSERT_EQUALS(size_t(hit.count), set->second.size());
+        ++set;
+    }
+
+    return sets;
+}
+
+static KmerHits random_read(std::mt19937_64 &rnd, size_t count, int taxes, hash_t values)
+{
+    KmerHits read;
+    for (size_t i = 0; i < count; i++)
+        read.emplace_back(tax_t(1 + rnd() % taxes), values ? rnd() % values : (rnd() % 3 + 1) << 40);
+
+    return read;
+}
+
+TEST(hit_arena_kmer_sets) {
+    std::mt19937_64 rnd(1);
+    DBSJob::HitArena arena;
+    for (bool count_repeats : {false, true})
+        for (size_t count : {0, 1, 2, 5, 50, 500})
+            for (hash_t values : {hash_t(0), hash_t(3), hash_t(20), hash_t(1000), hash_t(-1)})
+                for (int taxes : {1, 3, 10}) {
+                    arena.clear();
+                    std::vector<std::pair<KmerHits, DBSJob::Hits>> reads;
+                    for (int r = 0; r < 3; r++) { // reads share the arena
+                        auto read = random_read(rnd, count, taxes, values);
+                        arena.begin_read();
+                        for (auto &hit : read)
+                            arena.add_to_set(hit.first, hit.second);
+                        reads.emplace_back(read, arena.end_read(count_repeats));
+                    }
+
+                    for (auto &read : reads) {
+                        auto expected = reference_sets(read.first, count_repeats);
+                        ASSERT(arena_sets(read.second) == expected);
+                    }
+                }
+}
+
+TEST(hit_arena_counts) {
+    std::mt19937_64 rnd(2);
+    DBSJob::HitArena arena;
+    for (size_t count : {0, 1, 7, 1000})
+        for (int taxes : {1, 4, 100}) {
+            std::map<tax_t, unsigned int> expected;
+            arena.begin_read();
+            for (size_t i = 0; i < count; i++) {
+                const tax_t tax_id = tax_t(1 + rnd() % taxes);
+                expected[tax_id]++;
+                arena.add(tax_id);
+            }
+
+            auto hits = arena.end_read();
+            ASSERT_EQUALS(size_t(hits.end() - hits.begin()), expected.size());
+            auto it = expected.begin();
+            for (auto &hit : hits) {
+                ASSERT_EQUALS(hit.tax_id, it->first);
+                ASSERT_EQUALS(hit.count, it->second);
+                ++it;
+            }
+        }
+}
+
+TEST_MAIN();
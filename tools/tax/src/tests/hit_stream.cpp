@@ -0,0 +1,262 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include <random>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <unistd.h>
+
+#include "tests.h"
+#include "hit_stream.h"
+#include "tax_collator.hpp"
+
+struct Record
+{
+    std::string spotid;
+    std::vector<HitStream::Hit> hits;
+};
+
+static std::vector<Record> random_records(size_t count, uint64_t seed)
+{
+    std::mt19937_64 rnd(seed);
+    std::vector<Record> records(count);
+    size_t spot = 0;
+    for (auto &record : records)
+    {
+        spot += rnd() % 3 == 0; // fragments of a spot follow each other
+        record.spotid = "SRR01." + std::to_string(spot);
+        for (int i = 0, n = rnd() % 5; i < n; i++)
+            record.hits.push_back(HitStream::Hit{int32_t(1 + rnd() % 3000000), uint32_t(1 + rnd() % (i ? 3 : 300))});
+    }
+    return records;
+}
+
+static std::string tmp_file(const std::string &name)
+{
+    return "hit_stream_test." + std::to_string(getpid()) + "." + name;
+}
+
+static void write_records(const std::string &filename, const std::vector<Record> &records, bool has_counts, bool compress)
+{
+    std::ofstream f(filename, std::ios::binary);
+    HitStreamWriter writer(f, has_counts, compress);
+    for (auto &record : records)
+        writer.add(record.spotid, record.hits);
+    writer.close();
+}
+
+static std::vector<Record> read_records(const std::string &filename)
+{
+    HitStreamReader reader(filename);
+    std::vector<Record> records;
+    Record record;
+    std::vector<uint32_t> tax_ids, counts;
+    while (reader.next(record.spotid, tax_ids, counts))
+    {
+        ASSERT_EQUALS(tax_ids.size(), counts.size());
+        record.hits.clear();
+        for (size_t i = 0; i < tax_ids.size(); i++)
+            record.hits.push_back(HitStream::Hit{int32_t(tax_ids[i]), counts[i]});
+        records.push_back(record);
+    }
+    return records;
+}
+
+static bool same(const std::vector<Record> &a, const std::vector<Record> &b, bool has_counts)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i].spotid != b[i].spotid || a[i].hits.size() != b[i].hits.size())
+            return false;
+        for (size_t j = 0; j < a[i].hits.size(); j++)
+            if (a[i].hits[j].tax_id != b[i].hits[j].tax_id || (has_counts ? a[i].hits[j].count : 1) != b[i].hits[j].count)
+                return false;
+    }
+    return true;
+}
+
+static std::string text(const std::vector<Record> &records, bool print_counts)
+{
+    std::string s;
+    for (auto &record : records)
+        HitStream::append_text(s, record.spotid, record.hits, print_counts);
+    return s;
+}
+
+TEST(hit_stream_round_trip)
+{
+    auto records = random_records(500000, 1); // several chunks
+    for (bool has_counts : { true, false })
+    {
+        auto filename = tmp_file("hits");
+        write_records(filename, records, has_counts, false);
+        ASSERT(HitStream::is_hit_stream(filename));
+        ASSERT(same(records, read_records(filename), has_counts));
+        std::remove(filename.c_str());
+    }
+}
+
+TEST(hit_stream_zstd)
+{
+    auto records = random_records(200000, 2);
+    auto filename = tmp_file("zst");
+#if HAVE_ZSTD
+    write_records(filename, records, true, true);
+    ASSERT(same(records, read_records(filename), true));
+#else
+    bool thrown = false;
+    try
+    {
+        write_records(filename, records, true, true);
+    }
+    catch (std::runtime_error &)
+    {
+        thrown = true;
+    }
+    ASSERT(thrown);
+#endif
+    std::remove(filename.c_str());
+}
+
+TEST(hit_stream_empty)
+{
+    auto filename = tmp_file("empty");
+    write_records(filename, {}, true, false);
+    ASSERT(HitStream::is_hit_stream(filename));
+    ASSERT(read_records(filename).empty());
+
+    std::ofstream(filename) << "1\t9606x2\n";
+    ASSERT(!HitStream::is_hit_stream(filename));
+    std::remove(filename.c_str());
+}
+
+static bool read_throws(const std::string &filename)
+{
+    try
+    {
+        read_records(filename);
+    }
+    catch (std::runtime_error &)
+    {
+        return true;
+    }
+    return false;
+}
+
+TEST(hit_stream_truncated)
+{
+    auto records = random_records(1000, 4);
+    auto filename = tmp_file("truncated");
+    write_records(filename, records, true, false);
+    std::string data;
+    {
+        std::ifstream f(filename, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    }
+
+    // no end marker, a partial chunk header and a partial chunk are not a shorter stream
+    for (size_t cut : { sizeof(HitStream::ChunkHeader), sizeof(HitStream::ChunkHeader) / 2, sizeof(HitStream::ChunkHeader) + 100, data.size() - HitStream::MAGIC_SIZE - 1 - sizeof(HitStream::ChunkHeader) / 2 })
+    {
+        std::ofstream(filename, std::ios::binary) << data.substr(0, data.size() - cut);
+        ASSERT(read_throws(filename));
+    }
+
+    std::remove(filename.c_str());
+}
+
+TEST(hit_stream_corrupted_count)
+{
+    // a record claiming more hits than the chunk holds
+    const std::string record = std::string("\x01" "a" "\xff\xff\xff\x0f", 6);
+    HitStream::ChunkHeader chunk = { 1, uint32_t(record.size()), uint32_t(record.size()) }, end = { 0, 0, 0 };
+    auto filename = tmp_file("corrupted");
+    {
+        std::ofstream f(filename, std::ios::binary);
+        f.write(HitStream::magic(), HitStream::MAGIC_SIZE);
+        f.put(char(HitStream::HAS_COUNTS));
+        f.write((const char*)&chunk, sizeof(chunk));
+        f << record;
+        f.write((const char*)&end, sizeof(end));
+    }
+    ASSERT(read_throws(filename));
+    std::remove(filename.c_str());
+}
+
+TEST(hit_stream_text)
+{
+    std::vector<Record> records = { { "1", { {9606, 2}, {10090, 1} } }, { "a\tb\nc", { {562, 1} } }, { "2", {} } };
+    ASSERT_EQUALS(text(records, true), std::string("1\t9606x2\t10090\na b c\t562\n2\n"));
+    ASSERT_EQUALS(text(records, false), std::string("1\t9606\t10090\na b c\t562\n2\n"));
+}
+
+TEST(hit_stream_negative_tax_id)
+{
+    std::string s;
+    HitStream::append_number(s, int(-5));
+    HitStream::append_number(s, size_t(7));
+    ASSERT_EQUALS(s, std::string("-57"));
+
+    // printed as the text printer does, also after the binary round trip
+    std::vector<Record> records = { { "1", { {-5, 2}, {9606, 1} } } };
+    ASSERT_EQUALS(text(records, true), std::string("1\t-5x2\t9606\n"));
+    auto filename = tmp_file("negative");
+    write_records(filename, records, true, false);
+    ASSERT_EQUALS(text(read_records(filename), true), text(records, true));
+    std::remove(filename.c_str());
+}
+
+template <class Options>
+static std::string collated(tc::Tax_hits<Options> &tax_hits)
+{
+    tf::Executor executor(2);
+    std::stringstream ss;
+    tax_hits.template collate<Options>(executor)->print(executor, ss);
+    return ss.str();
+}
+
+TEST(hit_stream_tax_collator_load)
+{
+    typedef tc::tax_hits_options<false, true> Options;
+    auto records = random_records(100000, 3);
+    auto hits_file = tmp_file("hits"), text_file = tmp_file("txt");
+    write_records(hits_file, records, true, false);
+    std::ofstream(text_file) << text(records, true);
+
+    tc::Tax_hits<Options> from_hits(true), from_text(true);
+    from_hits.load_hit_stream(hits_file);
+    from_text.load(text_file);
+    ASSERT_EQUALS(from_hits.size(), from_text.size());
+    ASSERT(collated(from_hits) == collated(from_text));
+
+    std::remove(hits_file.c_str());
+    std::remove(text_file.c_str());
+}
+
+TEST_MAIN();
@@ -0,0 +1,128 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include <random>
+
+#include "tests.h"
+#include "dbs.h"
+#include "kmer_filter.h"
+
+typedef std::vector<DBS::KmerTax> KmerTaxes;
+
+static KmerTaxes random_kmers(size_t count, uint64_t seed)
+{
+    std::mt19937_64 rnd(seed);
+    KmerTaxes kmers;
+    for (size_t i = 0; i < count; i++)
+        kmers.emplace_back(rnd(), int(1 + i % 100));
+
+    return kmers;
+}
+
+static hash_t record_kmer(const DBS::KmerTax &x) { return x.kmer; }
+
+TEST(bloom_filter_no_false_negatives) {
+    for (size_t count : {0, 1, 7, 100, 12345}) {
+        auto kmers = random_kmers(count, count);
+        KmerBloomFilter filter;
+        filter.build(kmers, record_kmer);
+        for (auto &k : kmers)
+            ASSERT(filter.may_contain(k.kmer));
+    }
+
+    // kmers of one kmer_len are small numbers, close to each other
+    KmerTaxes dense;
+    for (hash_t kmer = 0; kmer < 10000; kmer++)
+        dense.emplace_back(kmer * 3, 1);
+
+    KmerBloomFilter filter;
+    filter.build(dense, record_kmer);
+    size_t passed = 0;
+    for (hash_t kmer = 0; kmer < 30000; kmer++) {
+        if (kmer % 3 == 0) {
+            ASSERT(filter.may_contain(kmer));
+        } else
+            passed += filter.may_contain(kmer);
+    }
+
+    ASSERT(passed < 20000 / 20);
+}
+
+TEST(bloom_filter_false_positive_rate) {
+    const size_t count = 200000;
+    auto kmers = random_kmers(count, 1);
+    KmerBloomFilter filter;
+    filter.build(kmers, record_kmer);
+
+    std::mt19937_64 rnd(2);
+    const size_t absent = 1000000;
+    size_t passed = 0;
+    for (size_t i = 0; i < absent; i++)
+        passed += filter.may_contain(rnd()); // random 64 bit kmers are not in the filter in practice
+
+    ASSERT(passed < absent / 20);
+}
+
+TEST(bloom_filter_remove_absent) {
+    auto kmers = random_kmers(1000, 3);
+    KmerBloomFilter filter;
+    filter.build(kmers, record_kmer);
+
+    std::mt19937_64 rnd(4);
+    std::vector<hash_t> keys;
+    std::vector<int> values;
+    for (size_t i = 0; i < 5000; i++) {
+        keys.push_back(i % 5 == 0 ? kmers[i / 5].kmer : rnd());
+        values.push_back(int(i));
+    }
+
+    KmerBloomFilter::Counts counts;
+    filter.remove_absent(keys, &values, counts);
+    ASSERT_EQUALS(counts.lookups, 5000);
+    ASSERT_EQUALS(keys.size(), values.size());
+    ASSERT_EQUALS(counts.rejected, 5000 - keys.size());
+    ASSERT(keys.size() >= 1000);
+
+    // present kmers keep their order and values
+    size_t present = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        ASSERT(filter.may_contain(keys[i]));
+        ASSERT(i == 0 || values[i] > values[i - 1]);
+        if (values[i] % 5 == 0) {
+            ASSERT_EQUALS(keys[i], kmers[values[i] / 5].kmer);
+            present++;
+        }
+    }
+    ASSERT_EQUALS(present, 1000);
+
+    std::vector<hash_t> all = {kmers[0].kmer, kmers[1].kmer};
+    KmerBloomFilter::Counts all_counts;
+    filter.remove_absent(all, all_counts);
+    ASSERT_EQUALS(all.size(), 2);
+    ASSERT_EQUALS(all_counts.rejected, 0);
+}
+
+TEST_MAIN();
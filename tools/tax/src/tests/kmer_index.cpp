@@ -0,0 +1,533 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include <random>
+#include <cstdlib>
+#include <cstdio>
+#include <limits>
+#include <fstream>
+
+#include "tests.h"
+#include "dbs.h"
+#include "kmer_index.h"
+
+typedef std::vector<DBS::KmerTax> KmerTaxes;
+
+static KmerTaxes random_sorted_kmers(size_t count, uint64_t seed)
+{
+    std::mt19937_64 rnd(seed);
+    std::vector<hash_t> hashes(count);
+    for (auto &h : hashes)
+        h = rnd();
+
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+
+    KmerTaxes kmers;
+    kmers.reserve(hashes.size());
+    for (auto h : hashes)
+        kmers.emplace_back(h, int(1 + h % 1000));
+
+    return kmers;
+}
+
+static bool kmer_less(const DBS::KmerTax &x, hash_t hash) { return x.kmer < hash; }
+
+static int lower_bound_find(const KmerTaxes &kmers, hash_t hash)
+{
+    auto it = std::lower_bound(kmers.begin(), kmers.end(), hash, kmer_less);
+    return (it != kmers.end() && it->kmer == hash) ? it->tax_id : 0;
+}
+
+static int bucket_find(const KmerBucketIndex &index, const KmerTaxes &kmers, hash_t hash)
+{
+    auto bucket = index.bucket_of(hash);
+    auto first = kmers.begin() + index.bucket_begin(bucket);
+    auto last = kmers.begin() + index.bucket_end(bucket);
+    auto it = std::lower_bound(first, last, hash, kmer_less);
+    return (it != last && it->kmer == hash) ? it->tax_id : 0;
+}
+
+TEST(kmer_index_equivalence) {
+    const int kmer_len = 32;
+    for (size_t count : {0, 1, 2, 3, 7, 8, 100, 1000, 12345}) {
+        auto kmers = random_sorted_kmers(count, count);
+
+        KmerBucketIndex bucket_index;
+        bucket_index.build(kmers, kmer_len);
+        KmerSoABucketIndex soa_index;
+        soa_index.build(kmers, kmer_len);
+        ASSERT_EQUALS(soa_index.size(), kmers.size());
+
+        std::vector<hash_t> queries = {0, 1, hash_t(-1), hash_t(-2)};
+        std::mt19937_64 rnd(count + 1);
+        for (int i = 0; i < 10000; i++)
+            queries.push_back(rnd());
+        for (auto &k : kmers) {
+            queries.push_back(k.kmer);
+            queries.push_back(k.kmer - 1);
+            queries.push_back(k.kmer + 1);
+        }
+
+        for (auto q : queries) {
+            auto expected = lower_bound_find(kmers, q);
+            ASSERT_EQUALS(soa_index.find(q), expected);
+            ASSERT_EQUALS(bucket_find(bucket_index, kmers, q), expected);
+        }
+    }
+}
+
+static void check_batched_lower_bound(const std::vector<hash_t> &array, const std::vector<hash_t> &keys)
+{
+    std::vector<size_t> positions(keys.size(), size_t(-1));
+    batched_lower_bound(array, keys.data(), keys.size(), positions.data());
+    for (size_t i = 0; i < keys.size(); i++)
+        ASSERT_EQUALS(positions[i], size_t(std::lower_bound(array.begin(), array.end(), keys[i]) - array.begin()));
+}
+
+TEST(batched_lower_bound_equivalence) {
+    const std::vector<hash_t> empty;
+    check_batched_lower_bound(empty, {});
+    check_batched_lower_bound(empty, {0, 5, hash_t(-1)});
+
+    const std::vector<hash_t> array = {10, 20, 20, 20, 30, 40, 40, 50};
+    check_batched_lower_bound(array, {});
+    check_batched_lower_bound(array, {0, 1, 9}); // all keys below
+    check_batched_lower_bound(array, {51, 100, hash_t(-1)}); // all keys above
+    check_batched_lower_bound(array, {20, 20, 40, 10, 50, 50}); // duplicate keys, duplicate array values
+    check_batched_lower_bound(array, {19, 21, 39, 41, 45});
+    check_batched_lower_bound(std::vector<hash_t>(7, 42), {41, 42, 43});
+
+    for (size_t count : {1, 2, 3, 100, 12345}) {
+        std::mt19937_64 rnd(count);
+        std::vector<hash_t> random_array(count);
+        for (auto &h : random_array)
+            h = rnd() % (count * 4); // small range leaves duplicates
+        std::sort(random_array.begin(), random_array.end());
+
+        std::vector<hash_t> keys;
+        for (int i = 0; i < 1000; i++)
+            keys.push_back(rnd() % (count * 5));
+        check_batched_lower_bound(random_array, keys);
+    }
+}
+
+// kmers of kmer_len bases with up to max_copies copies of a kmer, copies keep their own tax id
+static KmerTaxes random_kmers_with_duplicates(size_t count, int kmer_len, int max_copies, int tax_count, uint64_t seed)
+{
+    std::mt19937_64 rnd(seed);
+    const hash_t mask = kmer_len == 32 ? ~hash_t(0) : (hash_t(1) << (2 * kmer_len)) - 1;
+    KmerTaxes kmers;
+    for (size_t i = 0; i < count; i++)
+    {
+        const hash_t kmer = rnd() & mask;
+        const int copies = 1 + int(rnd() % max_copies);
+        for (int c = 0; c < copies; c++)
+            kmers.emplace_back(kmer, int(1 + rnd() % tax_count));
+    }
+
+    std::stable_sort(kmers.begin(), kmers.end(), [](const DBS::KmerTax &a, const DBS::KmerTax &b) { return a.kmer < b.kmer; });
+    return kmers;
+}
+
+static void check_compressed(const KmerCompressedIndex &index, const KmerTaxes &kmers, int kmer_len, uint64_t seed)
+{
+    const hash_t mask = kmer_len == 32 ? ~hash_t(0) : (hash_t(1) << (2 * kmer_len)) - 1;
+    std::vector<hash_t> queries = {0, 1, mask, mask - 1};
+    std::mt19937_64 rnd(seed);
+    for (int i = 0; i < 10000; i++)
+        queries.push_back(rnd() & mask);
+    for (auto &k : kmers) {
+        queries.push_back(k.kmer);
+        queries.push_back((k.kmer - 1) & mask);
+        queries.push_back((k.kmer + 1) & mask);
+    }
+
+    for (auto q : queries)
+        ASSERT_EQUALS(index.find(q), lower_bound_find(kmers, q));
+}
+
+TEST(compressed_index_equivalence) {
+    for (int kmer_len : {4, 8, 12, 32})
+    for (size_t count : {0, 1, 2, 127, 128, 129, 255, 256, 1000, 12345}) {
+        for (int max_copies : {1, 3}) {
+            auto kmers = random_kmers_with_duplicates(count, kmer_len, max_copies, 300, count * 100 + kmer_len + max_copies);
+
+            KmerCompressedIndex index;
+            index.build(kmers, kmer_len);
+            ASSERT_EQUALS(index.kmer_len(), kmer_len);
+            check_compressed(index, kmers, kmer_len, count + 1);
+
+            KmerStaticIndex static_index(KmerIndexType::COMPRESSED, kmers, kmer_len);
+            ASSERT_EQUALS(static_index.size(), index.size());
+            for (auto &k : kmers)
+                ASSERT_EQUALS(static_index.find(k.kmer), lower_bound_find(kmers, k.kmer));
+        }
+    }
+
+    // single tax id takes no bits, dense kmers take no low bits
+    KmerTaxes dense;
+    for (hash_t kmer = 0; kmer < 1000; kmer++)
+        dense.emplace_back(kmer * 2, 7);
+
+    KmerCompressedIndex index;
+    index.build(dense, 8);
+    ASSERT_EQUALS(index.header.tax_bits, 0);
+    check_compressed(index, dense, 8, 1);
+}
+
+TEST(compressed_index_for_each_kmer) {
+    for (int kmer_len : {4, 12, 32})
+    for (size_t count : {0, 1, 128, 129, 12345}) {
+        auto kmers = random_kmers_with_duplicates(count, kmer_len, 3, 300, count + kmer_len);
+        size_t unique_count = 0;
+        hash_t unique_sum = 0;
+        for (size_t i = 0; i < kmers.size(); i++)
+            if (i == 0 || kmers[i].kmer != kmers[i - 1].kmer) {
+                unique_count++;
+                unique_sum += kmers[i].kmer * 31 + 1;
+            }
+
+        KmerCompressedIndex index;
+        index.build(kmers, kmer_len);
+        size_t visited = 0;
+        hash_t sum = 0;
+        index.for_each_kmer([&](hash_t kmer) {
+            ASSERT(index.find(kmer) != 0);
+            __atomic_fetch_add(&visited, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&sum, kmer * 31 + 1, __ATOMIC_RELAXED);
+        });
+        ASSERT_EQUALS(visited, unique_count);
+        ASSERT_EQUALS(sum, unique_sum);
+    }
+}
+
+TEST(compressed_index_file) {
+    const std::string dbsc = "./kmer_index_test.dbsc";
+    auto kmers = random_kmers_with_duplicates(5000, 31, 2, 1000, 5);
+
+    KmerCompressedIndex built;
+    built.build(kmers, 31);
+    DBSIO::save_dbsc(dbsc, built);
+
+    KmerCompressedIndex loaded;
+    ASSERT_EQUALS(DBSIO::load_dbsc(dbsc, loaded), 31);
+    ASSERT_EQUALS(loaded.size(), built.size());
+    check_compressed(loaded, kmers, 31, 6);
+
+    {
+        IO::MappedFile mapping;
+        KmerCompressedIndex mapped;
+        ASSERT_EQUALS(DBSIO::map_dbsc(dbsc, mapping, mapped, IO::MappedFile::PREFETCH_NONE), 31);
+        ASSERT(mapped.image.empty());
+        KmerStaticIndex static_index(std::move(mapped)); // views into the mapping survive the move
+        for (auto &k : kmers)
+            ASSERT_EQUALS(static_index.find(k.kmer), lower_bound_find(kmers, k.kmer));
+    }
+
+    // truncated file and a dbs file are rejected
+    {
+        std::ofstream f(dbsc, std::ios::binary);
+        f.write((const char*)built.image.data(), (built.image.size() - 1) * sizeof(uint64_t));
+    }
+    KmerCompressedIndex truncated;
+    bool failed = false;
+    try { DBSIO::load_dbsc(dbsc, truncated); } catch (std::runtime_error &) { failed = true; }
+    ASSERT(failed);
+
+    DBSIO::save_dbs(dbsc, kmers, 31);
+    failed = false;
+    try { IO::MappedFile mapping; DBSIO::map_dbsc(dbsc, mapping, truncated, IO::MappedFile::PREFETCH_NONE); } catch (std::runtime_error &) { failed = true; }
+    ASSERT(failed);
+
+    std::remove(dbsc.c_str());
+}
+
+// run explicitly as "kmer_index bench_kmer_index"
+// KMER_INDEX_BENCH_SIZE sets the number of kmers, e.g. 1000000000 for a 1 billion kmers database (needs ~25GB)
+DISABLED_TEST(bench_kmer_index) {
+    const char *size_env = getenv("KMER_INDEX_BENCH_SIZE");
+    const size_t count = size_env ? std::stoull(size_env) : (size_t(1) << 26);
+    const size_t query_count = 20 * 1000 * 1000;
+    const int kmer_len = 32;
+
+    auto kmers = random_sorted_kmers(count, 42);
+    std::cerr << "kmers: " << kmers.size() << std::endl;
+
+    std::mt19937_64 rnd(7);
+    std::vector<hash_t> queries(query_count);
+    for (size_t i = 0; i < query_count; i++)
+        queries[i] = (i % 2) ? rnd() : kmers[rnd() % kmers.size()].kmer; // half hits, half misses
+
+    auto measure = [&](const char *name, auto find) {
+        auto before = high_resolution_clock::now();
+        size_t found = 0;
+        for (auto q : queries)
+            found += find(q) != 0;
+        auto seconds = duration_cast<duration<double>>(high_resolution_clock::now() - before).count();
+        std::cerr << name << ": " << size_t(query_count / seconds) << " lookups/sec, found " << found << std::endl;
+    };
+
+    {
+        KmerBucketIndex bucket_index;
+        bucket_index.build(kmers, kmer_len);
+        measure("lookup_table", [&](hash_t q) { return bucket_find(bucket_index, kmers, q); });
+    }
+    {
+        KmerSoABucketIndex soa_index;
+        soa_index.build(kmers, kmer_len);
+        measure("soa", [&](hash_t q) { return soa_index.find(q); });
+    }
+    {
+        KmerCompressedIndex compressed_index;
+        compressed_index.build(kmers, kmer_len);
+        std::cerr << "dbs " << kmers.size() * sizeof(DBS::KmerTax) / 1024 / 1024 << "MB, compressed " << compressed_index.memory_bytes() / 1024 / 1024 << "MB" << std::endl;
+        measure("compressed", [&](hash_t q) { return compressed_index.find(q); });
+    }
+}
+
+static void check_multi_tax(const KmerMultiTaxIndex &index, const std::vector<DBS::KmerTaxMulti> &kmers, uint64_t seed)
+{
+    ASSERT_EQUALS(index.size(), kmers.size());
+    for (auto &k : kmers) {
+        auto tax_ids = index.find(k.kmer);
+        ASSERT_EQUALS(tax_ids.size(), k.tax_ids.size());
+        for (size_t i = 0; i < tax_ids.size(); i++)
+            ASSERT_EQUALS(tax_ids[i], k.tax_ids[i]);
+    }
+
+    std::mt19937_64 rnd(seed);
+    for (int i = 0; i < 10000; i++) {
+        hash_t hash = rnd() >> 2;
+        auto it = std::lower_bound(kmers.begin(), kmers.end(), hash, [](const DBS::KmerTaxMulti &x, hash_t h) { return x.kmer < h; });
+        if (it == kmers.end() || it->kmer != hash)
+            ASSERT(index.find(hash).empty());
+    }
+}
+
+TEST(multi_tax_index_file) {
+    const std::string dbsm = "./kmer_index_test.dbsm";
+    for (size_t count : {0, 1, 2, 1000, 12345}) {
+        // tax id counts from 0 to 4, kmers of kmer_len 31 are below 2^62
+        std::mt19937_64 rnd(count);
+        std::vector<hash_t> hashes(count);
+        for (auto &h : hashes)
+            h = rnd() >> 2;
+        std::sort(hashes.begin(), hashes.end());
+        hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+
+        std::vector<DBS::KmerTaxMulti> kmers;
+        for (auto h : hashes) {
+            std::vector<int> tax_ids;
+            for (int t = int(h % 5); t > 0; t--)
+                tax_ids.push_back(int(rnd() % 1000) + 1);
+            kmers.emplace_back(h, tax_ids);
+        }
+        DBSIO::save_dbsm(dbsm, kmers, 31);
+
+        KmerMultiTaxIndex loaded;
+        ASSERT_EQUALS(DBSIO::load_dbsm(dbsm, loaded), 31);
+        ASSERT_EQUALS(loaded.gap, 0);
+        size_t tax_count = 0;
+        for (auto &k : kmers)
+            tax_count += k.tax_ids.size();
+        ASSERT_EQUALS(loaded.tax_storage.size(), tax_count);
+        check_multi_tax(loaded, kmers, count + 1);
+
+        IO::MappedFile mapping;
+        KmerMultiTaxIndex mapped;
+        ASSERT_EQUALS(DBSIO::map_dbsm(dbsm, mapping, mapped, IO::MappedFile::PREFETCH_NONE), 31);
+        ASSERT(mapped.tax_storage.empty());
+        check_multi_tax(mapped, kmers, count + 2);
+    }
+
+    // truncated file is rejected
+    std::vector<DBS::KmerTaxMulti> kmers = {DBS::KmerTaxMulti(5, {1, 2, 3})};
+    DBSIO::save_dbsm(dbsm, kmers, 31);
+    std::vector<char> image;
+    {
+        std::ifstream f(dbsm, std::ios::binary);
+        image.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    }
+    {
+        std::ofstream f(dbsm, std::ios::binary);
+        f.write(image.data(), image.size() - sizeof(int));
+    }
+    KmerMultiTaxIndex truncated;
+    bool failed = false;
+    try { DBSIO::load_dbsm(dbsm, truncated); } catch (std::runtime_error &) { failed = true; }
+    ASSERT(failed);
+
+    std::remove(dbsm.c_str());
+}
+
+static std::vector<char> file_image(const std::string &filename)
+{
+    std::ifstream f(filename, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+static void write_image(const std::string &filename, const std::vector<char> &image, size_t size)
+{
+    std::ofstream f(filename, std::ios::binary);
+    f.write(image.data(), size);
+}
+
+template <class F>
+static bool throws(F &&f)
+{
+    try { f(); } catch (std::runtime_error &) { return true; }
+    return false;
+}
+
+TEST(map_corrupt_files) {
+    const std::string dbs = "./kmer_index_test_map.dbs";
+    auto kmers = random_sorted_kmers(100, 21);
+    DBSIO::save_dbs(dbs, kmers, 32);
+    auto image = file_image(dbs);
+    const size_t count_offset = sizeof(DBSIO::DBSHeader);
+
+    auto map = [&]
+    {
+        IO::MappedFile mapping;
+        ArrayView<DBS::KmerTax> mapped;
+        return DBSIO::map_dbs(dbs, mapping, mapped, IO::MappedFile::PREFETCH_NONE);
+    };
+    ASSERT_EQUALS(map(), 32);
+
+    write_image(dbs, image, image.size() - 1); // truncated
+    ASSERT(throws(map));
+
+    // count * sizeof(KmerTax) wraps around to a small number
+    auto corrupt = image;
+    const size_t count = std::numeric_limits<size_t>::max() / sizeof(DBS::KmerTax) + 2;
+    memcpy(corrupt.data() + count_offset, &count, sizeof(count));
+    write_image(dbs, corrupt, corrupt.size());
+    ASSERT(throws(map));
+
+    write_image(dbs, image, count_offset); // header only
+    ASSERT(throws(map));
+
+    // dbsm with a corrupt kmer count
+    const std::string dbsm = "./kmer_index_test_map.dbsm";
+    DBSIO::save_dbsm(dbsm, {DBS::KmerTaxMulti(5, {1, 2, 3}), DBS::KmerTaxMulti(7, {4})}, 31);
+    auto dbsm_image = file_image(dbsm);
+    memcpy(dbsm_image.data() + count_offset, &count, sizeof(count));
+    write_image(dbsm, dbsm_image, dbsm_image.size());
+    ASSERT(throws([&]
+    {
+        IO::MappedFile mapping;
+        KmerMultiTaxIndex mapped;
+        DBSIO::map_dbsm(dbsm, mapping, mapped, IO::MappedFile::PREFETCH_NONE);
+    }));
+
+    std::remove(dbs.c_str());
+    std::remove(dbsm.c_str());
+}
+
+TEST(lookup_index_sidecar) {
+    const std::string dbs = "./kmer_index_test.dbs";
+    const std::string index_file = dbs + ".index";
+    auto kmers = random_sorted_kmers(20000, 11);
+    DBSIO::save_dbs(dbs, kmers, 32);
+    auto source = DBSIO::lookup_index_source(dbs, 32, kmers);
+
+    KmerBucketIndex built;
+    built.build(kmers, 32);
+    KmerBloomFilter filter;
+    filter.build(kmers, [](const DBS::KmerTax &k) { return k.kmer; });
+    DBSIO::save_lookup_index(index_file, source, built, nullptr);
+
+    {
+        IO::MappedFile mapping;
+        KmerBucketIndex mapped;
+        ASSERT(DBSIO::map_lookup_index(index_file, mapping, source, kmers, mapped));
+        ASSERT(mapped.storage.empty());
+        ASSERT_EQUALS(mapped.bucket_count(), built.bucket_count());
+        ASSERT(DBSIO::lookup_index_filter(mapping).empty());
+        std::mt19937_64 rnd(12);
+        for (size_t i = 0; i < 1000; i++) {
+            auto hash = (i % 2) ? kmers[rnd() % kmers.size()].kmer : rnd();
+            ASSERT_EQUALS(bucket_find(mapped, kmers, hash), lower_bound_find(kmers, hash));
+        }
+    }
+
+    // the prefilter is stored after the table
+    DBSIO::save_lookup_index(index_file, source, built, &filter);
+    {
+        IO::MappedFile mapping;
+        KmerBucketIndex mapped;
+        ASSERT(DBSIO::map_lookup_index(index_file, mapping, source, kmers, mapped));
+        auto blocks = DBSIO::lookup_index_filter(mapping);
+        ASSERT_EQUALS(blocks.size(), filter.blocks.size());
+        ASSERT_EQUALS(size_t(blocks.data()) % 64, 0);
+        KmerBloomFilter attached;
+        attached.attach(blocks.data(), blocks.size());
+        for (auto &k : kmers)
+            ASSERT(attached.may_contain(k.kmer));
+    }
+
+    // sidecar of another database or tax list is ignored
+    {
+        IO::MappedFile mapping;
+        KmerBucketIndex mapped;
+        auto other = source;
+        other.tax_list = 7;
+        ASSERT(!DBSIO::map_lookup_index(index_file, mapping, other, kmers, mapped));
+        other = source;
+        other.db_mtime++; // database rewritten in place
+        ASSERT(!DBSIO::map_lookup_index(index_file, mapping, other, kmers, mapped));
+        KmerTaxes changed = kmers;
+        changed.back().kmer++; // same size and mtime, other kmers
+        ASSERT(!DBSIO::map_lookup_index(index_file, mapping, DBSIO::lookup_index_source(dbs, 32, changed), changed, mapped));
+        KmerTaxes shifted = kmers;
+        for (auto &k : shifted)
+            k.kmer ^= 1ull << 63;
+        std::sort(shifted.begin(), shifted.end(), [](const DBS::KmerTax &a, const DBS::KmerTax &b) { return a.kmer < b.kmer; });
+        ASSERT(!DBSIO::map_lookup_index(index_file, mapping, source, shifted, mapped));
+    }
+
+    // the sidecar is written under a temporary name of the process and renamed
+    ASSERT(!std::ifstream(index_file + "." + std::to_string(getpid()) + ".tmp"));
+
+    // corrupted sidecar is ignored
+    {
+        std::fstream f(index_file, std::ios::binary | std::ios::in | std::ios::out);
+        f.seekp(sizeof(DBSIO::LookupIndexHeader) + 100 * sizeof(size_t));
+        size_t garbage = 12345;
+        f.write((const char*)&garbage, sizeof(garbage));
+    }
+    {
+        IO::MappedFile mapping;
+        KmerBucketIndex mapped;
+        ASSERT(!DBSIO::map_lookup_index(index_file, mapping, source, kmers, mapped));
+    }
+
+    std::remove(index_file.c_str());
+    std::remove(dbs.c_str());
+}
+
+TEST_MAIN();
@@ -0,0 +1,214 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include <random>
+#include <thread>
+#include <cstdio>
+#include <sys/stat.h>
+
+#include "tests.h"
+#include "kmers.h"
+#include "kmer_tax_table.h"
+#include "dbss.h"
+
+// 1 - 2 - 4 - 8, 9
+//       - 5 - 10, 11
+//   - 3 - 6 - 12, 13
+//       - 7 - 14, 15
+static void build_tree(TaxIdTree &tree)
+{
+    TaxIdTreeLoader::TaxParents tax_parents;
+    for (tax_id_t t = 2; t < 16; t++)
+        tax_parents.emplace_back(t, t / 2);
+    TaxIdTreeLoader::build(tree, tax_parents);
+}
+
+struct Added
+{
+    hash_t kmer;
+    tax_id_t tax_id;
+};
+
+// kmers of kmer len 20 repeated with tax ids of all levels
+static std::vector<Added> random_added(size_t count, uint64_t seed)
+{
+    std::mt19937_64 rnd(seed);
+    std::vector<hash_t> kmers(count / 4);
+    for (auto &k : kmers)
+        k = rnd() >> (64 - 40);
+
+    std::vector<Added> added(count);
+    for (auto &a : added)
+        a = Added{kmers[rnd() % kmers.size()], tax_id_t(2 + rnd() % 14)};
+    return added;
+}
+
+static std::vector<DBS::KmerTax> expected_kmers(const TaxIdTree &tree, const std::vector<Added> &added)
+{
+    Kmers kmers(tree);
+    for (auto &a : added)
+        kmers.add_kmer(a.kmer, a.tax_id);
+
+    std::vector<DBS::KmerTax> expected;
+    for (auto &k : kmers.storage)
+        if (k.second != TaxIdTree::ROOT)
+            expected.emplace_back(k.first, k.second);
+    std::sort(expected.begin(), expected.end(), [](const DBS::KmerTax &a, const DBS::KmerTax &b) { return a.kmer < b.kmer; });
+    return expected;
+}
+
+template <class Add>
+static void add_concurrently(const std::vector<Added> &added, int threads, Add &&add)
+{
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+        workers.emplace_back([&, t] {
+            for (size_t i = t; i < added.size(); i += threads)
+                add(added[i].kmer, added[i].tax_id);
+        });
+    for (auto &w : workers)
+        w.join();
+}
+
+static void check_equal(const std::vector<DBS::KmerTax> &kmers, const std::vector<DBS::KmerTax> &expected)
+{
+    ASSERT_EQUALS(kmers.size(), expected.size());
+    for (size_t i = 0; i < kmers.size(); i++)
+    {
+        ASSERT_EQUALS(kmers[i].kmer, expected[i].kmer);
+        ASSERT_EQUALS(kmers[i].tax_id, expected[i].tax_id);
+    }
+}
+
+TEST(kmer_tax_table_consensus) {
+    TaxIdTree tree;
+    build_tree(tree);
+    ASSERT_EQUALS(tree.consensus_of(8, 9), 4);
+    ASSERT_EQUALS(tree.consensus_of(8, 11), 2);
+    ASSERT_EQUALS(tree.consensus_of(8, 15), 1);
+
+    for (int threads : {1, 4})
+    {
+        auto added = random_added(100000, threads);
+        KmerTaxTable table(tree); // grows from the minimal size while threads add
+        add_concurrently(added, threads, [&](hash_t kmer, tax_id_t tax_id) { table.add_kmer(kmer, tax_id); });
+
+        Kmers kmers(tree);
+        for (auto &a : added)
+            kmers.add_kmer(a.kmer, a.tax_id);
+        ASSERT_EQUALS(table.size(), kmers.storage.size());
+        for (auto &k : kmers.storage)
+            ASSERT_EQUALS(table.find(k.first), k.second);
+        ASSERT_EQUALS(table.find(hash_t(1) << 50), 0);
+    }
+}
+
+TEST(kmer_tax_builder_shards) {
+    TaxIdTree tree;
+    build_tree(tree);
+    auto added = random_added(50000, 7);
+    auto expected = expected_kmers(tree, added);
+
+    const std::string spill_folder = "./kmer_tax_table_spill";
+    mkdir(spill_folder.c_str(), 0755);
+
+    for (bool spill : {false, true})
+    {
+        KmerTaxBuilder builder(tree, 20, spill ? spill_folder : "", 6);
+        ASSERT_EQUALS(builder.shard_count(), 64);
+        add_concurrently(added, 3, [&](hash_t kmer, tax_id_t tax_id) { builder.add_kmer(kmer, tax_id); });
+
+        std::vector<DBS::KmerTax> kmers;
+        size_t shards = 0;
+        builder.write_shards(2, [&](const std::vector<DBS::KmerTax> &shard) {
+            kmers.insert(kmers.end(), shard.begin(), shard.end());
+            shards++;
+        });
+        ASSERT_EQUALS(shards, 64);
+        check_equal(kmers, expected);
+    }
+
+    ASSERT_EQUALS(rmdir(spill_folder.c_str()), 0); // spill files are removed once written
+}
+
+TEST(dbs_writer_and_dbss) {
+    TaxIdTree tree;
+    build_tree(tree);
+    auto expected = expected_kmers(tree, random_added(20000, 3));
+
+    const std::string dbs = "./kmer_tax_table_test.dbs", dbss = "./kmer_tax_table_test.dbss";
+    {
+        DBSIO::DBSWriter<DBS::KmerTax> writer(dbs, 20);
+        for (size_t from = 0; from < expected.size(); from += 1000)
+            writer.append(std::vector<DBS::KmerTax>(expected.begin() + from, expected.begin() + std::min(expected.size(), from + 1000)));
+        writer.append(std::vector<DBS::KmerTax>());
+        writer.close();
+    }
+
+    std::vector<DBS::KmerTax> loaded;
+    ASSERT_EQUALS(DBSIO::load_dbs(dbs, loaded), 20);
+    check_equal(loaded, expected);
+
+    DBSS::save_dbss_from_dbs(dbs, dbss);
+
+    // same as sorting by tax then kmer
+    auto by_tax = expected;
+    std::sort(by_tax.begin(), by_tax.end(), [](const DBS::KmerTax &a, const DBS::KmerTax &b) { return a.tax_id == b.tax_id ? a.kmer < b.kmer : a.tax_id < b.tax_id; });
+    std::vector<hash_t> hashes;
+    ASSERT_EQUALS(DBSIO::load_dbs(dbss, hashes), 20);
+    ASSERT_EQUALS(hashes.size(), by_tax.size());
+    for (size_t i = 0; i < hashes.size(); i++)
+        ASSERT_EQUALS(hashes[i], by_tax[i].kmer);
+
+    DBSS::DBSAnnotation annotation;
+    DBSS::load_dbs_annotation(DBSS::DBSAnnot::annotation_filename(dbss), annotation);
+    size_t at = 0;
+    for (auto &a : annotation)
+    {
+        ASSERT_EQUALS(by_tax[at].tax_id, a.tax_id);
+        at += a.count;
+    }
+    ASSERT_EQUALS(at, by_tax.size());
+
+    std::remove(dbs.c_str());
+    std::remove(dbss.c_str());
+    std::remove(DBSS::DBSAnnot::annotation_filename(dbss).c_str());
+}
+
+TEST(dbs_writer_write_failure) {
+    // /dev/full accepts the open but fails every write, a short .dbs must not pass as written
+    bool failed = false;
+    try
+    {
+        DBSIO::DBSWriter<DBS::KmerTax> writer("/dev/full", 20);
+        writer.append(std::vector<DBS::KmerTax>(10));
+        writer.close();
+    }
+    catch (std::runtime_error &) { failed = true; }
+    ASSERT(failed);
+}
+
+TEST_MAIN();
@@ -0,0 +1,156 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include <random>
+#include <thread>
+
+#include "tests.h"
+#include "ordered_pipeline.h"
+
+struct TestSlot
+{
+    int input = -1, output = -1;
+};
+
+TEST(mpmc_queue) {
+    MPMCQueue<int> queue(5); // rounded up to 8
+    int x = 0;
+    ASSERT(!queue.try_pop(x));
+    for (int i = 0; i < 8; i++)
+        ASSERT(queue.try_push(i));
+    ASSERT(!queue.try_push(8));
+    ASSERT_EQUALS(queue.size(), size_t(8));
+    for (int i = 0; i < 8; i++) {
+        ASSERT(queue.try_pop(x));
+        ASSERT_EQUALS(x, i);
+    }
+    ASSERT(!queue.try_pop(x));
+}
+
+TEST(ordered_pipeline_keeps_order) {
+    for (int workers : {1, 2, 5}) {
+        const int count = 1000;
+        OrderedPipeline<TestSlot> pipeline(workers);
+        int next_input = 0;
+        std::vector<int> written;
+        pipeline.run(
+            [&](TestSlot &slot) { slot.input = next_input++; return next_input < count; },
+            [&](TestSlot &slot) {
+                std::mt19937 rnd(slot.input);
+                std::this_thread::sleep_for(std::chrono::microseconds(rnd() % 200)); // workers finish out of order
+                slot.output = slot.input * 2;
+            },
+            [&](TestSlot &slot) { written.push_back(slot.output); });
+
+        ASSERT_EQUALS(written.size(), size_t(count));
+        for (int i = 0; i < count; i++)
+            ASSERT_EQUALS(written[i], i * 2);
+        ASSERT_EQUALS(pipeline.stats.reader.items, size_t(count));
+        ASSERT_EQUALS(pipeline.stats.writer.items, size_t(count));
+        ASSERT_EQUALS(pipeline.stats.workers.size(), size_t(workers));
+    }
+}
+
+TEST(ordered_pipeline_rethrows) {
+    for (int failing_stage = 0; failing_stage < 3; failing_stage++) {
+        OrderedPipeline<TestSlot> pipeline(3);
+        int next_input = 0;
+        bool thrown = false;
+        try {
+            pipeline.run(
+                [&](TestSlot &slot) {
+                    if (failing_stage == 0 && next_input == 50)
+                        throw std::runtime_error("reader");
+                    slot.input = next_input++;
+                    return true; // endless input, only the exception stops it
+                },
+                [&](TestSlot &slot) {
+                    if (failing_stage == 1 && slot.input == 50)
+                        throw std::runtime_error("worker");
+                },
+                [&](TestSlot &slot) {
+                    if (failing_stage == 2 && slot.input == 50)
+                        throw std::runtime_error("writer");
+                });
+        } catch (std::runtime_error &e) {
+            thrown = true;
+            ASSERT_EQUALS(string(e.what()), string(failing_stage == 0 ? "reader" : failing_stage == 1 ? "worker" : "writer"));
+        }
+        ASSERT(thrown);
+    }
+}
+
+TEST(ordered_pipelines_share_worker_pool) {
+    WorkerPool pool(3);
+    const int pipelines = 4, count = 500;
+    std::vector<std::vector<int>> written(pipelines);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < pipelines; p++)
+        threads.emplace_back([&, p] {
+            OrderedPipeline<TestSlot> pipeline(1, 2, &pool);
+            int next_input = 0;
+            pipeline.run(
+                [&](TestSlot &slot) { slot.input = next_input++; return next_input < count; },
+                [&](TestSlot &slot) {
+                    std::mt19937 rnd(slot.input + p);
+                    std::this_thread::sleep_for(std::chrono::microseconds(rnd() % 100));
+                    slot.output = slot.input * 2 + p;
+                },
+                [&](TestSlot &slot) { written[p].push_back(slot.output); });
+            ASSERT_EQUALS(pipeline.stats.workers.size(), size_t(3));
+        });
+
+    for (auto &t : threads)
+        t.join();
+
+    for (int p = 0; p < pipelines; p++) {
+        ASSERT_EQUALS(written[p].size(), size_t(count));
+        for (int i = 0; i < count; i++)
+            ASSERT_EQUALS(written[p][i], i * 2 + p);
+    }
+}
+
+TEST(ordered_pipeline_with_pool_rethrows) {
+    WorkerPool pool(2);
+    OrderedPipeline<TestSlot> pipeline(1, 2, &pool);
+    int next_input = 0;
+    bool thrown = false;
+    try {
+        pipeline.run(
+            [&](TestSlot &slot) { slot.input = next_input++; return true; },
+            [&](TestSlot &slot) {
+                if (slot.input == 50)
+                    throw std::runtime_error("worker");
+            },
+            [&](TestSlot &) {});
+    } catch (std::runtime_error &e) {
+        thrown = true;
+        ASSERT_EQUALS(string(e.what()), string("worker"));
+    }
+    ASSERT(thrown);
+}
+
+TEST_MAIN();
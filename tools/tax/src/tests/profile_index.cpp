@@ -0,0 +1,231 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <unistd.h>
+#include <utime.h>
+
+#include "tests.h"
+#include "profile_index.h"
+
+using namespace std::chrono;
+
+typedef std::vector<ProfileIndex::kmer_t> Sketch;
+
+static void save_profile(const std::string &filename, const Sketch &kmers)
+{
+    std::ofstream f(filename, std::ios::out | std::ios::binary);
+    IO::save_vector(f, kmers);
+}
+
+// sketches of related genomes share positions: every position of the cluster sketch is kept with the given probability
+static Sketch mutated(const Sketch &base, double keep, std::mt19937_64 &rnd)
+{
+    Sketch x = base;
+    for (auto &kmer : x)
+        if (std::uniform_real_distribution<double>(0, 1)(rnd) > keep)
+            kmer = rnd();
+    return x;
+}
+
+struct TestProfiles
+{
+    std::vector<std::string> files;
+    std::vector<Sketch> sketches;
+    std::vector<Sketch> clusters;
+
+    TestProfiles(size_t count, size_t sketch_len, size_t cluster_count, std::mt19937_64 &rnd, bool save = true)
+    {
+        for (size_t c = 0; c < cluster_count; c++)
+        {
+            clusters.emplace_back(sketch_len);
+            for (auto &kmer : clusters.back())
+                kmer = rnd();
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            sketches.push_back(mutated(clusters[rnd() % cluster_count], std::uniform_real_distribution<double>(0.05, 0.98)(rnd), rnd));
+            files.push_back("./profile_index_test_" + std::to_string(i) + ".profile");
+            if (save)
+                save_profile(files.back(), sketches.back());
+        }
+    }
+
+    void remove() const
+    {
+        for (auto &file : files)
+            std::remove(file.c_str());
+    }
+};
+
+static std::vector<ProfileIndex::Match> closest_naive(const std::vector<Sketch> &sketches, const Sketch &query, size_t top_count)
+{
+    std::vector<ProfileIndex::Match> matches;
+    for (size_t i = 0; i < sketches.size(); i++)
+    {
+        size_t equal = 0;
+        for (size_t k = 0; k < query.size(); k++)
+            equal += sketches[i][k] == query[k];
+        matches.emplace_back(i, equal);
+    }
+    return ProfileIndex::top(matches, top_count);
+}
+
+TEST(equal_count_matches_scalar) {
+    std::mt19937_64 rnd(1);
+    for (size_t len = 1; len < 40; len++)
+    {
+        Sketch a(len), b(len);
+        size_t expected = 0;
+        for (size_t i = 0; i < len; i++)
+        {
+            a[i] = rnd() % 3;
+            b[i] = rnd() % 3;
+            expected += a[i] == b[i];
+        }
+        ASSERT_EQUALS(ProfileIndex::equal_count(a.data(), b.data(), len), expected);
+    }
+}
+
+TEST(profile_index_matches_linear_scan) {
+    std::mt19937_64 rnd(2);
+    const size_t sketch_len = 101; // not a multiple of rows
+    TestProfiles profiles(1500, sketch_len, 40, rnd);
+    const std::string list = "./profile_index_test.list", index_file = "./profile_index_test.pidx";
+    std::ofstream(list) << "0\tx\n";
+
+    for (int rows : {1, 4, 8})
+    {
+        ProfileIndex::build(index_file, profiles.files, ProfileIndex::source_of(list, profiles.files), rows);
+        ProfileIndex index;
+        ASSERT(index.open(index_file, ProfileIndex::source_of(list, profiles.files)));
+        ASSERT_EQUALS(index.size(), profiles.files.size());
+        ASSERT(index.names == profiles.files);
+
+        size_t scanned = 0, proven = 0;
+        for (int q = 0; q < 300; q++)
+        {
+            // close, distant and unrelated queries
+            Sketch query = q % 10 == 0 ? mutated(profiles.clusters[0], 0, rnd) : mutated(profiles.clusters[rnd() % profiles.clusters.size()], std::uniform_real_distribution<double>(0.1, 1.0)(rnd), rnd);
+            for (size_t top_count : {1, 5, 2000})
+            {
+                ProfileIndex::QueryStats stats;
+                auto result = index.closest(query, top_count, &stats);
+                auto expected = closest_naive(profiles.sketches, query, top_count);
+                ASSERT_EQUALS(result.size(), expected.size());
+                for (size_t i = 0; i < result.size(); i++)
+                {
+                    ASSERT_EQUALS(result[i].profile, expected[i].profile);
+                    ASSERT_EQUALS(result[i].equal, expected[i].equal);
+                }
+
+                scanned += stats.scanned;
+                proven += !stats.scanned;
+            }
+        }
+
+        ASSERT(proven > 0);
+        ASSERT(rows == 1 ? scanned == 0 : scanned > 0); // single row bands always prove the result
+    }
+
+    // an index of another version of a profile is not used
+    {
+        ProfileIndex index;
+        ASSERT(index.open(index_file, ProfileIndex::source_of(list, profiles.files)));
+        utimbuf times = { 12345, 12345 };
+        ASSERT_EQUALS(utime(profiles.files[3].c_str(), &times), 0);
+        ASSERT(!index.open(index_file, ProfileIndex::source_of(list, profiles.files)));
+    }
+
+    // nor of another version of the files list
+    ProfileIndex::build(index_file, profiles.files, ProfileIndex::source_of(list, profiles.files));
+    std::ofstream(list) << "0\tx\n0\ty\n";
+    ProfileIndex index;
+    ASSERT(!index.open(index_file, ProfileIndex::source_of(list, profiles.files)));
+
+    bool failed = false;
+    save_profile(profiles.files[7], Sketch(sketch_len + 1));
+    try { ProfileIndex::build(index_file, profiles.files, ProfileIndex::source_of(list, profiles.files)); } catch (std::runtime_error &) { failed = true; }
+    ASSERT(failed);
+
+    profiles.remove();
+    std::remove(list.c_str());
+    std::remove(index_file.c_str());
+}
+
+// run explicitly as "profile_index bench_profile_index"
+DISABLED_TEST(bench_profile_index) {
+    std::mt19937_64 rnd(3);
+    const size_t count = 100000, sketch_len = 256, queries = 1000;
+    TestProfiles profiles(count, sketch_len, 5000, rnd, false);
+
+    auto before = high_resolution_clock::now();
+    size_t sum = 0;
+    for (size_t q = 0; q < 20; q++)
+        sum += closest_naive(profiles.sketches, mutated(profiles.clusters[q], 0.8, rnd), 10)[0].equal;
+    const double naive_sec = duration_cast<duration<double>>(high_resolution_clock::now() - before).count() / 20;
+    std::cerr << "scalar linear scan " << naive_sec * 1000 << " ms/query (" << sum % 10 << ")" << std::endl;
+
+    for (size_t i = 0; i < count; i++)
+        save_profile(profiles.files[i], profiles.sketches[i]);
+
+    const std::string list = "./profile_index_test.list", index_file = "./profile_index_test.pidx";
+    std::ofstream(list) << "0\tx\n";
+    for (int rows : {1, 2, 4})
+    {
+        before = high_resolution_clock::now();
+        ProfileIndex::build(index_file, profiles.files, ProfileIndex::source_of(list, profiles.files), rows);
+        const double build_sec = duration_cast<duration<double>>(high_resolution_clock::now() - before).count();
+        ProfileIndex index;
+        index.open(index_file, ProfileIndex::source_of(list, profiles.files));
+
+        for (double keep : {0.9, 0.5})
+        {
+            size_t scanned = 0, candidates = 0;
+            before = high_resolution_clock::now();
+            for (size_t q = 0; q < queries; q++)
+            {
+                ProfileIndex::QueryStats stats;
+                sum += index.closest(mutated(profiles.clusters[rnd() % profiles.clusters.size()], keep, rnd), 10, &stats)[0].equal;
+                scanned += stats.scanned;
+                candidates += stats.candidates;
+            }
+            const double sec = duration_cast<duration<double>>(high_resolution_clock::now() - before).count() / queries;
+            std::cerr << "rows " << rows << " (built in " << build_sec << "s), queries sharing " << keep << " of a cluster: " << sec * 1000 << " ms/query, "
+                << candidates / queries << " candidates, " << scanned << " of " << queries << " scanned, " << int(naive_sec / sec) << "x" << std::endl;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+        std::remove(profiles.files[i].c_str());
+    std::remove(list.c_str());
+    std::remove(index_file.c_str());
+}
+
+TEST_MAIN();
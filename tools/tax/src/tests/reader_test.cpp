@@ -29,6 +29,8 @@
 #include "tests.h"
 
 #include "fasta_reader.h"
+#include "fastx_reader.h"
+#include "compressed_input.h"
 #include "mt_reader.h"
 #include "aux_reader.h"
 
@@ -54,16 +56,6 @@ public:
     }
 };
 
-struct FragmentSort {
-    bool operator() (const Reader::Fragment& f1, const Reader::Fragment& f2) const {
-        if (f1.spotid != f2.spotid) {
-            return f1.spotid < f2.spotid;
-        } else {
-            return f1.bases < f2.bases;
-        }
-    }
-};
-
 template <typename ReaderPtr>
 static std::vector<Reader::Fragment> read_all(ReaderPtr reader) {
     std::vector<Reader::Fragment> result;
@@ -131,24 +123,275 @@ TEST(fasta_reader) {
     ASSERT(_unix == dos);
 }
 
-#if 0
-template <typename ReaderType>
-void test_mt_reader(const char* type, const char* path) {
-    auto reference = Helper<ReaderType>::read_all(path);
-    std::sort(reference.begin(), reference.end(), FragmentSort());
-    for (int thread_count = 1; thread_count <= 16; thread_count <<= 2) {
+static void write_file(const std::string &filename, const std::string &content) {
+    std::ofstream f(filename, std::ios::binary);
+    f << content;
+}
+
+TEST(fastx_reader_fasta) {
+    const char* paths[] = {"./tests/data/SRR1068106.fasta", "./tests/data/SRR1068106.fasta.dos", "./tests/data/multiline_reads.fasta", "./tests/data/one_line_reads.fasta"};
+    for (auto path : paths) {
+        auto expected = Helper<FastaReader>::read_all(path);
+        for (size_t block_size : {size_t(1), size_t(7), size_t(1000), size_t(FastxReader::BLOCK_SIZE)}) {
+            for (int thread_count : {1, 3}) {
+                FastxReader reader(path, false, thread_count, block_size);
+                ASSERT(reader.file_format() == FastxReader::FORMAT_FASTA);
+                ASSERT(::read_all(&reader) == expected);
+            }
+        }
+
+        FastaReader fasta_reader(path);
+        ::read_all(&fasta_reader);
+        FastxReader reader(path);
+        std::vector<Reader::Fragment> chunk, chunked;
+        while (reader.read_many(chunk, 5)) {
+            ASSERT(chunk.size() <= 5);
+            chunked.insert(chunked.end(), chunk.begin(), chunk.end());
+        }
+        ASSERT(chunked == expected);
+        ASSERT(reader.stats() == fasta_reader.stats());
+    }
+}
+
+TEST(fastx_reader_fastq) {
+    const std::string path = "./tests/data/fastx_reader_test.fastq";
+    write_file(path,
+        "@SRR1.1 1 length=8\n"
+        "ACGTACGT\n"
+        "+SRR1.1 1 length=8\n"
+        "IIII#III\n"
+        "@SRR1.1/2\r\n"
+        "TTGCA\r\n"
+        "+\r\n"
+        "!IIII\r\n"
+        "\n"
+        "@SRR1.2\n"
+        "GGGG\n"
+        "+\n"
+        "IIII");
+
+    for (size_t block_size = 1; block_size < 100; block_size++) { // records end at block ends too
+        auto fragments = Helper<FastxReader>::read_all(path, false, 2, block_size);
+        ASSERT_EQUALS(fragments.size(), 3);
+        ASSERT_EQUALS(fragments[0].spotid, "SRR1.1");
+        ASSERT_EQUALS(fragments[0].bases, "ACGTACGT");
+        ASSERT_EQUALS(fragments[1].spotid, "SRR1.1");
+        ASSERT_EQUALS(fragments[1].bases, "TTGCA");
+        ASSERT_EQUALS(fragments[2].spotid, "SRR1.2");
+        ASSERT_EQUALS(fragments[2].bases, "GGGG");
+
+        auto masked = Helper<FastxReader>::read_all_bases(path, true, 1, block_size);
+        ASSERT_EQUALS(masked.size(), 3);
+        ASSERT_EQUALS(masked[0], "ACGTNCGT");
+        ASSERT_EQUALS(masked[1], "NTGCA");
+        ASSERT_EQUALS(masked[2], "GGGG");
+    }
+
+    FastxReader reader(path);
+    ASSERT(reader.file_format() == FastxReader::FORMAT_FASTQ);
+    ::read_all(&reader);
+    ASSERT(reader.stats() == Reader::SourceStats(2, 3));
+
+    write_file(path, "@SRR1.1\nACGT\nIIII\n");
+    bool thrown = false;
+    try {
+        Helper<FastxReader>::read_all(path);
+    } catch (std::runtime_error&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    std::remove(path.c_str());
+}
+
+static std::string read_file(const std::string &filename) {
+    std::ifstream f(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+// windowBits -15 gives raw deflate data, 15 + 16 a gzip member
+static std::string deflate_data(const std::string &data, int window_bits) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    ASSERT(deflateInit2(&stream, 6, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+    std::string out(deflateBound(&stream, data.size()) + 32, 0);
+    stream.next_in = (Bytef*)data.data();
+    stream.avail_in = data.size();
+    stream.next_out = (Bytef*)&out[0];
+    stream.avail_out = out.size();
+    ASSERT(deflate(&stream, Z_FINISH) == Z_STREAM_END);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return out;
+}
+
+static void append_le(std::string &s, uint32_t x, int bytes) {
+    for (int i = 0; i < bytes; i++)
+        s += char((x >> (8 * i)) & 0xff);
+}
+
+static std::string bgzf_block(const std::string &block) {
+    std::string out("\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0", 16);
+    auto compressed = deflate_data(block, -15);
+    append_le(out, uint32_t(compressed.size() + 25), 2);
+    out += compressed;
+    append_le(out, crc32(crc32(0, Z_NULL, 0), (const Bytef*)block.data(), block.size()), 4);
+    append_le(out, block.size(), 4);
+    return out;
+}
+
+// same layout as bgzip: blocks of up to 64KB ending with an empty block as eof marker
+static std::string bgzf_data(const std::string &data, size_t block_size) {
+    std::string out;
+    for (size_t pos = 0; pos < data.size(); pos += block_size)
+        out += bgzf_block(data.substr(pos, block_size));
+    return out + bgzf_block("");
+}
+
+static std::string read_input(InputStream &input, size_t read_size) {
+    std::vector<char> buffer(read_size);
+    std::string data;
+    size_t bytes = 0;
+    while ((bytes = input.read(buffer.data(), buffer.size())) > 0) {
+        data.append(buffer.data(), bytes);
+        ASSERT(input.progress() >= 0 && input.progress() <= 1);
+    }
+    return data;
+}
+
+TEST(compressed_input) {
+    const std::string fasta = "./tests/data/SRR1068106.fasta";
+    const std::string path = "./tests/data/compressed_input_test.fasta.gz";
+    const auto data = read_file(fasta);
+    const auto expected = Helper<FastaReader>::read_all(fasta);
+    ASSERT(FastxReader::is_fastx(path));
+    ASSERT(FastxReader::is_fastq("reads.fq.zst"));
+
+    std::vector<std::string> compressed = {
+        deflate_data(data, 15 + 16), // gzip
+        deflate_data(data.substr(0, 1000), 15 + 16) + deflate_data(data.substr(1000), 15 + 16), // concatenated gzip members
+        bgzf_data(data, 65280),
+        bgzf_data(data, 1000)
+    };
+
+    for (auto &file : compressed) {
+        write_file(path, file);
+        for (int thread_count : {1, 4}) {
+            for (size_t read_size : {size_t(1), size_t(777), size_t(1 << 20)}) {
+                auto input = InputStream::open(path, thread_count);
+                ASSERT(read_input(*input, read_size) == data);
+                ASSERT_EQUALS(input->progress(), 1);
+            }
+            ASSERT(Helper<FastxReader>::read_all(path, false, thread_count) == expected);
+        }
+
+        write_file(path, file.substr(0, file.size() / 2)); // truncated input
+        bool thrown = false;
+        try {
+            Helper<FastxReader>::read_all(path);
+        } catch (std::runtime_error&) {
+            thrown = true;
+        }
+        ASSERT(thrown);
+    }
+
+#if HAVE_ZSTD
+    std::string frames; // multi-frame zstd like pzstd or zstd --split output
+    for (size_t pos = 0; pos < data.size(); pos += 3000) {
+        auto chunk = data.substr(pos, 3000);
+        std::string frame(ZSTD_compressBound(chunk.size()), 0);
+        frame.resize(ZSTD_compress(&frame[0], frame.size(), chunk.data(), chunk.size(), 3));
+        frames += frame;
+    }
+    std::string single_frame(ZSTD_compressBound(data.size()), 0);
+    single_frame.resize(ZSTD_compress(&single_frame[0], single_frame.size(), data.data(), data.size(), 3));
+
+    for (auto &file : {frames, single_frame}) {
+        write_file(path, file);
+        ASSERT(Helper<FastxReader>::read_all(path, false, 3) == expected);
+        for (size_t max_raw_size : {size_t(64), size_t(5000), size_t(BlockInput::MAX_RAW_SIZE)}) { // small sizes make frames oversized
+            ZstdInput input(std::unique_ptr<FileInput>(new FileInput(path)), 2, max_raw_size);
+            ASSERT(read_input(input, 4096) == data);
+        }
+    }
+#endif
+    std::remove(path.c_str());
+}
+
+TEST(bgzf_small_files) {
+    const std::string path = "./tests/data/bgzf_small_test.fasta.gz";
+    const std::string fasta = ">SRR1.1\nACGT\n>SRR1.2\nGGCC\n";
+    for (auto &data : {fasta, std::string()}) { // one block and the eof marker, the eof marker only
+        write_file(path, bgzf_data(data, 65280));
+        for (int thread_count : {1, 4}) {
+            auto input = InputStream::open(path, thread_count);
+            ASSERT(read_input(*input, 4096) == data);
+        }
+    }
+
+    write_file(path, bgzf_data(fasta, fasta.size() / 2)); // data ends at a block boundary
+    auto fragments = Helper<FastxReader>::read_all(path);
+    ASSERT_EQUALS(fragments.size(), 2);
+    ASSERT_EQUALS(fragments[1].bases, "GGCC");
+    std::remove(path.c_str());
+}
+
+template <typename ReaderType, typename ...Args>
+void test_mt_reader(const char* type, Args... args) {
+    auto reference = Helper<ReaderType>::read_all(args...);
+    for (size_t queue_size = 1; queue_size <= 4; queue_size <<= 1) {
         for (size_t chunk_size = 1; chunk_size <= 256; chunk_size <<= 2) {
-            std::cout << "checking mt " << type << " reader with thread_count=" << thread_count << " chunk_size=" << chunk_size << " on path=" << path << std::endl;
-            auto result = Helper<MTReader<ReaderType> >::read_all(thread_count, chunk_size, path);
-            std::sort(result.begin(), result.end(), FragmentSort());
-            ASSERT(reference == result);
+            std::cout << "checking mt " << type << " reader with queue_size=" << queue_size << " chunk_size=" << chunk_size << std::endl;
+            auto result = Helper<MTReader<ReaderType> >::read_all(queue_size, chunk_size, args...);
+            ASSERT(reference == result); // same order as the wrapped reader
+
+            // chunks are swapped out as is or read fragment by fragment when sizes differ, stats come from the wrapped reader
+            for (size_t requested_size: { chunk_size, chunk_size + 3 }) {
+                ReaderType single_reader(args...);
+                MTReader<ReaderType> reader(queue_size, chunk_size, args...);
+                std::vector<Reader::Fragment> chunk, expected;
+                std::vector<Reader::Fragment> chunked;
+                while (reader.read_many(chunk, requested_size)) {
+                    ASSERT(single_reader.read_many(expected, requested_size));
+                    ASSERT(chunk == expected);
+                    ASSERT(reader.progress() >= 0 && reader.progress() <= 1);
+                    chunked.insert(chunked.end(), chunk.begin(), chunk.end());
+                }
+                ASSERT(!single_reader.read_many(expected, requested_size));
+                ASSERT(chunked == reference);
+                ASSERT_EQUALS(reader.progress(), 1);
+                ASSERT(reader.stats() == single_reader.stats());
+            }
         }
     }
 }
+
 TEST(mt_reader) {
     test_mt_reader<FastaReader>("fasta", "./tests/data/SRR1068106.fasta");
+    test_mt_reader<SplittingReader<FastxReader>>("splitting fastx", "./tests/data/SRR1068106.fasta", false, 2, size_t(1000));
+
+    { // reader is stopped without reading till the end
+        MTReader<FastaReader> reader(2, 1, "./tests/data/SRR1068106.fasta");
+        Reader::Fragment f;
+        ASSERT(reader.read(&f));
+        ASSERT_EQUALS(f.spotid, "SRR1068106.1");
+    }
+
+    // errors come after all the chunks before them
+    const std::string path = "./tests/data/mt_reader_test.fastq";
+    write_file(path, "@SRR1.1\nACGT\n+\nIIII\n@SRR1.2\nACGT\nIIII\n");
+    MTReader<FastxReader> reader(2, 1, path, false, 1, size_t(1));
+    Reader::Fragment f;
+    bool thrown = false;
+    try {
+        ASSERT(reader.read(&f));
+        ASSERT_EQUALS(f.spotid, "SRR1.1");
+        reader.read(&f);
+    } catch (std::runtime_error&) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    std::remove(path.c_str());
 }
-#endif
 
 TEST(splitting_cutting_reader) {
     std::vector<std::string> source = {"ATGC",
@@ -0,0 +1,199 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include <random>
+#include <cstdlib>
+#include <list>
+
+#include "tests.h"
+#include "seq_cleaner.h"
+#include "seq_encoder.h"
+
+static string random_seq(std::mt19937 &rnd, size_t len, int bad_per_1000)
+{
+    const char good[] = "ACGT";
+    const char bad[] = "NnacgtRY-.\n\t";
+    string s(len, 'A');
+    for (auto &c : s)
+        c = (int(rnd() % 1000) < bad_per_1000) ? bad[rnd() % (sizeof(bad) - 1)] : good[rnd() % 4];
+
+    return s;
+}
+
+TEST(seq_encoder_kernels) {
+    std::mt19937 rnd(1);
+    for (size_t len = 0; len < 300; len++) {
+        auto s = random_seq(rnd, len, 100);
+        vector<uint8_t> expected(len), codes(len);
+        for (size_t i = 0; i < len; i++) {
+            expected[i] = SeqEncoder::encode_base(s[i]);
+            ASSERT_EQUALS(uint64_t(expected[i] & SeqEncoder::CODE_MASK), Hash<uint64_t>::update_hash(s[i], 0));
+        }
+
+        size_t first_invalid = std::find_if(expected.begin(), expected.end(), [](uint8_t code) { return code & SeqEncoder::INVALID; }) - expected.begin();
+        ASSERT_EQUALS(SeqEncoder::find_invalid(s.data(), len), first_invalid);
+        size_t half_first_invalid = std::min(first_invalid, len / 2);
+        ASSERT_EQUALS(SeqEncoder::find_invalid(s.data(), len / 2), half_first_invalid);
+
+        SeqEncoder::encode_scalar(s.data(), len, codes.data());
+        ASSERT(codes == expected);
+        SeqEncoder::encode(s.data(), len, codes.data());
+        ASSERT(codes == expected);
+#if SEQ_ENCODER_X86
+        SeqEncoder::encode_sse2(s.data(), len, codes.data());
+        ASSERT(codes == expected);
+        if (__builtin_cpu_supports("avx2")) {
+            SeqEncoder::encode_avx2(s.data(), len, codes.data());
+            ASSERT(codes == expected);
+        }
+#endif
+    }
+}
+
+template <class hash_t>
+static void check_against_hash(const string &s, int kmer_len)
+{
+    KmerStreams<hash_t> streams;
+    streams.build(s, kmer_len, false);
+
+    size_t i = 0;
+    Hash<hash_t>::for_all_hashes_do(s, kmer_len, [&](hash_t hash) {
+        ASSERT(i < streams.size());
+        ASSERT_EQUALS(streams.positions[i], int(i));
+        ASSERT(streams.forward[i] == hash);
+        ASSERT(streams.rev_complement[i] == seq_transform<hash_t>::to_rev_complement(hash, kmer_len));
+        ASSERT(streams.canonical[i] == seq_transform<hash_t>::min_hash_variant(hash, kmer_len));
+        i++;
+        return true;
+    });
+    ASSERT_EQUALS(i, streams.size());
+}
+
+template <class hash_t>
+static void check_against_seq_cleaner(const string &s, int kmer_len)
+{
+    KmerStreams<hash_t> streams;
+    streams.build(s, kmer_len, true);
+
+    size_t i = 0;
+    SeqCleaner cleaner(s);
+    for (auto &clean_string : cleaner.clean_strings) {
+        const int offset = int(clean_string.s - s.data());
+        int pos = 0;
+        Hash<hash_t>::for_all_hashes_do(clean_string, kmer_len, [&](hash_t hash) {
+            ASSERT(i < streams.size());
+            ASSERT_EQUALS(streams.positions[i], offset + pos);
+            ASSERT(streams.forward[i] == hash);
+            ASSERT(streams.canonical[i] == seq_transform<hash_t>::min_hash_variant(hash, kmer_len));
+            i++;
+            pos++;
+            return true;
+        });
+    }
+    ASSERT_EQUALS(i, streams.size());
+}
+
+TEST(kmer_stream_equivalence) {
+    std::mt19937 rnd(2);
+    for (int kmer_len : {1, 2, 5, 16, 25, 31, 32}) {
+        for (int iter = 0; iter < 200; iter++) {
+            auto s = random_seq(rnd, rnd() % 400, iter % 2 ? 0 : 20);
+            check_against_hash<uint64_t>(s, kmer_len);
+            check_against_seq_cleaner<uint64_t>(s, kmer_len);
+        }
+    }
+
+    for (int kmer_len : {33, 50, 64}) {
+        for (int iter = 0; iter < 50; iter++) {
+            auto s = random_seq(rnd, rnd() % 400, iter % 2 ? 0 : 5);
+            check_against_hash<__uint128_t>(s, kmer_len);
+            check_against_seq_cleaner<__uint128_t>(s, kmer_len);
+        }
+    }
+}
+
+// run explicitly as "seq_encoder bench_kmer_stream"
+DISABLED_TEST(bench_kmer_stream) {
+    const int kmer_len = 32;
+    std::mt19937 rnd(3);
+    vector<string> reads;
+    for (int i = 0; i < 200000; i++)
+        reads.push_back(random_seq(rnd, 150, 1));
+
+    const size_t bases = reads.size() * 150;
+    auto measure = [&](const char *name, auto &&for_read) {
+        auto before = high_resolution_clock::now();
+        uint64_t checksum = 0;
+        for (int pass = 0; pass < 10; pass++)
+            for (auto &read : reads)
+                checksum += for_read(read);
+        auto seconds = duration_cast<duration<double>>(high_resolution_clock::now() - before).count();
+        std::cerr << name << ": " << size_t(10 * bases / seconds / 1000000) << " Mbases/sec, checksum " << checksum << std::endl;
+    };
+
+    measure("Hash::for_all_hashes_do + min_hash_variant", [&](const string &read) {
+        uint64_t sum = 0;
+        Hash<uint64_t>::for_all_hashes_do(read, kmer_len, [&](uint64_t hash) {
+            sum += seq_transform<uint64_t>::min_hash_variant(hash, kmer_len);
+            return true;
+        });
+        return sum;
+    });
+
+    vector<uint8_t> codes;
+    measure("SeqEncoder + KmerStream", [&](const string &read) {
+        uint64_t sum = 0;
+        SeqEncoder::encode(read, codes);
+        KmerStream<uint64_t>::for_all_canonical_kmers_do(codes.data(), (int)codes.size(), kmer_len, false, [&](int, uint64_t hash) {
+            sum += hash;
+            return true;
+        });
+        return sum;
+    });
+
+    measure("SeqCleaner + Hash::for_all_hashes_do + min_hash_variant", [&](const string &read) {
+        uint64_t sum = 0;
+        SeqCleaner cleaner(read);
+        for (auto &clean_string : cleaner.clean_strings)
+            Hash<uint64_t>::for_all_hashes_do(clean_string, kmer_len, [&](uint64_t hash) {
+                sum += seq_transform<uint64_t>::min_hash_variant(hash, kmer_len);
+                return true;
+            });
+        return sum;
+    });
+
+    measure("SeqEncoder + KmerStream, split on N", [&](const string &read) {
+        uint64_t sum = 0;
+        SeqEncoder::encode(read, codes);
+        KmerStream<uint64_t>::for_all_canonical_kmers_do(codes.data(), (int)codes.size(), kmer_len, true, [&](int, uint64_t hash) {
+            sum += hash;
+            return true;
+        });
+        return sum;
+    });
+}
+
+TEST_MAIN();
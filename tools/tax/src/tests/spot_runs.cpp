@@ -0,0 +1,213 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include <random>
+#include <chrono>
+#include <sstream>
+#include <cstdio>
+#include <unistd.h>
+
+#include "tests.h"
+#include "spot_runs.hpp"
+
+using namespace std::chrono;
+
+typedef tc::tax_hits_options<false, true> CountsOptions;
+typedef tc::tax_hits_options<false, false> NoCountsOptions;
+typedef tc::tax_hits_options<true, false> CompactOptions;
+
+// spots in random order with repeated names, tax_id are not normalized as they come from the matcher
+template <class Options>
+static std::vector<tc::Spot<Options>> random_spots(size_t count, size_t max_id, uint64_t seed, const std::string &name_prefix = "")
+{
+    std::mt19937_64 rnd(seed);
+    std::vector<tc::Spot<Options>> spots(count);
+    for (auto &spot : spots)
+    {
+        spot.name = name_prefix + std::to_string(rnd() % max_id);
+        for (int i = 0, n = rnd() % 4; i < n; i++)
+        {
+            spot.tax_id.push_back(1 + rnd() % 30);
+            if (Options::has_counts())
+                spot.counts.push_back(1 + rnd() % 3);
+        }
+    }
+    return spots;
+}
+
+static std::string run_prefix()
+{
+    return "spot_runs_test." + std::to_string(getpid());
+}
+
+template <class Options>
+static std::string in_memory(const std::vector<tc::Spot<Options>> &spots, bool compact)
+{
+    tf::Executor executor(2);
+    tc::Tax_hits<Options> tax_hits(true);
+    for (auto &spot : spots)
+        tax_hits.add_row(spot);
+    tax_hits.finalize();
+    std::stringstream ss;
+    if (compact)
+        tax_hits.template collate<CompactOptions>(executor)->group(executor, ss);
+    else
+        tax_hits.template collate<Options>(executor)->print(executor, ss);
+    return ss.str();
+}
+
+template <class Options>
+static tc::Spot_runs<Options> make_runs(const std::vector<tc::Spot<Options>> &spots, size_t memory_limit)
+{
+    tc::Spot_runs<Options> runs(run_prefix(), memory_limit);
+    for (auto &spot : spots)
+        runs.add_row(spot);
+    runs.flush();
+    return runs;
+}
+
+template <class Options>
+static std::string from_runs(tc::Spot_runs<Options> &runs, bool compact, int num_threads = 3)
+{
+    std::stringstream ss;
+    if (compact)
+        runs.group(num_threads, ss);
+    else
+        runs.print(num_threads, ss);
+    return ss.str();
+}
+
+static std::string sorted_lines(const std::string &text)
+{
+    std::vector<std::string> lines;
+    std::stringstream ss(text);
+    for (std::string line; std::getline(ss, line); )
+        lines.push_back(line);
+    std::sort(lines.begin(), lines.end());
+    std::string s;
+    for (auto &line : lines)
+        s += line + '\n';
+    return s;
+}
+
+TEST(spot_runs_print_as_in_memory)
+{
+    for (auto memory_limit : { size_t(1) << 12, size_t(1) << 16, size_t(1) << 30 })
+        for (auto prefix : { "", "SRR01." })
+        {
+            auto spots = random_spots<CountsOptions>(30000, 8000, memory_limit, prefix);
+            auto runs = make_runs(spots, memory_limit);
+            ASSERT(memory_limit > (1 << 20) ? runs.run_files.size() == 1 : runs.run_files.size() > 10);
+            ASSERT_EQUALS(runs.integer_ids, *prefix == 0);
+            ASSERT(from_runs(runs, false) == in_memory(spots, false));
+            ASSERT(from_runs(runs, false, 1) == in_memory(spots, false));
+            runs.remove_runs();
+        }
+}
+
+TEST(spot_runs_without_counts)
+{
+    auto spots = random_spots<NoCountsOptions>(20000, 3000, 1);
+    auto runs = make_runs(spots, 1 << 14);
+    ASSERT(from_runs(runs, false) == in_memory(spots, false));
+    runs.remove_runs();
+}
+
+TEST(spot_runs_group_as_in_memory)
+{
+    for (auto memory_limit : { size_t(1) << 12, size_t(1) << 30 })
+    {
+        auto spots = random_spots<NoCountsOptions>(20000, 5000, 2);
+        auto runs = make_runs(spots, memory_limit);
+        auto grouped = from_runs(runs, true);
+        // Tax_hits::group() prints cardinalities concurrently
+        ASSERT(sorted_lines(grouped) == sorted_lines(in_memory(spots, true)));
+        ASSERT(grouped.substr(0, grouped.find('\n')).find('\t') == grouped.substr(0, grouped.find('\n')).rfind('\t'));
+        runs.remove_runs();
+    }
+}
+
+TEST(spot_runs_switch_to_names)
+{
+    auto spots = random_spots<CountsOptions>(20000, 4000, 3);
+    spots[15000].name = "007";
+    auto runs = make_runs(spots, 1 << 14);
+    ASSERT(!runs.integer_ids);
+    ASSERT(runs.run_files.size() > 10);
+    ASSERT(from_runs(runs, false) == in_memory(spots, false));
+    runs.remove_runs();
+}
+
+TEST(spot_runs_save_and_init)
+{
+    auto spots = random_spots<CountsOptions>(10000, 2000, 4);
+    auto runs = make_runs(spots, 1 << 14);
+    std::string list_file = run_prefix() + ".runs";
+    runs.save(list_file);
+
+    tc::Spot_runs<CountsOptions> loaded;
+    ASSERT(!loaded.init(list_file + ".missing"));
+    ASSERT(loaded.init(list_file));
+    ASSERT(loaded.run_files == runs.run_files);
+    ASSERT(loaded.integer_ids);
+    ASSERT(from_runs(loaded, false) == in_memory(spots, false));
+    // counts are dropped by compact mode
+    ASSERT(sorted_lines(from_runs(loaded, true)) == sorted_lines(in_memory(spots, true)));
+
+    loaded.remove_runs();
+    std::remove(list_file.c_str());
+    for (auto &file_name : runs.run_files)
+        ASSERT(access(file_name.c_str(), F_OK) != 0);
+}
+
+TEST(spot_runs_empty)
+{
+    tc::Spot_runs<CountsOptions> runs(run_prefix(), 1 << 20);
+    runs.flush();
+    ASSERT(runs.run_files.empty());
+    ASSERT(from_runs(runs, false).empty());
+    ASSERT(from_runs(runs, true).empty());
+}
+
+static double seconds_since(high_resolution_clock::time_point before)
+{
+    return duration_cast<duration<double>>(high_resolution_clock::now() - before).count();
+}
+
+DISABLED_TEST(bench_spot_runs)
+{
+    auto spots = random_spots<CountsOptions>(5 * 1000 * 1000, 2 * 1000 * 1000, 5);
+    auto before = high_resolution_clock::now();
+    auto runs = make_runs(spots, size_t(64) << 20);
+    std::cerr << runs.run_files.size() << " runs written in " << seconds_since(before) << "s" << std::endl;
+    before = high_resolution_clock::now();
+    std::stringstream ss;
+    runs.print(std::thread::hardware_concurrency(), ss);
+    std::cerr << "merged in " << seconds_since(before) << "s, " << ss.str().size() << " bytes" << std::endl;
+    runs.remove_runs();
+}
+
+TEST_MAIN();
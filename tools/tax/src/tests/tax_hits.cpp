@@ -0,0 +1,232 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include <random>
+#include <chrono>
+#include <sstream>
+#include <cstdio>
+#include <unistd.h>
+
+#include "tests.h"
+#include "tax_collator.hpp"
+
+using namespace std::chrono;
+
+typedef tc::tax_hits_options<false, true> CountsOptions;
+typedef tc::tax_hits_options<true, false> CompactOptions;
+
+// random spots with repeated names in random order, as merged from several readers
+static std::vector<tc::Spot<CountsOptions>> random_spots(size_t count, size_t max_id, uint64_t seed)
+{
+    std::mt19937_64 rnd(seed);
+    std::vector<tc::Spot<CountsOptions>> spots(count);
+    for (auto &spot : spots)
+    {
+        spot.name = std::to_string(rnd() % max_id);
+        for (int i = 0, n = 1 + rnd() % 3; i < n; i++)
+        {
+            spot.tax_id.push_back(1 + rnd() % 20);
+            spot.counts.push_back(1 + rnd() % 3);
+        }
+        spot.normalize();
+    }
+    return spots;
+}
+
+template <class Spots>
+static std::unique_ptr<tc::Tax_hits<CountsOptions>> make_tax_hits(const Spots &spots, bool integer_ids)
+{
+    auto tax_hits = std::make_unique<tc::Tax_hits<CountsOptions>>(true, integer_ids);
+    for (auto &spot : spots)
+        tax_hits->add_row(spot);
+    tax_hits->finalize();
+    return tax_hits;
+}
+
+static std::vector<std::string> collated_lines(tc::Tax_hits<CountsOptions> &tax_hits, tf::Executor &executor)
+{
+    auto collated = tax_hits.template collate<CountsOptions>(executor);
+    std::stringstream ss;
+    collated->print(executor, ss);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(ss, line); )
+        lines.push_back(line);
+    return lines;
+}
+
+static std::vector<std::string> grouped_lines(tc::Tax_hits<CountsOptions> &tax_hits, tf::Executor &executor)
+{
+    auto collated = tax_hits.template collate<CompactOptions>(executor);
+    std::stringstream ss;
+    collated->group(executor, ss);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(ss, line); )
+        lines.push_back(line);
+    std::sort(lines.begin(), lines.end());
+    return lines;
+}
+
+static uint64_t spot_id_of(const std::string &line)
+{
+    return std::stoull(line.substr(0, line.find('\t')));
+}
+
+static bool numerically_sorted(const std::vector<std::string> &lines)
+{
+    for (size_t i = 1; i < lines.size(); i++)
+        if (spot_id_of(lines[i - 1]) >= spot_id_of(lines[i]))
+            return false;
+    return true;
+}
+
+static std::vector<std::string> sorted(std::vector<std::string> lines)
+{
+    std::sort(lines.begin(), lines.end());
+    return lines;
+}
+
+TEST(parse_spot_id)
+{
+    uint64_t id = 1;
+    ASSERT(tc::parse_spot_id("0", id) && id == 0);
+    ASSERT(tc::parse_spot_id("12345", id) && id == 12345);
+    ASSERT(tc::parse_spot_id("9999999999999999999", id) && id == 9999999999999999999ull);
+    ASSERT(!tc::parse_spot_id("", id));
+    ASSERT(!tc::parse_spot_id("007", id));
+    ASSERT(!tc::parse_spot_id("12a", id));
+    ASSERT(!tc::parse_spot_id("-1", id));
+    ASSERT(!tc::parse_spot_id("10000000000000000000", id));
+}
+
+TEST(integer_ids_collate_as_names)
+{
+    tf::Executor executor(2);
+    for (auto max_id : { size_t(10), size_t(5000), size_t(1) << 40 })
+    {
+        auto spots = random_spots(20000, max_id, max_id);
+        auto by_name = make_tax_hits(spots, false);
+        auto by_id = make_tax_hits(spots, true);
+        ASSERT(!by_name->spot_ids);
+        ASSERT(by_id->spot_ids);
+        ASSERT_EQUALS(by_id->size(), spots.size());
+
+        auto name_lines = collated_lines(*by_name, executor);
+        auto id_lines = collated_lines(*by_id, executor);
+        ASSERT(numerically_sorted(id_lines));
+        ASSERT(sorted(name_lines) == sorted(id_lines));
+
+        ASSERT(grouped_lines(*make_tax_hits(spots, false), executor) == grouped_lines(*make_tax_hits(spots, true), executor));
+    }
+}
+
+TEST(integer_ids_wider_than_packed_key)
+{
+    tf::Executor executor(2);
+    auto spots = random_spots(5000, 1000, 1);
+    spots[0].name = "18446744073709551";
+    spots[1].name = "1";
+    spots[2].name = "9999999999999999999";
+    auto name_lines = collated_lines(*make_tax_hits(spots, false), executor);
+    auto id_lines = collated_lines(*make_tax_hits(spots, true), executor);
+    ASSERT(numerically_sorted(id_lines));
+    ASSERT(sorted(name_lines) == sorted(id_lines));
+}
+
+TEST(monotonic_integer_ids)
+{
+    tf::Executor executor(2);
+    auto spots = random_spots(10000, 100, 2);
+    std::stable_sort(spots.begin(), spots.end(), [](auto &a, auto &b) { return std::stoull(a.name) < std::stoull(b.name); });
+    auto name_lines = collated_lines(*make_tax_hits(spots, false), executor);
+    auto id_lines = collated_lines(*make_tax_hits(spots, true), executor);
+    ASSERT_EQUALS(id_lines.size(), size_t(100));
+    ASSERT(sorted(name_lines) == sorted(id_lines));
+}
+
+TEST(non_numeric_falls_back_to_names)
+{
+    tf::Executor executor(2);
+    for (auto odd_name : { "SRR123.1", "007" })
+    {
+        auto spots = random_spots(3000, 500, 3);
+        spots[2000].name = odd_name;
+        auto tax_hits = make_tax_hits(spots, true);
+        ASSERT(!tax_hits->spot_ids);
+        ASSERT_EQUALS(tax_hits->size(), spots.size());
+        auto lines = collated_lines(*tax_hits, executor);
+        ASSERT(lines == collated_lines(*make_tax_hits(spots, false), executor));
+        bool found = false;
+        for (auto &line : lines)
+            found |= line.substr(0, line.find('\t')) == odd_name;
+        ASSERT(found);
+    }
+}
+
+TEST(save_and_init)
+{
+    tf::Executor executor(2);
+    auto spots = random_spots(5000, 700, 4);
+    std::string prefix = "tax_hits_test." + std::to_string(getpid());
+    make_tax_hits(spots, true)->save(prefix);
+
+    tc::Tax_hits<CountsOptions> loaded(true);
+    ASSERT(loaded.init(prefix));
+    ASSERT(loaded.spot_ids);
+    ASSERT_EQUALS(loaded.size(), spots.size());
+    ASSERT(sorted(collated_lines(loaded, executor)) == sorted(collated_lines(*make_tax_hits(spots, false), executor)));
+
+    // names saved over ids, the ids of the earlier save are not loaded with them
+    auto other_spots = random_spots(3000, 300, 5);
+    make_tax_hits(other_spots, false)->save(prefix);
+    tc::Tax_hits<CountsOptions> reloaded(true);
+    ASSERT(reloaded.init(prefix));
+    ASSERT(!reloaded.spot_ids);
+    ASSERT_EQUALS(reloaded.size(), other_spots.size());
+    ASSERT(collated_lines(reloaded, executor) == collated_lines(*make_tax_hits(other_spots, false), executor));
+
+    for (auto ext : { ".ids", ".names", ".taxa", ".counts" })
+        std::remove((prefix + ext).c_str());
+}
+
+static double seconds_since(high_resolution_clock::time_point before)
+{
+    return duration_cast<duration<double>>(high_resolution_clock::now() - before).count();
+}
+
+DISABLED_TEST(bench_sort)
+{
+    tf::Executor executor;
+    auto spots = random_spots(5 * 1000 * 1000, 2 * 1000 * 1000, 5);
+    for (bool integer_ids : { false, true })
+    {
+        auto tax_hits = make_tax_hits(spots, integer_ids);
+        auto before = high_resolution_clock::now();
+        tax_hits->sort(executor);
+        std::cerr << (integer_ids ? "integer" : "string") << " spot id sort: " << seconds_since(before) << "s" << std::endl;
+    }
+}
+
+TEST_MAIN();
@@ -0,0 +1,258 @@
+/*===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+*/
+
+#include <random>
+#include <chrono>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "tests.h"
+#include "tax_id_tree.h"
+
+using namespace std::chrono;
+
+// parent walks over a map, as the tree was queried before
+struct NaiveTree
+{
+    std::map<tax_id_t, tax_id_t> parents;
+
+    std::vector<tax_id_t> path(tax_id_t t) const
+    {
+        std::vector<tax_id_t> p;
+        for (; t != TaxIdTree::ROOT; t = parents.at(t))
+            p.push_back(t);
+        p.push_back(tax_id_t(TaxIdTree::ROOT));
+        return p;
+    }
+
+    bool a_sub_b(tax_id_t a, tax_id_t b) const
+    {
+        if (!parents.count(a))
+            return a == b || b == TaxIdTree::ROOT;
+        auto p = path(a);
+        return std::find(p.begin(), p.end(), b) != p.end();
+    }
+
+    tax_id_t lca(tax_id_t a, tax_id_t b) const
+    {
+        auto pa = path(a);
+        for (auto t : path(b))
+            if (std::find(pa.begin(), pa.end(), t) != pa.end())
+                return t;
+        return TaxIdTree::ROOT;
+    }
+};
+
+// random tax ids, every node gets a parent among the nodes created before, deep chains and wide nodes
+static TaxIdTreeLoader::TaxParents random_tax_parents(size_t count, uint64_t seed, NaiveTree &naive)
+{
+    std::mt19937_64 rnd(seed);
+    std::vector<tax_id_t> created(1, tax_id_t(TaxIdTree::ROOT));
+    std::vector<tax_id_t> ids;
+    for (size_t i = 0; ids.size() < count; i++)
+    {
+        tax_id_t t = tax_id_t(2 + rnd() % (count * 10));
+        if (!naive.parents.count(t))
+        {
+            ids.push_back(t);
+            naive.parents[t] = 0;
+        }
+    }
+
+    TaxIdTreeLoader::TaxParents tax_parents;
+    for (auto t : ids)
+    {
+        auto r = rnd() % 4;
+        tax_id_t parent = r == 0 ? created.back() : (r == 1 ? tax_id_t(TaxIdTree::ROOT) : created[rnd() % created.size()]);
+        naive.parents[t] = parent;
+        created.push_back(t);
+        tax_parents.emplace_back(t, parent);
+    }
+
+    std::shuffle(tax_parents.begin(), tax_parents.end(), rnd);
+    return tax_parents;
+}
+
+TEST(tax_id_tree_matches_naive) {
+    for (size_t count : {1, 2, 63, 64, 65, 200, 5000})
+    {
+        NaiveTree naive;
+        TaxIdTree tree;
+        TaxIdTreeLoader::build(tree, random_tax_parents(count, count, naive));
+        ASSERT_EQUALS(tree.size(), count + 1);
+
+        std::vector<tax_id_t> ids(1, tax_id_t(TaxIdTree::ROOT));
+        for (auto &p : naive.parents)
+            ids.push_back(p.first);
+
+        std::mt19937_64 rnd(count);
+        for (int i = 0; i < 20000; i++)
+        {
+            auto a = ids[rnd() % ids.size()], b = ids[rnd() % ids.size()];
+            ASSERT_EQUALS(tree.consensus_of(a, b), naive.lca(a, b));
+            ASSERT_EQUALS(tree.a_sub_b(a, b), naive.a_sub_b(a, b));
+        }
+
+        for (auto t : ids)
+        {
+            ASSERT(tree.known_id(t) == (t != TaxIdTree::ROOT));
+            ASSERT_EQUALS(tree.level(t), int(naive.path(t).size()) - 1);
+            if (t != TaxIdTree::ROOT)
+                ASSERT_EQUALS(tree.get_parent_id(t), naive.parents[t]);
+        }
+    }
+}
+
+TEST(tax_id_tree_special_ids) {
+    TaxIdTree tree;
+    TaxIdTreeLoader::build(tree, {{2, 1}, {3, 2}, {4, 2}, {5, 1}});
+    ASSERT_EQUALS(tree.consensus_of(3, 4), 2);
+    ASSERT_EQUALS(tree.consensus_of(3, 5), 1);
+    ASSERT_EQUALS(tree.consensus_of(3, 1), 1);
+    ASSERT_EQUALS(tree.consensus_of(-7, 3), -7); // negative tax ids win
+    ASSERT_EQUALS(tree.consensus_of(3, 0), 0);
+    ASSERT_EQUALS(tree.consensus_of(9, 9), 9);
+    ASSERT(!tree.a_sub_b(9, 2)); // unknown tax is not under a known one
+    ASSERT(tree.a_sub_b(9, 1));
+    ASSERT_EQUALS(tree.level(9), 0);
+    ASSERT(!tree.known_id(9));
+
+    bool failed = false;
+    try { tree.consensus_of(3, 9); } catch (std::runtime_error &) { failed = true; }
+    ASSERT(failed);
+
+    // a parent which is not listed, a cycle
+    failed = false;
+    try { TaxIdTreeLoader::build(tree, {{2, 1}, {3, 7}}); } catch (std::runtime_error &) { failed = true; }
+    ASSERT(failed);
+    failed = false;
+    try { TaxIdTreeLoader::build(tree, {{2, 1}, {3, 4}, {4, 3}}); } catch (std::runtime_error &) { failed = true; }
+    ASSERT(failed);
+
+    // the last line of a tax listed twice wins
+    TaxIdTreeLoader::build(tree, {{2, 1}, {3, 1}, {4, 2}, {4, 3}, {1, 1}});
+    ASSERT_EQUALS(tree.get_parent_id(4), 3);
+    ASSERT(tree.known_id(1));
+}
+
+TEST(tax_id_tree_cache) {
+    const std::string filename = "./tax_id_tree_test.parents";
+    const std::string cache = TaxIdTreeLoader::cache_filename(filename);
+    std::remove(cache.c_str());
+    {
+        std::ofstream f(filename);
+        f << "2\t1\n3\t2\n4\t2\n5\t1\n";
+    }
+
+    TaxIdTree parsed;
+    TaxIdTreeLoader::load_tax_id_tree(parsed, filename);
+    std::ifstream cache_file(cache);
+    ASSERT(cache_file.good());
+
+    TaxIdTree cached;
+    TaxIdTreeLoader::CacheHeader source = TaxIdTreeLoader::cache_source(filename);
+    ASSERT(TaxIdTreeLoader::load_cache(cached, cache, source));
+    ASSERT(cached.tax_ids == parsed.tax_ids);
+    ASSERT(cached.parents == parsed.parents);
+    ASSERT_EQUALS(cached.consensus_of(3, 4), 2);
+
+    // a changed file does not use the cache made from the old one
+    {
+        std::ofstream f(filename);
+        f << "2\t1\n3\t2\n4\t5\n5\t1\n6\t5\n";
+    }
+    ASSERT(!TaxIdTreeLoader::load_cache(cached, cache, TaxIdTreeLoader::cache_source(filename)));
+    TaxIdTree reloaded;
+    TaxIdTreeLoader::load_tax_id_tree(reloaded, filename);
+    ASSERT_EQUALS(reloaded.consensus_of(3, 4), 1);
+
+    // a truncated cache is ignored
+    truncate(cache.c_str(), sizeof(TaxIdTreeLoader::CacheHeader) + 4);
+    ASSERT(!TaxIdTreeLoader::load_cache(cached, cache, TaxIdTreeLoader::cache_source(filename)));
+
+    std::remove(filename.c_str());
+    std::remove(cache.c_str());
+}
+
+// run explicitly as "tax_id_tree bench_tax_id_tree"
+// TAX_TREE_BENCH_SIZE sets the number of nodes, the NCBI taxonomy has about 2.6 million
+DISABLED_TEST(bench_tax_id_tree) {
+    const char *size_env = getenv("TAX_TREE_BENCH_SIZE");
+    const size_t count = size_env ? std::stoull(size_env) : 2600000;
+
+    // NCBI like shape: a few levels of ranks, most nodes are species and strains under genera
+    std::mt19937_64 rnd(1);
+    const std::string filename = "./tax_id_tree_bench.parents";
+    std::vector<tax_id_t> ids;
+    {
+        std::ofstream f(filename);
+        std::vector<tax_id_t> level(1, tax_id_t(TaxIdTree::ROOT));
+        tax_id_t next = 2;
+        for (size_t width : {3, 30, 100, 300, 1000, 3000, 10000, 100000})
+        {
+            std::vector<tax_id_t> created;
+            for (size_t i = 0; i < width; i++, next++)
+            {
+                f << next << '\t' << level[rnd() % level.size()] << '\n';
+                created.push_back(next);
+            }
+            level = created;
+        }
+        while (size_t(next) < count)
+        {
+            tax_id_t parent = (rnd() % 4 == 0 && !ids.empty()) ? ids[rnd() % ids.size()] : level[rnd() % level.size()];
+            f << next << '\t' << parent << '\n';
+            ids.push_back(next++);
+        }
+    }
+    std::remove(TaxIdTreeLoader::cache_filename(filename).c_str());
+
+    auto seconds_since = [](high_resolution_clock::time_point before) { return duration_cast<duration<double>>(high_resolution_clock::now() - before).count(); };
+
+    auto before = high_resolution_clock::now();
+    TaxIdTree tree;
+    TaxIdTreeLoader::load_tax_id_tree(tree, filename);
+    std::cerr << tree.size() << " nodes parsed in " << seconds_since(before) << "s" << std::endl;
+
+    before = high_resolution_clock::now();
+    TaxIdTree cached;
+    TaxIdTreeLoader::load_tax_id_tree(cached, filename);
+    std::cerr << "loaded from cache in " << seconds_since(before) << "s" << std::endl;
+
+    const size_t queries = 20 * 1000 * 1000;
+    before = high_resolution_clock::now();
+    size_t sum = 0;
+    for (size_t i = 0; i < queries; i++)
+        sum += cached.consensus_of(ids[rnd() % ids.size()], ids[rnd() % ids.size()]);
+    std::cerr << size_t(queries / seconds_since(before)) << " consensus_of/sec (" << sum % 10 << ")" << std::endl;
+
+    std::remove(filename.c_str());
+    std::remove(TaxIdTreeLoader::cache_filename(filename).c_str());
+}
+
+TEST_MAIN();